@@ -1,13 +1,813 @@
 #pragma once
 
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dl/compile/literal.hpp"
+#include "dl/compile/nodeerr.hpp"
+#include "dl/compile/symboltable.hpp"
 #include "dl/err.hpp"
-#include "dl/node.hpp"
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/binaryop.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/parse/opid.hpp"
+#include "dl/process/node.hpp"
+#include "dl/process/opinfo.hpp"
 
 namespace dl {
 
+// Indicates that generated C++ could not be written, or that building it
+// failed with the exit status of the command.
+struct BuildErr final: Err {
+	std::string command;
+	int status;
+
+	BuildErr(std::string command, int status) noexcept:
+		command(std::move(command)), status(status) {}
+
+	virtual std::ostream& out_data(std::ostream& os) const override {
+		return os << command << ", " << status;
+	}
+
+	virtual std::ostream& out_name(std::ostream& os) const override {
+		return os << "BuildErr";
+	}
+};
+
+// What is known before a program runs about the values of an expression or a
+// variable.
+enum class StaticType {
+	// A variable nothing is assigned to yet.
+	UNASSIGNED,
+	BOOL,
+	INT64,
+	FLOAT64,
+	// Anything, boxed as `Any`.
+	ANY
+};
+
+StaticType join(StaticType x, StaticType y) noexcept {
+	if (x == StaticType::UNASSIGNED || x == y)
+		return y;
+	if (y == StaticType::UNASSIGNED)
+		return x;
+	return StaticType::ANY;
+}
+
+// Type of the result of a binary operator. Only `Int64`s and `Float64`s have
+// native operations; everything else is left to the runtime.
+StaticType binary_type(BinaryOp op, StaticType x, StaticType y) noexcept {
+	bool native = x == y && (
+		x == StaticType::INT64 || x == StaticType::FLOAT64
+	);
+	if (!native)
+		return StaticType::ANY;
+	return op >= BinaryOp::EQ ? StaticType::BOOL : x;
+}
+
+// Type of the value of a numeric literal. Suffixes narrower than 64 bits have
+// wrapping rules that are left to their dunder methods, so they are boxed.
+StaticType literal_type(Any value) noexcept {
+	if (value.tid == static_cast<std::uint32_t>(BuiltinTypeID::INT64))
+		return StaticType::INT64;
+	if (value.tid == static_cast<std::uint32_t>(BuiltinTypeID::FLOAT64))
+		return StaticType::FLOAT64;
+	return StaticType::ANY;
+}
+
+// Compiles a whole program ahead of time, to C++ that includes the runtime
+// headers, then builds it into a standalone executable.
+//
+// Statements come one at a time, in the node shapes `RegCompiler` takes, and
+// are checked as they come. The C++ is only generated once the program is
+// complete, since the type of a variable depends on every assignment to it.
+// Variables only ever holding `Bool`s, `Int64`s or `Float64`s are C++ scalars,
+// and operations on them native ones. Other values are boxed, variables
+// holding them live in slots on the value stack, and operations on them go
+// through the runtime like they do when interpreted.
 struct CompilerImpl {
+	struct Var {
+		std::uint32_t index;
+		StaticType type;
+	};
+
+	// A C++ expression, which is cheap and side effect free to repeat.
+	struct Value {
+		std::string code;
+		StaticType type;
+	};
+
+	SymbolTable& symbols;
+
+	// Directory the runtime headers are included from, as `dl/...`.
+	std::string include_dir;
+
+	// Command of the C++ compiler.
+	std::string cxx = "clang++";
+
+	std::vector<Node> program;
+	std::unordered_map<std::string, Var> vars;
+
+	// Number of branches and loops around the statement being checked.
+	std::uint32_t depth = 0;
+
+	std::ostringstream out;
+	std::uint32_t indent = 0;
+	std::uint32_t ntemps = 0;
+
+	CompilerImpl(SymbolTable& symbols, std::string include_dir) noexcept:
+		symbols(symbols), include_dir(std::move(include_dir)) {}
+
+	// Add a statement to the program.
 	ErrPtr compile(Node&& node) {
+		auto saved = vars;
+		if (ErrPtr err = check(node)) {
+			vars = std::move(saved);
+			return err;
+		}
+		program.push_back(std::move(node));
+		return nullptr;
+	}
+
+	// Write the C++ of the program to path + ".cpp" and build it into the
+	// executable path.
+	ErrPtr build(const std::string& path) {
+		std::string src = path + ".cpp";
+		{
+			auto file = std::ofstream(src);
+			file << source();
+			if (!file)
+				return ErrPtr(new BuildErr(src, -1));
+		}
+		std::string command = cxx + " -std=c++20 -O2 -I'" + include_dir +
+			"' -o '" + path + "' '" + src + "'";
+		int status = std::system(command.c_str());
+		if (status != 0)
+			return ErrPtr(new BuildErr(std::move(command), status));
+		return nullptr;
+	}
+
+	// C++ of the program so far.
+	std::string source() {
+		// Types only ever widen, so checking again reaches a fixpoint.
+		for (bool changed = true; changed;) {
+			auto before = vars;
+			for (const Node& stmt: program)
+				check(stmt);
+			changed = false;
+			for (const auto& [name, var]: vars)
+				changed = changed || var.type != before.at(name).type;
+		}
+
+		out.str("");
+		indent = 0;
+		ntemps = 0;
+		line("// Generated by CompilerImpl.");
+		line("#include \"dl/interpreter2/aot.hpp\"");
+		line("");
+		line("namespace {");
+		line("");
+		line("dl::Any program(dl::InterpreterImpl& interp, dl::Any* slots) {");
+		indent++;
+		auto decls = std::vector<Var>(vars.size());
+		for (const auto& [name, var]: vars)
+			decls[var.index] = var;
+		for (const Var& var: decls) {
+			if (var.type == StaticType::ANY)
+				continue;
+			line(
+				ctype(var.type) + " " + ref(var) + " = " +
+				ctype(var.type) + "();"
+			);
+		}
+		for (const Node& stmt: program) {
+			line("{");
+			indent++;
+			emit_stmt(stmt);
+			indent--;
+			line("}");
+			// Between statements every live value is reachable from state.
+			line("dl::gc::safepoint(interp.state);");
+		}
+		line("return dl::coreutil::NONE;");
+		indent--;
+		line("}");
+		line("");
+		line("}");
+		line("");
+		line("int main() {");
+		line(
+			"    return dl::aot::run(" + std::to_string(vars.size()) +
+			", program);"
+		);
+		line("}");
+		return out.str();
+	}
+
+	// Check that a statement is supported and its variables are assigned
+	// before they are read, and widen the types of the ones it assigns.
+	ErrPtr check(const Node& node) {
+		using enum OpID;
+		switch (node.op) {
+		case BLOCK:
+			for (const Node& stmt: node.nodes) {
+				if (ErrPtr err = check(stmt))
+					return err;
+			}
+			return nullptr;
+		case IF:
+		case ELIF: {
+			const Node& pred = *node.node;
+			if (opinfo(pred.op).kind != OpKind::BINARY)
+				return ErrPtr(new UnsupportedNodeErr(pred.op));
+			StaticType cond;
+			if (ErrPtr err = check_expr(pred.bin->lhs, cond))
+				return err;
+			return check_nested(pred.bin->rhs);
+		}
+		case ELSE:
+			return check_nested(*node.node);
+		case RAISE: {
+			StaticType type;
+			return check_expr(*node.node, type);
+		}
+		case SET: {
+			const Node& lhs = node.bin->lhs;
+			if (lhs.op != ALNUM || is_numeric_literal(lhs.str))
+				return ErrPtr(new UnsupportedNodeErr(lhs.op));
+			StaticType type;
+			if (ErrPtr err = check_expr(node.bin->rhs, type))
+				return err;
+			assign(lhs.str, type);
+			return nullptr;
+		}
+		case FOR:
+			return check_for(*node.node);
+		default: {
+			StaticType type;
+			return check_expr(node, type);
+		}
+		}
+	}
+
+	ErrPtr check_nested(const Node& node) {
+		depth++;
+		ErrPtr err = check(node);
+		depth--;
+		return err;
+	}
+
+	// A variable first assigned in a branch or loop may be read unassigned,
+	// as `None`, so it is boxed.
+	void assign(const std::string& name, StaticType type) {
+		auto it = vars.find(name);
+		if (it == vars.end()) {
+			auto index = static_cast<std::uint32_t>(vars.size());
+			vars.emplace(name, Var{
+				index, depth == 0 ? type : StaticType::ANY
+			});
+		} else
+			it->second.type = join(it->second.type, type);
+	}
+
+	ErrPtr check_for(const Node& node) {
+		if (opinfo(node.op).kind != OpKind::BINARY)
+			return ErrPtr(new UnsupportedNodeErr(node.op));
+		const Node& pred = node.bin->lhs;
+		if (pred.op == OpID::IN)
+			return ErrPtr(new UnsupportedNodeErr(pred.op));
+		if (!is_range(pred)) {
+			StaticType cond;
+			if (ErrPtr err = check_expr(pred, cond))
+				return err;
+			return check_nested(node.bin->rhs);
+		}
+		Range range;
+		if (ErrPtr err = range_of(pred, range))
+			return err;
+		StaticType from = literal_type(range.step);
+		if (range.from != nullptr) {
+			if (ErrPtr err = check_expr(*range.from, from))
+				return err;
+		}
+		assign(range.name->str, from);
+		StaticType limit;
+		if (ErrPtr err = check_expr(*range.to, limit))
+			return err;
+		if (ErrPtr err = check_nested(node.bin->rhs))
+			return err;
+		const Var& var = vars.at(range.name->str);
+		assign(range.name->str, binary_type(
+			BinaryOp::ADD, var.type, literal_type(range.step)
+		));
+		return nullptr;
+	}
+
+	ErrPtr check_expr(const Node& node, StaticType& type) {
+		using enum OpID;
+		switch (node.op) {
+		case ALNUM: {
+			if (is_numeric_literal(node.str)) {
+				Any value;
+				if (ErrPtr err = parse_literal(node.str, value))
+					return err;
+				type = literal_type(value);
+				return nullptr;
+			}
+			auto it = vars.find(node.str);
+			if (it == vars.end())
+				return ErrPtr(new UnknownVarErr(node.str));
+			type = it->second.type;
+			return nullptr;
+		}
+		case TRUE:
+		case FALSE:
+			type = StaticType::BOOL;
+			return nullptr;
+		case NONE:
+			type = StaticType::ANY;
+			return nullptr;
+		case GROUP:
+			return check_expr(*node.node, type);
+		case CALL: {
+			type = StaticType::ANY;
+			StaticType part;
+			for (const Node* arg: call_parts(node)) {
+				if (ErrPtr err = check_expr(*arg, part))
+					return err;
+			}
+			return nullptr;
+		}
+		case GET: {
+			const Node& name = node.bin->rhs;
+			if (name.op != ALNUM || is_numeric_literal(name.str))
+				return ErrPtr(new UnsupportedNodeErr(name.op));
+			type = StaticType::ANY;
+			StaticType obj;
+			return check_expr(node.bin->lhs, obj);
+		}
+		case AND:
+		case OR: {
+			type = StaticType::BOOL;
+			StaticType operand;
+			if (ErrPtr err = check_expr(node.bin->lhs, operand))
+				return err;
+			return check_expr(node.bin->rhs, operand);
+		}
+		case NOT: {
+			type = StaticType::BOOL;
+			StaticType operand;
+			return check_expr(*node.node, operand);
+		}
+		default: {
+			BinaryOp op;
+			if (!binary_op(node.op, op))
+				return ErrPtr(new UnsupportedNodeErr(node.op));
+			StaticType x;
+			StaticType y;
+			if (ErrPtr err = check_expr(node.bin->lhs, x))
+				return err;
+			if (ErrPtr err = check_expr(node.bin->rhs, y))
+				return err;
+			type = binary_type(op, x, y);
+			return nullptr;
+		}
+		}
+	}
+
+	static bool binary_op(OpID id, BinaryOp& op) noexcept {
+		using enum OpID;
+		constexpr std::pair<OpID, BinaryOp> OPS[] = {
+			{ADD, BinaryOp::ADD},
+			{SUB, BinaryOp::SUB},
+			{MUL, BinaryOp::MUL},
+			{DIV, BinaryOp::DIV},
+			{MOD, BinaryOp::MOD},
+			{EQ, BinaryOp::EQ},
+			{NEQ, BinaryOp::NEQ},
+			{LT, BinaryOp::LT},
+			{LTE, BinaryOp::LTE},
+			{GT, BinaryOp::GT},
+			{GTE, BinaryOp::GTE}
+		};
+		for (auto [from, to]: OPS) {
+			if (from == id) {
+				op = to;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// The callee, then the arguments of a (possibly parenthesized) chain of
+	// separators.
+	static std::vector<const Node*> call_parts(const Node& node) {
+		auto parts = std::vector<const Node*>{&node.bin->lhs};
+		const Node* rest = &node.bin->rhs;
+		if (rest->op == OpID::GROUP)
+			rest = rest->node;
+		while (rest->op == OpID::SEP) {
+			parts.push_back(&rest->bin->lhs);
+			rest = &rest->bin->rhs;
+		}
+		parts.push_back(rest);
+		return parts;
+	}
+
+	static bool is_range(const Node& pred) noexcept {
+		return pred.op == OpID::FROM || pred.op == OpID::TO ||
+			pred.op == OpID::BY;
+	}
+
+	// Parts of `for name from a to b by step`, where only `to` is required,
+	// and step is a numeric literal that may be negated.
+	struct Range {
+		const Node* name = nullptr;
+		const Node* from = nullptr;
+		const Node* to = nullptr;
+		Any step = coreutil::wrap(std::int64_t(1));
+		bool down = false;
+	};
+
+	ErrPtr range_of(const Node& pred, Range& range) {
+		using enum OpID;
+		std::vector<std::pair<OpID, const Node*>> parts;
+		range_parts(pred, FOR, parts);
+		const Node* by = nullptr;
+		for (std::size_t i = 1; i < parts.size(); i++) {
+			const Node*& part = parts[i].first == FROM ? range.from :
+				parts[i].first == TO ? range.to : by;
+			if (part != nullptr)
+				return ErrPtr(new UnsupportedNodeErr(parts[i].first));
+			part = parts[i].second;
+		}
+		range.name = parts[0].second;
+		if (range.name->op != ALNUM || is_numeric_literal(range.name->str))
+			return ErrPtr(new UnsupportedNodeErr(range.name->op));
+		if (range.to == nullptr)
+			return ErrPtr(new UnsupportedNodeErr(pred.op));
+		if (by == nullptr)
+			return nullptr;
+		bool neg = by->op == NEG;
+		const Node& lit = neg ? *by->node : *by;
+		if (lit.op != ALNUM || !is_numeric_literal(lit.str))
+			return ErrPtr(new UnsupportedNodeErr(lit.op));
+		if (ErrPtr err = parse_literal(lit.str, range.step))
+			return err;
+		if (literal_type(range.step) == StaticType::INT64) {
+			auto k = coreutil::unwrap<std::int64_t>(range.step);
+			range.step = coreutil::wrap(neg ? -k : k);
+		} else if (literal_type(range.step) == StaticType::FLOAT64) {
+			auto k = coreutil::unwrap<double>(range.step);
+			range.step = coreutil::wrap(neg ? -k : k);
+		} else
+			return ErrPtr(new UnsupportedNodeErr(lit.op));
+		range.down = neg;
+		return nullptr;
+	}
+
+	// Operands of a chain of `FROM`, `TO` and `BY`, each with the operator
+	// before it, in source order whichever way the chain associates.
+	static void range_parts(
+		const Node& node, OpID op,
+		std::vector<std::pair<OpID, const Node*>>& parts
+	) {
+		using enum OpID;
+		if (node.op == FROM || node.op == TO || node.op == BY) {
+			range_parts(node.bin->lhs, op, parts);
+			range_parts(node.bin->rhs, node.op, parts);
+		} else
+			parts.emplace_back(op, &node);
+	}
+
+	void line(const std::string& code) {
+		out << std::string(4 * indent, ' ') << code << '\n';
+	}
+
+	std::string temp() {
+		return "t" + std::to_string(ntemps++);
+	}
+
+	static std::string ctype(StaticType type) {
+		switch (type) {
+		case StaticType::BOOL:
+			return "bool";
+		case StaticType::INT64:
+			return "std::int64_t";
+		case StaticType::FLOAT64:
+			return "double";
+		default:
+			return "dl::Any";
+		}
+	}
+
+	static std::string ref(const Var& var) {
+		std::string index = std::to_string(var.index);
+		return var.type == StaticType::ANY ?
+			"slots[" + index + "]" : "v" + index;
+	}
+
+	static std::string box(const Value& value) {
+		if (value.type == StaticType::ANY)
+			return value.code;
+		return "dl::coreutil::wrap(" + value.code + ")";
+	}
+
+	// Declare a temporary initialized to code, and check it for an error
+	// signal if it is boxed.
+	Value bind(StaticType type, const std::string& code) {
+		std::string t = temp();
+		line(ctype(type) + " " + t + " = " + code + ";");
+		if (type == StaticType::ANY)
+			line("if (dl::coreutil::is_error(" + t + ")) return " + t + ";");
+		return Value{t, type};
+	}
+
+	// A C++ condition for value, which raises unless it is a `Bool`.
+	std::string truth(const Value& value) {
+		if (value.type == StaticType::BOOL)
+			return value.code;
+		std::string t = temp();
+		line("int " + t + " = dl::aot::test(interp, " + box(value) + ");");
+		line("if (" + t + " < 0) return dl::coreutil::ERROR_SIGNAL;");
+		return "(" + t + " != 0)";
+	}
+
+	static std::string literal(Any value) {
+		if (literal_type(value) == StaticType::INT64) {
+			auto k = coreutil::unwrap<std::int64_t>(value);
+			return "std::int64_t(" + std::to_string(k) + ")";
+		}
+		char buf[64];
+		if (literal_type(value) == StaticType::FLOAT64) {
+			// Hexadecimal, so that no digits are lost.
+			double k = coreutil::unwrap<double>(value);
+			std::snprintf(buf, sizeof(buf), "%a", k);
+			return buf;
+		}
+		std::uint64_t bits;
+		std::memcpy(&bits, &value.data, sizeof(bits));
+		std::snprintf(
+			buf, sizeof(buf), "dl::aot::constant(%uu, 0x%llxull)", value.tid,
+			static_cast<unsigned long long>(bits)
+		);
+		return buf;
+	}
+
+	void emit_stmt(const Node& node) {
+		using enum OpID;
+		switch (node.op) {
+		case BLOCK:
+			emit_block(node.nodes);
+			return;
+		case IF:
+		case ELIF:
+		case ELSE: {
+			auto chain = std::vector<const Node*>{&node};
+			emit_chain(chain, 0);
+			return;
+		}
+		case RAISE: {
+			Value exc = emit_expr(*node.node);
+			line("interp.state.exc_info.raised = " + box(exc) + ";");
+			line("return dl::coreutil::ERROR_SIGNAL;");
+			return;
+		}
+		case SET:
+			emit_assign(node.bin->lhs.str, emit_expr(node.bin->rhs));
+			return;
+		case FOR:
+			emit_for(*node.node);
+			return;
+		default:
+			// Expression statement, whose value is dropped.
+			emit_expr(node);
+		}
+	}
+
+	void emit_block(const std::vector<Node>& nodes) {
+		for (std::size_t i = 0; i < nodes.size(); i++) {
+			if (nodes[i].op != OpID::IF) {
+				emit_stmt(nodes[i]);
+				continue;
+			}
+			// Gather the `ELIF`s and `ELSE` following this `IF`.
+			auto chain = std::vector<const Node*>{&nodes[i]};
+			while (
+				i + 1 < nodes.size() && chain.back()->op != OpID::ELSE && (
+					nodes[i + 1].op == OpID::ELIF ||
+					nodes[i + 1].op == OpID::ELSE
+				)
+			)
+				chain.push_back(&nodes[++i]);
+			emit_chain(chain, 0);
+		}
+	}
+
+	// Each condition after the first is evaluated in the `else` of the one
+	// before, so that it only runs if that is false.
+	void emit_chain(const std::vector<const Node*>& chain, std::size_t i) {
+		const Node& branch = *chain[i];
+		if (branch.op == OpID::ELSE) {
+			emit_stmt(*branch.node);
+			return;
+		}
+		const Node& pred = *branch.node;
+		std::string cond = truth(emit_expr(pred.bin->lhs));
+		line("if (" + cond + ") {");
+		indent++;
+		emit_stmt(pred.bin->rhs);
+		indent--;
+		if (i + 1 == chain.size()) {
+			line("}");
+			return;
+		}
+		line("} else {");
+		indent++;
+		emit_chain(chain, i + 1);
+		indent--;
+		line("}");
+	}
+
+	void emit_assign(const std::string& name, const Value& value) {
+		const Var& var = vars.at(name);
+		// A scalar variable is only ever assigned values of its own type.
+		std::string code = var.type == StaticType::ANY ?
+			box(value) : value.code;
+		line(ref(var) + " = " + code + ";");
+	}
+
+	Value var_value(const std::string& name) const {
+		const Var& var = vars.at(name);
+		return Value{ref(var), var.type};
+	}
+
+	void emit_for(const Node& node) {
+		const Node& pred = node.bin->lhs;
+		if (!is_range(pred)) {
+			line("for (;;) {");
+			indent++;
+			std::string cond = truth(emit_expr(pred));
+			line("if (!" + cond + ") break;");
+			emit_stmt(node.bin->rhs);
+			indent--;
+			line("}");
+			return;
+		}
+		Range range;
+		range_of(pred, range);
+		const std::string& name = range.name->str;
+		Value step = Value{literal(range.step), literal_type(range.step)};
+		if (range.from != nullptr)
+			emit_assign(name, emit_expr(*range.from));
+		else {
+			bool real = step.type == StaticType::FLOAT64;
+			emit_assign(name, real ?
+				Value{"0.0", StaticType::FLOAT64} :
+				Value{"std::int64_t(0)", StaticType::INT64});
+		}
+		// The limit is evaluated once, before the first iteration.
+		Value to = emit_expr(*range.to);
+		Value limit = bind(to.type, to.code);
+		line("for (;;) {");
+		indent++;
+		auto cmp = range.down ? BinaryOp::GT : BinaryOp::LT;
+		std::string cond = truth(emit_binary(cmp, var_value(name), limit));
+		line("if (!" + cond + ") break;");
+		line("{");
+		indent++;
+		emit_stmt(node.bin->rhs);
+		indent--;
+		line("}");
+		emit_assign(name, emit_binary(BinaryOp::ADD, var_value(name), step));
+		indent--;
+		line("}");
+	}
+
+	Value emit_expr(const Node& node) {
+		using enum OpID;
+		switch (node.op) {
+		case ALNUM: {
+			if (!is_numeric_literal(node.str))
+				return var_value(node.str);
+			Any value;
+			parse_literal(node.str, value);
+			return Value{literal(value), literal_type(value)};
+		}
+		case TRUE:
+			return Value{"true", StaticType::BOOL};
+		case FALSE:
+			return Value{"false", StaticType::BOOL};
+		case NONE:
+			return Value{"dl::coreutil::NONE", StaticType::ANY};
+		case GROUP:
+			return emit_expr(*node.node);
+		case CALL: {
+			std::string parts;
+			for (const Node* part: call_parts(node)) {
+				Value value = emit_expr(*part);
+				parts += (parts.empty() ? "" : ", ") + box(value);
+			}
+			return bind(
+				StaticType::ANY, "dl::aot::call(interp, {" + parts + "})"
+			);
+		}
+		case GET: {
+			Value obj = emit_expr(node.bin->lhs);
+			Symbol name = symbols.intern(node.bin->rhs.str);
+			return bind(
+				StaticType::ANY, "dl::aot::get_attr(interp, " + box(obj) +
+				", " + std::to_string(name) + ")"
+			);
+		}
+		case AND:
+			return emit_logical(node, false);
+		case OR:
+			return emit_logical(node, true);
+		case NOT: {
+			std::string cond = truth(emit_expr(*node.node));
+			return bind(StaticType::BOOL, "!" + cond);
+		}
+		default: {
+			BinaryOp op;
+			binary_op(node.op, op);
+			Value x = emit_expr(node.bin->lhs);
+			Value y = emit_expr(node.bin->rhs);
+			return emit_binary(op, x, y);
+		}
+		}
+	}
+
+	// `and` if stop is false, `or` if it is true: the right operand only runs
+	// if the left one is not stop.
+	Value emit_logical(const Node& node, bool stop) {
+		Value res = bind(StaticType::BOOL, truth(emit_expr(node.bin->lhs)));
+		line(std::string("if (") + (stop ? "!" : "") + res.code + ") {");
+		indent++;
+		std::string rhs = truth(emit_expr(node.bin->rhs));
+		line(res.code + " = " + rhs + ";");
+		indent--;
+		line("}");
+		return res;
+	}
 
+	Value emit_binary(BinaryOp op, const Value& x, const Value& y) {
+		using enum BinaryOp;
+		constexpr const char* SYMBOLS[] = {
+			"+", "-", "*", "/", "%", "==", "!=", "<", "<=", ">", ">="
+		};
+		constexpr const char* NAMES[] = {
+			"ADD", "SUB", "MUL", "DIV", "MOD", "EQ", "NEQ", "LT", "LTE", "GT",
+			"GTE"
+		};
+		std::string sym = SYMBOLS[static_cast<int>(op)];
+		std::string bop = std::string("dl::BinaryOp::") +
+			NAMES[static_cast<int>(op)];
+		StaticType type = binary_type(op, x.type, y.type);
+		if (type == StaticType::ANY) {
+			return bind(
+				StaticType::ANY, "dl::aot::binary<" + bop + ">(interp, " +
+				box(x) + ", " + box(y) + ")"
+			);
+		}
+		if (type == StaticType::BOOL)
+			return bind(type, x.code + " " + sym + " " + y.code);
+		if (type == StaticType::FLOAT64) {
+			if (op == MOD)
+				return bind(type, "std::fmod(" + x.code + ", " + y.code + ")");
+			return bind(type, x.code + " " + sym + " " + y.code);
+		}
+		// `Int64` operations the VM's fast path leaves to the dunder method
+		// take the slow path here too.
+		std::string t = temp();
+		std::string slow = "dl::aot::int64_slow(interp, " + bop + ", " +
+			x.code + ", " + y.code + ", " + t + ") != 0";
+		line("std::int64_t " + t + ";");
+		if (op == DIV || op == MOD) {
+			line("if (" + x.code + " < 0 || " + y.code + " <= 0) {");
+			line("    if (" + slow + ") return dl::coreutil::ERROR_SIGNAL;");
+			line("} else");
+			line("    " + t + " = " + x.code + " " + sym + " " + y.code + ";");
+		} else {
+			const char* builtin = op == ADD ? "__builtin_add_overflow" :
+				op == SUB ? "__builtin_sub_overflow" : "__builtin_mul_overflow";
+			line(
+				std::string("if (") + builtin + "(" + x.code + ", " + y.code +
+				", &" + t + ") &&"
+			);
+			line("    " + slow + ") return dl::coreutil::ERROR_SIGNAL;");
+		}
+		return Value{t, type};
 	}
 };
 
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "dl/convert.hpp"
+#include "dl/err.hpp"
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpretnode/literalsuffix.hpp"
+
+namespace dl {
+
+// Indicates that a numeric literal had no valid digits or did not fit its type.
+struct InvalidLiteralErr final: Err {
+    std::string alnum;
+
+    InvalidLiteralErr(std::string alnum) noexcept: alnum(std::move(alnum)) {}
+
+    virtual std::ostream& out_data(std::ostream& os) const override {
+        return os << alnum;
+    }
+
+    virtual std::ostream& out_name(std::ostream& os) const override {
+        return os << "InvalidLiteralErr";
+    }
+};
+
+bool is_numeric_literal(const std::string& alnum) noexcept {
+    return !alnum.empty() && std::isdigit(static_cast<unsigned char>(alnum[0]));
+}
+
+template<typename T>
+ErrPtr parse_literal_as(
+    const std::string& alnum, std::string&& digits, Any& res
+) {
+    char* end;
+    T value;
+    if constexpr (std::is_floating_point_v<T>) {
+        errno = 0;
+        value = static_cast<T>(std::strtod(digits.c_str(), &end));
+    } else
+        value = strto<T>(digits.c_str(), &end, 10);
+    if (errno == ERANGE || *end != '\0')
+        return ErrPtr(new InvalidLiteralErr(alnum));
+    res = coreutil::wrap(value);
+    return nullptr;
+}
+
+// Get the value of a numeric literal, typed by its suffix. Unsuffixed literals
+// are `Int64`.
+ErrPtr parse_literal(const std::string& alnum, Any& res) {
+    LiteralSuffix suffix = lit_suffix(alnum);
+    std::string digits = alnum.substr(0, alnum.size() - lit_suffix_len(suffix));
+    switch (suffix) {
+    case LiteralSuffix::F32:
+        return parse_literal_as<float>(alnum, std::move(digits), res);
+    case LiteralSuffix::F64:
+        return parse_literal_as<double>(alnum, std::move(digits), res);
+    case LiteralSuffix::S8:
+        return parse_literal_as<std::int8_t>(alnum, std::move(digits), res);
+    case LiteralSuffix::S16:
+        return parse_literal_as<std::int16_t>(alnum, std::move(digits), res);
+    case LiteralSuffix::S32:
+        return parse_literal_as<std::int32_t>(alnum, std::move(digits), res);
+    case LiteralSuffix::U8:
+        return parse_literal_as<std::uint8_t>(alnum, std::move(digits), res);
+    case LiteralSuffix::U16:
+        return parse_literal_as<std::uint16_t>(alnum, std::move(digits), res);
+    case LiteralSuffix::U32:
+        return parse_literal_as<std::uint32_t>(alnum, std::move(digits), res);
+    case LiteralSuffix::U64:
+        return parse_literal_as<std::uint64_t>(alnum, std::move(digits), res);
+    default:
+        return parse_literal_as<std::int64_t>(alnum, std::move(digits), res);
+    }
+}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <utility>
+
+#include "dl/err.hpp"
+#include "dl/parse/opid.hpp"
+
+namespace dl {
+
+// Indicates that a variable was read before anything was assigned to it.
+struct UnknownVarErr final: Err {
+    std::string name;
+
+    UnknownVarErr(std::string name) noexcept: name(std::move(name)) {}
+
+    virtual std::ostream& out_data(std::ostream& os) const override {
+        return os << name;
+    }
+
+    virtual std::ostream& out_name(std::ostream& os) const override {
+        return os << "UnknownVarErr";
+    }
+};
+
+// Indicates a node a compiler has no translation for.
+struct UnsupportedNodeErr final: Err {
+    OpID op;
+
+    UnsupportedNodeErr(OpID op) noexcept: op(op) {}
+
+    virtual std::ostream& out_data(std::ostream& os) const override {
+        return os << op;
+    }
+
+    virtual std::ostream& out_name(std::ostream& os) const override {
+        return os << "UnsupportedNodeErr";
+    }
+};
+
+}
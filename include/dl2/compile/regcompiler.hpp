@@ -0,0 +1,918 @@
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dl/compile/literal.hpp"
+#include "dl/compile/nodeerr.hpp"
+#include "dl/compile/switchcases.hpp"
+#include "dl/compile/symboltable.hpp"
+#include "dl/err.hpp"
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/gc.hpp"
+#include "dl/interpreter2/regcode.hpp"
+#include "dl/parse/opid.hpp"
+#include "dl/process/node.hpp"
+#include "dl/process/opinfo.hpp"
+
+namespace dl {
+
+// Indicates that a function needs more slots or instructions than register code
+// can address.
+struct CodeTooLargeErr final: Err {
+    virtual std::ostream& out_name(std::ostream& os) const override {
+        return os << "CodeTooLargeErr";
+    }
+};
+
+// Compiles the processed statements of a function body into register code.
+//
+// Variables live in fixed slots, parameters first. Every intermediate value
+// gets its own virtual register while compiling; once the whole body is known,
+// linear scan packs them into the slots above the variables, reusing the slot
+// of any temporary that is no longer live.
+//
+// Branches are `IF`/`ELIF` nodes whose operand is a binary node of condition
+// and body, optionally followed by an `ELSE` sibling whose operand is the body.
+// Loops are `FOR` nodes of the same shape. Matches, and `if` chains comparing
+// a variable to enough `Int64` literals, are a `SWITCH`, as in
+// `dl/compile/switchcases.hpp`; a match with other keys compares them in turn.
+//
+// Every instruction starts with the same quickening counter, every attribute
+// read gets its own empty inline cache, and every loop its own empty trace.
+struct RegCompiler {
+    // Virtual registers with this bit set are temporaries, the rest are
+    // variable slots.
+    static constexpr std::uint32_t TEMP = std::uint32_t(1) << 31;
+
+    // No preferred destination for an expression.
+    static constexpr std::uint32_t ANY_REG = UINT32_MAX;
+
+    // A switch table uses a jump table if its keys fill at least this share
+    // of the values between the least and the greatest.
+    static constexpr std::uint32_t MIN_DENSE_PERCENT = 50;
+
+    // Instruction with virtual register operands. The constant index of
+    // `LOADK`, the table of `SWITCH` and the target of jumps are kept in `b`.
+    struct VInst {
+        RegOpcode op;
+        std::uint32_t a;
+        std::uint32_t b;
+        std::uint32_t c;
+    };
+
+    // Live range of a temporary, in instruction indices, from its definition
+    // to its last read. The callee and arguments of a call must be in adjacent
+    // slots, so they are allocated together as the group starting at the
+    // callee; `group_len` is the size of the group for its first temporary and
+    // zero for the rest.
+    struct Interval {
+        std::uint32_t start;
+        std::uint32_t end;
+        std::uint32_t group_len;
+    };
+
+    // Cases of a `SWITCH`, with instruction indices as targets.
+    struct VSwitch {
+        std::vector<std::int64_t> keys;
+        std::vector<std::uint32_t> targets;
+        std::uint32_t otherwise = 0;
+    };
+
+    std::vector<VInst> vcode;
+    std::vector<Interval> temps;
+    std::vector<VSwitch> vswitches;
+    std::unordered_map<std::string, std::uint32_t> vars;
+
+    SymbolTable& symbols;
+
+    // Output, valid after a successful `compile`.
+    std::vector<std::uint32_t> insts;
+    std::vector<std::uint8_t> counters;
+    std::vector<AttrCache> attr_caches;
+    std::vector<LoopTrace> traces;
+    std::vector<Any> consts;
+    std::vector<SwitchTable> switches;
+    std::vector<std::int64_t> switch_keys;
+    std::vector<std::uint32_t> switch_targets;
+    std::vector<std::uint32_t> switch_dense;
+    std::uint32_t nslots;
+
+    // Whether `code` made the constants GC roots.
+    bool rooted = false;
+
+    RegCompiler(SymbolTable& symbols) noexcept:
+        symbols(symbols), nslots(0) {}
+
+    RegCompiler(const RegCompiler&) = delete;
+    RegCompiler& operator=(const RegCompiler&) = delete;
+
+    ~RegCompiler() {
+        if (rooted)
+            gc::remove_roots(consts.data());
+    }
+
+    // Compile body into the output members. The first slots are the
+    // parameters, in order.
+    ErrPtr compile(const Node& body, const std::vector<std::string>& params) {
+        for (const std::string& param: params)
+            vars.emplace(param, static_cast<std::uint32_t>(vars.size()));
+        if (ErrPtr err = stmt(body))
+            return err;
+        emit(RegOpcode::END);
+        return finish();
+    }
+
+    // The code runs from the output members, which it quickens in place. Its
+    // constants become roots, so that what they refer to stays live and they
+    // follow it when it moves, for as long as the compiler does.
+    RegCode code() {
+        if (!rooted && !consts.empty()) {
+            gc::add_roots(
+                consts.data(), static_cast<std::uint32_t>(consts.size())
+            );
+            rooted = true;
+        }
+        return RegCode{
+            insts.data(), static_cast<std::uint32_t>(insts.size()),
+            counters.data(), attr_caches.data(),
+            static_cast<std::uint32_t>(attr_caches.size()), traces.data(),
+            static_cast<std::uint32_t>(traces.size()), consts.data(),
+            static_cast<std::uint32_t>(consts.size()), switches.data(),
+            static_cast<std::uint32_t>(switches.size()), nslots
+        };
+    }
+
+    std::uint32_t emit(
+        RegOpcode op, std::uint32_t a = 0, std::uint32_t b = 0,
+        std::uint32_t c = 0
+    ) {
+        using enum RegOpcode;
+        auto i = static_cast<std::uint32_t>(vcode.size());
+        vcode.push_back(VInst{op, a, b, c});
+        switch (op) {
+        case MOVE:
+            use(b, i);
+            def(a, i);
+            break;
+        case LOADK:
+            def(a, i);
+            break;
+        case CALL:
+            for (std::uint32_t j = 0; j <= c; j++)
+                use(b + j, i);
+            def(a, i);
+            break;
+        case GET_ATTR:
+            use(b, i);
+            def(a, i);
+            break;
+        case FOR_NEXT:
+            use(a, i);
+            use(b, i);
+            use(b + 1, i);
+            def(a, i);
+            def(b + 2, i);
+            break;
+        case ITER:
+            use(b, i);
+            for (std::uint32_t j = 0; j < coreutil::ITER_SLOTS; j++)
+                def(a + j, i);
+            break;
+        case FOR_ITER:
+            for (std::uint32_t j = 0; j < coreutil::ITER_SLOTS; j++)
+                use(b + j, i);
+            def(a, i);
+            break;
+        case BRANCH:
+        case SWITCH:
+        case RETURN:
+        case RAISE:
+            use(a, i);
+            break;
+        case GOTO:
+        case LOOP:
+        case END:
+            break;
+        default:
+            use(b, i);
+            use(c, i);
+            def(a, i);
+        }
+        return i;
+    }
+
+    void def(std::uint32_t reg, std::uint32_t i) {
+        if (reg & TEMP)
+            temps[reg & ~TEMP].start = std::min(temps[reg & ~TEMP].start, i);
+    }
+
+    void use(std::uint32_t reg, std::uint32_t i) {
+        if (reg & TEMP)
+            temps[reg & ~TEMP].end = std::max(temps[reg & ~TEMP].end, i);
+    }
+
+    std::uint32_t new_temps(std::uint32_t n) {
+        auto first = static_cast<std::uint32_t>(temps.size());
+        for (std::uint32_t i = 0; i < n; i++)
+            temps.push_back(Interval{UINT32_MAX, 0, i == 0 ? n : 0});
+        return first | TEMP;
+    }
+
+    std::uint32_t here() const noexcept {
+        return static_cast<std::uint32_t>(vcode.size());
+    }
+
+    std::uint32_t constant(Any value) {
+        consts.push_back(value);
+        return static_cast<std::uint32_t>(consts.size() - 1);
+    }
+
+    // Compile a statement, or a block of them.
+    ErrPtr stmt(const Node& node) {
+        using enum OpID;
+        switch (node.op) {
+        case BLOCK:
+            return block(node.nodes);
+        case IF:
+        case ELIF:
+        case ELSE: {
+            // A branch with no preceding siblings.
+            auto nodes = std::vector<const Node*>{&node};
+            return if_chain(nodes);
+        }
+        case MATCH: {
+            auto nodes = std::vector<const Node*>{&node};
+            return match_chain(nodes);
+        }
+        case FOR:
+            return for_loop(*node.node);
+        case RAISE: {
+            std::uint32_t reg = ANY_REG;
+            if (ErrPtr err = expr(*node.node, reg))
+                return err;
+            emit(RegOpcode::RAISE, reg);
+            return nullptr;
+        }
+        case SET: {
+            const Node& lhs = node.bin->lhs;
+            if (lhs.op != ALNUM || is_numeric_literal(lhs.str))
+                return ErrPtr(new UnsupportedNodeErr(lhs.op));
+            // Compute straight into the variable's slot, saving a move. A new
+            // variable is only visible once assigned.
+            auto it = vars.find(lhs.str);
+            auto var = it == vars.end() ?
+                static_cast<std::uint32_t>(vars.size()) : it->second;
+            std::uint32_t reg = var;
+            if (ErrPtr err = expr(node.bin->rhs, reg))
+                return err;
+            vars.emplace(lhs.str, var);
+            if (reg != var)
+                emit(RegOpcode::MOVE, var, reg);
+            return nullptr;
+        }
+        default: {
+            // Expression statement, whose value is dropped.
+            std::uint32_t reg = ANY_REG;
+            return expr(node, reg);
+        }
+        }
+    }
+
+    ErrPtr block(const std::vector<Node>& nodes) {
+        for (std::size_t i = 0; i < nodes.size(); i++) {
+            OpID first = nodes[i].op;
+            if (first != OpID::IF && first != OpID::MATCH) {
+                if (ErrPtr err = stmt(nodes[i]))
+                    return err;
+                continue;
+            }
+            // Gather the `ELIF`s, or `CASE`s, and `ELSE` following this `IF`
+            // or `MATCH`.
+            OpID middle = first == OpID::IF ? OpID::ELIF : OpID::CASE;
+            auto chain = std::vector<const Node*>{&nodes[i]};
+            while (
+                i + 1 < nodes.size() && chain.back()->op != OpID::ELSE && (
+                    nodes[i + 1].op == middle || nodes[i + 1].op == OpID::ELSE
+                )
+            )
+                chain.push_back(&nodes[++i]);
+            ErrPtr err = first == OpID::IF ?
+                if_chain(chain) : match_chain(chain);
+            if (err)
+                return err;
+        }
+        return nullptr;
+    }
+
+    ErrPtr if_chain(const std::vector<const Node*>& chain) {
+        std::string name;
+        std::vector<SwitchArm> arms;
+        std::size_t n = if_arms(chain, name, arms);
+        if (n >= MIN_SWITCH_ARMS) {
+            std::uint32_t subject = ANY_REG;
+            if (ErrPtr err = expr(chain[0]->node->bin->lhs.bin->lhs, subject))
+                return err;
+            auto rest =
+                std::vector<const Node*>(chain.begin() + n, chain.end());
+            return switch_chain(subject, arms, rest);
+        }
+        // Jumps to the end of the chain, patched once it is known.
+        std::vector<std::uint32_t> exits;
+        for (const Node* branch: chain) {
+            if (branch->op == OpID::ELSE) {
+                if (ErrPtr err = stmt(*branch->node))
+                    return err;
+                break;
+            }
+            const Node& pred = *branch->node;
+            if (opinfo(pred.op).kind != OpKind::BINARY)
+                return ErrPtr(new UnsupportedNodeErr(pred.op));
+            std::uint32_t cond = ANY_REG;
+            if (ErrPtr err = expr(pred.bin->lhs, cond))
+                return err;
+            std::uint32_t skip = emit(RegOpcode::BRANCH, cond);
+            if (ErrPtr err = stmt(pred.bin->rhs))
+                return err;
+            if (branch != chain.back())
+                exits.push_back(emit(RegOpcode::GOTO));
+            vcode[skip].b = here();
+        }
+        for (std::uint32_t exit: exits)
+            vcode[exit].b = here();
+        return nullptr;
+    }
+
+    ErrPtr match_chain(const std::vector<const Node*>& chain) {
+        std::uint32_t subject = ANY_REG;
+        if (ErrPtr err = expr(*chain[0]->node, subject))
+            return err;
+        std::vector<const Node*> rest;
+        if (chain.back()->op == OpID::ELSE)
+            rest.push_back(chain.back());
+        std::vector<SwitchArm> arms;
+        if (match_arms(chain, arms))
+            return switch_chain(subject, arms, rest);
+
+        // Keys that are not literals are compared in turn.
+        std::vector<std::uint32_t> exits;
+        for (std::size_t i = 1; i < chain.size(); i++) {
+            if (chain[i]->op != OpID::CASE)
+                break;
+            const Node& pred = *chain[i]->node;
+            if (opinfo(pred.op).kind != OpKind::BINARY)
+                return ErrPtr(new UnsupportedNodeErr(pred.op));
+            std::vector<const Node*> values = case_values(pred.bin->lhs);
+            std::vector<std::uint32_t> hits;
+            std::uint32_t miss = 0;
+            for (std::size_t j = 0; j < values.size(); j++) {
+                std::uint32_t key = ANY_REG;
+                if (ErrPtr err = expr(*values[j], key))
+                    return err;
+                std::uint32_t cond = new_temps(1);
+                emit(RegOpcode::EQ, cond, subject, key);
+                miss = emit(RegOpcode::BRANCH, cond);
+                if (j + 1 < values.size()) {
+                    hits.push_back(emit(RegOpcode::GOTO));
+                    vcode[miss].b = here();
+                }
+            }
+            for (std::uint32_t hit: hits)
+                vcode[hit].b = here();
+            if (ErrPtr err = stmt(pred.bin->rhs))
+                return err;
+            exits.push_back(emit(RegOpcode::GOTO));
+            vcode[miss].b = here();
+        }
+        if (!rest.empty()) {
+            if (ErrPtr err = stmt(*rest[0]->node))
+                return err;
+        }
+        for (std::uint32_t exit: exits)
+            vcode[exit].b = here();
+        return nullptr;
+    }
+
+    // Jump to the first arm with a key equal to the value in subject, or to
+    // the rest of the chain if none has one.
+    ErrPtr switch_chain(
+        std::uint32_t subject, const std::vector<SwitchArm>& arms,
+        const std::vector<const Node*>& rest
+    ) {
+        if (vswitches.size() > MAX_REG_BX)
+            return ErrPtr(new CodeTooLargeErr());
+        auto index = static_cast<std::uint32_t>(vswitches.size());
+        vswitches.emplace_back();
+        emit(RegOpcode::SWITCH, subject, index);
+        std::vector<std::uint32_t> exits;
+        for (const SwitchArm& arm: arms) {
+            for (std::int64_t key: arm.keys) {
+                vswitches[index].keys.push_back(key);
+                vswitches[index].targets.push_back(here());
+            }
+            if (ErrPtr err = stmt(*arm.body))
+                return err;
+            if (&arm != &arms.back() || !rest.empty())
+                exits.push_back(emit(RegOpcode::GOTO));
+        }
+        vswitches[index].otherwise = here();
+        if (!rest.empty()) {
+            if (ErrPtr err = if_chain(rest))
+                return err;
+        }
+        for (std::uint32_t exit: exits)
+            vcode[exit].b = here();
+        return nullptr;
+    }
+
+    // `for cond:` runs while cond is true. `for i from x to y by k:` counts i
+    // from x, or 0, up to but excluding y, or down to it if the step k is
+    // negative. y is evaluated once, and k must be a literal, 1 if left out.
+    // A `FOR_NEXT` steps and tests i at the end of each iteration. `for x in
+    // xs:` runs once for each item of xs, assigned to x.
+    ErrPtr for_loop(const Node& node) {
+        if (opinfo(node.op).kind != OpKind::BINARY)
+            return ErrPtr(new UnsupportedNodeErr(node.op));
+        if (traces.size() == MAX_REG_SLOTS)
+            return ErrPtr(new CodeTooLargeErr());
+        auto index = static_cast<std::uint32_t>(traces.size());
+        traces.emplace_back();
+        const Node& pred = node.bin->lhs;
+        const Node& body = node.bin->rhs;
+        switch (pred.op) {
+        case OpID::FROM:
+        case OpID::TO:
+        case OpID::BY:
+            return range_loop(pred, body, index);
+        case OpID::IN:
+            return item_loop(pred, body, index);
+        default:
+            break;
+        }
+        std::uint32_t head = here();
+        std::uint32_t cond = ANY_REG;
+        if (ErrPtr err = expr(pred, cond))
+            return err;
+        std::uint32_t skip = emit(RegOpcode::BRANCH, cond);
+        if (ErrPtr err = stmt(body))
+            return err;
+        emit(RegOpcode::LOOP, index, head);
+        vcode[skip].b = here();
+        return nullptr;
+    }
+
+    ErrPtr item_loop(const Node& pred, const Node& body, std::uint32_t index) {
+        const Node& name = pred.bin->lhs;
+        if (name.op != OpID::ALNUM || is_numeric_literal(name.str))
+            return ErrPtr(new UnsupportedNodeErr(name.op));
+        std::uint32_t xs = ANY_REG;
+        if (ErrPtr err = expr(pred.bin->rhs, xs))
+            return err;
+        std::uint32_t cursor = new_temps(coreutil::ITER_SLOTS);
+        emit(RegOpcode::ITER, cursor, xs);
+        auto it = vars.find(name.str);
+        auto var = it == vars.end() ?
+            static_cast<std::uint32_t>(vars.size()) : it->second;
+        vars.emplace(name.str, var);
+
+        // The first item is taken on the way in, the rest at the end.
+        std::uint32_t enter = emit(RegOpcode::GOTO);
+        std::uint32_t head = here();
+        if (ErrPtr err = stmt(body))
+            return err;
+        vcode[enter].b = here();
+        emit(RegOpcode::FOR_ITER, var, cursor);
+        emit(RegOpcode::LOOP, index, head);
+        return nullptr;
+    }
+
+    // Operands of a chain of `FROM`, `TO` and `BY`, each with the operator
+    // before it, in source order whichever way the chain associates.
+    void range_parts(
+        const Node& node, OpID op,
+        std::vector<std::pair<OpID, const Node*>>& parts
+    ) {
+        using enum OpID;
+        if (node.op == FROM || node.op == TO || node.op == BY) {
+            range_parts(node.bin->lhs, op, parts);
+            range_parts(node.bin->rhs, node.op, parts);
+        } else
+            parts.emplace_back(op, &node);
+    }
+
+    // Value of a step, a numeric literal that may be negated.
+    ErrPtr step_literal(const Node& node, Any& step, bool& down) {
+        bool neg = node.op == OpID::NEG;
+        const Node& lit = neg ? *node.node : node;
+        if (lit.op != OpID::ALNUM || !is_numeric_literal(lit.str))
+            return ErrPtr(new UnsupportedNodeErr(lit.op));
+        if (ErrPtr err = parse_literal(lit.str, step))
+            return err;
+        if (step.tid == static_cast<std::uint32_t>(BuiltinTypeID::INT64)) {
+            auto k = coreutil::unwrap<std::int64_t>(step);
+            step = coreutil::wrap(neg ? -k : k);
+        } else if (
+            step.tid == static_cast<std::uint32_t>(BuiltinTypeID::FLOAT64)
+        ) {
+            auto k = coreutil::unwrap<double>(step);
+            step = coreutil::wrap(neg ? -k : k);
+        } else
+            return ErrPtr(new UnsupportedNodeErr(lit.op));
+        down = neg;
+        return nullptr;
+    }
+
+    ErrPtr range_loop(const Node& pred, const Node& body, std::uint32_t index) {
+        using enum OpID;
+        std::vector<std::pair<OpID, const Node*>> parts;
+        range_parts(pred, FOR, parts);
+        const Node* from = nullptr;
+        const Node* to = nullptr;
+        const Node* by = nullptr;
+        for (std::size_t i = 1; i < parts.size(); i++) {
+            const Node*& part = parts[i].first == FROM ? from :
+                parts[i].first == TO ? to : by;
+            if (part != nullptr)
+                return ErrPtr(new UnsupportedNodeErr(parts[i].first));
+            part = parts[i].second;
+        }
+        const Node& name = *parts[0].second;
+        if (name.op != ALNUM || is_numeric_literal(name.str))
+            return ErrPtr(new UnsupportedNodeErr(name.op));
+        if (to == nullptr)
+            return ErrPtr(new UnsupportedNodeErr(pred.op));
+
+        Any step = coreutil::wrap(std::int64_t(1));
+        bool down = false;
+        if (by != nullptr) {
+            if (ErrPtr err = step_literal(*by, step, down))
+                return err;
+        }
+        // The counter is a variable, visible once assigned like any other.
+        auto it = vars.find(name.str);
+        auto var = it == vars.end() ?
+            static_cast<std::uint32_t>(vars.size()) : it->second;
+        if (from != nullptr) {
+            if (ErrPtr err = expr_into(*from, var))
+                return err;
+        } else {
+            bool real =
+                step.tid == static_cast<std::uint32_t>(BuiltinTypeID::FLOAT64);
+            Any zero = real ?
+                coreutil::wrap(0.0) : coreutil::wrap(std::int64_t(0));
+            emit(RegOpcode::LOADK, var, constant(zero));
+        }
+        vars.emplace(name.str, var);
+        // The limit, the step and the result of the test, for `FOR_NEXT`.
+        std::uint32_t range = new_temps(3);
+        if (ErrPtr err = expr_into(*to, range))
+            return err;
+        emit(RegOpcode::LOADK, range + 1, constant(step));
+
+        // The first test is on the way in; the loop then turns at the end.
+        emit(down ? RegOpcode::GT : RegOpcode::LT, range + 2, var, range);
+        std::uint32_t skip = emit(RegOpcode::BRANCH, range + 2);
+        std::uint32_t head = here();
+        if (ErrPtr err = stmt(body))
+            return err;
+        emit(RegOpcode::FOR_NEXT, var, range, down ? 1 : 0);
+        emit(RegOpcode::LOOP, index, head);
+        vcode[skip].b = here();
+        return nullptr;
+    }
+
+    // Compile an expression. dest is the preferred register for the result,
+    // or `ANY_REG`; on return it is the register actually holding it, which
+    // differs for reads of variables.
+    ErrPtr expr(const Node& node, std::uint32_t& dest) {
+        using enum OpID;
+        switch (node.op) {
+        case ALNUM: {
+            if (is_numeric_literal(node.str)) {
+                Any value;
+                if (ErrPtr err = parse_literal(node.str, value))
+                    return err;
+                return load(value, dest);
+            }
+            auto it = vars.find(node.str);
+            if (it == vars.end())
+                return ErrPtr(new UnknownVarErr(node.str));
+            dest = it->second;
+            return nullptr;
+        }
+        case TRUE:
+            return load(coreutil::wrap(true), dest);
+        case FALSE:
+            return load(coreutil::wrap(false), dest);
+        case NONE:
+            return load(coreutil::NONE, dest);
+        case GROUP:
+            return expr(*node.node, dest);
+        case CALL:
+            return call(node, dest);
+        case GET:
+            return get_attr(node, dest);
+        case ADD:
+            return binary(RegOpcode::ADD, node, dest);
+        case SUB:
+            return binary(RegOpcode::SUB, node, dest);
+        case MUL:
+            return binary(RegOpcode::MUL, node, dest);
+        case DIV:
+            return binary(RegOpcode::DIV, node, dest);
+        case MOD:
+            return binary(RegOpcode::MOD, node, dest);
+        case EQ:
+            return binary(RegOpcode::EQ, node, dest);
+        case NEQ:
+            return binary(RegOpcode::NEQ, node, dest);
+        case LT:
+            return binary(RegOpcode::LT, node, dest);
+        case LTE:
+            return binary(RegOpcode::LTE, node, dest);
+        case GT:
+            return binary(RegOpcode::GT, node, dest);
+        case GTE:
+            return binary(RegOpcode::GTE, node, dest);
+        default:
+            return ErrPtr(new UnsupportedNodeErr(node.op));
+        }
+    }
+
+    // Compile an expression into exactly the register dest.
+    ErrPtr expr_into(const Node& node, std::uint32_t dest) {
+        std::uint32_t reg = dest;
+        if (ErrPtr err = expr(node, reg))
+            return err;
+        if (reg != dest)
+            emit(RegOpcode::MOVE, dest, reg);
+        return nullptr;
+    }
+
+    ErrPtr load(Any value, std::uint32_t& dest) {
+        if (dest == ANY_REG)
+            dest = new_temps(1);
+        emit(RegOpcode::LOADK, dest, constant(value));
+        return nullptr;
+    }
+
+    ErrPtr binary(RegOpcode op, const Node& node, std::uint32_t& dest) {
+        // Operands read variables in place; only the result needs a register.
+        std::uint32_t lhs = ANY_REG;
+        if (ErrPtr err = expr(node.bin->lhs, lhs))
+            return err;
+        std::uint32_t rhs = ANY_REG;
+        if (ErrPtr err = expr(node.bin->rhs, rhs))
+            return err;
+        if (dest == ANY_REG)
+            dest = new_temps(1);
+        emit(op, dest, lhs, rhs);
+        return nullptr;
+    }
+
+    ErrPtr get_attr(const Node& node, std::uint32_t& dest) {
+        const Node& name = node.bin->rhs;
+        if (name.op != OpID::ALNUM || is_numeric_literal(name.str))
+            return ErrPtr(new UnsupportedNodeErr(name.op));
+        std::uint32_t obj = ANY_REG;
+        if (ErrPtr err = expr(node.bin->lhs, obj))
+            return err;
+        if (attr_caches.size() == MAX_REG_SLOTS)
+            return ErrPtr(new CodeTooLargeErr());
+        attr_caches.push_back(AttrCache{symbols.intern(name.str), 0, 0, 0});
+        if (dest == ANY_REG)
+            dest = new_temps(1);
+        emit(
+            RegOpcode::GET_ATTR, dest, obj,
+            static_cast<std::uint32_t>(attr_caches.size() - 1)
+        );
+        return nullptr;
+    }
+
+    ErrPtr call(const Node& node, std::uint32_t& dest) {
+        // Flatten the argument list, a (possibly parenthesized) chain of
+        // separators.
+        std::vector<const Node*> args;
+        const Node* rest = &node.bin->rhs;
+        if (rest->op == OpID::GROUP)
+            rest = rest->node;
+        while (rest->op == OpID::SEP) {
+            args.push_back(&rest->bin->lhs);
+            rest = &rest->bin->rhs;
+        }
+        args.push_back(rest);
+
+        std::uint32_t group = new_temps(args.size() + 1);
+        if (ErrPtr err = expr_into(node.bin->lhs, group))
+            return err;
+        for (std::uint32_t i = 0; i < args.size(); i++) {
+            if (ErrPtr err = expr_into(*args[i], group + 1 + i))
+                return err;
+        }
+        if (dest == ANY_REG)
+            dest = new_temps(1);
+        emit(RegOpcode::CALL, dest, group, args.size());
+        return nullptr;
+    }
+
+    // Allocate slots for temporaries by linear scan, then encode.
+    ErrPtr finish() {
+        auto nvars = static_cast<std::uint32_t>(vars.size());
+
+        // Groups are live from their first definition to their last use.
+        std::vector<std::uint32_t> order;
+        for (std::uint32_t i = 0; i < temps.size(); i++) {
+            Interval& head = temps[i];
+            if (head.group_len == 0)
+                continue;
+            for (std::uint32_t j = 1; j < head.group_len; j++) {
+                head.start = std::min(head.start, temps[i + j].start);
+                head.end = std::max(head.end, temps[i + j].end);
+            }
+            if (head.start != UINT32_MAX)
+                order.push_back(i);
+        }
+        std::sort(
+            order.begin(), order.end(),
+            [&](std::uint32_t x, std::uint32_t y) {
+                return temps[x].start < temps[y].start;
+            }
+        );
+
+        // A slot is free again at the instruction that last reads it, since
+        // operands are read before the result is written.
+        std::vector<std::uint32_t> slot_of(temps.size());
+        std::vector<bool> busy;
+        std::vector<std::uint32_t> active;
+        for (std::uint32_t t: order) {
+            Interval& interval = temps[t];
+            std::erase_if(active, [&](std::uint32_t u) {
+                if (temps[u].end > interval.start)
+                    return false;
+                for (std::uint32_t j = 0; j < temps[u].group_len; j++)
+                    busy[slot_of[u] - nvars + j] = false;
+                return true;
+            });
+
+            // Lowest run of free slots fitting the group.
+            std::uint32_t k = 0;
+            std::uint32_t run = 0;
+            while (run < interval.group_len) {
+                if (k + run < busy.size() && busy[k + run]) {
+                    k += run + 1;
+                    run = 0;
+                } else
+                    run++;
+            }
+            if (busy.size() < k + run)
+                busy.resize(k + run, false);
+            for (std::uint32_t j = 0; j < interval.group_len; j++) {
+                busy[k + j] = true;
+                slot_of[t + j] = nvars + k + j;
+            }
+            active.push_back(t);
+        }
+        nslots = nvars + static_cast<std::uint32_t>(busy.size());
+        if (nslots > MAX_REG_SLOTS || vcode.size() > MAX_REG_BX)
+            return ErrPtr(new CodeTooLargeErr());
+
+        auto slot = [&](std::uint32_t reg) {
+            return reg & TEMP ? slot_of[reg & ~TEMP] : reg;
+        };
+        insts.clear();
+        for (const VInst& inst: vcode) {
+            using enum RegOpcode;
+            switch (inst.op) {
+            case LOADK:
+                insts.push_back(encode_abx(inst.op, slot(inst.a), inst.b));
+                break;
+            case CALL:
+            case GET_ATTR:
+            case FOR_NEXT:
+            case ITER:
+            case FOR_ITER:
+                insts.push_back(
+                    encode_abc(inst.op, slot(inst.a), slot(inst.b), inst.c)
+                );
+                break;
+            case BRANCH:
+            case SWITCH:
+                insts.push_back(encode_abx(inst.op, slot(inst.a), inst.b));
+                break;
+            case GOTO:
+                insts.push_back(encode_abx(inst.op, 0, inst.b));
+                break;
+            case LOOP:
+                insts.push_back(encode_abx(inst.op, inst.a, inst.b));
+                break;
+            case RETURN:
+            case RAISE:
+                insts.push_back(encode_abc(inst.op, slot(inst.a)));
+                break;
+            case END:
+                insts.push_back(encode_abc(inst.op, 0));
+                break;
+            default:
+                insts.push_back(encode_abc(
+                    inst.op, slot(inst.a), slot(inst.b), slot(inst.c)
+                ));
+            }
+        }
+        counters.assign(insts.size(), QUICKEN_DELAY);
+        build_switches();
+        return nullptr;
+    }
+
+    // Lay out the cases of each switch: as given, sorted, and as a jump table
+    // if they are dense enough.
+    void build_switches() {
+        // Keys and their targets are at the same offsets.
+        struct Offsets {
+            std::size_t keys;
+            std::size_t sorted;
+            std::size_t dense;
+            std::uint32_t nsorted;
+            std::uint32_t ndense;
+        };
+        std::vector<Offsets> offsets;
+        switch_keys.clear();
+        switch_targets.clear();
+        switch_dense.clear();
+        for (const VSwitch& s: vswitches) {
+            Offsets at{switch_keys.size(), 0, 0, 0, 0};
+            switch_keys.insert(switch_keys.end(), s.keys.begin(), s.keys.end());
+            switch_targets.insert(
+                switch_targets.end(), s.targets.begin(), s.targets.end()
+            );
+
+            // The first of equal keys is the one taken.
+            std::vector<std::uint32_t> order(s.keys.size());
+            for (std::uint32_t i = 0; i < order.size(); i++)
+                order[i] = i;
+            std::stable_sort(
+                order.begin(), order.end(),
+                [&](std::uint32_t x, std::uint32_t y) {
+                    return s.keys[x] < s.keys[y];
+                }
+            );
+            order.erase(
+                std::unique(
+                    order.begin(), order.end(),
+                    [&](std::uint32_t x, std::uint32_t y) {
+                        return s.keys[x] == s.keys[y];
+                    }
+                ),
+                order.end()
+            );
+            at.sorted = switch_keys.size();
+            at.nsorted = static_cast<std::uint32_t>(order.size());
+            for (std::uint32_t i: order) {
+                switch_keys.push_back(s.keys[i]);
+                switch_targets.push_back(s.targets[i]);
+            }
+
+            if (!order.empty()) {
+                auto min = static_cast<std::uint64_t>(s.keys[order.front()]);
+                std::uint64_t gap =
+                    static_cast<std::uint64_t>(s.keys[order.back()]) - min;
+                if (gap < std::uint64_t(100) * at.nsorted / MIN_DENSE_PERCENT) {
+                    at.dense = switch_dense.size();
+                    at.ndense = static_cast<std::uint32_t>(gap + 1);
+                    switch_dense.resize(at.dense + at.ndense, s.otherwise);
+                    for (std::uint32_t i: order) {
+                        std::uint64_t offset =
+                            static_cast<std::uint64_t>(s.keys[i]) - min;
+                        switch_dense[at.dense + offset] = s.targets[i];
+                    }
+                }
+            }
+            offsets.push_back(at);
+        }
+
+        // The tables point into the arrays, which are complete now.
+        switches.clear();
+        for (std::size_t i = 0; i < vswitches.size(); i++) {
+            const VSwitch& s = vswitches[i];
+            const Offsets& at = offsets[i];
+            auto len = static_cast<std::uint32_t>(s.keys.size());
+            switches.push_back(SwitchTable{
+                switch_keys.data() + at.keys, switch_targets.data() + at.keys,
+                len, s.otherwise, switch_keys.data() + at.sorted,
+                switch_targets.data() + at.sorted, at.nsorted,
+                at.ndense == 0 ? nullptr : switch_dense.data() + at.dense,
+                at.ndense,
+                at.nsorted == 0 ? 0 : switch_keys[at.sorted]
+            });
+        }
+    }
+};
+
+}
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <list>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "dl/compile/ssa.hpp"
+#include "dl/compile/ssacompiler.hpp"
+#include "dl/compile/symboltable.hpp"
+#include "dl/err.hpp"
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/gc.hpp"
+#include "dl/interpreter2/interpreterimpl.hpp"
+#include "dl/interpreter2/regcode.hpp"
+#include "dl/interpreter2/regvm.hpp"
+#include "dl/interpretnode/def.hpp"
+#include "dl/process/node.hpp"
+
+namespace dl {
+
+// A `Def`, by the ID `Specializer::add` gave it, and the TIDs of the
+// positional arguments of a call to it.
+struct SpecKey {
+    std::uint32_t def;
+    std::vector<std::uint32_t> tids;
+
+    bool operator==(const SpecKey& that) const = default;
+};
+
+struct SpecKeyHash {
+    std::size_t operator()(const SpecKey& key) const noexcept {
+        // FNV-1a, a word at a time.
+        std::uint64_t h = 14695981039346656037u;
+        h = (h ^ key.def) * 1099511628211u;
+        for (std::uint32_t tid: key.tids)
+            h = (h ^ tid) * 1099511628211u;
+        return static_cast<std::size_t>(h);
+    }
+};
+
+// Runs each `Def` whose body it was given as register code compiled for the
+// types of the arguments of the call, once per combination of them. Knowing
+// the types of its parameters lets `SsaCompiler` optimize more, and start
+// operators on them out quickened. Each specialization also has inline caches
+// of its own, so a function called with objects of several types has
+// monomorphic caches where one body would have had them thrash.
+//
+// Specializations are kept up to a capacity, the least recently used going
+// first. One still running, further up the stack, is kept until it returns.
+// Argument types a body failed to compile for are remembered, so that calls
+// with them go to `execute_def` without trying again.
+//
+// Calls from one body to another known `Def` may be inlined into it, if the
+// name it calls is among the constants. Each specialization checks on entry
+// that the constants it read, the callees it inlined among them, are still
+// bound to the same values, and all are compiled again if one is not. The
+// same goes for the types it assumed calls to only make an object.
+struct Specializer final: DefRunner {
+    static constexpr std::size_t DEFAULT_CAPACITY = 256;
+
+    struct Source {
+        const ssa::Inlinable* def;
+    };
+
+    struct Stats {
+        // Specializations compiled, and how many of them are still cached.
+        std::uint32_t compiled = 0;
+        std::uint32_t cached = 0;
+        std::uint32_t evicted = 0;
+        // Calls that found their specialization cached.
+        std::uint64_t hits = 0;
+    };
+
+    struct Entry {
+        SpecKey key;
+        SsaCompiler compiler;
+        RegCode code;
+
+        // Calls to it in progress.
+        std::uint32_t running = 0;
+
+        // Set if it was invalidated while running, which takes it out of
+        // `index`. It is freed when its last call returns.
+        bool stale = false;
+
+        // Types the code was compiled assuming `plain_type` of.
+        std::vector<Any> plain_types;
+
+        Entry(SpecKey key, SymbolTable& symbols):
+            key(std::move(key)), compiler(symbols), code() {}
+
+        // Undoes `root`.
+        ~Entry() {
+            for (auto& [binding, value]: compiler.constants_read) {
+                gc::remove_roots(const_cast<Any*>(binding));
+                gc::remove_roots(&value);
+            }
+        }
+
+        // Make the bindings of the constants read, and the values they had,
+        // GC roots, so that `bound` compares where the objects are now.
+        void root() {
+            for (auto& [binding, value]: compiler.constants_read) {
+                gc::add_roots(const_cast<Any*>(binding), 1);
+                gc::add_roots(&value, 1);
+            }
+        }
+    };
+
+    SymbolTable& symbols;
+    std::size_t capacity;
+
+    // Names bound to values that stay the same while specializations are
+    // cached, such as the `Def`s of a module, which bodies read as constants.
+    // The bindings an entry read are GC roots while it is cached.
+    const std::unordered_map<std::string, Any>* constants = nullptr;
+
+    // Whether calls to the `Def`s made known may be inlined.
+    bool inline_calls = true;
+
+    // By ID.
+    std::vector<Source> sources;
+    std::vector<Stats> stats;
+    // IDs and bodies by code, which identifies a `Def`.
+    std::unordered_map<const Any*, std::uint32_t> ids;
+    std::unordered_map<const Any*, ssa::Inlinable> bodies;
+
+    // Most recently used first.
+    std::list<Entry> entries;
+    std::unordered_map<SpecKey, std::list<Entry>::iterator, SpecKeyHash> index;
+    // Keys whose body failed to compile.
+    std::unordered_set<SpecKey, SpecKeyHash> unsupported;
+
+    Specializer(
+        SymbolTable& symbols, std::size_t capacity = DEFAULT_CAPACITY
+    ) noexcept: symbols(symbols), capacity(capacity) {}
+
+    // Make the body of def known, returning the ID it is known by. The body
+    // must outlive the specializer.
+    std::uint32_t add(
+        const Def& def, const Node& body, std::vector<std::string> params
+    ) {
+        auto id = static_cast<std::uint32_t>(sources.size());
+        auto [it, inserted] = ids.emplace(def.code, id);
+        if (!inserted)
+            return it->second;
+        const ssa::Inlinable& inlinable = bodies.emplace(
+            def.code, ssa::Inlinable{def.name, &body, std::move(params)}
+        ).first->second;
+        sources.push_back(Source{&inlinable});
+        stats.emplace_back();
+        return id;
+    }
+
+    virtual bool run(
+        InterpreterImpl& interp, const Def& def, Any& res
+    ) override {
+        auto it = ids.find(def.code);
+        if (it == ids.end())
+            return false;
+        // Register code only takes positional arguments, one per parameter.
+        const Args& args = coreutil::args(interp.state);
+        const Source& source = sources[it->second];
+        if (args.kwargs.len != 0 || args.args.len != source.def->params.size())
+            return false;
+        auto entry = find(interp.state, it->second, args.args);
+        if (entry != entries.end() && !bound(interp.state, *entry)) {
+            invalidate();
+            entry = find(interp.state, it->second, args.args);
+        }
+        if (entry == entries.end())
+            return false;
+        // Calls made by the code may evict or invalidate other entries, but
+        // not a running one, so entry stays valid.
+        entry->running++;
+        res = vm::run(interp, entry->code);
+        entry->running--;
+        if (entry->running == 0 && entry->stale) {
+            stats[entry->key.def].cached--;
+            entries.erase(entry);
+        }
+        return true;
+    }
+
+    // The specialization of def for the types of args, compiled if it is not
+    // cached. The end of `entries` if the body cannot be compiled for them.
+    std::list<Entry>::iterator find(
+        State& state, std::uint32_t def, const Seq& args
+    ) {
+        SpecKey key{def, std::vector<std::uint32_t>(args.len)};
+        for (std::uint32_t i = 0; i < args.len; i++)
+            key.tids[i] = args.xs[i].tid;
+        auto it = index.find(key);
+        if (it != index.end()) {
+            entries.splice(entries.begin(), entries, it->second);
+            stats[def].hits++;
+            return entries.begin();
+        }
+        if (unsupported.contains(key))
+            return entries.end();
+
+        Source& source = sources[def];
+        Entry& entry = entries.emplace_front(key, symbols);
+        for (std::uint32_t tid: key.tids)
+            entry.compiler.param_types.push_back(ssa::tid_type(tid));
+        entry.compiler.constants = constants;
+        entry.compiler.inlinable = inline_calls ? &bodies : nullptr;
+        entry.compiler.self = source.def;
+        entry.compiler.plain_type = [this, &state, &entry](Any type) {
+            if (!plain_type(state, type))
+                return false;
+            std::vector<Any>& types = entry.plain_types;
+            auto same = [&](Any t) { return t.data == type.data; };
+            if (std::none_of(types.begin(), types.end(), same))
+                types.push_back(type);
+            return true;
+        };
+        ErrPtr err = entry.compiler.compile(
+            *source.def->body, source.def->params
+        );
+        entry.root();
+        if (err == nullptr)
+            entry.code = entry.compiler.code();
+        if (err != nullptr || verify(entry.code) != 0) {
+            entries.pop_front();
+            unsupported.insert(std::move(key));
+            return entries.end();
+        }
+        index.emplace(std::move(key), entries.begin());
+        stats[def].compiled++;
+        stats[def].cached++;
+        evict();
+        return entries.begin();
+    }
+
+    void evict() {
+        // Only running entries are ever stale, and those are skipped.
+        auto it = entries.end();
+        while (entries.size() > capacity && it != entries.begin()) {
+            --it;
+            if (it->running != 0)
+                continue;
+            stats[it->key.def].cached--;
+            stats[it->key.def].evicted++;
+            index.erase(it->key);
+            it = entries.erase(it);
+        }
+    }
+
+    // Whether calling type only makes an object, with its fields zeroed: its
+    // `__call__` is `default_type_call`, which then runs `__init__` if the
+    // object has one, and it has none. That call raises if given arguments.
+    bool plain_type(State& state, Any type) {
+        Any call =
+            coreutil::get_method(state, type, BuiltinSymbol::DUNDER_CALL);
+        Any default_call = coreutil::get_var(
+            symbols.intern("default_type_call"),
+            coreutil::unwrap<Vars>(coreutil::get_var(
+                BuiltinSymbol::TRUNDER_COREDEFS, coreutil::globals(state)
+            ))
+        );
+        auto def_tid = static_cast<std::uint32_t>(BuiltinTypeID::DEF);
+        if (
+            call.tid != def_tid || default_call.tid != def_tid ||
+            coreutil::unwrap<Def>(call).code !=
+                coreutil::unwrap<Def>(default_call).code
+        )
+            return false;
+        Symbol init = symbols.intern("__init__");
+        const Type& t = coreutil::unwrap<Type>(type);
+        return coreutil::is_error(coreutil::get_var(init, t.dunder_callattr)) &&
+            coreutil::is_error(coreutil::get_var(init, t.dunder_getattr));
+    }
+
+    // Whether the constants entry read are still bound to what they were, and
+    // the types it assumed plain still are.
+    bool bound(State& state, const Entry& entry) {
+        for (auto& [binding, value]: entry.compiler.constants_read) {
+            if (binding->tid != value.tid || binding->data != value.data)
+                return false;
+        }
+        for (Any type: entry.plain_types) {
+            if (!plain_type(state, type))
+                return false;
+        }
+        return true;
+    }
+
+    // Drop every specialization, so that each is compiled again when next
+    // called, such as once a name among the constants is rebound. Entries
+    // point to the bindings they read, so names must not be removed from the
+    // constants while any are cached. Bodies that failed to compile are tried
+    // again too, since what they inline may have changed.
+    void invalidate() {
+        unsupported.clear();
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (!it->stale)
+                index.erase(it->key);
+            if (it->running != 0) {
+                it->stale = true;
+                ++it;
+                continue;
+            }
+            stats[it->key.def].cached--;
+            it = entries.erase(it);
+        }
+    }
+
+    // One line per `Def` that was called:
+    //
+    //     f: 3 compiled, 2 cached, 1 evicted, 9997 hits
+    void report(std::ostream& os) const {
+        for (std::size_t i = 0; i < sources.size(); i++) {
+            const Stats& s = stats[i];
+            if (s.compiled == 0)
+                continue;
+            os << symbols.names[sources[i].def->name] << ": " << s.compiled <<
+                " compiled, " << s.cached << " cached, " << s.evicted <<
+                " evicted, " << s.hits << " hits\n";
+        }
+    }
+};
+
+}
@@ -0,0 +1,554 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "dl/compile/symboltable.hpp"
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+
+// Static single assignment form of a function body, between processed nodes
+// and register code. Every value is defined by exactly one instruction, and
+// where control flow merges, phi instructions pick the value of the edge taken.
+namespace dl::ssa {
+
+// What is known before running about the values of an instruction.
+enum class Type: std::uint8_t {
+    ANY,
+    BOOL,
+    INT64,
+    FLOAT64
+};
+
+enum class Op: std::uint8_t {
+    // A constant, `k`. Constants are in no block: they are materialized
+    // wherever they are used.
+    CONST,
+    // Parameter number `index`, in the entry block.
+    PARAM,
+    // Value of its argument for each predecessor of its block, in order.
+    // Phis come first in their block.
+    PHI,
+    // Binary operators, in the order of `BinaryOp`.
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    EQ,
+    NEQ,
+    LT,
+    LTE,
+    GT,
+    GTE,
+    // Call the first argument with the rest.
+    CALL,
+    // Attribute of symbol `index` of the argument.
+    GET_ATTR,
+
+    // Terminators, which end every block.
+
+    // Go to the first successor if the argument is true and to the second if
+    // it is false, raising if it is not a `Bool`.
+    BRANCH,
+    // Go to the only successor.
+    JUMP,
+    // Go to the successor of the first of the rest of the arguments, `Int64`
+    // constants, that the first equals, or to the last successor if none.
+    SWITCH,
+    RAISE,
+    RETURN
+};
+
+constexpr const char* OP_NAMES[] = {
+    "const", "param", "phi", "add", "sub", "mul", "div", "mod", "eq", "neq",
+    "lt", "lte", "gt", "gte", "call", "get_attr", "branch", "jump", "switch",
+    "raise", "return"
+};
+
+constexpr const char* TYPE_NAMES[] = {"any", "bool", "int64", "float64"};
+
+constexpr bool is_binary(Op op) noexcept {
+    return op >= Op::ADD && op <= Op::GTE;
+}
+
+constexpr bool is_compare(Op op) noexcept {
+    return op >= Op::EQ && op <= Op::GTE;
+}
+
+constexpr bool is_terminator(Op op) noexcept {
+    return op >= Op::BRANCH;
+}
+
+// Index of an instruction, and so of the value it defines.
+using Value = std::uint32_t;
+
+constexpr Value NO_VALUE = UINT32_MAX;
+
+constexpr std::uint32_t NO_BLOCK = UINT32_MAX;
+
+struct Inst {
+    Op op;
+    Type type;
+    std::uint32_t block;
+    std::vector<Value> args;
+    std::uint32_t index = 0;
+    Any k = Any{0, nullptr};
+
+    // Whether it was removed from its block.
+    bool dead = false;
+
+    // Inlined call it belongs to, in `Function::frames`.
+    std::uint32_t frame = 0;
+};
+
+// A call whose callee's body was inlined: the callee's name, and the frame
+// and source of the call. Frame 0 is the function itself.
+struct Frame {
+    std::uint32_t parent;
+    Symbol name;
+    std::uint64_t src_id;
+};
+
+struct Block {
+    std::vector<Value> insts;
+    std::vector<std::uint32_t> preds;
+    std::vector<std::uint32_t> succs;
+    bool dead = false;
+};
+
+// Type of a binary operator's result. Operators on two `Int64`s or two
+// `Float64`s give a value of that type, or `Bool` for comparisons. Arithmetic
+// on `Int64`s goes to the dunder method on overflow or division by zero, but
+// the core ones apply the type's own primitive to operands of one type, which
+// gives the same type if it does not raise.
+Type binary_type(Op op, Type x, Type y) noexcept {
+    if (x != y || (x != Type::INT64 && x != Type::FLOAT64))
+        return Type::ANY;
+    return is_compare(op) ? Type::BOOL : x;
+}
+
+// Type of values with a TID.
+Type tid_type(std::uint32_t tid) noexcept {
+    switch (static_cast<BuiltinTypeID>(tid)) {
+    case BuiltinTypeID::BOOL:
+        return Type::BOOL;
+    case BuiltinTypeID::INT64:
+        return Type::INT64;
+    case BuiltinTypeID::FLOAT64:
+        return Type::FLOAT64;
+    default:
+        return Type::ANY;
+    }
+}
+
+Type const_type(Any k) noexcept {
+    return tid_type(k.tid);
+}
+
+Type join(Type x, Type y) noexcept {
+    return x == y ? x : Type::ANY;
+}
+
+struct Function {
+    std::vector<Inst> insts;
+    // The entry block is the first.
+    std::vector<Block> blocks;
+    std::uint32_t nparams = 0;
+
+    std::vector<Frame> frames = {Frame{0, 0, 0}};
+    // Frame new instructions are in.
+    std::uint32_t frame = 0;
+
+    // Constants by TID and bits, so that each is one value.
+    std::map<std::pair<std::uint32_t, std::uint64_t>, Value> consts;
+
+    // Whether calling a constant type with no arguments only makes an object
+    // with its fields zeroed, for `sra`. Unset if that is not known of any.
+    std::function<bool(Any)> plain_type;
+
+    std::uint32_t new_block() {
+        blocks.emplace_back();
+        return static_cast<std::uint32_t>(blocks.size() - 1);
+    }
+
+    // Append an instruction to a block, or insert it before the terminator
+    // of one that has it.
+    Value add(std::uint32_t block, Inst inst) {
+        auto v = static_cast<Value>(insts.size());
+        inst.frame = frame;
+        insts.push_back(std::move(inst));
+        insert(block, v);
+        return v;
+    }
+
+    // Put an instruction that is in no block at the end of one, as `add`.
+    void insert(std::uint32_t block, Value v) {
+        insts[v].block = block;
+        insts[v].dead = false;
+        std::vector<Value>& list = blocks[block].insts;
+        if (!list.empty() && is_terminator(insts[list.back()].op))
+            list.insert(list.end() - 1, v);
+        else
+            list.push_back(v);
+    }
+
+    Value add_phi(std::uint32_t block) {
+        auto v = static_cast<Value>(insts.size());
+        insts.push_back(Inst{Op::PHI, Type::ANY, block, {}});
+        std::vector<Value>& list = blocks[block].insts;
+        list.insert(list.begin(), v);
+        return v;
+    }
+
+    Value constant(Any k) {
+        std::uint64_t bits = 0;
+        std::memcpy(&bits, &k.data, sizeof(bits));
+        auto [it, inserted] = consts.emplace(
+            std::make_pair(k.tid, bits), static_cast<Value>(insts.size())
+        );
+        if (inserted)
+            insts.push_back(Inst{Op::CONST, const_type(k), NO_BLOCK, {}, 0, k});
+        return it->second;
+    }
+
+    void edge(std::uint32_t from, std::uint32_t to) {
+        blocks[from].succs.push_back(to);
+        blocks[to].preds.push_back(from);
+    }
+
+    Inst& terminator(std::uint32_t block) {
+        return insts[blocks[block].insts.back()];
+    }
+
+    // Remove one edge from `from` to `to`, with the phi arguments for it.
+    void remove_edge(std::uint32_t from, std::uint32_t to) {
+        std::vector<std::uint32_t>& succs = blocks[from].succs;
+        succs.erase(std::find(succs.begin(), succs.end(), to));
+        std::vector<std::uint32_t>& preds = blocks[to].preds;
+        auto i = std::find(preds.begin(), preds.end(), from) - preds.begin();
+        preds.erase(preds.begin() + i);
+        for (Value v: blocks[to].insts) {
+            if (insts[v].op != Op::PHI)
+                break;
+            insts[v].args.erase(insts[v].args.begin() + i);
+        }
+    }
+
+    void remove(Value v) {
+        Inst& inst = insts[v];
+        std::vector<Value>& list = blocks[inst.block].insts;
+        list.erase(std::find(list.begin(), list.end(), v));
+        inst.dead = true;
+    }
+
+    // Replace every use of each value by the value `map` gives, following
+    // chains of replacements.
+    void substitute(std::vector<Value>& map) {
+        auto find = [&](Value v) {
+            while (map[v] != v)
+                v = map[v] = map[map[v]];
+            return v;
+        };
+        for (Inst& inst: insts) {
+            for (Value& arg: inst.args)
+                arg = find(arg);
+        }
+    }
+
+    // Blocks reachable from the entry, in reverse postorder.
+    std::vector<std::uint32_t> rpo() const {
+        std::vector<std::uint32_t> order;
+        std::vector<bool> seen(blocks.size());
+        // Blocks with the index of the next successor to visit.
+        std::vector<std::pair<std::uint32_t, std::size_t>> stack = {{0, 0}};
+        seen[0] = true;
+        while (!stack.empty()) {
+            auto& [block, next] = stack.back();
+            if (next == blocks[block].succs.size()) {
+                order.push_back(block);
+                stack.pop_back();
+                continue;
+            }
+            std::uint32_t succ = blocks[block].succs[next++];
+            if (!seen[succ]) {
+                seen[succ] = true;
+                stack.emplace_back(succ, 0);
+            }
+        }
+        std::reverse(order.begin(), order.end());
+        return order;
+    }
+
+    // Remove the blocks that cannot be reached from the entry. Returns the
+    // number removed.
+    std::uint32_t remove_unreachable() {
+        std::vector<bool> reachable(blocks.size());
+        for (std::uint32_t block: rpo())
+            reachable[block] = true;
+        std::uint32_t n = 0;
+        for (std::uint32_t b = 0; b < blocks.size(); b++) {
+            if (reachable[b] || blocks[b].dead)
+                continue;
+            while (!blocks[b].succs.empty())
+                remove_edge(b, blocks[b].succs.back());
+            for (Value v: blocks[b].insts)
+                insts[v].dead = true;
+            blocks[b].insts.clear();
+            blocks[b].preds.clear();
+            blocks[b].dead = true;
+            n++;
+        }
+        return n;
+    }
+
+    std::uint32_t live_insts() const {
+        std::uint32_t n = 0;
+        for (const Block& block: blocks)
+            n += static_cast<std::uint32_t>(block.insts.size());
+        return n;
+    }
+};
+
+// Immediate dominator of each block reachable from the entry, by the
+// iterative algorithm of Cooper, Harvey and Kennedy. The entry is its own.
+// Unreachable blocks have `NO_BLOCK`.
+std::vector<std::uint32_t> dominators(
+    const Function& fn, const std::vector<std::uint32_t>& rpo
+) {
+    std::vector<std::uint32_t> order(fn.blocks.size(), NO_BLOCK);
+    for (std::uint32_t i = 0; i < rpo.size(); i++)
+        order[rpo[i]] = i;
+    std::vector<std::uint32_t> idom(fn.blocks.size(), NO_BLOCK);
+    idom[0] = 0;
+    auto intersect = [&](std::uint32_t x, std::uint32_t y) {
+        while (x != y) {
+            while (order[x] > order[y])
+                x = idom[x];
+            while (order[y] > order[x])
+                y = idom[y];
+        }
+        return x;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (std::uint32_t i = 1; i < rpo.size(); i++) {
+            std::uint32_t block = rpo[i];
+            std::uint32_t dom = NO_BLOCK;
+            for (std::uint32_t pred: fn.blocks[block].preds) {
+                if (idom[pred] == NO_BLOCK)
+                    continue;
+                dom = dom == NO_BLOCK ? pred : intersect(pred, dom);
+            }
+            if (idom[block] != dom) {
+                idom[block] = dom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+bool dominates(
+    const std::vector<std::uint32_t>& idom, std::uint32_t x, std::uint32_t y
+) {
+    while (y != x && y != 0)
+        y = idom[y];
+    return y == x;
+}
+
+// Blocks of the natural loop of a back edge, an edge to a block that
+// dominates its source.
+struct Loop {
+    std::uint32_t head;
+    std::vector<bool> body;
+    std::uint32_t size;
+};
+
+// Natural loops, smallest first, so that inner loops come before the loops
+// around them.
+std::vector<Loop> find_loops(
+    const Function& fn, const std::vector<std::uint32_t>& rpo
+) {
+    std::vector<std::uint32_t> idom = dominators(fn, rpo);
+    std::vector<Loop> loops;
+    for (std::uint32_t block: rpo) {
+        for (std::uint32_t succ: fn.blocks[block].succs) {
+            if (!dominates(idom, succ, block))
+                continue;
+            Loop loop{succ, std::vector<bool>(fn.blocks.size()), 1};
+            loop.body[succ] = true;
+            std::vector<std::uint32_t> work = {block};
+            while (!work.empty()) {
+                std::uint32_t b = work.back();
+                work.pop_back();
+                if (loop.body[b])
+                    continue;
+                loop.body[b] = true;
+                loop.size++;
+                for (std::uint32_t pred: fn.blocks[b].preds)
+                    work.push_back(pred);
+            }
+            loops.push_back(std::move(loop));
+        }
+    }
+    std::stable_sort(
+        loops.begin(), loops.end(),
+        [](const Loop& x, const Loop& y) { return x.size < y.size; }
+    );
+    return loops;
+}
+
+// Types of the phis and of the operators on them, from the types of their
+// arguments, to a fixpoint. They start out as nothing, so that loops do not
+// widen them to `Any` on their own.
+void infer_types(Function& fn) {
+    std::vector<bool> typed(fn.insts.size(), true);
+    for (Value v = 0; v < fn.insts.size(); v++) {
+        const Inst& inst = fn.insts[v];
+        if (!inst.dead && (inst.op == Op::PHI || is_binary(inst.op)))
+            typed[v] = false;
+    }
+    std::vector<std::uint32_t> rpo = fn.rpo();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (std::uint32_t block: rpo) {
+            for (Value v: fn.blocks[block].insts) {
+                Inst& inst = fn.insts[v];
+                Type type = inst.type;
+                bool known = typed[v];
+                if (inst.op == Op::PHI) {
+                    for (Value arg: inst.args) {
+                        if (!typed[arg])
+                            continue;
+                        type = known ? join(type, fn.insts[arg].type) :
+                            fn.insts[arg].type;
+                        known = true;
+                    }
+                } else if (
+                    is_binary(inst.op) && typed[inst.args[0]] &&
+                    typed[inst.args[1]]
+                ) {
+                    type = binary_type(
+                        inst.op, fn.insts[inst.args[0]].type,
+                        fn.insts[inst.args[1]].type
+                    );
+                    known = true;
+                }
+                if (type != inst.type || known != typed[v]) {
+                    inst.type = type;
+                    typed[v] = known;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+// Whether an instruction can be removed, duplicated or moved without changing
+// what a program does: it cannot call anything or raise.
+bool is_pure(const Function& fn, const Inst& inst) noexcept {
+    if (inst.op == Op::CONST || inst.op == Op::PARAM || inst.op == Op::PHI)
+        return true;
+    if (!is_binary(inst.op))
+        return false;
+    Type x = fn.insts[inst.args[0]].type;
+    Type y = fn.insts[inst.args[1]].type;
+    if (x != y)
+        return false;
+    return x == Type::FLOAT64 || (x == Type::INT64 && is_compare(inst.op));
+}
+
+void dump_value(std::ostream& os, const Function& fn, Value v) {
+    if (fn.insts[v].op != Op::CONST) {
+        os << 'v' << v;
+        return;
+    }
+    Any k = fn.insts[v].k;
+    switch (static_cast<BuiltinTypeID>(k.tid)) {
+    case BuiltinTypeID::NONE_TYPE:
+        os << "none";
+        return;
+    case BuiltinTypeID::BOOL:
+        os << (coreutil::unwrap<bool>(k) ? "true" : "false");
+        return;
+    case BuiltinTypeID::INT64:
+        os << coreutil::unwrap<std::int64_t>(k);
+        return;
+    case BuiltinTypeID::FLOAT64: {
+        char buf[32];
+        std::snprintf(
+            buf, sizeof(buf), "%.17gf64", coreutil::unwrap<double>(k)
+        );
+        os << buf;
+        return;
+    }
+    default:
+        os << "const<" << k.tid << '>';
+        return;
+    }
+}
+
+// Write a function out one block per paragraph, in reverse postorder:
+//
+//     b1: ; preds b0, b2
+//         v4: int64 = phi 0, v9
+//         v5: bool = lt v4, v1
+//         branch v5, b2, b3
+//
+// Constants are written in place, as literals, and instructions inlined from
+// another function end with a comment naming it.
+void dump(std::ostream& os, const Function& fn, const SymbolTable& symbols) {
+    for (std::uint32_t b: fn.rpo()) {
+        const Block& block = fn.blocks[b];
+        os << 'b' << b << ':';
+        for (std::size_t i = 0; i < block.preds.size(); i++)
+            os << (i == 0 ? " ; preds b" : ", b") << block.preds[i];
+        os << '\n';
+        for (Value v: block.insts) {
+            const Inst& inst = fn.insts[v];
+            os << "    ";
+            if (!is_terminator(inst.op)) {
+                os << 'v' << v << ": " <<
+                    TYPE_NAMES[static_cast<int>(inst.type)] << " = ";
+            }
+            os << OP_NAMES[static_cast<int>(inst.op)];
+            const char* sep = " ";
+            if (inst.op == Op::PARAM)
+                os << ' ' << inst.index;
+            for (Value arg: inst.args) {
+                os << sep;
+                dump_value(os, fn, arg);
+                sep = ", ";
+            }
+            if (inst.op == Op::GET_ATTR)
+                os << ", ." << symbols.names[inst.index];
+            for (std::uint32_t succ: block.succs) {
+                if (
+                    inst.op != Op::BRANCH && inst.op != Op::JUMP &&
+                    inst.op != Op::SWITCH
+                )
+                    break;
+                os << sep << 'b' << succ;
+                sep = ", ";
+            }
+            if (inst.frame != 0)
+                os << " ; in " << symbols.names[fn.frames[inst.frame].name];
+            os << '\n';
+        }
+        os << '\n';
+    }
+}
+
+}
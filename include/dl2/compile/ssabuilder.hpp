@@ -0,0 +1,783 @@
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "dl/compile/literal.hpp"
+#include "dl/compile/nodeerr.hpp"
+#include "dl/compile/ssa.hpp"
+#include "dl/compile/switchcases.hpp"
+#include "dl/compile/symboltable.hpp"
+#include "dl/err.hpp"
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpretnode/def.hpp"
+#include "dl/parse/opid.hpp"
+#include "dl/process/node.hpp"
+#include "dl/process/opinfo.hpp"
+#include "dl/process/opkind.hpp"
+
+namespace dl::ssa {
+
+// Body of a `Def`, which calls to it can be replaced with.
+struct Inlinable {
+    Symbol name;
+    const Node* body;
+    std::vector<std::string> params;
+};
+
+// Nodes in a tree, as a measure of the code it compiles to.
+std::uint32_t node_size(const Node& node) {
+    switch (opinfo(node.op).kind) {
+    case OpKind::UNARY:
+        return 1 + node_size(*node.node);
+    case OpKind::BINARY:
+        return 1 + node_size(node.bin->lhs) + node_size(node.bin->rhs);
+    case OpKind::BLOCK: {
+        std::uint32_t size = 1;
+        for (const Node& child: node.nodes)
+            size += node_size(child);
+        return size;
+    }
+    default:
+        return 1;
+    }
+}
+
+// Lowers the processed statements of a function body to SSA form. It takes
+// the node shapes `RegCompiler` does, with the same meaning.
+//
+// Phis are placed while lowering, by the algorithm of Braun et al.: reading a
+// variable looks for its definition back through the predecessors of the
+// current block, adding a phi where they merge. A block whose predecessors
+// are not all known yet, like a loop header, gets incomplete phis that are
+// filled in once it is sealed. Phis that turn out to pick the same value
+// everywhere are replaced by it.
+//
+// Calls to a `Def` known when compiling, whose body is small, are replaced by
+// the body, in a frame of its own that records the call for dumps.
+// Calls to anything else, including a variable that may hold one of several
+// `Def`s, stay calls, as do calls that would recurse.
+struct Builder {
+    // Most nodes in the body of a `Def` to inline, and in all of them.
+    static constexpr std::uint32_t MAX_INLINE_SIZE = 40;
+    static constexpr std::uint32_t INLINE_BUDGET = 400;
+
+    SymbolTable& symbols;
+    Function fn;
+
+    // Block instructions are being added to.
+    std::uint32_t current = 0;
+
+    // Value of each variable at the end of each block, where it was assigned
+    // or looked up.
+    std::vector<std::unordered_map<std::string, Value>> defs;
+    std::vector<bool> sealed;
+    std::vector<std::vector<std::pair<std::string, Value>>> incomplete;
+
+    // Variables assigned so far, which are the ones that may be read.
+    std::unordered_set<std::string> known;
+
+    // Types of the parameters, if known, such as when specializing. Those
+    // left out are `Any`. The code must only run with arguments of them.
+    std::vector<Type> param_types;
+
+    // Names bound to values that do not change while the body runs, such as
+    // the `Def`s of the module, read as constants where no variable has the
+    // name.
+    const std::unordered_map<std::string, Any>* constants = nullptr;
+
+    // Each binding of constants read, and the value it had, so that code built
+    // can check it still has it before running. Includes the callees inlined.
+    std::vector<std::pair<const Any*, Any>> constants_read;
+
+    // Bodies of the `Def`s calls to which may be inlined, by their code.
+    const std::unordered_map<const Any*, Inlinable>* inlinable = nullptr;
+
+    // Bodies being inlined, innermost last, starting with the one being
+    // compiled if it is one, so that none is inlined into itself.
+    std::vector<const Inlinable*> inlining;
+
+    // Prefix of the names of the variables of the frame being lowered, so
+    // that those of each inlined call are distinct.
+    std::string scope;
+
+    // Nodes inlined so far, and whether each body inlined lowers at all.
+    std::uint32_t inlined_size = 0;
+    std::unordered_map<const Inlinable*, bool> lowerable;
+
+    Builder(SymbolTable& symbols) noexcept: symbols(symbols) {}
+
+    // Lower body into `fn`. The parameters are the first values.
+    ErrPtr build(const Node& body, const std::vector<std::string>& params) {
+        current = new_block(true);
+        for (const std::string& param: params) {
+            Type type = fn.nparams < param_types.size() ?
+                param_types[fn.nparams] : Type::ANY;
+            Value v = fn.add(
+                current, Inst{Op::PARAM, type, 0, {}, fn.nparams++}
+            );
+            write(param, current, v);
+            known.insert(param);
+        }
+        if (ErrPtr err = stmt(body))
+            return err;
+        terminate(Op::RETURN, {fn.constant(coreutil::NONE)});
+        fn.remove_unreachable();
+        infer_types(fn);
+        return nullptr;
+    }
+
+    std::uint32_t new_block(bool seal) {
+        std::uint32_t block = fn.new_block();
+        defs.emplace_back();
+        sealed.push_back(seal);
+        incomplete.emplace_back();
+        return block;
+    }
+
+    void terminate(Op op, std::vector<Value> args) {
+        fn.add(current, Inst{op, Type::ANY, 0, std::move(args)});
+    }
+
+    void jump(std::uint32_t to) {
+        terminate(Op::JUMP, {});
+        fn.edge(current, to);
+    }
+
+    void write(const std::string& name, std::uint32_t block, Value v) {
+        defs[block][name] = v;
+    }
+
+    Value read(const std::string& name, std::uint32_t block) {
+        auto it = defs[block].find(name);
+        if (it != defs[block].end())
+            return it->second;
+        Value v;
+        const std::vector<std::uint32_t>& preds = fn.blocks[block].preds;
+        if (!sealed[block]) {
+            v = fn.add_phi(block);
+            incomplete[block].emplace_back(name, v);
+        } else if (preds.size() == 1)
+            v = read(name, preds[0]);
+        else if (preds.empty()) {
+            // Not assigned on this path: the slot still holds `None`.
+            v = fn.constant(coreutil::NONE);
+        } else {
+            // The phi breaks cycles through loops.
+            v = fn.add_phi(block);
+            write(name, block, v);
+            v = add_phi_args(name, v);
+        }
+        write(name, block, v);
+        return v;
+    }
+
+    Value add_phi_args(const std::string& name, Value phi) {
+        std::uint32_t block = fn.insts[phi].block;
+        for (std::uint32_t pred: fn.blocks[block].preds) {
+            Value arg = read(name, pred);
+            fn.insts[phi].args.push_back(arg);
+        }
+        return remove_trivial_phi(phi);
+    }
+
+    // A phi of only itself and one other value is that value.
+    Value remove_trivial_phi(Value phi) {
+        Value same = phi;
+        for (Value arg: fn.insts[phi].args) {
+            if (arg == same || arg == phi)
+                continue;
+            if (same != phi)
+                return phi;
+            same = arg;
+        }
+        if (same == phi)
+            same = fn.constant(coreutil::NONE);
+        fn.remove(phi);
+        std::vector<Value> users;
+        for (Value v = 0; v < fn.insts.size(); v++) {
+            Inst& inst = fn.insts[v];
+            bool uses = false;
+            for (Value& arg: inst.args) {
+                if (arg == phi) {
+                    arg = same;
+                    uses = true;
+                }
+            }
+            if (uses && inst.op == Op::PHI && !inst.dead && v != phi)
+                users.push_back(v);
+        }
+        for (auto& block: defs) {
+            for (auto& [name, v]: block) {
+                if (v == phi)
+                    v = same;
+            }
+        }
+        for (auto& block: incomplete) {
+            for (auto& [name, v]: block) {
+                if (v == phi)
+                    v = same;
+            }
+        }
+        for (Value user: users) {
+            if (!fn.insts[user].dead)
+                remove_trivial_phi(user);
+        }
+        return same;
+    }
+
+    // All predecessors of block are known: fill in its incomplete phis.
+    void seal(std::uint32_t block) {
+        sealed[block] = true;
+        auto phis = std::move(incomplete[block]);
+        for (auto& [name, phi]: phis) {
+            if (fn.insts[phi].op == Op::PHI && !fn.insts[phi].dead)
+                add_phi_args(name, phi);
+        }
+    }
+
+    ErrPtr stmt(const Node& node) {
+        using enum OpID;
+        switch (node.op) {
+        case BLOCK:
+            return block(node.nodes);
+        case IF:
+        case ELIF:
+        case ELSE: {
+            auto nodes = std::vector<const Node*>{&node};
+            return if_chain(nodes);
+        }
+        case MATCH: {
+            auto nodes = std::vector<const Node*>{&node};
+            return match_chain(nodes);
+        }
+        case FOR:
+            return for_loop(*node.node);
+        case RAISE: {
+            Value v;
+            if (ErrPtr err = expr(*node.node, v))
+                return err;
+            terminate(Op::RAISE, {v});
+            // Whatever follows is unreachable.
+            current = new_block(true);
+            return nullptr;
+        }
+        case SET: {
+            const Node& lhs = node.bin->lhs;
+            if (lhs.op != ALNUM || is_numeric_literal(lhs.str))
+                return ErrPtr(new UnsupportedNodeErr(lhs.op));
+            Value v;
+            if (ErrPtr err = expr(node.bin->rhs, v))
+                return err;
+            write(scope + lhs.str, current, v);
+            known.insert(scope + lhs.str);
+            return nullptr;
+        }
+        default: {
+            Value v;
+            return expr(node, v);
+        }
+        }
+    }
+
+    ErrPtr block(const std::vector<Node>& nodes) {
+        for (std::size_t i = 0; i < nodes.size(); i++) {
+            OpID first = nodes[i].op;
+            if (first != OpID::IF && first != OpID::MATCH) {
+                if (ErrPtr err = stmt(nodes[i]))
+                    return err;
+                continue;
+            }
+            OpID middle = first == OpID::IF ? OpID::ELIF : OpID::CASE;
+            auto chain = std::vector<const Node*>{&nodes[i]};
+            while (
+                i + 1 < nodes.size() && chain.back()->op != OpID::ELSE && (
+                    nodes[i + 1].op == middle || nodes[i + 1].op == OpID::ELSE
+                )
+            )
+                chain.push_back(&nodes[++i]);
+            ErrPtr err = first == OpID::IF ?
+                if_chain(chain) : match_chain(chain);
+            if (err)
+                return err;
+        }
+        return nullptr;
+    }
+
+    ErrPtr if_chain(const std::vector<const Node*>& chain) {
+        std::string name;
+        std::vector<SwitchArm> arms;
+        std::size_t n = if_arms(chain, name, arms);
+        if (n >= MIN_SWITCH_ARMS) {
+            Value subject;
+            if (ErrPtr err = expr(chain[0]->node->bin->lhs.bin->lhs, subject))
+                return err;
+            auto rest =
+                std::vector<const Node*>(chain.begin() + n, chain.end());
+            return switch_chain(subject, arms, rest);
+        }
+        std::uint32_t join = new_block(false);
+        for (const Node* branch: chain) {
+            if (branch->op == OpID::ELSE) {
+                if (ErrPtr err = stmt(*branch->node))
+                    return err;
+                jump(join);
+                seal(join);
+                current = join;
+                return nullptr;
+            }
+            const Node& pred = *branch->node;
+            if (opinfo(pred.op).kind != OpKind::BINARY)
+                return ErrPtr(new UnsupportedNodeErr(pred.op));
+            Value cond;
+            if (ErrPtr err = expr(pred.bin->lhs, cond))
+                return err;
+            std::uint32_t then = new_block(false);
+            std::uint32_t next = new_block(false);
+            terminate(Op::BRANCH, {cond});
+            fn.edge(current, then);
+            fn.edge(current, next);
+            seal(then);
+            seal(next);
+            current = then;
+            if (ErrPtr err = stmt(pred.bin->rhs))
+                return err;
+            jump(join);
+            current = next;
+        }
+        jump(join);
+        seal(join);
+        current = join;
+        return nullptr;
+    }
+
+    // A match whose keys are not all literals compares them in turn, as a
+    // chain of branches.
+    ErrPtr match_chain(const std::vector<const Node*>& chain) {
+        Value subject;
+        if (ErrPtr err = expr(*chain[0]->node, subject))
+            return err;
+        std::vector<const Node*> rest;
+        if (chain.back()->op == OpID::ELSE)
+            rest.push_back(chain.back());
+        std::vector<SwitchArm> arms;
+        if (match_arms(chain, arms))
+            return switch_chain(subject, arms, rest);
+
+        std::uint32_t join = new_block(false);
+        for (std::size_t i = 1; i < chain.size(); i++) {
+            if (chain[i]->op != OpID::CASE)
+                break;
+            const Node& pred = *chain[i]->node;
+            if (opinfo(pred.op).kind != OpKind::BINARY)
+                return ErrPtr(new UnsupportedNodeErr(pred.op));
+            std::uint32_t then = new_block(false);
+            for (const Node* value: case_values(pred.bin->lhs)) {
+                Value key;
+                if (ErrPtr err = expr(*value, key))
+                    return err;
+                Value cond = binary(Op::EQ, subject, key);
+                std::uint32_t next = new_block(false);
+                terminate(Op::BRANCH, {cond});
+                fn.edge(current, then);
+                fn.edge(current, next);
+                seal(next);
+                current = next;
+            }
+            std::uint32_t miss = current;
+            seal(then);
+            current = then;
+            if (ErrPtr err = stmt(pred.bin->rhs))
+                return err;
+            jump(join);
+            current = miss;
+        }
+        if (!rest.empty()) {
+            if (ErrPtr err = stmt(*rest[0]->node))
+                return err;
+        }
+        jump(join);
+        seal(join);
+        current = join;
+        return nullptr;
+    }
+
+    // Go to the first arm with a key equal to subject, or to the rest of the
+    // chain if none has one. Every key gets an edge of its own, so the other
+    // keys of an arm go through a block that only jumps to its body.
+    ErrPtr switch_chain(
+        Value subject, const std::vector<SwitchArm>& arms,
+        const std::vector<const Node*>& rest
+    ) {
+        std::uint32_t from = current;
+        std::vector<Value> args = {subject};
+        for (const SwitchArm& arm: arms) {
+            for (std::int64_t key: arm.keys)
+                args.push_back(fn.constant(coreutil::wrap(key)));
+        }
+        terminate(Op::SWITCH, std::move(args));
+        std::vector<std::uint32_t> bodies;
+        for (const SwitchArm& arm: arms) {
+            std::uint32_t body = new_block(false);
+            bodies.push_back(body);
+            fn.edge(from, body);
+            for (std::size_t i = 1; i < arm.keys.size(); i++) {
+                std::uint32_t via = new_block(false);
+                fn.edge(from, via);
+                seal(via);
+                current = via;
+                jump(body);
+            }
+            seal(body);
+        }
+        std::uint32_t otherwise = new_block(false);
+        fn.edge(from, otherwise);
+        seal(otherwise);
+
+        std::uint32_t join = new_block(false);
+        for (std::size_t i = 0; i < arms.size(); i++) {
+            current = bodies[i];
+            if (ErrPtr err = stmt(*arms[i].body))
+                return err;
+            jump(join);
+        }
+        current = otherwise;
+        if (!rest.empty()) {
+            if (ErrPtr err = if_chain(rest))
+                return err;
+        }
+        jump(join);
+        seal(join);
+        current = join;
+        return nullptr;
+    }
+
+    ErrPtr for_loop(const Node& node) {
+        if (opinfo(node.op).kind != OpKind::BINARY)
+            return ErrPtr(new UnsupportedNodeErr(node.op));
+        const Node& pred = node.bin->lhs;
+        const Node& body = node.bin->rhs;
+        switch (pred.op) {
+        case OpID::FROM:
+        case OpID::TO:
+        case OpID::BY:
+            return range_loop(pred, body);
+        case OpID::IN:
+            return ErrPtr(new UnsupportedNodeErr(pred.op));
+        default:
+            break;
+        }
+        std::uint32_t head = enter_loop();
+        Value cond;
+        if (ErrPtr err = expr(pred, cond))
+            return err;
+        return loop_body(head, cond, body, nullptr, 0);
+    }
+
+    // The block before a loop only jumps to its header, so that invariants
+    // have somewhere to be hoisted to.
+    std::uint32_t enter_loop() {
+        std::uint32_t head = new_block(false);
+        jump(head);
+        current = head;
+        return head;
+    }
+
+    // Branch on cond from the header to body and the exit, then run the
+    // body, and the increment of a range loop, and go back to the header.
+    ErrPtr loop_body(
+        std::uint32_t head, Value cond, const Node& body,
+        const std::string* counter, Value step
+    ) {
+        std::uint32_t inner = new_block(false);
+        std::uint32_t exit = new_block(false);
+        terminate(Op::BRANCH, {cond});
+        fn.edge(current, inner);
+        fn.edge(current, exit);
+        seal(inner);
+        seal(exit);
+        current = inner;
+        if (ErrPtr err = stmt(body))
+            return err;
+        if (counter != nullptr) {
+            Value i = read(*counter, current);
+            write(*counter, current, binary(Op::ADD, i, step));
+        }
+        jump(head);
+        seal(head);
+        current = exit;
+        return nullptr;
+    }
+
+    void range_parts(
+        const Node& node, OpID op,
+        std::vector<std::pair<OpID, const Node*>>& parts
+    ) {
+        using enum OpID;
+        if (node.op == FROM || node.op == TO || node.op == BY) {
+            range_parts(node.bin->lhs, op, parts);
+            range_parts(node.bin->rhs, node.op, parts);
+        } else
+            parts.emplace_back(op, &node);
+    }
+
+    ErrPtr step_literal(const Node& node, Any& step, bool& down) {
+        bool neg = node.op == OpID::NEG;
+        const Node& lit = neg ? *node.node : node;
+        if (lit.op != OpID::ALNUM || !is_numeric_literal(lit.str))
+            return ErrPtr(new UnsupportedNodeErr(lit.op));
+        if (ErrPtr err = parse_literal(lit.str, step))
+            return err;
+        if (step.tid == static_cast<std::uint32_t>(BuiltinTypeID::INT64)) {
+            auto k = coreutil::unwrap<std::int64_t>(step);
+            step = coreutil::wrap(neg ? -k : k);
+        } else if (
+            step.tid == static_cast<std::uint32_t>(BuiltinTypeID::FLOAT64)
+        ) {
+            auto k = coreutil::unwrap<double>(step);
+            step = coreutil::wrap(neg ? -k : k);
+        } else
+            return ErrPtr(new UnsupportedNodeErr(lit.op));
+        down = neg;
+        return nullptr;
+    }
+
+    ErrPtr range_loop(const Node& pred, const Node& body) {
+        using enum OpID;
+        std::vector<std::pair<OpID, const Node*>> parts;
+        range_parts(pred, FOR, parts);
+        const Node* from = nullptr;
+        const Node* to = nullptr;
+        const Node* by = nullptr;
+        for (std::size_t i = 1; i < parts.size(); i++) {
+            const Node*& part = parts[i].first == FROM ? from :
+                parts[i].first == TO ? to : by;
+            if (part != nullptr)
+                return ErrPtr(new UnsupportedNodeErr(parts[i].first));
+            part = parts[i].second;
+        }
+        const Node& name = *parts[0].second;
+        if (name.op != ALNUM || is_numeric_literal(name.str))
+            return ErrPtr(new UnsupportedNodeErr(name.op));
+        if (to == nullptr)
+            return ErrPtr(new UnsupportedNodeErr(pred.op));
+
+        Any step = coreutil::wrap(std::int64_t(1));
+        bool down = false;
+        if (by != nullptr) {
+            if (ErrPtr err = step_literal(*by, step, down))
+                return err;
+        }
+        Value start;
+        if (from != nullptr) {
+            if (ErrPtr err = expr(*from, start))
+                return err;
+        } else {
+            bool real =
+                step.tid == static_cast<std::uint32_t>(BuiltinTypeID::FLOAT64);
+            start = fn.constant(
+                real ? coreutil::wrap(0.0) : coreutil::wrap(std::int64_t(0))
+            );
+        }
+        std::string counter = scope + name.str;
+        write(counter, current, start);
+        known.insert(counter);
+        Value limit;
+        if (ErrPtr err = expr(*to, limit))
+            return err;
+
+        std::uint32_t head = enter_loop();
+        Value i = read(counter, current);
+        Value cond = binary(down ? Op::GT : Op::LT, i, limit);
+        return loop_body(head, cond, body, &counter, fn.constant(step));
+    }
+
+    Value binary(Op op, Value x, Value y) {
+        Type type = binary_type(op, fn.insts[x].type, fn.insts[y].type);
+        return fn.add(current, Inst{op, type, 0, {x, y}});
+    }
+
+    ErrPtr expr(const Node& node, Value& v) {
+        using enum OpID;
+        switch (node.op) {
+        case ALNUM: {
+            if (is_numeric_literal(node.str)) {
+                Any value;
+                if (ErrPtr err = parse_literal(node.str, value))
+                    return err;
+                v = fn.constant(value);
+                return nullptr;
+            }
+            if (std::string name = scope + node.str; known.contains(name)) {
+                v = read(name, current);
+                return nullptr;
+            }
+            if (constants != nullptr) {
+                auto it = constants->find(node.str);
+                if (it != constants->end()) {
+                    read_constant(it->second);
+                    v = fn.constant(it->second);
+                    return nullptr;
+                }
+            }
+            return ErrPtr(new UnknownVarErr(node.str));
+        }
+        case TRUE:
+            v = fn.constant(coreutil::wrap(true));
+            return nullptr;
+        case FALSE:
+            v = fn.constant(coreutil::wrap(false));
+            return nullptr;
+        case NONE:
+            v = fn.constant(coreutil::NONE);
+            return nullptr;
+        case GROUP:
+            return expr(*node.node, v);
+        case CALL:
+            return call(node, v);
+        case GET: {
+            const Node& name = node.bin->rhs;
+            if (name.op != ALNUM || is_numeric_literal(name.str))
+                return ErrPtr(new UnsupportedNodeErr(name.op));
+            Value obj;
+            if (ErrPtr err = expr(node.bin->lhs, obj))
+                return err;
+            v = fn.add(current, Inst{
+                Op::GET_ATTR, Type::ANY, 0, {obj}, symbols.intern(name.str)
+            });
+            return nullptr;
+        }
+        default:
+            break;
+        }
+        constexpr std::pair<OpID, Op> OPS[] = {
+            {ADD, Op::ADD},
+            {SUB, Op::SUB},
+            {MUL, Op::MUL},
+            {DIV, Op::DIV},
+            {MOD, Op::MOD},
+            {EQ, Op::EQ},
+            {NEQ, Op::NEQ},
+            {LT, Op::LT},
+            {LTE, Op::LTE},
+            {GT, Op::GT},
+            {GTE, Op::GTE}
+        };
+        for (auto [from, to]: OPS) {
+            if (from != node.op)
+                continue;
+            Value x;
+            Value y;
+            if (ErrPtr err = expr(node.bin->lhs, x))
+                return err;
+            if (ErrPtr err = expr(node.bin->rhs, y))
+                return err;
+            v = binary(to, x, y);
+            return nullptr;
+        }
+        return ErrPtr(new UnsupportedNodeErr(node.op));
+    }
+
+    ErrPtr call(const Node& node, Value& v) {
+        std::vector<const Node*> parts = {&node.bin->lhs};
+        const Node* rest = &node.bin->rhs;
+        if (rest->op == OpID::GROUP)
+            rest = rest->node;
+        while (rest->op == OpID::SEP) {
+            parts.push_back(&rest->bin->lhs);
+            rest = &rest->bin->rhs;
+        }
+        parts.push_back(rest);
+        std::vector<Value> args;
+        for (const Node* part: parts) {
+            Value arg;
+            if (ErrPtr err = expr(*part, arg))
+                return err;
+            args.push_back(arg);
+        }
+        if (const Inlinable* callee = inline_target(args)) {
+            inline_call(*callee, args, node.src_id);
+            v = fn.constant(coreutil::NONE);
+            return nullptr;
+        }
+        v = fn.add(current, Inst{Op::CALL, Type::ANY, 0, std::move(args)});
+        return nullptr;
+    }
+
+    // Add binding to `constants_read`, unless it is there already.
+    void read_constant(const Any& binding) {
+        for (auto& [read, value]: constants_read) {
+            if (read == &binding)
+                return;
+        }
+        constants_read.emplace_back(&binding, binding);
+    }
+
+    // The body to replace a call with, if the callee is a known `Def` taking
+    // that many arguments, small enough, not being inlined already, and made
+    // only of what lowers.
+    const Inlinable* inline_target(const std::vector<Value>& args) {
+        const Inst& callee = fn.insts[args[0]];
+        auto def_tid = static_cast<std::uint32_t>(BuiltinTypeID::DEF);
+        if (
+            inlinable == nullptr || callee.op != Op::CONST ||
+            callee.k.tid != def_tid
+        )
+            return nullptr;
+        Any k = callee.k;
+        auto it = inlinable->find(coreutil::unwrap<Def>(k).code);
+        if (it == inlinable->end())
+            return nullptr;
+        const Inlinable& body = it->second;
+        std::uint32_t size = node_size(*body.body);
+        if (
+            body.params.size() != args.size() - 1 || size > MAX_INLINE_SIZE ||
+            inlined_size + size > INLINE_BUDGET ||
+            std::find(inlining.begin(), inlining.end(), &body) !=
+                inlining.end()
+        )
+            return nullptr;
+        auto [lowers, inserted] = lowerable.emplace(&body, false);
+        if (inserted) {
+            Builder probe(symbols);
+            probe.constants = constants;
+            lowers->second = probe.build(*body.body, body.params) == nullptr;
+        }
+        return lowers->second ? &body : nullptr;
+    }
+
+    // Lower the body of callee in place of a call to it, with its parameters
+    // as variables set to the arguments. It cannot return a value, so the
+    // call's is `None`.
+    void inline_call(
+        const Inlinable& callee, const std::vector<Value>& args,
+        std::uint64_t src_id
+    ) {
+        inlined_size += node_size(*callee.body);
+        std::uint32_t caller = fn.frame;
+        fn.frames.push_back(Frame{caller, callee.name, src_id});
+        fn.frame = static_cast<std::uint32_t>(fn.frames.size() - 1);
+        std::string saved = std::move(scope);
+        scope = '\x01' + std::to_string(fn.frame) + '.';
+        inlining.push_back(&callee);
+        for (std::size_t i = 0; i < callee.params.size(); i++) {
+            write(scope + callee.params[i], current, args[i + 1]);
+            known.insert(scope + callee.params[i]);
+        }
+        // It lowered on its own, so it does here.
+        stmt(*callee.body);
+        inlining.pop_back();
+        scope = std::move(saved);
+        fn.frame = caller;
+    }
+};
+
+}
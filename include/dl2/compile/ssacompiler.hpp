@@ -0,0 +1,655 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include <algorithm>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dl/compile/regcompiler.hpp"
+#include "dl/compile/ssa.hpp"
+#include "dl/compile/ssabuilder.hpp"
+#include "dl/compile/ssapasses.hpp"
+#include "dl/compile/symboltable.hpp"
+#include "dl/err.hpp"
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/regcode.hpp"
+#include "dl/process/node.hpp"
+
+namespace dl {
+
+// Compiles the processed statements of a function body into register code
+// by way of SSA form, which is optimized in between. It takes what
+// `RegCompiler` takes and produces what it does, so that the result runs,
+// quickens, traces and compiles to native code the same way.
+//
+// Out of SSA form, parameters stay in their slots and every other value gets
+// a temporary. Phis become copies at the end of their predecessors, unless
+// the argument can be computed in place, and constants are loaded where they
+// are used, or once at the start if that is in a loop. Temporaries are then
+// allocated by `RegCompiler`, once their intervals cover everywhere they are
+// live.
+struct SsaCompiler {
+    // Most constants read in loops that get a register of their own.
+    static constexpr std::uint32_t MAX_LOOP_CONSTS = 32;
+
+    SymbolTable& symbols;
+
+    // Whether to run the passes of `ssa::optimize`.
+    bool optimize = true;
+
+    // Types of the parameters, if known, and what calls may be inlined, as
+    // for `ssa::Builder`. self is the body being compiled, if it is a `Def`'s.
+    std::vector<ssa::Type> param_types;
+    const std::unordered_map<std::string, Any>* constants = nullptr;
+    const std::unordered_map<const Any*, ssa::Inlinable>* inlinable = nullptr;
+    const ssa::Inlinable* self = nullptr;
+
+    // As `ssa::Function::plain_type`, for scalar replacement.
+    std::function<bool(Any)> plain_type;
+
+    // If set, the SSA form is written to it once lowered and after each pass.
+    std::ostream* dump = nullptr;
+
+    // Time taken by lowering, each pass and emission.
+    std::vector<ssa::PassTiming> timings;
+
+    // Output, valid after a successful `compile`.
+    RegCompiler out;
+
+    // Bindings of constants the output depends on, as
+    // `ssa::Builder::constants_read`.
+    std::vector<std::pair<const Any*, Any>> constants_read;
+
+    // Binary operators in the output, and how many of them have operands of
+    // types proven when compiling, so run typed, without guards.
+    std::uint32_t binary_ops = 0;
+    std::uint32_t typed_ops = 0;
+
+    SsaCompiler(SymbolTable& symbols) noexcept:
+        symbols(symbols), out(symbols) {}
+
+    ErrPtr compile(const Node& body, const std::vector<std::string>& params) {
+        using Clock = std::chrono::steady_clock;
+        using Ms = std::chrono::duration<double, std::milli>;
+
+        auto start = Clock::now();
+        ssa::Builder builder(symbols);
+        builder.param_types = param_types;
+        builder.constants = constants;
+        builder.inlinable = inlinable;
+        if (self != nullptr)
+            builder.inlining.push_back(self);
+        if (ErrPtr err = builder.build(body, params))
+            return err;
+        ssa::Function& fn = builder.fn;
+        std::uint32_t size = fn.live_insts();
+        timings.push_back(ssa::PassTiming{
+            "build", Ms(Clock::now() - start).count(), 0, size, size
+        });
+        if (fn.frames.size() > 1) {
+            auto inlined = static_cast<std::uint32_t>(fn.frames.size() - 1);
+            timings.push_back(
+                ssa::PassTiming{"inline", 0, size, size, inlined}
+            );
+        }
+        if (dump != nullptr) {
+            *dump << "; built\n";
+            ssa::dump(*dump, fn, symbols);
+        }
+        fn.plain_type = plain_type;
+        if (optimize)
+            ssa::optimize(fn, timings, dump, &symbols);
+
+        start = Clock::now();
+        for (const std::string& param: params) {
+            auto slot = static_cast<std::uint32_t>(out.vars.size());
+            out.vars.emplace(param, slot);
+        }
+        Emitter emitter(fn, out);
+        if (ErrPtr err = emitter.emit())
+            return err;
+        constants_read = std::move(builder.constants_read);
+        binary_ops = emitter.binary_ops;
+        typed_ops = emitter.typed_ops;
+        timings.push_back(ssa::PassTiming{
+            "emit", Ms(Clock::now() - start).count(), size, out.here(), 0
+        });
+        return nullptr;
+    }
+
+    RegCode code() {
+        return out.code();
+    }
+
+    struct Emitter {
+        using Value = ssa::Value;
+        using Op = ssa::Op;
+        using VInst = RegCompiler::VInst;
+
+        ssa::Function& fn;
+        RegCompiler& rc;
+
+        // Register of each value, or `ANY_REG` if it has none yet.
+        std::vector<std::uint32_t> regs;
+
+        // Blocks in the order they are laid out, with where each starts.
+        std::vector<std::uint32_t> layout;
+        std::vector<std::uint32_t> starts;
+
+        // Jumps to the start of a block, patched once all are laid out.
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> fixups;
+
+        // Binary operators emitted, and how many of them are typed.
+        std::uint32_t binary_ops = 0;
+        std::uint32_t typed_ops = 0;
+
+        Emitter(ssa::Function& fn, RegCompiler& rc) noexcept: fn(fn), rc(rc) {}
+
+        ErrPtr emit() {
+            split_critical_edges();
+            regs.assign(fn.insts.size(), RegCompiler::ANY_REG);
+            for (Value v = 0; v < fn.insts.size(); v++) {
+                if (fn.insts[v].op == Op::PARAM)
+                    regs[v] = fn.insts[v].index;
+            }
+            coalesce_phis();
+            load_loop_constants();
+            layout = order();
+            starts.assign(fn.blocks.size(), UINT32_MAX);
+            for (std::size_t i = 0; i < layout.size(); i++) {
+                starts[layout[i]] = rc.here();
+                std::uint32_t next = i + 1 < layout.size() ?
+                    layout[i + 1] : ssa::NO_BLOCK;
+                if (ErrPtr err = block(layout[i], next))
+                    return err;
+            }
+            for (auto [at, block]: fixups)
+                rc.vcode[at].b = starts[block];
+            // Switch tables are all this emitter's, with blocks as targets.
+            for (RegCompiler::VSwitch& table: rc.vswitches) {
+                for (std::uint32_t& target: table.targets)
+                    target = starts[target];
+                table.otherwise = starts[table.otherwise];
+            }
+            if (rc.vcode.empty() || rc.vcode.back().op != RegOpcode::END)
+                rc.emit(RegOpcode::END);
+            extend_intervals();
+            return rc.finish();
+        }
+
+        // Copies for the phis of a block are made at the end of each of its
+        // predecessors, which must then have no other successor: an edge
+        // from a branch to a block with phis gets a block of its own.
+        void split_critical_edges() {
+            auto nblocks = static_cast<std::uint32_t>(fn.blocks.size());
+            for (std::uint32_t b = 0; b < nblocks; b++) {
+                if (fn.blocks[b].succs.size() < 2)
+                    continue;
+                for (std::uint32_t& succ: fn.blocks[b].succs) {
+                    const std::vector<Value>& insts = fn.blocks[succ].insts;
+                    if (insts.empty() || fn.insts[insts[0]].op != Op::PHI)
+                        continue;
+                    std::uint32_t mid = fn.new_block();
+                    fn.add(mid, ssa::Inst{Op::JUMP, ssa::Type::ANY, 0, {}});
+                    std::vector<std::uint32_t>& preds = fn.blocks[succ].preds;
+                    *std::find(preds.begin(), preds.end(), b) = mid;
+                    fn.blocks[mid].preds.push_back(b);
+                    fn.blocks[mid].succs.push_back(succ);
+                    succ = mid;
+                }
+            }
+        }
+
+        // A value that is only an argument to one phi, in the predecessor
+        // defining it, can go straight into the phi's register instead of
+        // being copied there, as long as the phi's old value is not read
+        // after it. Only the phi is read past a predecessor with phis after
+        // it, which then has no other successor.
+        void coalesce_phis() {
+            std::vector<std::uint32_t> phi_uses(fn.insts.size());
+            for (const ssa::Block& block: fn.blocks) {
+                for (Value v: block.insts) {
+                    if (fn.insts[v].op != Op::PHI)
+                        break;
+                    for (Value arg: fn.insts[v].args)
+                        phi_uses[arg]++;
+                }
+            }
+            for (const ssa::Block& block: fn.blocks) {
+                if (block.preds.size() < 2)
+                    continue;
+                for (Value phi: block.insts) {
+                    if (fn.insts[phi].op != Op::PHI)
+                        break;
+                    for (std::size_t i = 0; i < block.preds.size(); i++) {
+                        if (can_coalesce(block, i, phi, phi_uses))
+                            regs[fn.insts[phi].args[i]] = reg(phi);
+                    }
+                }
+            }
+        }
+
+        bool can_coalesce(
+            const ssa::Block& block, std::size_t i, Value phi,
+            const std::vector<std::uint32_t>& phi_uses
+        ) {
+            Value arg = fn.insts[phi].args[i];
+            const ssa::Inst& inst = fn.insts[arg];
+            std::uint32_t pred = block.preds[i];
+            if (
+                inst.op == Op::CONST || inst.op == Op::PARAM ||
+                inst.op == Op::PHI || inst.block != pred ||
+                regs[arg] != RegCompiler::ANY_REG || phi_uses[arg] != 1
+            )
+                return false;
+            auto uses_phi = [&](Value v) {
+                const std::vector<Value>& args = fn.insts[v].args;
+                return std::find(args.begin(), args.end(), phi) != args.end();
+            };
+            const std::vector<Value>& insts = fn.blocks[pred].insts;
+            auto after = std::find(insts.begin(), insts.end(), arg) + 1;
+            if (std::any_of(after, insts.end(), uses_phi))
+                return false;
+            // Nor may another phi's copy read it.
+            for (Value v: block.insts) {
+                if (fn.insts[v].op != Op::PHI)
+                    break;
+                if (v != phi && fn.insts[v].args[i] == phi)
+                    return false;
+            }
+            return true;
+        }
+
+        // Constants read in loops are loaded once, up front, rather than on
+        // every iteration, while there are few enough of them.
+        void load_loop_constants() {
+            std::vector<bool> in_loop(fn.blocks.size());
+            for (const ssa::Loop& loop: ssa::find_loops(fn, fn.rpo())) {
+                for (std::size_t b = 0; b < in_loop.size(); b++)
+                    in_loop[b] = in_loop[b] || loop.body[b];
+            }
+            std::uint32_t n = 0;
+            for (std::size_t b = 0; b < fn.blocks.size(); b++) {
+                if (!in_loop[b])
+                    continue;
+                for (Value v: fn.blocks[b].insts) {
+                    const ssa::Inst& inst = fn.insts[v];
+                    if (
+                        inst.op == Op::PHI || inst.op == Op::CALL ||
+                        inst.op == Op::SWITCH
+                    )
+                        continue;
+                    for (Value arg: inst.args) {
+                        const ssa::Inst& k = fn.insts[arg];
+                        if (
+                            k.op != Op::CONST ||
+                            regs[arg] != RegCompiler::ANY_REG ||
+                            n == MAX_LOOP_CONSTS
+                        )
+                            continue;
+                        regs[arg] = rc.new_temps(1);
+                        rc.emit(RegOpcode::LOADK, regs[arg], rc.constant(k.k));
+                        n++;
+                    }
+                }
+            }
+        }
+
+        // Reverse postorder, visiting the last successor first so that the
+        // first, which a branch goes to when true, comes straight after.
+        std::vector<std::uint32_t> order() const {
+            std::vector<std::uint32_t> res;
+            std::vector<bool> seen(fn.blocks.size());
+            std::vector<std::pair<std::uint32_t, std::size_t>> stack = {{0, 0}};
+            seen[0] = true;
+            while (!stack.empty()) {
+                auto& [block, done] = stack.back();
+                const std::vector<std::uint32_t>& succs =
+                    fn.blocks[block].succs;
+                if (done == succs.size()) {
+                    res.push_back(block);
+                    stack.pop_back();
+                    continue;
+                }
+                std::uint32_t succ = succs[succs.size() - 1 - done++];
+                if (!seen[succ]) {
+                    seen[succ] = true;
+                    stack.emplace_back(succ, 0);
+                }
+            }
+            std::reverse(res.begin(), res.end());
+            return res;
+        }
+
+        std::uint32_t reg(Value v) {
+            if (regs[v] == RegCompiler::ANY_REG)
+                regs[v] = rc.new_temps(1);
+            return regs[v];
+        }
+
+        // Register holding an operand, loading it first if it is a constant
+        // that is not loaded already.
+        std::uint32_t operand(Value v) {
+            if (fn.insts[v].op != Op::CONST || regs[v] != RegCompiler::ANY_REG)
+                return reg(v);
+            std::uint32_t dest = rc.new_temps(1);
+            rc.emit(RegOpcode::LOADK, dest, rc.constant(fn.insts[v].k));
+            return dest;
+        }
+
+        void into(std::uint32_t dest, Value v) {
+            if (fn.insts[v].op == Op::CONST)
+                rc.emit(RegOpcode::LOADK, dest, rc.constant(fn.insts[v].k));
+            else if (reg(v) != dest)
+                rc.emit(RegOpcode::MOVE, dest, reg(v));
+        }
+
+        ErrPtr block(std::uint32_t b, std::uint32_t next) {
+            for (Value v: fn.blocks[b].insts) {
+                if (ErrPtr err = inst(b, v, next))
+                    return err;
+            }
+            return nullptr;
+        }
+
+        ErrPtr inst(std::uint32_t b, Value v, std::uint32_t next) {
+            const ssa::Inst& inst = fn.insts[v];
+            const std::vector<std::uint32_t>& succs = fn.blocks[b].succs;
+            if (ssa::is_binary(inst.op)) {
+                RegOpcode first = typed(inst);
+                binary_ops++;
+                typed_ops += first != RegOpcode::ADD;
+                auto op = static_cast<RegOpcode>(
+                    static_cast<int>(first) +
+                    static_cast<int>(inst.op) - static_cast<int>(Op::ADD)
+                );
+                std::uint32_t x = operand(inst.args[0]);
+                std::uint32_t y = operand(inst.args[1]);
+                rc.emit(op, reg(v), x, y);
+                return nullptr;
+            }
+            switch (inst.op) {
+            case Op::CONST:
+            case Op::PARAM:
+            case Op::PHI:
+                return nullptr;
+            case Op::CALL: {
+                auto nargs = static_cast<std::uint32_t>(inst.args.size() - 1);
+                std::uint32_t group = rc.new_temps(nargs + 1);
+                for (std::uint32_t i = 0; i <= nargs; i++)
+                    into(group + i, inst.args[i]);
+                rc.emit(RegOpcode::CALL, reg(v), group, nargs);
+                return nullptr;
+            }
+            case Op::GET_ATTR: {
+                if (rc.attr_caches.size() == MAX_REG_SLOTS)
+                    return ErrPtr(new CodeTooLargeErr());
+                rc.attr_caches.push_back(AttrCache{inst.index, 0, 0, 0});
+                std::uint32_t obj = operand(inst.args[0]);
+                rc.emit(
+                    RegOpcode::GET_ATTR, reg(v), obj,
+                    static_cast<std::uint32_t>(rc.attr_caches.size() - 1)
+                );
+                return nullptr;
+            }
+            case Op::BRANCH: {
+                std::uint32_t cond = operand(inst.args[0]);
+                fixups.emplace_back(rc.emit(RegOpcode::BRANCH, cond), succs[1]);
+                if (succs[0] == next)
+                    return nullptr;
+                return jump(succs[0]);
+            }
+            case Op::JUMP:
+                phi_copies(b, succs[0]);
+                if (succs[0] == next)
+                    return nullptr;
+                return jump(succs[0]);
+            case Op::SWITCH: {
+                // The successors have no phis, with critical edges split.
+                if (rc.vswitches.size() > MAX_REG_BX)
+                    return ErrPtr(new CodeTooLargeErr());
+                auto index = static_cast<std::uint32_t>(rc.vswitches.size());
+                RegCompiler::VSwitch& table = rc.vswitches.emplace_back();
+                for (std::size_t i = 1; i < inst.args.size(); i++) {
+                    table.keys.push_back(coreutil::unwrap<std::int64_t>(
+                        fn.insts[inst.args[i]].k
+                    ));
+                    table.targets.push_back(succs[i - 1]);
+                }
+                table.otherwise = succs.back();
+                rc.emit(RegOpcode::SWITCH, operand(inst.args[0]), index);
+                return nullptr;
+            }
+            case Op::RAISE:
+                rc.emit(RegOpcode::RAISE, operand(inst.args[0]));
+                return nullptr;
+            case Op::RETURN: {
+                // `END` returns `None`, but only as the last instruction.
+                const ssa::Inst& arg = fn.insts[inst.args[0]];
+                bool none = arg.op == Op::CONST &&
+                    arg.k.tid == static_cast<std::uint32_t>(
+                        BuiltinTypeID::NONE_TYPE
+                    );
+                if (none && next == ssa::NO_BLOCK)
+                    rc.emit(RegOpcode::END);
+                else
+                    rc.emit(RegOpcode::RETURN, operand(inst.args[0]));
+                return nullptr;
+            }
+            default:
+                return nullptr;
+            }
+        }
+
+        // Operators on operands of a known type are typed for it, and need
+        // no guard. The types of SSA values are proven: those of parameters
+        // are what the code is specialized for, and the rest follow from
+        // constants and operators.
+        RegOpcode typed(const ssa::Inst& inst) const noexcept {
+            ssa::Type x = fn.insts[inst.args[0]].type;
+            ssa::Type y = fn.insts[inst.args[1]].type;
+            if (x != y)
+                return RegOpcode::ADD;
+            if (x == ssa::Type::INT64)
+                return RegOpcode::ADD_INT64_TYPED;
+            if (x == ssa::Type::FLOAT64)
+                return RegOpcode::ADD_FLOAT64_TYPED;
+            return RegOpcode::ADD;
+        }
+
+        // Jumps back to a block already laid out close a loop, and get a
+        // trace of their own.
+        ErrPtr jump(std::uint32_t to) {
+            if (starts[to] == UINT32_MAX) {
+                fixups.emplace_back(rc.emit(RegOpcode::GOTO), to);
+                return nullptr;
+            }
+            if (rc.traces.size() == MAX_REG_SLOTS)
+                return ErrPtr(new CodeTooLargeErr());
+            auto index = static_cast<std::uint32_t>(rc.traces.size());
+            rc.traces.emplace_back();
+            rc.emit(RegOpcode::LOOP, index, starts[to]);
+            return nullptr;
+        }
+
+        // Copy the argument of each phi of `to` for the edge from `from`. The
+        // copies happen at once, so one that overwrites a register another
+        // still reads waits for it, and a cycle of them is broken with a
+        // temporary.
+        void phi_copies(std::uint32_t from, std::uint32_t to) {
+            const std::vector<std::uint32_t>& preds = fn.blocks[to].preds;
+            std::size_t i =
+                std::find(preds.begin(), preds.end(), from) - preds.begin();
+            std::vector<std::pair<std::uint32_t, Value>> moves;
+            std::vector<std::pair<std::uint32_t, Value>> loads;
+            for (Value v: fn.blocks[to].insts) {
+                if (fn.insts[v].op != Op::PHI)
+                    break;
+                Value arg = fn.insts[v].args[i];
+                if (fn.insts[arg].op == Op::CONST)
+                    loads.emplace_back(reg(v), arg);
+                else if (reg(arg) != reg(v))
+                    moves.emplace_back(reg(v), arg);
+            }
+            std::vector<std::pair<std::uint32_t, std::uint32_t>> pending;
+            for (auto [dest, arg]: moves)
+                pending.emplace_back(dest, reg(arg));
+            while (!pending.empty()) {
+                auto ready = std::find_if(
+                    pending.begin(), pending.end(), [&](const auto& move) {
+                        return std::none_of(
+                            pending.begin(), pending.end(),
+                            [&](const auto& other) {
+                                return other.second == move.first;
+                            }
+                        );
+                    }
+                );
+                if (ready != pending.end()) {
+                    rc.emit(RegOpcode::MOVE, ready->first, ready->second);
+                    pending.erase(ready);
+                    continue;
+                }
+                std::uint32_t saved = pending[0].second;
+                std::uint32_t temp = rc.new_temps(1);
+                rc.emit(RegOpcode::MOVE, temp, saved);
+                for (auto& move: pending) {
+                    if (move.second == saved)
+                        move.second = temp;
+                }
+            }
+            for (auto [dest, arg]: loads)
+                into(dest, arg);
+        }
+
+        // Intervals so far run from the first write of each temporary to its
+        // last read in layout order, which misses reads in a loop of values
+        // written before it, and later writes of phis read earlier. Liveness
+        // over the code fills those in.
+        void extend_intervals() {
+            using enum RegOpcode;
+            const std::vector<VInst>& code = rc.vcode;
+            auto n = static_cast<std::uint32_t>(code.size());
+            auto ntemps = static_cast<std::uint32_t>(rc.temps.size());
+            std::size_t words = (ntemps + 63) / 64;
+
+            auto reads = [&](const VInst& inst, auto f) {
+                switch (inst.op) {
+                case MOVE:
+                case GET_ATTR:
+                    f(inst.b);
+                    break;
+                case LOADK:
+                case GOTO:
+                case LOOP:
+                case END:
+                    break;
+                case CALL:
+                    for (std::uint32_t j = 0; j <= inst.c; j++)
+                        f(inst.b + j);
+                    break;
+                case BRANCH:
+                case SWITCH:
+                case RETURN:
+                case RAISE:
+                    f(inst.a);
+                    break;
+                default:
+                    f(inst.b);
+                    f(inst.c);
+                }
+            };
+            auto writes = [](const VInst& inst) {
+                switch (inst.op) {
+                case BRANCH:
+                case SWITCH:
+                case GOTO:
+                case LOOP:
+                case RETURN:
+                case RAISE:
+                case END:
+                    return false;
+                default:
+                    return true;
+                }
+            };
+            auto succs = [&](std::uint32_t i, auto f) {
+                switch (code[i].op) {
+                case GOTO:
+                case LOOP:
+                    f(code[i].b);
+                    break;
+                case BRANCH:
+                    f(code[i].b);
+                    f(i + 1);
+                    break;
+                case SWITCH: {
+                    const RegCompiler::VSwitch& table = rc.vswitches[code[i].b];
+                    for (std::uint32_t target: table.targets)
+                        f(target);
+                    f(table.otherwise);
+                    break;
+                }
+                case RETURN:
+                case RAISE:
+                case END:
+                    break;
+                default:
+                    f(i + 1);
+                }
+            };
+
+            // Temporaries live on entry to each instruction, as bit sets.
+            std::vector<std::uint64_t> live_in(n * words);
+            std::vector<std::uint64_t> live(words);
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (std::uint32_t i = n; i-- > 0;) {
+                    std::fill(live.begin(), live.end(), 0);
+                    succs(i, [&](std::uint32_t j) {
+                        for (std::size_t w = 0; j < n && w < words; w++)
+                            live[w] |= live_in[j * words + w];
+                    });
+                    std::uint32_t a = code[i].a;
+                    if (writes(code[i]) && (a & RegCompiler::TEMP)) {
+                        std::uint32_t t = a & ~RegCompiler::TEMP;
+                        live[t / 64] &= ~(std::uint64_t(1) << t % 64);
+                    }
+                    reads(code[i], [&](std::uint32_t reg) {
+                        if (reg & RegCompiler::TEMP) {
+                            std::uint32_t t = reg & ~RegCompiler::TEMP;
+                            live[t / 64] |= std::uint64_t(1) << t % 64;
+                        }
+                    });
+                    for (std::size_t w = 0; w < words; w++) {
+                        if (live_in[i * words + w] != live[w]) {
+                            live_in[i * words + w] = live[w];
+                            changed = true;
+                        }
+                    }
+                }
+            }
+
+            // A temporary live on entry to an instruction was written before
+            // it, and is read at or after it.
+            for (std::uint32_t i = 1; i < n; i++) {
+                for (std::uint32_t t = 0; t < ntemps; t++) {
+                    if (live_in[i * words + t / 64] >> t % 64 & 1) {
+                        rc.def(t | RegCompiler::TEMP, i - 1);
+                        rc.use(t | RegCompiler::TEMP, i);
+                    }
+                }
+            }
+        }
+    };
+};
+
+}
@@ -0,0 +1,647 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include <algorithm>
+#include <map>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "dl/compile/ssa.hpp"
+#include "dl/compile/symboltable.hpp"
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/binaryop.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+
+// Optimizations on SSA form. Each returns how many instructions or blocks it
+// removed, replaced or moved.
+namespace dl::ssa {
+
+// Apply a binary operator to constants, if the VM's fast path would: the
+// result is then the same as at run time. Anything else is left to the dunder
+// method when it runs.
+bool fold(Op op, Any x, Any y, Any& res) noexcept {
+    switch (op) {
+    case Op::ADD:
+        return vm::binary_fast<BinaryOp::ADD>(x, y, res);
+    case Op::SUB:
+        return vm::binary_fast<BinaryOp::SUB>(x, y, res);
+    case Op::MUL:
+        return vm::binary_fast<BinaryOp::MUL>(x, y, res);
+    case Op::DIV:
+        return vm::binary_fast<BinaryOp::DIV>(x, y, res);
+    case Op::MOD:
+        return vm::binary_fast<BinaryOp::MOD>(x, y, res);
+    case Op::EQ:
+        return vm::binary_fast<BinaryOp::EQ>(x, y, res);
+    case Op::NEQ:
+        return vm::binary_fast<BinaryOp::NEQ>(x, y, res);
+    case Op::LT:
+        return vm::binary_fast<BinaryOp::LT>(x, y, res);
+    case Op::LTE:
+        return vm::binary_fast<BinaryOp::LTE>(x, y, res);
+    case Op::GT:
+        return vm::binary_fast<BinaryOp::GT>(x, y, res);
+    case Op::GTE:
+        return vm::binary_fast<BinaryOp::GTE>(x, y, res);
+    default:
+        return false;
+    }
+}
+
+// Sparse conditional constant propagation, by Wegman and Zadeck. Values start
+// out unknown and blocks unreachable; only the reachable blocks are evaluated,
+// and only the edges a branch can take with what is known of its condition
+// are followed. Values found constant are replaced by the constant, branches
+// on constants become jumps, and blocks never reached are removed.
+std::uint32_t sccp(Function& fn) {
+    enum class Level: std::uint8_t {UNKNOWN, CONST, VARYING};
+    struct Lattice {
+        Level level = Level::UNKNOWN;
+        Any k = Any{0, nullptr};
+    };
+
+    auto n = static_cast<Value>(fn.insts.size());
+    std::vector<Lattice> values(n);
+    // Users of each value, to revisit when it changes.
+    std::vector<std::vector<Value>> users(n);
+    for (Value v = 0; v < n; v++) {
+        const Inst& inst = fn.insts[v];
+        if (inst.op == Op::CONST)
+            values[v] = Lattice{Level::CONST, inst.k};
+        else if (inst.op == Op::PARAM)
+            values[v].level = Level::VARYING;
+        if (inst.dead)
+            continue;
+        for (Value arg: inst.args)
+            users[arg].push_back(v);
+    }
+
+    std::vector<bool> reached(fn.blocks.size());
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> taken;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> edges;
+    std::vector<Value> work;
+
+    auto same = [](Any x, Any y) {
+        return x.tid == y.tid && x.data == y.data;
+    };
+    // Values only ever go down, from unknown to constant to varying.
+    auto lower = [&](Value v, Lattice to) {
+        Lattice& at = values[v];
+        if (at.level == Level::VARYING || to.level == Level::UNKNOWN)
+            return;
+        if (at.level == Level::CONST) {
+            if (to.level == Level::CONST && same(at.k, to.k))
+                return;
+            to.level = Level::VARYING;
+        }
+        at = to;
+        for (Value user: users[v])
+            work.push_back(user);
+    };
+    auto is_taken = [&](std::uint32_t from, std::uint32_t to) {
+        return std::find(
+            taken.begin(), taken.end(), std::make_pair(from, to)
+        ) != taken.end();
+    };
+
+    auto visit = [&](Value v) {
+        const Inst& inst = fn.insts[v];
+        std::uint32_t block = inst.block;
+        const std::vector<std::uint32_t>& succs = fn.blocks[block].succs;
+        switch (inst.op) {
+        case Op::PARAM:
+            return;
+        case Op::PHI: {
+            // Only the arguments for edges taken so far count.
+            Lattice res;
+            const std::vector<std::uint32_t>& preds = fn.blocks[block].preds;
+            for (std::size_t i = 0; i < preds.size(); i++) {
+                const Lattice& arg = values[inst.args[i]];
+                if (!is_taken(preds[i], block) || arg.level == Level::UNKNOWN)
+                    continue;
+                if (
+                    arg.level == Level::VARYING || (
+                        res.level == Level::CONST && !same(res.k, arg.k)
+                    )
+                ) {
+                    res.level = Level::VARYING;
+                    break;
+                }
+                res = arg;
+            }
+            lower(v, res);
+            return;
+        }
+        case Op::BRANCH: {
+            // A condition that is not a `Bool` raises, taking neither edge.
+            // Which constants raise is left to run time.
+            const Lattice& cond = values[inst.args[0]];
+            auto bool_tid = static_cast<std::uint32_t>(BuiltinTypeID::BOOL);
+            if (cond.level == Level::UNKNOWN)
+                return;
+            if (cond.level == Level::CONST && cond.k.tid == bool_tid) {
+                Any k = cond.k;
+                edges.emplace_back(
+                    block, succs[coreutil::unwrap<bool>(k) ? 0 : 1]
+                );
+                return;
+            }
+            for (std::uint32_t succ: succs)
+                edges.emplace_back(block, succ);
+            return;
+        }
+        case Op::JUMP:
+            edges.emplace_back(block, succs[0]);
+            return;
+        case Op::SWITCH: {
+            // Only an `Int64` is known to equal just the key of its value.
+            const Lattice& x = values[inst.args[0]];
+            auto int64_tid = static_cast<std::uint32_t>(BuiltinTypeID::INT64);
+            if (x.level == Level::UNKNOWN)
+                return;
+            if (x.level == Level::CONST && x.k.tid == int64_tid) {
+                Any k = x.k;
+                auto key = coreutil::unwrap<std::int64_t>(k);
+                std::size_t i = 1;
+                for (; i < inst.args.size(); i++) {
+                    Any case_k = fn.insts[inst.args[i]].k;
+                    if (coreutil::unwrap<std::int64_t>(case_k) == key)
+                        break;
+                }
+                edges.emplace_back(block, succs[i - 1]);
+                return;
+            }
+            for (std::uint32_t succ: succs)
+                edges.emplace_back(block, succ);
+            return;
+        }
+        case Op::RAISE:
+        case Op::RETURN:
+            return;
+        default:
+            break;
+        }
+        if (!is_binary(inst.op)) {
+            lower(v, Lattice{Level::VARYING});
+            return;
+        }
+        const Lattice& x = values[inst.args[0]];
+        const Lattice& y = values[inst.args[1]];
+        if (x.level == Level::UNKNOWN || y.level == Level::UNKNOWN)
+            return;
+        Any res;
+        if (
+            x.level == Level::CONST && y.level == Level::CONST &&
+            fold(inst.op, x.k, y.k, res)
+        )
+            lower(v, Lattice{Level::CONST, res});
+        else
+            lower(v, Lattice{Level::VARYING});
+    };
+
+    // The phis of a block are visited again for each edge to it, the rest
+    // only the first time.
+    auto reach = [&](std::uint32_t block) {
+        bool first = !reached[block];
+        reached[block] = true;
+        for (Value v: fn.blocks[block].insts) {
+            if (first || fn.insts[v].op == Op::PHI)
+                visit(v);
+        }
+    };
+    reach(0);
+    while (!edges.empty() || !work.empty()) {
+        if (!edges.empty()) {
+            auto [from, to] = edges.back();
+            edges.pop_back();
+            if (!is_taken(from, to)) {
+                taken.emplace_back(from, to);
+                reach(to);
+            }
+            continue;
+        }
+        Value v = work.back();
+        work.pop_back();
+        if (reached[fn.insts[v].block])
+            visit(v);
+    }
+
+    // Constant values are replaced by the constant. They are known not to
+    // raise, since what they fold to is what the VM computes.
+    std::uint32_t changed = 0;
+    std::vector<Value> map(n);
+    for (Value v = 0; v < n; v++) {
+        map[v] = v;
+        const Inst& inst = fn.insts[v];
+        if (
+            inst.dead || inst.op == Op::CONST || !reached[inst.block] ||
+            values[v].level != Level::CONST
+        )
+            continue;
+        Value k = fn.constant(values[v].k);
+        map.resize(fn.insts.size(), 0);
+        map[k] = k;
+        map[v] = k;
+        fn.remove(v);
+        changed++;
+    }
+    fn.substitute(map);
+
+    // Branches and switches with one edge taken become jumps.
+    for (std::uint32_t b = 0; b < fn.blocks.size(); b++) {
+        if (!reached[b])
+            continue;
+        Op op = fn.terminator(b).op;
+        if (op != Op::BRANCH && op != Op::SWITCH)
+            continue;
+        std::vector<std::uint32_t> succs = fn.blocks[b].succs;
+        auto ntaken = std::count_if(
+            succs.begin(), succs.end(), [&](std::uint32_t succ) {
+                return is_taken(b, succ);
+            }
+        );
+        if (ntaken != 1)
+            continue;
+        for (std::uint32_t succ: succs) {
+            if (!is_taken(b, succ))
+                fn.remove_edge(b, succ);
+        }
+        Inst& term = fn.terminator(b);
+        term.op = Op::JUMP;
+        term.args.clear();
+        changed++;
+    }
+    changed += fn.remove_unreachable();
+    infer_types(fn);
+    return changed;
+}
+
+// The structure of the object an instruction constructs, if it calls a
+// constant struct type, with no arguments, that `Function::plain_type` says
+// only makes an object, and each field holds a scalar unboxed. Such a call
+// does nothing else, so reading a field back gives zero. Types are not
+// assumed to be plain: `default_type_call` runs `__init__` if there is one,
+// and raises if given arguments when there is not.
+const Struct* constructs(const Function& fn, const Inst& inst) {
+    if (inst.op != Op::CALL || inst.args.size() != 1 || !fn.plain_type)
+        return nullptr;
+    const Inst& callee = fn.insts[inst.args[0]];
+    auto type_tid = static_cast<std::uint32_t>(BuiltinTypeID::TYPE);
+    if (callee.op != Op::CONST || callee.k.tid != type_tid)
+        return nullptr;
+    Any k = callee.k;
+    const Struct& structure = coreutil::unwrap<dl::Type>(k).dunder_struct;
+    // Pointer types have no names.
+    if (structure.names == nullptr)
+        return nullptr;
+    for (std::uint32_t i = 0; i < structure.len; i++) {
+        if (tid_type(structure.tids[i]) == Type::ANY)
+            return nullptr;
+    }
+    return fn.plain_type(k) ? &structure : nullptr;
+}
+
+// Index of the field of structure with the name, or `UINT32_MAX`.
+std::uint32_t field_index(const Struct& structure, Symbol name) noexcept {
+    for (std::uint32_t i = 0; i < structure.len; i++) {
+        if (structure.names[i] == name)
+            return i;
+    }
+    return UINT32_MAX;
+}
+
+// Scalar replacement of objects that do not escape. An object constructed
+// here whose only uses are reads of its fields is never built: each read is
+// replaced by the constant the field was left with. An object used whole, by
+// a call, operator, phi, return or raise, may outlive the function or be told
+// apart by its identity, so is still built.
+std::uint32_t sra(Function& fn) {
+    std::vector<const Struct*> structs(fn.insts.size());
+    for (const Block& block: fn.blocks) {
+        for (Value v: block.insts)
+            structs[v] = constructs(fn, fn.insts[v]);
+    }
+    for (const Block& block: fn.blocks) {
+        for (Value v: block.insts) {
+            const Inst& inst = fn.insts[v];
+            for (std::size_t i = 0; i < inst.args.size(); i++) {
+                const Struct* structure = structs[inst.args[i]];
+                if (
+                    structure != nullptr && (
+                        i != 0 || inst.op != Op::GET_ATTR ||
+                        field_index(*structure, inst.index) == UINT32_MAX
+                    )
+                )
+                    structs[inst.args[i]] = nullptr;
+            }
+        }
+    }
+
+    // Zeroed fields read as the constant zero of their type.
+    std::vector<std::pair<Value, Any>> reads;
+    for (const Block& block: fn.blocks) {
+        for (Value v: block.insts) {
+            const Inst& inst = fn.insts[v];
+            if (inst.op != Op::GET_ATTR || structs[inst.args[0]] == nullptr)
+                continue;
+            const Struct& structure = *structs[inst.args[0]];
+            std::uint32_t i = field_index(structure, inst.index);
+            reads.emplace_back(v, Any{structure.tids[i], nullptr});
+        }
+    }
+    std::vector<Value> map(fn.insts.size());
+    for (Value v = 0; v < fn.insts.size(); v++)
+        map[v] = v;
+    for (auto [v, zero]: reads) {
+        Value k = fn.constant(zero);
+        map.resize(fn.insts.size(), 0);
+        map[k] = k;
+        map[v] = k;
+    }
+    std::uint32_t removed = 0;
+    for (Block& block: fn.blocks) {
+        std::erase_if(block.insts, [&](Value v) {
+            if (map[v] == v && structs[v] == nullptr)
+                return false;
+            fn.insts[v].dead = true;
+            removed++;
+            return true;
+        });
+    }
+    fn.substitute(map);
+    infer_types(fn);
+    return removed;
+}
+
+// Dead code elimination. Instructions that have an effect are live, and so
+// is whatever they use; the rest are removed. Parameters are kept, so that
+// dumps show them all.
+std::uint32_t dce(Function& fn) {
+    std::vector<bool> live(fn.insts.size());
+    std::vector<Value> work;
+    for (const Block& block: fn.blocks) {
+        for (Value v: block.insts) {
+            const Inst& inst = fn.insts[v];
+            if (
+                is_terminator(inst.op) || inst.op == Op::PARAM ||
+                !is_pure(fn, inst)
+            ) {
+                live[v] = true;
+                work.push_back(v);
+            }
+        }
+    }
+    while (!work.empty()) {
+        Value v = work.back();
+        work.pop_back();
+        for (Value arg: fn.insts[v].args) {
+            if (!live[arg]) {
+                live[arg] = true;
+                work.push_back(arg);
+            }
+        }
+    }
+    std::uint32_t removed = 0;
+    for (Block& block: fn.blocks) {
+        std::erase_if(block.insts, [&](Value v) {
+            if (live[v])
+                return false;
+            fn.insts[v].dead = true;
+            removed++;
+            return true;
+        });
+    }
+    return removed;
+}
+
+// Global value numbering over the dominator tree. A pure instruction that
+// computes what one dominating it already did is replaced by it, as is a phi
+// whose arguments are all the same value.
+std::uint32_t gvn(Function& fn) {
+    std::vector<std::uint32_t> rpo = fn.rpo();
+    std::vector<std::uint32_t> idom = dominators(fn, rpo);
+    std::vector<std::vector<std::uint32_t>> children(fn.blocks.size());
+    for (std::uint32_t block: rpo) {
+        if (block != 0)
+            children[idom[block]].push_back(block);
+    }
+
+    std::vector<Value> map(fn.insts.size());
+    for (Value v = 0; v < map.size(); v++)
+        map[v] = v;
+    auto find = [&](Value v) {
+        while (map[v] != v)
+            v = map[v];
+        return v;
+    };
+
+    // The one value other than itself a phi picks, if there is one.
+    auto trivial = [&](Value phi) {
+        Value same = phi;
+        for (Value arg: fn.insts[phi].args) {
+            arg = find(arg);
+            if (arg == phi || arg == same)
+                continue;
+            if (same != phi)
+                return NO_VALUE;
+            same = arg;
+        }
+        return same == phi ? NO_VALUE : same;
+    };
+
+    // Expressions available in the dominators of the block being visited,
+    // with an undo log of what each block added.
+    std::map<std::vector<std::uint32_t>, Value> available;
+    std::vector<std::vector<std::uint32_t>> added;
+    std::uint32_t replaced = 0;
+
+    auto number = [&](std::uint32_t block) {
+        for (Value v: fn.blocks[block].insts) {
+            Inst& inst = fn.insts[v];
+            for (Value& arg: inst.args)
+                arg = find(arg);
+            if (inst.op == Op::PHI) {
+                if (Value same = trivial(v); same != NO_VALUE) {
+                    map[v] = same;
+                    replaced++;
+                }
+                continue;
+            }
+            if (!is_binary(inst.op) || !is_pure(fn, inst))
+                continue;
+            std::vector<std::uint32_t> key = {
+                static_cast<std::uint32_t>(inst.op), inst.args[0], inst.args[1]
+            };
+            // Operands of operators that commute are put in one order.
+            bool commutes = inst.op == Op::ADD || inst.op == Op::MUL ||
+                inst.op == Op::EQ || inst.op == Op::NEQ;
+            if (commutes && key[1] > key[2])
+                std::swap(key[1], key[2]);
+            auto [it, inserted] = available.emplace(key, v);
+            if (inserted)
+                added.push_back(std::move(key));
+            else {
+                map[v] = it->second;
+                replaced++;
+            }
+        }
+    };
+
+    // Preorder walk of the dominator tree, with the size of the undo log on
+    // entering each block.
+    std::vector<std::pair<std::uint32_t, std::size_t>> stack = {{0, 0}};
+    std::vector<bool> visited(fn.blocks.size());
+    while (!stack.empty()) {
+        auto [block, mark] = stack.back();
+        if (visited[block]) {
+            stack.pop_back();
+            while (added.size() > mark) {
+                available.erase(added.back());
+                added.pop_back();
+            }
+            continue;
+        }
+        visited[block] = true;
+        stack.back().second = added.size();
+        number(block);
+        for (std::uint32_t child: children[block])
+            stack.emplace_back(child, 0);
+    }
+
+    // Arguments from back edges are numbered after the phis using them, which
+    // may then turn out trivial.
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const Block& block: fn.blocks) {
+            for (Value v: block.insts) {
+                if (fn.insts[v].op != Op::PHI || map[v] != v)
+                    continue;
+                if (Value same = trivial(v); same != NO_VALUE) {
+                    map[v] = same;
+                    replaced++;
+                    changed = true;
+                }
+            }
+        }
+    }
+    fn.substitute(map);
+    for (Block& block: fn.blocks) {
+        std::erase_if(block.insts, [&](Value v) {
+            if (map[v] == v)
+                return false;
+            fn.insts[v].dead = true;
+            return true;
+        });
+    }
+    infer_types(fn);
+    return replaced;
+}
+
+// Loop invariant code motion. Pure instructions in a loop whose arguments are
+// all computed before it are moved to the block before its header, so that
+// they run once per entry to the loop instead of once per iteration. Being
+// pure, they cannot raise, so running them when the loop runs no iterations
+// is harmless. Inner loops go first, so that what is hoisted out of one can be
+// hoisted further out of the loops around it.
+std::uint32_t licm(Function& fn) {
+    std::vector<std::uint32_t> rpo = fn.rpo();
+    std::vector<Loop> loops = find_loops(fn, rpo);
+
+    std::uint32_t hoisted = 0;
+    for (const Loop& loop: loops) {
+        // The block entering the loop, if there is one and it only goes to
+        // the header.
+        std::uint32_t preheader = NO_BLOCK;
+        bool unique = true;
+        for (std::uint32_t pred: fn.blocks[loop.head].preds) {
+            if (loop.body[pred])
+                continue;
+            unique = unique && preheader == NO_BLOCK;
+            preheader = pred;
+        }
+        if (
+            !unique || preheader == NO_BLOCK ||
+            fn.blocks[preheader].succs.size() != 1
+        )
+            continue;
+        auto outside = [&](Value v) {
+            const Inst& inst = fn.insts[v];
+            return inst.op == Op::CONST || !loop.body[inst.block];
+        };
+        for (std::uint32_t block: rpo) {
+            if (!loop.body[block])
+                continue;
+            std::vector<Value> list = fn.blocks[block].insts;
+            for (Value v: list) {
+                Inst& inst = fn.insts[v];
+                if (
+                    inst.op == Op::PHI || is_terminator(inst.op) ||
+                    !is_pure(fn, inst) ||
+                    !std::all_of(inst.args.begin(), inst.args.end(), outside)
+                )
+                    continue;
+                fn.remove(v);
+                fn.insert(preheader, v);
+                hoisted++;
+            }
+        }
+    }
+    return hoisted;
+}
+
+// How long a pass took, and what it did.
+struct PassTiming {
+    const char* name;
+    double ms;
+    // Instructions in blocks before and after.
+    std::uint32_t before;
+    std::uint32_t after;
+    // What the pass reported changing.
+    std::uint32_t changed;
+};
+
+// The passes in the order they run. Constant propagation goes first, since it
+// removes the most, and leaves scalar replacement only the calls still
+// reached. Value numbering sees what they left, then what it merged is
+// hoisted, and dead code is cleaned up last.
+constexpr std::pair<const char*, std::uint32_t (*)(Function&)> PASSES[] = {
+    {"sccp", sccp},
+    {"sra", sra},
+    {"gvn", gvn},
+    {"licm", licm},
+    {"dce", dce}
+};
+
+// Run every pass, timing each. If dump is set, the function is written to it
+// after each pass.
+void optimize(
+    Function& fn, std::vector<PassTiming>& timings,
+    std::ostream* dump_to = nullptr, const SymbolTable* symbols = nullptr
+) {
+    for (auto [name, pass]: PASSES) {
+        std::uint32_t before = fn.live_insts();
+        auto start = std::chrono::steady_clock::now();
+        std::uint32_t changed = pass(fn);
+        std::chrono::duration<double, std::milli> ms =
+            std::chrono::steady_clock::now() - start;
+        timings.push_back(PassTiming{
+            name, ms.count(), before, fn.live_insts(), changed
+        });
+        if (dump_to != nullptr && symbols != nullptr) {
+            *dump_to << "; after " << name << '\n';
+            dump(*dump_to, fn, *symbols);
+        }
+    }
+}
+
+std::ostream& operator<<(std::ostream& os, const PassTiming& timing) {
+    return os << timing.name << ": " << timing.ms << " ms, " <<
+        timing.changed << " changed, " << timing.before << " -> " <<
+        timing.after << " instructions";
+}
+
+}
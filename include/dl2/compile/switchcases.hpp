@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include "dl/compile/literal.hpp"
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/parse/opid.hpp"
+#include "dl/process/node.hpp"
+#include "dl/process/opinfo.hpp"
+
+namespace dl {
+
+// A branch of a chain that compares one value against constants: the keys it
+// is taken for, and its body. Compilers turn such chains into a `SWITCH`.
+//
+// A match is a `MATCH` node whose operand is the value, followed by `CASE`
+// siblings and optionally an `ELSE`. The operand of a `CASE` is a binary node
+// of its keys, one or a list separated by commas, and its body, as with `IF`.
+// Keys are compared to the value with `==`, the value on the left, in order,
+// and the body of the first case with an equal key runs, or the `ELSE` if none
+// has one.
+//
+// A chain of `IF`s and `ELIF`s comparing one variable to `Int64` literals,
+// `x == k`, is the same as matching the variable, with a case for each.
+struct SwitchArm {
+    std::vector<std::int64_t> keys;
+    const Node* body;
+};
+
+// Fewest leading branches of an `if` chain that are worth a switch.
+constexpr std::size_t MIN_SWITCH_ARMS = 4;
+
+// Value of an `Int64` literal, which may be negated.
+bool int64_key(const Node& node, std::int64_t& key) {
+    bool neg = node.op == OpID::NEG;
+    const Node& lit = neg ? *node.node : node;
+    Any value;
+    if (
+        lit.op != OpID::ALNUM || !is_numeric_literal(lit.str) ||
+        parse_literal(lit.str, value) != nullptr ||
+        value.tid != static_cast<std::uint32_t>(BuiltinTypeID::INT64)
+    )
+        return false;
+    key = coreutil::unwrap<std::int64_t>(value);
+    if (neg)
+        key = -key;
+    return true;
+}
+
+// The keys of a `CASE`, a chain of separators.
+std::vector<const Node*> case_values(const Node& node) {
+    std::vector<const Node*> values;
+    const Node* rest = &node;
+    while (rest->op == OpID::SEP) {
+        values.push_back(&rest->bin->lhs);
+        rest = &rest->bin->rhs;
+    }
+    values.push_back(rest);
+    return values;
+}
+
+// Arms of the `CASE`s after the `MATCH` starting chain, up to any `ELSE`.
+// Returns false if a case is malformed or a key is not an `Int64` literal.
+bool match_arms(
+    const std::vector<const Node*>& chain, std::vector<SwitchArm>& arms
+) {
+    for (std::size_t i = 1; i < chain.size(); i++) {
+        if (chain[i]->op != OpID::CASE)
+            break;
+        const Node& pred = *chain[i]->node;
+        if (opinfo(pred.op).kind != OpKind::BINARY)
+            return false;
+        SwitchArm arm{{}, &pred.bin->rhs};
+        for (const Node* value: case_values(pred.bin->lhs)) {
+            std::int64_t key;
+            if (!int64_key(*value, key))
+                return false;
+            arm.keys.push_back(key);
+        }
+        arms.push_back(std::move(arm));
+    }
+    return true;
+}
+
+// Arms of the leading branches of an `if` chain that compare one variable to
+// an `Int64` literal, and the variable's name. Returns how many there are,
+// which the rest of the chain follows as if it were the `ELSE`.
+std::size_t if_arms(
+    const std::vector<const Node*>& chain, std::string& name,
+    std::vector<SwitchArm>& arms
+) {
+    for (const Node* branch: chain) {
+        if (branch->op == OpID::ELSE)
+            break;
+        const Node& pred = *branch->node;
+        if (opinfo(pred.op).kind != OpKind::BINARY)
+            break;
+        const Node& cond = pred.bin->lhs;
+        if (cond.op != OpID::EQ)
+            break;
+        const Node& var = cond.bin->lhs;
+        std::int64_t key;
+        if (
+            var.op != OpID::ALNUM || is_numeric_literal(var.str) ||
+            (!arms.empty() && var.str != name) ||
+            !int64_key(cond.bin->rhs, key)
+        )
+            break;
+        name = var.str;
+        arms.push_back(SwitchArm{{key}, &pred.bin->rhs});
+    }
+    return arms.size();
+}
+
+}
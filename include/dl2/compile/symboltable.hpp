@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/builtinsymbol.hpp"
+
+namespace dl {
+
+// Symbols of the names in compiled code. New names get symbols after the
+// builtin ones; names that must match a builtin symbol are registered with
+// `add` first.
+struct SymbolTable {
+    std::unordered_map<std::string, Symbol> symbols;
+    std::vector<std::string> names;
+
+    SymbolTable():
+        names(static_cast<std::size_t>(BuiltinSymbol::XS) + 1) {}
+
+    void add(std::string name, BuiltinSymbol sym) {
+        auto i = static_cast<std::size_t>(sym);
+        symbols.emplace(name, static_cast<Symbol>(i));
+        names[i] = std::move(name);
+    }
+
+    Symbol intern(const std::string& name) {
+        auto [it, inserted] = symbols.emplace(
+            name, static_cast<Symbol>(names.size())
+        );
+        if (inserted)
+            names.push_back(name);
+        return it->second;
+    }
+};
+
+}
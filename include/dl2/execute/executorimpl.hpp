@@ -1,28 +1,58 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
+
+#include <new>
 
 #include "dl/err.hpp"
 #include "dl/types.hpp"
 #include "dl/executor/executor.hpp"
+#include "dl/interpreter2/pool.hpp"
 
 namespace dl {
 
 struct ExecutorImpl: Executor {
     State state;
 
+    // Whether the payload of objects of the given type is stored inline in
+    // `Typed::data`. Types here are numbered by `BUILTIN_TYPES`, not by the
+    // runtime's `BuiltinTypeID`.
+    static bool is_immediate(std::uint32_t typeidx) noexcept {
+        return typeidx == static_cast<std::uint32_t>(BUILTIN_TYPES::BOOL) ||
+            typeidx == static_cast<std::uint32_t>(BUILTIN_TYPES::INT32);
+    }
+
+    // Size of the pooled payload of an object of a type which is not an
+    // immediate, so that allocation and `del` agree on its size class.
+    std::uint64_t payload_size(std::uint32_t typeidx) const noexcept {
+        // Strings are a `Word` made by `execute_str`, not a struct.
+        if (typeidx == static_cast<std::uint32_t>(BUILTIN_TYPES::STRING))
+            return sizeof(Word);
+        return state.types.types[typeidx].dunder_struct.size;
+    }
+
     void del(Typed x) {
-        Type t = state.types.types[x.typeidx];
-        
-        delete x.data;
+        // Immediates own no memory.
+        if (is_immediate(x.typeidx))
+            return;
+        if (x.typeidx == static_cast<std::uint32_t>(BUILTIN_TYPES::STRING))
+            static_cast<Word*>(x.data)->~Word();
+        payload_pool().deallocate(x.data, payload_size(x.typeidx));
     }
 
     Typed execute(Typed node) override;
 
+    // Make an immediate `Typed` whose payload is stored inline in its data.
+    template<typename T>
+    static Typed immediate(BUILTIN_TYPES typeidx, T x) noexcept {
+        auto res = Typed{static_cast<std::uint32_t>(typeidx), nullptr};
+        std::memcpy(&res.data, &x, sizeof(T));
+        return res;
+    }
+
     Typed execute_bool(bool x) {
-        return Typed{
-            static_cast<std::uint32_t>(BUILTIN_TYPES::BOOL), new bool(x)
-        };
+        return immediate(BUILTIN_TYPES::BOOL, x);
     }
 
     Typed execute_id(Word word) {
@@ -30,16 +60,13 @@ struct ExecutorImpl: Executor {
     }
 
     Typed execute_int32(std::int32_t x) {
-        return Typed{
-            static_cast<std::uint32_t>(BUILTIN_TYPES::INT32),
-            new std::int32_t(x)
-        };
+        return immediate(BUILTIN_TYPES::INT32, x);
     }
 
     Typed execute_str(Word word) {
-        return Typed{
-            static_cast<std::uint32_t>(BUILTIN_TYPES::STRING), new Word(word)
-        };
+        auto typeidx = static_cast<std::uint32_t>(BUILTIN_TYPES::STRING);
+        void* data = payload_pool().allocate(payload_size(typeidx));
+        return Typed{typeidx, new (data) Word(word)};
     }
 };
 
@@ -47,11 +47,22 @@ struct TIDs {
     std::uint32_t len;
 };
 
+// Elements of the primitive type tid, unboxed and contiguous. data is the
+// payload of a heap object of its own, replaced by a larger one as it fills.
+struct Array {
+    void* data;
+    std::uint32_t tid;
+    std::uint32_t len;
+    std::uint32_t cap;
+};
+
 struct Type {
     Struct dunder_struct;
     TIDs dunder_bases;
+    TIDs dunder_supers;
     Symbol dunder_name;
     std::uint32_t dunder_tid;
+    std::uint32_t dunder_depth;
 
     Vars dunder_getattr;
     Vars dunder_setattr;
@@ -72,9 +83,16 @@ struct Stack {
 
     Args* args;
     std::uint32_t call_depth;
+
+    // Arguments of calls in progress, pushed contiguously by callers. The
+    // arguments of each depth are read in place through `args`.
+    Any* values;
+    std::uint32_t nvalues;
 };
 
 struct Config {
+    // Runs of tiered register code before it is compiled to native code.
+    std::uint32_t jit_threshold;
     std::uint32_t max_args;
     std::uint32_t max_call_depth;
     std::uint32_t max_kwargs;
@@ -82,6 +100,7 @@ struct Config {
     std::uint32_t max_symbols;
     std::uint32_t max_src;
     std::uint32_t max_types;
+    std::uint32_t max_values;
     std::uint32_t max_vars;
 };
 
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <initializer_list>
+#include <vector>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/binaryop.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/exceptions.hpp"
+#include "dl/interpreter2/gc.hpp"
+#include "dl/interpreter2/interpreterimpl.hpp"
+#include "dl/interpretnode/call.hpp"
+
+// Runtime support for programs compiled ahead of time by `CompilerImpl`. The
+// C++ it generates includes this header and calls these functions for
+// everything that is not a native scalar operation.
+namespace dl::aot {
+
+// Limits of the interpreter a compiled program runs in.
+constexpr Config CONFIG = {
+    .jit_threshold = 1000,
+    .max_args = 256,
+    .max_call_depth = 1024,
+    .max_kwargs = 256,
+    .max_scope_depth = 1024,
+    .max_symbols = 1 << 16,
+    .max_src = 1 << 20,
+    .max_types = 1 << 16,
+    .max_values = 1 << 20,
+    .max_vars = 1 << 16
+};
+
+// A compiled program, run with its variables' slots on the value stack.
+using Program = Any (*)(InterpreterImpl&, Any*);
+
+// A boxed constant, from its bits.
+Any constant(std::uint32_t tid, std::uint64_t bits) noexcept {
+    auto res = Any{tid, nullptr};
+    std::memcpy(&res.data, &bits, sizeof(bits));
+    return res;
+}
+
+// Test a condition that is not statically a `Bool`. Returns 1 if true, 0 if
+// false and -1 if something was raised.
+int test(InterpreterImpl& interp, Any cond) {
+    if (cond.tid != static_cast<std::uint32_t>(BuiltinTypeID::BOOL)) {
+        coreutil::raise(interp.state, NotBoolError{cond});
+        return -1;
+    }
+    return coreutil::unwrap<bool>(cond);
+}
+
+template<BinaryOp OP>
+Any binary(InterpreterImpl& interp, Any x, Any y) {
+    Any res;
+    if (vm::binary_fast<OP>(x, y, res))
+        return res;
+    return vm::binary_slow(interp, OP, x, y);
+}
+
+// Apply a binary operator to native `Int64`s whose native operation overflowed
+// or divided by a nonpositive number, through the dunder method. Compiled code
+// keeps `Int64` arithmetic in `Int64`, so a result of another type is raised as
+// unsupported. Returns nonzero if something was raised.
+int int64_slow(
+    InterpreterImpl& interp, BinaryOp op, std::int64_t x, std::int64_t y,
+    std::int64_t& res
+) {
+    constexpr auto INT64 = static_cast<std::uint32_t>(BuiltinTypeID::INT64);
+    Any boxed = vm::binary_slow(
+        interp, op, coreutil::wrap(x), coreutil::wrap(y)
+    );
+    if (coreutil::is_error(boxed))
+        return 1;
+    if (boxed.tid != INT64) {
+        auto name = static_cast<Symbol>(
+            vm::BINARY_DUNDERS[static_cast<int>(op)]
+        );
+        coreutil::raise(interp.state, UnsupportedOperandError{
+            name, coreutil::wrap(x), coreutil::wrap(y)
+        });
+        return 1;
+    }
+    res = coreutil::unwrap<std::int64_t>(boxed);
+    return 0;
+}
+
+// Call the first value with the rest as positional arguments.
+Any call(InterpreterImpl& interp, std::initializer_list<Any> parts) {
+    Stack& stack = interp.state.stack;
+    std::uint32_t base = stack.nvalues;
+    Any* values = interp.push_values(static_cast<std::uint32_t>(parts.size()));
+    if (values == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    std::copy(parts.begin(), parts.end(), values);
+    auto nargs = static_cast<std::uint32_t>(parts.size() - 1);
+    Any res = interp.call(
+        Call{Source{}, values[0], base + 1, nargs, 0, 0, nullptr, 0}
+    );
+    // The call pops its arguments, but not the callee.
+    stack.nvalues = base;
+    return res;
+}
+
+Any get_attr(InterpreterImpl& interp, Any obj, Symbol name) {
+    std::uint32_t field_tid;
+    std::uint32_t offset;
+    if (
+        is_immediate_tid(obj.tid) || !coreutil::find_field(
+            interp.state, obj.tid, name, field_tid, offset
+        )
+    ) {
+        coreutil::raise(interp.state, NoAttrError{obj, name});
+        return coreutil::ERROR_SIGNAL;
+    }
+    return coreutil::load_field(obj, field_tid, offset);
+}
+
+// Run a compiled program with nslots variables in a fresh interpreter.
+// Returns the exit status of the executable: nonzero if an exception was
+// left uncaught.
+int run(std::uint32_t nslots, Program program) {
+    auto values = std::vector<Any>(CONFIG.max_values);
+    auto args = std::vector<Args>(CONFIG.max_call_depth + 1);
+    auto interp = InterpreterImpl{};
+    interp.state.config = CONFIG;
+    interp.state.stack.values = values.data();
+    interp.state.stack.args = args.data();
+    interp.state.exc_info.raised = coreutil::NONE;
+    Any* slots = interp.push_values(nslots);
+    if (slots == nullptr)
+        return 1;
+    // The slots are GC roots, so they must not hold stale references.
+    std::fill_n(slots, nslots, coreutil::NONE);
+    if (coreutil::is_error(program(interp, slots))) {
+        std::fprintf(
+            stderr, "uncaught exception of type %u\n",
+            interp.state.exc_info.raised.tid
+        );
+        return 1;
+    }
+    return 0;
+}
+
+}
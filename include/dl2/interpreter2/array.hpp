@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <new>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/exceptions.hpp"
+#include "dl/interpreter2/gc.hpp"
+
+// Typed arrays, `Array[Int32]`, `Array[Float64]` and so on, hold elements of
+// one primitive type unboxed in a contiguous buffer on the collected heap. The
+// element type is part of the payload, so every array has the `ARRAY` TID.
+// Elements are only boxed into an `Any` when read by generic code, such as
+// iteration; kernels over whole arrays work on the buffer through `elems`.
+namespace dl::array {
+
+// Smallest buffer an array is given.
+constexpr std::uint32_t MIN_CAP = 8;
+
+// Lengths are `UInt32`s, like those of `Seq`.
+constexpr std::uint32_t MAX_LEN = UINT32_MAX;
+
+// Whether arrays can hold elements of type tid: `Bool` and the numbers.
+constexpr bool is_elem_tid(std::uint32_t tid) noexcept {
+    using enum BuiltinTypeID;
+    return
+        tid >= static_cast<std::uint32_t>(BOOL) &&
+        tid <= static_cast<std::uint32_t>(FLOAT64);
+}
+
+// Call `f.template operator()<T>()`, where T is the C++ type of the number type
+// tid: `std::uint8_t` for `UInt8` through `double` for `Float64`.
+template<typename F>
+decltype(auto) with_num_type(std::uint32_t tid, F&& f) {
+    using enum BuiltinTypeID;
+    switch (static_cast<BuiltinTypeID>(tid)) {
+    case UINT8:
+        return f.template operator()<std::uint8_t>();
+    case UINT16:
+        return f.template operator()<std::uint16_t>();
+    case UINT32:
+        return f.template operator()<std::uint32_t>();
+    case UINT64:
+        return f.template operator()<std::uint64_t>();
+    case INT8:
+        return f.template operator()<std::int8_t>();
+    case INT16:
+        return f.template operator()<std::int16_t>();
+    case INT32:
+        return f.template operator()<std::int32_t>();
+    case INT64:
+        return f.template operator()<std::int64_t>();
+    case FLOAT32:
+        return f.template operator()<float>();
+    default:
+        assert(tid == static_cast<std::uint32_t>(FLOAT64));
+        return f.template operator()<double>();
+    }
+}
+
+// Like `with_num_type`, for any element type; `Bool` elements are `bool`s.
+template<typename F>
+decltype(auto) with_elem_type(std::uint32_t tid, F&& f) {
+    if (tid == static_cast<std::uint32_t>(BuiltinTypeID::BOOL))
+        return f.template operator()<bool>();
+    return with_num_type(tid, f);
+}
+
+// Bytes per element of arr.
+std::uint32_t elem_size(const Array& arr) noexcept {
+    return immediate_size(arr.tid);
+}
+
+// The elements of arr as a C++ array, where T is the C++ type of its element
+// type. Invalidated by anything that may grow arr.
+template<typename T>
+T* elems(Array& arr) noexcept {
+    return static_cast<T*>(arr.data);
+}
+
+template<typename T>
+const T* elems(const Array& arr) noexcept {
+    return static_cast<const T*>(arr.data);
+}
+
+// Grow the buffer of arr to hold at least cap elements. The capacity at least
+// doubles, so that pushing elements one at a time takes amortized constant
+// time.
+void reserve(State& state, Array& arr, std::uint32_t cap) {
+    if (cap <= arr.cap)
+        return;
+    std::uint64_t grown = std::max<std::uint64_t>(
+        {cap, 2 * static_cast<std::uint64_t>(arr.cap), MIN_CAP}
+    );
+    auto new_cap = static_cast<std::uint32_t>(
+        std::min<std::uint64_t>(grown, MAX_LEN)
+    );
+    // Allocating never collects, so arr stays where it is. The buffer holds
+    // no references, so it is allocated as bytes.
+    std::uint64_t size = elem_size(arr);
+    void* data = coreutil::alloc(
+        static_cast<std::uint32_t>(BuiltinTypeID::UINT8), new_cap * size
+    );
+    if (arr.len != 0)
+        std::memcpy(data, arr.data, arr.len * size);
+    arr.data = data;
+    arr.cap = new_cap;
+    gc::write_barrier(
+        state, static_cast<std::uint32_t>(BuiltinTypeID::ARRAY), &arr
+    );
+}
+
+// A new empty array of elements of type tid, which must satisfy
+// `is_elem_tid`, with room for cap of them.
+Any make(State& state, std::uint32_t tid, std::uint32_t cap) {
+    auto& arr = *new(
+        coreutil::alloc(
+            static_cast<std::uint32_t>(BuiltinTypeID::ARRAY), sizeof(Array)
+        )
+    ) Array{nullptr, tid, 0, 0};
+    if (cap != 0)
+        reserve(state, arr, cap);
+    return Any{static_cast<std::uint32_t>(BuiltinTypeID::ARRAY), &arr};
+}
+
+// Element i of arr, boxed, where i is less than its length.
+Any load(const Array& arr, std::uint32_t i) noexcept {
+    auto data = static_cast<const char*>(arr.data);
+    std::uint64_t offset = static_cast<std::uint64_t>(i) * elem_size(arr);
+    return coreutil::load_immediate(arr.tid, data + offset);
+}
+
+// Set element i of arr, where i is less than its length, to x, which must be
+// of its element type.
+void store(Array& arr, std::uint32_t i, Any x) noexcept {
+    auto data = static_cast<char*>(arr.data);
+    std::uint64_t offset = static_cast<std::uint64_t>(i) * elem_size(arr);
+    std::memcpy(data + offset, &x.data, elem_size(arr));
+}
+
+// Append x, which must be of the element type of arr.
+int push(State& state, Array& arr, Any x) {
+    if (arr.len == MAX_LEN) {
+        coreutil::raise(state, ArrayOverflowError{MAX_LEN});
+        return 1;
+    }
+    reserve(state, arr, arr.len + 1);
+    store(arr, arr.len++, x);
+    return 0;
+}
+
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+// Native code generation, opted into by defining `DL_JIT`. Only x86-64 Linux is
+// supported; elsewhere the flag is ignored and everything is interpreted.
+#if defined(DL_JIT) && defined(__x86_64__) && defined(__linux__)
+#define DL_JIT_ENABLED
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#ifdef DL_JIT_ENABLED
+#include <sys/mman.h>
+#endif
+
+#include "dl/interpret/types.hpp"
+
+namespace dl::jit {
+
+// Executable memory holding generated native code.
+struct JitCode {
+    void* mem = nullptr;
+    std::size_t size = 0;
+
+    JitCode() noexcept = default;
+
+    JitCode(const JitCode&) = delete;
+
+    JitCode(JitCode&& that) noexcept:
+        mem(std::exchange(that.mem, nullptr)), size(that.size) {}
+
+    JitCode& operator=(JitCode&& that) noexcept {
+        std::swap(mem, that.mem);
+        std::swap(size, that.size);
+        return *this;
+    }
+
+    ~JitCode() noexcept {
+#ifdef DL_JIT_ENABLED
+        if (mem != nullptr)
+            munmap(mem, size);
+#endif
+    }
+
+    template<typename Fn>
+    Fn entry() const noexcept {
+        return reinterpret_cast<Fn>(mem);
+    }
+};
+
+// Copy machine code to executable memory. Returns an empty `JitCode` if none
+// can be had, or without `DL_JIT`.
+JitCode make_executable(const std::vector<std::uint8_t>& code) {
+    auto jit = JitCode();
+#ifdef DL_JIT_ENABLED
+    // Writable while copying the code in, then only executable.
+    void* mem = mmap(
+        nullptr, code.size(), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if (mem == MAP_FAILED)
+        return jit;
+    std::memcpy(mem, code.data(), code.size());
+    if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, code.size());
+        return jit;
+    }
+    jit.mem = mem;
+    jit.size = code.size();
+#else
+    (void)code;
+#endif
+    return jit;
+}
+
+// Condition codes of the `setcc` for each comparison, from `BinaryOp::EQ`.
+constexpr std::uint8_t COMPARE_CCS[] = {
+    0x94, // sete
+    0x95, // setne
+    0x9c, // setl
+    0x9e, // setle
+    0x9f, // setg
+    0x9d  // setge
+};
+
+// Stitches machine code templates together, patching in slot offsets,
+// constants and jump targets.
+//
+// Generated functions take two pointer arguments, kept in rbx and r12, the
+// second being the slots of a frame. Both are callee-saved, so helpers can be
+// called without saving anything. A slot's TID is at 16 * slot and its data at
+// 16 * slot + 8.
+struct Assembler {
+    // Where a rel32 is to be patched, and the index of the template it jumps
+    // to, or `EXIT`.
+    struct Fixup {
+        std::size_t at;
+        std::uint32_t target;
+    };
+
+    static constexpr std::uint32_t EXIT = UINT32_MAX;
+
+    std::vector<std::uint8_t> buf;
+    std::vector<Fixup> fixups;
+
+    void bytes(std::initializer_list<std::uint8_t> bs) {
+        buf.insert(buf.end(), bs);
+    }
+
+    void u32(std::uint32_t x) {
+        for (int i = 0; i < 4; i++)
+            buf.push_back(static_cast<std::uint8_t>(x >> 8 * i));
+    }
+
+    void u64(std::uint64_t x) {
+        for (int i = 0; i < 8; i++)
+            buf.push_back(static_cast<std::uint8_t>(x >> 8 * i));
+    }
+
+    // A rel32 to patch once the offset of target is known.
+    void rel32(std::uint32_t target) {
+        fixups.push_back(Fixup{buf.size(), target});
+        u32(0);
+    }
+
+    // A rel32 to a label later in the current template; returns where to
+    // patch it with `bind`.
+    std::size_t forward() {
+        u32(0);
+        return buf.size() - 4;
+    }
+
+    void bind(std::size_t at) {
+        auto rel = static_cast<std::uint32_t>(buf.size() - (at + 4));
+        std::memcpy(buf.data() + at, &rel, 4);
+    }
+
+    // Patch every rel32 given the offset of each template and of the exit.
+    void link(const std::vector<std::size_t>& offsets, std::size_t exit) {
+        for (const Fixup& fixup: fixups) {
+            std::size_t to =
+                fixup.target == EXIT ? exit : offsets[fixup.target];
+            auto rel = static_cast<std::uint32_t>(to - (fixup.at + 4));
+            std::memcpy(buf.data() + fixup.at, &rel, 4);
+        }
+    }
+
+    // ModRM and SIB of `[r12 + disp32]` with reg as the other operand.
+    void slot_operand(std::uint8_t reg, std::uint32_t disp) {
+        bytes({static_cast<std::uint8_t>(0x84 | reg << 3), 0x24});
+        u32(disp);
+    }
+
+    static std::uint32_t tid_at(std::uint32_t slot) noexcept {
+        static_assert(sizeof(Any) == 16 && offsetof(Any, data) == 8);
+        return slot * sizeof(Any);
+    }
+
+    static std::uint32_t data_at(std::uint32_t slot) noexcept {
+        return slot * sizeof(Any) + offsetof(Any, data);
+    }
+
+    void prologue() {
+        bytes({0x53});             // push rbx
+        bytes({0x41, 0x54});       // push r12
+        bytes({0x55});             // push rbp, realigning the stack
+        bytes({0x48, 0x89, 0xfb}); // mov rbx, rdi
+        bytes({0x49, 0x89, 0xf4}); // mov r12, rsi
+    }
+
+    void epilogue() {
+        bytes({0x5d});             // pop rbp
+        bytes({0x41, 0x5c});       // pop r12
+        bytes({0x5b});             // pop rbx
+        bytes({0xc3});             // ret
+    }
+
+    // mov reg, [slot data]
+    void load_data(std::uint8_t reg, std::uint32_t slot) {
+        bytes({0x49, 0x8b});
+        slot_operand(reg, data_at(slot));
+    }
+
+    // mov [slot data], reg
+    void store_data(std::uint32_t slot, std::uint8_t reg) {
+        bytes({0x49, 0x89});
+        slot_operand(reg, data_at(slot));
+    }
+
+    // cmp dword [slot tid], tid; jne forward
+    std::size_t guard_tid(std::uint32_t slot, std::uint32_t tid) {
+        bytes({0x41, 0x81});
+        slot_operand(7, tid_at(slot));
+        u32(tid);
+        bytes({0x0f, 0x85});
+        return forward();
+    }
+
+    // mov qword [slot tid], tid, which also clears the padding after it.
+    void store_tid(std::uint32_t slot, std::uint32_t tid) {
+        bytes({0x49, 0xc7});
+        slot_operand(0, tid_at(slot));
+        u32(tid);
+    }
+
+    // Copy a whole slot.
+    void move(std::uint32_t dest, std::uint32_t src) {
+        bytes({0x49, 0x8b});       // mov rax, [src tid]
+        slot_operand(0, tid_at(src));
+        load_data(2, src);         // mov rdx, [src data]
+        bytes({0x49, 0x89});       // mov [dest tid], rax
+        slot_operand(0, tid_at(dest));
+        store_data(dest, 2);       // mov [dest data], rdx
+    }
+
+    // The value is known, so its bits are patched in as immediates.
+    void loadk(std::uint32_t dest, Any value) {
+        std::uint64_t words[2];
+        std::memcpy(words, &value, sizeof(words));
+        bytes({0x48, 0xb8});       // mov rax, tid word
+        u64(words[0]);
+        bytes({0x49, 0x89});       // mov [dest tid], rax
+        slot_operand(0, tid_at(dest));
+        bytes({0x48, 0xb8});       // mov rax, data word
+        u64(words[1]);
+        store_data(dest, 0);       // mov [dest data], rax
+    }
+
+    // The value is an object, which may move, so it is loaded from where the
+    // collector keeps it up to date.
+    void loadk_at(std::uint32_t dest, const Any* at) {
+        bytes({0x48, 0xb8});       // mov rax, at
+        u64(reinterpret_cast<std::uint64_t>(at));
+        bytes({0x48, 0x8b, 0x50, 0x08}); // mov rdx, [rax + 8]
+        bytes({0x48, 0x8b, 0x00});       // mov rax, [rax]
+        bytes({0x49, 0x89});       // mov [dest tid], rax
+        slot_operand(0, tid_at(dest));
+        store_data(dest, 2);       // mov [dest data], rdx
+    }
+
+    void jump(std::uint32_t target) {
+        bytes({0xe9});             // jmp target
+        rel32(target);
+    }
+};
+
+}
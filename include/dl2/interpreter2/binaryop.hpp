@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/builtinsymbol.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/exceptions.hpp"
+#include "dl/interpreter2/interpreterimpl.hpp"
+
+namespace dl {
+
+// Binary operators with their own VM instructions. Each VM's opcodes for them
+// are in this order, so converting between the two is an offset.
+enum class BinaryOp {
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    EQ,
+    NEQ,
+    LT,
+    LTE,
+    GT,
+    GTE
+};
+
+}
+
+namespace dl::vm {
+
+// Dunder methods implementing each `BinaryOp`.
+constexpr BuiltinSymbol BINARY_DUNDERS[] = {
+    BuiltinSymbol::DUNDER_ADD,
+    BuiltinSymbol::DUNDER_SUB,
+    BuiltinSymbol::DUNDER_MUL,
+    BuiltinSymbol::DUNDER_DIV,
+    BuiltinSymbol::DUNDER_MOD,
+    BuiltinSymbol::DUNDER_EQ,
+    BuiltinSymbol::DUNDER_NEQ,
+    BuiltinSymbol::DUNDER_LT,
+    BuiltinSymbol::DUNDER_LTE,
+    BuiltinSymbol::DUNDER_GT,
+    BuiltinSymbol::DUNDER_GTE
+};
+
+template<BinaryOp OP, typename T>
+constexpr bool compare(T x, T y) noexcept {
+    using enum BinaryOp;
+    if constexpr (OP == EQ)
+        return x == y;
+    else if constexpr (OP == NEQ)
+        return x != y;
+    else if constexpr (OP == LT)
+        return x < y;
+    else if constexpr (OP == LTE)
+        return x <= y;
+    else if constexpr (OP == GT)
+        return x > y;
+    else
+        return x >= y;
+}
+
+// Apply a binary operator to operands known to be two `Int64`s without a
+// call. Returns false for results the fast path cannot produce (overflow,
+// division by zero, negative division), so that the dunder method decides.
+template<BinaryOp OP>
+bool binary_int64_typed(Any x, Any y, Any& res) noexcept {
+    using enum BinaryOp;
+    std::int64_t a = coreutil::unwrap<std::int64_t>(x);
+    std::int64_t b = coreutil::unwrap<std::int64_t>(y);
+    std::int64_t r;
+    if constexpr (OP == ADD) {
+        if (__builtin_add_overflow(a, b, &r))
+            return false;
+    } else if constexpr (OP == SUB) {
+        if (__builtin_sub_overflow(a, b, &r))
+            return false;
+    } else if constexpr (OP == MUL) {
+        if (__builtin_mul_overflow(a, b, &r))
+            return false;
+    } else if constexpr (OP == DIV || OP == MOD) {
+        if (a < 0 || b <= 0)
+            return false;
+        r = OP == DIV ? a / b : a % b;
+    } else {
+        res = coreutil::wrap(compare<OP>(a, b));
+        return true;
+    }
+    res = coreutil::wrap(r);
+    return true;
+}
+
+// Apply a binary operator to two `Int64`s without a call. Returns false for
+// other operands too.
+template<BinaryOp OP>
+bool binary_int64(Any x, Any y, Any& res) noexcept {
+    constexpr auto INT64 = static_cast<std::uint32_t>(BuiltinTypeID::INT64);
+    return x.tid == INT64 && y.tid == INT64 &&
+        binary_int64_typed<OP>(x, y, res);
+}
+
+// Apply a binary operator to operands known to be two `Float64`s without a
+// call, which always succeeds.
+template<BinaryOp OP>
+bool binary_float64_typed(Any x, Any y, Any& res) noexcept {
+    using enum BinaryOp;
+    double a = coreutil::unwrap<double>(x);
+    double b = coreutil::unwrap<double>(y);
+    if constexpr (OP == ADD)
+        res = coreutil::wrap(a + b);
+    else if constexpr (OP == SUB)
+        res = coreutil::wrap(a - b);
+    else if constexpr (OP == MUL)
+        res = coreutil::wrap(a * b);
+    else if constexpr (OP == DIV)
+        res = coreutil::wrap(a / b);
+    else if constexpr (OP == MOD)
+        res = coreutil::wrap(std::fmod(a, b));
+    else
+        res = coreutil::wrap(compare<OP>(a, b));
+    return true;
+}
+
+// Apply a binary operator to two `Float64`s without a call.
+template<BinaryOp OP>
+bool binary_float64(Any x, Any y, Any& res) noexcept {
+    constexpr auto FLOAT64 =
+        static_cast<std::uint32_t>(BuiltinTypeID::FLOAT64);
+    return x.tid == FLOAT64 && y.tid == FLOAT64 &&
+        binary_float64_typed<OP>(x, y, res);
+}
+
+// Apply a binary operator to two `Int64`s or two `Float64`s without a call.
+template<BinaryOp OP>
+bool binary_fast(Any x, Any y, Any& res) noexcept {
+    return binary_int64<OP>(x, y, res) || binary_float64<OP>(x, y, res);
+}
+
+// Apply a binary operator through the dunder method of its left operand.
+Any binary_slow(InterpreterImpl& interp, BinaryOp op, Any x, Any y) {
+    auto name = static_cast<Symbol>(BINARY_DUNDERS[static_cast<int>(op)]);
+    Any method = coreutil::get_method(interp.state, x, name);
+    if (coreutil::is_error(method)) {
+        coreutil::raise(interp.state, UnsupportedOperandError{name, x, y});
+        return coreutil::ERROR_SIGNAL;
+    }
+    return interp.call2(method, x, y);
+}
+
+}
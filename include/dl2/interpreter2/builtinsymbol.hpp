@@ -6,30 +6,42 @@ enum class BuiltinSymbol {
     NO_SYMBOL,
     ADDRESS,
     ANY,
+    ARRAY,
     BOOL,
+    CAP,
     CODE,
     DATA,
     DEF,
     DUNDER_ADD,
+    DUNDER_ADVANCE,
     DUNDER_BASES,
     DUNDER_CALL,
     DUNDER_CALL_ATTR,
     DUNDER_DEL,
+    DUNDER_DEPTH,
     DUNDER_DIV,
     DUNDER_END,
+    DUNDER_EQ,
     DUNDER_GET,
+    DUNDER_GT,
+    DUNDER_GTE,
     DUNDER_IADD,
     DUNDER_ISUB,
     DUNDER_IMUL,
     DUNDER_IDIV,
     DUNDER_IMOD,
+    DUNDER_ITEM,
     DUNDER_ITER,
+    DUNDER_LT,
+    DUNDER_LTE,
     DUNDER_MOD,
     DUNDER_MUL,
     DUNDER_NAME,
+    DUNDER_NEQ,
     DUNDER_SET,
     DUNDER_STRUCT,
     DUNDER_SUB,
+    DUNDER_SUPERS,
     DUNDER_TID,
     DUNDER_UPDATE,
     DUNDER_UPDATE_ATTR,
@@ -69,6 +81,6 @@ enum class BuiltinSymbol {
     UINT32,
     UINT64,
     XS
-}
+};
 
 }
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
+#include <iterator>
+
 namespace dl {
 
 enum class BuiltinTypeID {
@@ -39,34 +42,99 @@ enum class BuiltinTypeID {
     INT32,
     INT64,
     FLOAT32,
-    FLOAT64
+    FLOAT64,
+    ARRAY
 };
 
+// Payload sizes of the builtin types, indexed by TID.
 constexpr std::uint32_t BUILTIN_SIZES[] = {
+    0, // ERROR_SIGNAL
     0, // NONE_TYPE
     sizeof(void*), // ADDRESS
     sizeof(void*), // FN_PTR
+    1, // DUNDER_BOOL
+    1, // DUNDER_UINT8
+    2, // DUNDER_UINT16
+    4, // DUNDER_UINT32
+    8, // DUNDER_UINT64
+    1, // DUNDER_INT8
+    2, // DUNDER_INT16
+    4, // DUNDER_INT32
+    8, // DUNDER_INT64
+    4, // DUNDER_FLOAT32
+    8, // DUNDER_FLOAT64
+    4, // SYMBOL
+    8 + sizeof(void*), // ANY
+    4 + 4 + sizeof(void*), // DEF
+    4 + sizeof(void*), // SEQ
+    4 + 4 + 3 * sizeof(void*), // VARS
+    8 + 4 + 3 * sizeof(void*), // STRUCT
+    4 + sizeof(void*), // TIDS
+    5 * (4 + 3 * sizeof(void*)) + 2 * (4 + sizeof(void*)) + 4 + 4 + 4, // TYPE
+    // TYPE, then `dunder_add` and `dunder_sub`.
+    5 * (4 + 3 * sizeof(void*)) + 2 * (4 + sizeof(void*)) + 4 + 4 + 4
+        + 2 * (4 + 4 + sizeof(void*)), // PTR_TYPE
     1, // BOOL
-    1, // INT8
-    2, // INT16
-    4, // INT32
-    8, // INT64
     1, // UINT8
     2, // UINT16
     4, // UINT32
     8, // UINT64
+    1, // INT8
+    2, // INT16
+    4, // INT32
+    8, // INT64
     4, // FLOAT32
     8, // FLOAT64
-    4, // SYMBOL
-    8, // QUALIFIED
-    8 + sizeof(void*), // ANY
-    4 + sizeof(void*), // SEQ
-    4 + 3 * sizeof(void*), // FIXED_VARS
-    8 + 4 + 3 * sizeof(void*), // STRUCT
-    4 + sizeof(void*), // TYPE_SEQ
-    5 * (4 + 3 * sizeof(void*)) + (4 + sizeof(void*)) + 4 + 4 // TYPE
+    4 + 4 + 4 + sizeof(void*) // ARRAY
+};
+
+static_assert(
+    std::size(BUILTIN_SIZES) ==
+        static_cast<std::size_t>(BuiltinTypeID::ARRAY) + 1,
+    "BUILTIN_SIZES needs an entry for every BuiltinTypeID"
+);
+
+// Whether objects of the type with the given TID are immediates, i.e., whether
+// their payload is stored inline in `Any::data` rather than being pointed to by
+// it. Every immediate payload fits in the 8 bytes of a `void*`.
+constexpr bool is_immediate_tid(std::uint32_t tid) noexcept {
+    using enum BuiltinTypeID;
+    return
+        tid == static_cast<std::uint32_t>(NONE_TYPE) ||
+        tid == static_cast<std::uint32_t>(SYMBOL) ||
+        tid >= static_cast<std::uint32_t>(BOOL) &&
+        tid <= static_cast<std::uint32_t>(FLOAT64);
 }
 
+// Size of the payload of an immediate with the given TID.
+constexpr std::uint32_t immediate_size(std::uint32_t tid) noexcept {
+    using enum BuiltinTypeID;
+    switch(static_cast<BuiltinTypeID>(tid)) {
+    case NONE_TYPE:
+        return 0;
+    case BOOL:
+    case UINT8:
+    case INT8:
+        return 1;
+    case UINT16:
+    case INT16:
+        return 2;
+    case SYMBOL:
+    case UINT32:
+    case INT32:
+    case FLOAT32:
+        return 4;
+    case UINT64:
+    case INT64:
+    case FLOAT64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static_assert(sizeof(void*) == 8, "Immediates need an 8-byte data slot");
+
 // Gives the TID for a builtin type.
 template<typename T>
 constexpr BuiltinTypeID tid_for = BuiltinTypeID::ERROR_SIGNAL;
@@ -113,10 +181,20 @@ constexpr BuiltinTypeID tid_for<Any> = BuiltinTypeID::ANY;
 template<>
 constexpr BuiltinTypeID tid_for<Seq> = BuiltinTypeID::SEQ;
 
+template<>
+constexpr BuiltinTypeID tid_for<Array> = BuiltinTypeID::ARRAY;
+
 template<>
 constexpr BuiltinTypeID tid_for<Struct> = BuiltinTypeID::STRUCT;
 
 template<>
 constexpr BuiltinTypeID tid_for<Type> = BuiltinTypeID::TYPE;
 
+// Whether `T` is stored as an immediate. `Symbol` and `None` have no C++ type
+// of their own here, so they are wrapped with `coreutil::wrap_symbol` and
+// `coreutil::NONE` instead.
+template<typename T>
+constexpr bool is_immediate =
+    is_immediate_tid(static_cast<std::uint32_t>(tid_for<T>));
+
 }
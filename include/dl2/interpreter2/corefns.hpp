@@ -1,9 +1,356 @@
 #pragma once
 
+#include <cstring>
+
 #include "dl/interpret/types.hpp"
+#include "dl/interpreter2/array.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/exceptions.hpp"
+#include "dl/interpreter2/simd.hpp"
 
 namespace dl::corefn {
 
+// The arguments of an array builtin, if there are nargs of them and the first
+// is an `Array`; otherwise raises and returns null.
+Seq* array_args(State& state, std::uint32_t nargs) {
+    Seq& args = coreutil::args(state).args;
+    if (args.len != nargs) {
+        coreutil::raise(state, NumArgsError{nargs, nargs, args.len});
+        return nullptr;
+    }
+    auto array_tid = static_cast<std::uint32_t>(BuiltinTypeID::ARRAY);
+    if (args.xs[0].tid != array_tid) {
+        coreutil::raise(state, ArgTypeError{0, args.xs[0]});
+        return nullptr;
+    }
+    return &args;
+}
+
+// Whether index, argument i of an array builtin, is a `UInt64` less than the
+// length of arr; raises if not. Callers in `core.dl` have wrapped negative
+// indices already.
+bool array_index(State& state, const Array& arr, std::uint32_t i, Any index) {
+    if (
+        index.tid != static_cast<std::uint32_t>(BuiltinTypeID::UINT64) ||
+        coreutil::unwrap<std::uint64_t>(index) >= arr.len
+    ) {
+        coreutil::raise(state, ArgTypeError{i, index});
+        return false;
+    }
+    return true;
+}
+
+// `___array_at___(arr, i)`
+Any array_at(State& state) {
+    Seq* args = array_args(state, 2);
+    if (args == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    auto& arr = coreutil::unwrap<Array>(args->xs[0]);
+    if (!array_index(state, arr, 1, args->xs[1]))
+        return coreutil::ERROR_SIGNAL;
+    auto i = static_cast<std::uint32_t>(
+        coreutil::unwrap<std::uint64_t>(args->xs[1])
+    );
+    return array::load(arr, i);
+}
+
+// `___array_len___(arr)`
+Any array_len(State& state) {
+    Seq* args = array_args(state, 1);
+    if (args == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    auto& arr = coreutil::unwrap<Array>(args->xs[0]);
+    return coreutil::wrap(static_cast<std::uint64_t>(arr.len));
+}
+
+// `___array_new___(t, cap)`: an empty `Array[t]` with room for cap elements.
+Any array_new(State& state) {
+    Seq& args = coreutil::args(state).args;
+    if (args.len != 2) {
+        coreutil::raise(state, NumArgsError{2, 2, args.len});
+        return coreutil::ERROR_SIGNAL;
+    }
+    Any t = args.xs[0];
+    if (
+        t.tid != static_cast<std::uint32_t>(BuiltinTypeID::TYPE) ||
+        !array::is_elem_tid(coreutil::unwrap<Type>(t).dunder_tid)
+    ) {
+        coreutil::raise(state, ArgTypeError{0, t});
+        return coreutil::ERROR_SIGNAL;
+    }
+    Any cap = args.xs[1];
+    if (
+        cap.tid != static_cast<std::uint32_t>(BuiltinTypeID::UINT64) ||
+        coreutil::unwrap<std::uint64_t>(cap) > array::MAX_LEN
+    ) {
+        coreutil::raise(state, ArgTypeError{1, cap});
+        return coreutil::ERROR_SIGNAL;
+    }
+    return array::make(
+        state, coreutil::unwrap<Type>(t).dunder_tid,
+        static_cast<std::uint32_t>(coreutil::unwrap<std::uint64_t>(cap))
+    );
+}
+
+// `___array_push___(arr, x)`, where x must be of the element type.
+Any array_push(State& state) {
+    Seq* args = array_args(state, 2);
+    if (args == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    auto& arr = coreutil::unwrap<Array>(args->xs[0]);
+    Any x = args->xs[1];
+    if (x.tid != arr.tid) {
+        coreutil::raise(state, ArgTypeError{1, x});
+        return coreutil::ERROR_SIGNAL;
+    }
+    if (array::push(state, arr, x) != 0)
+        return coreutil::ERROR_SIGNAL;
+    return coreutil::NONE;
+}
+
+// `___array_update___(arr, i, x)`, where x must be of the element type.
+Any array_update(State& state) {
+    Seq* args = array_args(state, 3);
+    if (args == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    auto& arr = coreutil::unwrap<Array>(args->xs[0]);
+    if (!array_index(state, arr, 1, args->xs[1]))
+        return coreutil::ERROR_SIGNAL;
+    Any x = args->xs[2];
+    if (x.tid != arr.tid) {
+        coreutil::raise(state, ArgTypeError{2, x});
+        return coreutil::ERROR_SIGNAL;
+    }
+    auto i = static_cast<std::uint32_t>(
+        coreutil::unwrap<std::uint64_t>(args->xs[1])
+    );
+    array::store(arr, i, x);
+    return coreutil::NONE;
+}
+
+// The elements of y, argument 1 of an elementwise array builtin, in ys:
+// either those of an array with the same element type and length as xs, or y
+// itself if it is one element, to pair with each of those of xs. Raises and
+// returns false if y is neither.
+bool array_operand(
+    State& state, const Array& xs, Any& y, const void*& ys,
+    bool& broadcast
+) {
+    broadcast = y.tid == xs.tid;
+    if (broadcast) {
+        // Elements are immediates, stored in the argument itself.
+        ys = &y.data;
+        return true;
+    }
+    if (
+        y.tid != static_cast<std::uint32_t>(BuiltinTypeID::ARRAY) ||
+        coreutil::unwrap<Array>(y).tid != xs.tid
+    ) {
+        coreutil::raise(state, ArgTypeError{1, y});
+        return false;
+    }
+    auto& arr = coreutil::unwrap<Array>(y);
+    if (arr.len != xs.len) {
+        coreutil::raise(state, ArrayLengthError{xs.len, arr.len});
+        return false;
+    }
+    ys = arr.data;
+    return true;
+}
+
+// The first argument of an array builtin over numbers, if there are nargs
+// arguments and it is an array of numbers; otherwise raises and returns null.
+Array* num_array_arg(State& state, std::uint32_t nargs) {
+    Seq* args = array_args(state, nargs);
+    if (args == nullptr)
+        return nullptr;
+    auto& arr = coreutil::unwrap<Array>(args->xs[0]);
+    if (arr.tid == static_cast<std::uint32_t>(BuiltinTypeID::BOOL)) {
+        coreutil::raise(state, ArgTypeError{0, args->xs[0]});
+        return nullptr;
+    }
+    return &arr;
+}
+
+// A new array of len elements of type tid, with its length already set.
+Any array_of_len(State& state, std::uint32_t tid, std::uint32_t len) {
+    Any res = array::make(state, tid, len);
+    coreutil::unwrap<Array>(res).len = len;
+    return res;
+}
+
+// `___array_add___(xs, ys)` and the rest of the arithmetic builtins: a new
+// array of xs OP ys elementwise.
+template<BinaryOp OP>
+Any array_arith(State& state) {
+    Array* xs = num_array_arg(state, 2);
+    if (xs == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    const void* ys;
+    bool broadcast;
+    Any& y = coreutil::args(state).args.xs[1];
+    if (!array_operand(state, *xs, y, ys, broadcast))
+        return coreutil::ERROR_SIGNAL;
+    Any res = array_of_len(state, xs->tid, xs->len);
+    auto& out = coreutil::unwrap<Array>(res);
+    std::size_t n = xs->len;
+    bool ok = array::with_num_type(xs->tid, [&]<typename T>() {
+        T* dst = array::elems<T>(out);
+        const T* src = array::elems<T>(*xs);
+        auto rhs = static_cast<const T*>(ys);
+        if (broadcast)
+            return simd::run<simd::Arith<OP, true, T>>(dst, src, rhs, n);
+        return simd::run<simd::Arith<OP, false, T>>(dst, src, rhs, n);
+    });
+    if (!ok) {
+        coreutil::raise(state, DivideByZeroError{});
+        return coreutil::ERROR_SIGNAL;
+    }
+    return res;
+}
+
+// `___array_eq___(xs, ys)` and the rest of the comparison builtins: a new
+// `Array[Bool]` of xs OP ys elementwise.
+template<BinaryOp OP>
+Any array_compare(State& state) {
+    Array* xs = num_array_arg(state, 2);
+    if (xs == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    const void* ys;
+    bool broadcast;
+    Any& y = coreutil::args(state).args.xs[1];
+    if (!array_operand(state, *xs, y, ys, broadcast))
+        return coreutil::ERROR_SIGNAL;
+    Any res = array_of_len(
+        state, static_cast<std::uint32_t>(BuiltinTypeID::BOOL), xs->len
+    );
+    auto& out = coreutil::unwrap<Array>(res);
+    std::size_t n = xs->len;
+    array::with_num_type(xs->tid, [&]<typename T>() {
+        bool* dst = array::elems<bool>(out);
+        const T* src = array::elems<T>(*xs);
+        auto rhs = static_cast<const T*>(ys);
+        if (broadcast)
+            simd::run<simd::Compare<OP, true, T>>(dst, src, rhs, n);
+        else
+            simd::run<simd::Compare<OP, false, T>>(dst, src, rhs, n);
+    });
+    return res;
+}
+
+// `___array_dot___(xs, ys)`: the sum of the products of the elements of two
+// arrays alike.
+Any array_dot(State& state) {
+    Array* xs = num_array_arg(state, 2);
+    if (xs == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    Any& y = coreutil::args(state).args.xs[1];
+    const void* ys;
+    bool broadcast;
+    if (!array_operand(state, *xs, y, ys, broadcast))
+        return coreutil::ERROR_SIGNAL;
+    if (broadcast) {
+        coreutil::raise(state, ArgTypeError{1, y});
+        return coreutil::ERROR_SIGNAL;
+    }
+    return array::with_num_type(xs->tid, [&]<typename T>() {
+        T dot = simd::run<simd::Dot<T>>(
+            array::elems<T>(*xs), static_cast<const T*>(ys),
+            std::size_t{xs->len}
+        );
+        return coreutil::load_immediate(xs->tid, &dot);
+    });
+}
+
+// `___array_sum___(arr)`
+Any array_sum(State& state) {
+    Array* arr = num_array_arg(state, 1);
+    if (arr == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    return array::with_num_type(arr->tid, [&]<typename T>() {
+        T sum = simd::run<simd::Sum<T>>(
+            array::elems<T>(*arr), std::size_t{arr->len}
+        );
+        return coreutil::load_immediate(arr->tid, &sum);
+    });
+}
+
+// `___array_min___(arr)` if not MAX, otherwise `___array_max___(arr)`.
+template<bool MAX>
+Any array_extreme(State& state) {
+    Array* arr = num_array_arg(state, 1);
+    if (arr == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    if (arr->len == 0) {
+        Any obj = coreutil::args(state).args.xs[0];
+        coreutil::raise(state, EmptyArrayError{obj});
+        return coreutil::ERROR_SIGNAL;
+    }
+    return array::with_num_type(arr->tid, [&]<typename T>() {
+        T best = simd::run<simd::Extreme<MAX, T>>(
+            array::elems<T>(*arr), std::size_t{arr->len}
+        );
+        return coreutil::load_immediate(arr->tid, &best);
+    });
+}
+
+// `___array_fill___(arr, x)`: set every element of arr to x, which must be of
+// its element type.
+Any array_fill(State& state) {
+    Seq* args = array_args(state, 2);
+    if (args == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    auto& arr = coreutil::unwrap<Array>(args->xs[0]);
+    Any x = args->xs[1];
+    if (x.tid != arr.tid) {
+        coreutil::raise(state, ArgTypeError{1, x});
+        return coreutil::ERROR_SIGNAL;
+    }
+    array::with_elem_type(arr.tid, [&]<typename T>() {
+        T elem;
+        std::memcpy(&elem, &x.data, sizeof(T));
+        simd::run<simd::Fill<T>>(
+            array::elems<T>(arr), elem, std::size_t{arr.len}
+        );
+    });
+    return coreutil::NONE;
+}
+
+// `___array_convert___(t, arr)`: a new `Array[t]` of the elements of arr
+// converted to t.
+Any array_convert(State& state) {
+    Seq& args = coreutil::args(state).args;
+    if (args.len != 2) {
+        coreutil::raise(state, NumArgsError{2, 2, args.len});
+        return coreutil::ERROR_SIGNAL;
+    }
+    Any t = args.xs[0];
+    if (
+        t.tid != static_cast<std::uint32_t>(BuiltinTypeID::TYPE) ||
+        !array::is_elem_tid(coreutil::unwrap<Type>(t).dunder_tid)
+    ) {
+        coreutil::raise(state, ArgTypeError{0, t});
+        return coreutil::ERROR_SIGNAL;
+    }
+    if (args.xs[1].tid != static_cast<std::uint32_t>(BuiltinTypeID::ARRAY)) {
+        coreutil::raise(state, ArgTypeError{1, args.xs[1]});
+        return coreutil::ERROR_SIGNAL;
+    }
+    auto& arr = coreutil::unwrap<Array>(args.xs[1]);
+    std::uint32_t tid = coreutil::unwrap<Type>(t).dunder_tid;
+    Any res = array_of_len(state, tid, arr.len);
+    auto& out = coreutil::unwrap<Array>(res);
+    array::with_elem_type(tid, [&]<typename To>() {
+        array::with_elem_type(arr.tid, [&]<typename From>() {
+            simd::run<simd::Convert<To, From>>(
+                array::elems<To>(out), array::elems<From>(arr),
+                std::size_t{arr.len}
+            );
+        });
+    });
+    return res;
+}
+
 template<typename FromType, typename ToType>
 Any convert(Vars& globals, Args& arg, ExcInfo& exc_info) {
     auto from = *static_cast<FromType*>(args.args.xs[0]);
@@ -12,7 +359,7 @@ Any convert(Vars& globals, Args& arg, ExcInfo& exc_info) {
 
 Any dunder_new(Vars& globals, Args& args, ExcInfo& exc_info) {
     auto type = *static_cast<Type*>(args.args.xs[0].data);
-    return Any{type.tid, new(type.structure.size)};
+    return Any{type.tid, coreutil::alloc(type.tid, type.structure.size)};
 }
 
 Any dunder_ptradd(State& state) {
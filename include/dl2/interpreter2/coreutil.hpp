@@ -2,18 +2,81 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <new>
+#include <vector>
 
 #include "dl/interpet/types.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/heap.hpp"
+
+namespace dl::gc {
+
+// Defined in `dl/interpreter2/gc.hpp`, which depends on this file.
+void write_barrier(State& state, std::uint32_t tid, void* dest);
+
+}
 
 namespace dl::coreutil {
 
 constexpr std::uint32_t MAX_TID = UINT32_MAX - BuiltinTypeID::DUNDER_FLOAT64;
 constexpr auto ERROR_SIGNAL = Any{BuiltinTypeID::ERROR_SIGNAL, nullptr};
 
+// `Type::dunder_depth` of types with more than one base in their ancestry.
+constexpr std::uint32_t NO_DEPTH = UINT32_MAX;
+
+// None is an immediate with an empty payload, so there is only ever one value.
+constexpr auto NONE = Any{BuiltinTypeID::NONE_TYPE, nullptr};
+
+// Adjacent values an iteration keeps its state in: the sequence or iterator,
+// the `Int64` index into a sequence or whether an iterator must advance before
+// its next item, and the iterator's `__end__`, `__item__` and `__advance__`.
+// See `InterpreterImpl::iter_begin`.
+constexpr std::uint32_t ITER_SLOTS = 5;
+
 Args& args(State& state) noexcept {
     return state.stack.args[state.stack.call_depth];
 }
 
+void compute_supers(State& state, Type& type) {
+    // Precompute the ancestors of a type so that `issubclass` need not walk
+    // `dunder_bases`. If every ancestor has at most one base, they form a
+    // chain which is stored root first as a Cohen display, so that a type is
+    // found at index `dunder_depth` in the display of each of its subclasses.
+    // Otherwise, the ancestors are stored sorted by TID for binary search.
+    TIDs& bases = type.dunder_bases;
+    bool is_chain = bases.len == 0 ||
+        bases.len == 1 &&
+        get_type(state, bases.tids[0]).dunder_depth != NO_DEPTH;
+    if (is_chain) {
+        TIDs parent = TIDs{nullptr, 0};
+        if (bases.len == 1)
+            parent = get_type(state, bases.tids[0]).dunder_supers;
+        std::uint32_t len = parent.len + 1;
+        type.dunder_supers = TIDs{new std::uint32_t[len], len};
+        std::copy_n(parent.tids, parent.len, type.dunder_supers.tids);
+        type.dunder_supers.tids[parent.len] = type.dunder_tid;
+        type.dunder_depth = parent.len;
+        return;
+    }
+    auto supers = std::vector<std::uint32_t>{type.dunder_tid};
+    for (std::uint32_t i = 0; i < bases.len; i++) {
+        // Whichever form the base uses, its supers are all of its ancestors.
+        const TIDs& base_supers = get_type(state, bases.tids[i]).dunder_supers;
+        supers.insert(
+            supers.end(), base_supers.tids, base_supers.tids + base_supers.len
+        );
+    }
+    std::sort(supers.begin(), supers.end());
+    supers.erase(std::unique(supers.begin(), supers.end()), supers.end());
+    auto len = static_cast<std::uint32_t>(supers.size());
+    type.dunder_supers = TIDs{new std::uint32_t[len], len};
+    std::copy(supers.begin(), supers.end(), type.dunder_supers.tids);
+    type.dunder_depth = NO_DEPTH;
+}
+
 Def core_def(State& state, BuiltinSymbol name) noexcept {
     return unwrap<Def>(
         get_var(name, unwrap<Vars>(
@@ -23,9 +86,13 @@ Def core_def(State& state, BuiltinSymbol name) noexcept {
 }
 
 Any deref(State& state, Any obj) noexcept {
-    return Any{
-        deref_tid(state, obj.tid), *static_cast<void**>(obj.data)
-    };
+    // A pointer's payload is the address of the payload of the object it
+    // points to. Immediates must be loaded from there into the inline slot.
+    std::uint32_t tid = deref_tid(state, obj.tid);
+    void* addr = *static_cast<void**>(obj.data);
+    if (is_immediate_tid(tid))
+        return load_immediate(tid, addr);
+    return Any{tid, addr};
 }
 
 std::uint32_t deref_tid(State& state, std::uint32_t tid) noexcept {
@@ -45,10 +112,23 @@ Any deref_until(State& state, Any obj, std::uint32_t naddr) noexcept {
     return obj;
 }
 
+void* alloc(std::uint32_t tid, std::uint64_t size) noexcept {
+    // Allocate a payload for a new runtime object on the collected heap.
+    return runtime_heap().allocate(tid, size);
+}
+
 Vars empty_vars() {
     return Vars{nullptr, nullptr, nullptr, 0, 0};
 }
 
+Vars fixed_vars(std::uint32_t cap) {
+    // Allocate an empty table which is reused rather than grown, such as the
+    // keyword arguments of a call depth.
+    return Vars{
+        new Symbol[cap](), new Any[cap](), new std::uint32_t[cap], 0, cap
+    };
+}
+
 Any get_method(State& state, Any obj, Symbol name) noexcept {
     return get_var(symbol, get_type(state, obj).dunder_callattr);
 }
@@ -69,6 +149,25 @@ Type& get_type(State& state, std::uint32_t tid) noexcept {
     return *static_cast<Type*>(types(state).xs[tid].data);
 }
 
+// Find the field called name of objects of type tid.
+bool find_field(
+    State& state, std::uint32_t tid, Symbol name, std::uint32_t& field_tid,
+    std::uint32_t& offset
+) noexcept {
+    const Struct& structure = get_type(state, tid).dunder_struct;
+    // Pointer types keep their target type in `len`, and have no names.
+    if (structure.names == nullptr)
+        return false;
+    for (std::uint32_t i = 0; i < structure.len; i++) {
+        if (structure.names[i] == name) {
+            field_tid = structure.tids[i];
+            offset = structure.offsets[i];
+            return true;
+        }
+    }
+    return false;
+}
+
 Any get_var(Symbol name, const Vars& vars) noexcept {
     std::uint32_t idx = name % vars.cap;
     Symbol found = vars.names[idx];
@@ -88,25 +187,26 @@ Vars& globals(State& state) {
 std::int64_t integer_as_int64(Any integer) noexcept {
     using enum BuiltinTypeID;
 
+    // All integers are immediates, so this never touches the heap.
     switch(static_cast<BuiltinTypeID>(integer.tid)) {
     case BOOL:
-        return std::int64_t(*static_cast<bool*>(integer.data));
+        return std::int64_t(unwrap<bool>(integer));
     case UINT8:
-        return std::int64_t(*static_cast<std::uint8_t*>(integer.data));
+        return std::int64_t(unwrap<std::uint8_t>(integer));
     case UINT16:
-        return std::int64_t(*static_cast<std::uint16_t*>(integer.data));
+        return std::int64_t(unwrap<std::uint16_t>(integer));
     case UINT32:
-        return std::int64_t(*static_cast<std::uint32_t*>(integer.data));
+        return std::int64_t(unwrap<std::uint32_t>(integer));
     case UINT64:
-        return std::int64_t(*static_cast<std::uint64_t*>(integer.data));
+        return std::int64_t(unwrap<std::uint64_t>(integer));
     case INT8:
-        return std::int64_t(*static_cast<std::int8_t*>(integer.data));
+        return std::int64_t(unwrap<std::int8_t>(integer));
     case INT16:
-        return std::int64_t(*static_cast<std::int16_t*>(integer.data));
+        return std::int64_t(unwrap<std::int16_t>(integer));
     case INT32:
-        return std::int64_t(*static_cast<std::int32_t*>(integer.data));
+        return std::int64_t(unwrap<std::int32_t>(integer));
     case INT64:
-        return *static_cast<std::int64_t*>(integer.data);
+        return unwrap<std::int64_t>(integer);
     default:
         assert(false);
     }
@@ -116,6 +216,10 @@ bool is_error(Any obj) {
     return obj.tid == BuiltinTypeID::ERROR_SIGNAL;
 }
 
+bool is_immediate(Any obj) noexcept {
+    return is_immediate_tid(obj.tid);
+}
+
 bool is_integer(Any obj) {
     return obj.tid >= BuiltinTypeID::BOOL && obj.tid <= BuiltinTypeID::UINT64;
 }
@@ -129,16 +233,47 @@ bool is_ptr_type(State& state, std::uint32_t tid) {
     return structure.names == nullptr && structure.len < MAX_TID;
 }
 
+// Whether objects of type tid are builtin sequences, whose items are read in
+// place with `seq_item` rather than through `__iter__`.
+bool is_seq_tid(std::uint32_t tid) noexcept {
+    return tid == BuiltinTypeID::SEQ || tid == BuiltinTypeID::TIDS ||
+        tid == BuiltinTypeID::ARRAY;
+}
+
 bool issubclass(
     State& state, std::uint32_t child_tid, std::uint32_t parent_tid
 ) {
+    // Whether parent is a proper ancestor of child, using the supers computed
+    // by `compute_supers`.
+    if (child_tid == parent_tid)
+        return false;
     Type& child_type = get_type(state, child_tid);
-    for (std::uint32_t i = 0; i < child_type.dunder_bases.len; i++) {
-        std::uint32_t base_tid = child_type.dunder_bases.tids[i];
-        if (base_tid == parent_tid || issubclass(state, base_tid, parent_tid))
-            return true;
+    const TIDs& supers = child_type.dunder_supers;
+    if (child_type.dunder_depth != NO_DEPTH) {
+        // A chain can only contain types which are themselves in a chain, at
+        // their own depth.
+        std::uint32_t depth = get_type(state, parent_tid).dunder_depth;
+        return depth < supers.len && supers.tids[depth] == parent_tid;
     }
-    return false;
+    return std::binary_search(
+        supers.tids, supers.tids + supers.len, parent_tid
+    );
+}
+
+Any load_immediate(std::uint32_t tid, const void* addr) noexcept {
+    // Copy an immediate payload from memory into the inline slot of an `Any`.
+    auto res = Any{tid, nullptr};
+    std::memcpy(&res.data, addr, immediate_size(tid));
+    return res;
+}
+
+// Fields are embedded in their object, so a field that is not an immediate is
+// an interior reference into it.
+Any load_field(Any obj, std::uint32_t field_tid, std::uint32_t offset) {
+    char* addr = static_cast<char*>(obj.data) + offset;
+    if (is_immediate_tid(field_tid))
+        return load_immediate(field_tid, addr);
+    return Any{field_tid, addr};
 }
 
 void make_ptr_type(State& state, std::uint32_t tid) {
@@ -172,6 +307,14 @@ std::uint32_t nptr(State& state, std::uint32_t tid) {
     return i;
 }
 
+void* payload(Any& obj) noexcept {
+    // Address of the payload of obj: the inline slot for immediates, otherwise
+    // the memory data points to.
+    if (is_immediate(obj))
+        return static_cast<void*>(&obj.data);
+    return obj.data;
+}
+
 template<typename E>
 void raise(State& state, E exc) {
     state.exc_info.raised = wrap(exc);
@@ -182,12 +325,42 @@ std::uint32_t register_type(State& state, Any t) {
     Seq& ts = types(state);
     if (ts.len == state.config.max_types)
         raise(state, TypeOverflowError{state.config.max_types});
-    static_cast<Type*>(t.data)->tid = ts.len;
+    static_cast<Type*>(t.data)->dunder_tid = ts.len;
+    compute_supers(state, *static_cast<Type*>(t.data));
+    // Give the type's payloads a size class of their own if there is room.
+    runtime_heap().add_size_class(
+        static_cast<Type*>(t.data)->dunder_struct.size
+    );
     ts[ts.len++] = t;
     return ts.len - 1;
 }
 
-int set(State& state, Any from, Any to) {
+// Item i of xs, a builtin sequence, where i is less than `seq_len(xs)`. The
+// items of `TIDs` are `UInt32`s, and those of an `Array` are boxed here.
+Any seq_item(Any xs, std::uint32_t i) noexcept {
+    if (xs.tid == BuiltinTypeID::SEQ)
+        return static_cast<Seq*>(xs.data)->xs[i];
+    if (xs.tid == BuiltinTypeID::ARRAY) {
+        auto& arr = *static_cast<Array*>(xs.data);
+        auto elems = static_cast<const char*>(arr.data);
+        std::uint64_t offset =
+            static_cast<std::uint64_t>(i) * immediate_size(arr.tid);
+        return load_immediate(arr.tid, elems + offset);
+    }
+    return load_immediate(
+        BuiltinTypeID::UINT32, &static_cast<TIDs*>(xs.data)->tids[i]
+    );
+}
+
+std::uint32_t seq_len(Any xs) noexcept {
+    if (xs.tid == BuiltinTypeID::SEQ)
+        return static_cast<Seq*>(xs.data)->len;
+    if (xs.tid == BuiltinTypeID::ARRAY)
+        return static_cast<Array*>(xs.data)->len;
+    return static_cast<TIDs*>(xs.data)->len;
+}
+
+int set(State& state, Any& from, Any to) {
     Any set_method = get_method(state, from, BuiltinSymbol::DUNDER_SET);
     if (set_method.tid == BuiltinTypeID::ERROR_SIGNAL)
         return set0(state, from, to);
@@ -197,15 +370,26 @@ int set(State& state, Any from, Any to) {
     return 0;
 }
 
-int set0(State& state, Any from, Any to) {
-    if (!issubclass(state, from, to))
+int set0(State& state, std::uint32_t tid, void* dest, Any to) {
+    // Copy the payload of to into the payload of type tid at dest. For
+    // immediates, dest may point into an inline slot.
+    if (to.tid != tid && !issubclass(state, to.tid, tid))
         return 1;
-    std::uint64_t sz = get_size(state, to);
-    std::memcpy(from.data, to.data, sz);
+    if (is_immediate_tid(to.tid)) {
+        std::memcpy(dest, &to.data, immediate_size(to.tid));
+        return 0;
+    }
+    std::memcpy(dest, to.data, get_size(state, to));
+    // The copied payload may hold references the collector has to know about.
+    gc::write_barrier(state, to.tid, dest);
     return 0;
 }
 
-int InterpreterImpl::set_var(
+int set0(State& state, Any& from, Any to) {
+    return set0(state, from.tid, payload(from), to);
+}
+
+int set_var(
     State& state, Symbol name, Any value, Vars& vars, std::uint32_t naddr
 ) {
     std::uint32_t idx = name % vars.cap;
@@ -218,15 +402,29 @@ int InterpreterImpl::set_var(
             }
             vars.idxs[vars.len++] = idx;
             vars.data[idx] = value;
+            gc::write_barrier(
+                state, BuiltinTypeID::ANY, static_cast<void*>(&vars.data[idx])
+            );
             return 0;
         }
 
         if (found == name) {
-            Any data = vars.data[idx];
-            data = deref_until(state, data, naddr);
-            if (is_error(data))
+            Any& data = vars.data[idx];
+            std::uint32_t numptr = nptr(state, data.tid);
+            if (naddr == numptr)
+                // Set in place so that immediates are updated in their slot.
+                return set(state, data, value);
+            if (naddr > numptr) {
+                raise(state, PtrDepthError{data, naddr, numptr});
                 return 1;
-            return set(state, data, value);
+            }
+            // Stop one pointer short of the target so its address is known.
+            Any ptr = deref_until(state, data, naddr + 1);
+            std::uint32_t tid = deref_tid(state, ptr.tid);
+            if (is_immediate_tid(tid))
+                return set0(state, tid, *static_cast<void**>(ptr.data), value);
+            Any target = deref(state, ptr);
+            return set(state, target, value);
         }
         idx = (idx + 1) % vars.cap;
     }
@@ -239,13 +437,30 @@ Seq& types(State& state) noexcept {
 }
 
 template<typename T>
-T& unwrap(Any obj) {
+T& unwrap(Any& obj) {
+    return *static_cast<T*>(payload(obj));
+}
+
+template<typename T>
+T& unwrap(Any&& obj) {
+    // An immediate would be unwrapped from a slot that is about to die.
+    static_assert(!is_immediate<T>);
     return *static_cast<T*>(obj.data);
 }
 
 template<typename T>
 Any wrap(T obj) {
-    return Any{tid_for<T>, new T(obj)};
+    if constexpr (is_immediate<T>) {
+        auto res = Any{tid_for<T>, nullptr};
+        std::memcpy(&res.data, &obj, sizeof(T));
+        return res;
+    } else
+        return Any{tid_for<T>, new(alloc(tid_for<T>, sizeof(T))) T(obj)};
+}
+
+Any wrap_symbol(Symbol sym) noexcept {
+    // Symbol shares its C++ type with UInt32, so it cannot go through wrap.
+    return load_immediate(BuiltinTypeID::SYMBOL, &sym);
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,8 @@
+#pragma once
+
+// Direct-threaded dispatch needs the labels-as-values extension. Define
+// `DL_NO_COMPUTED_GOTO` to force the portable switch loops, e.g. to compare the
+// two.
+#if defined(__GNUC__) && !defined(DL_NO_COMPUTED_GOTO)
+#define DL_COMPUTED_GOTO
+#endif
@@ -11,11 +11,47 @@ struct ArgTypeError {
     Any obj;
 };
 
+struct ArrayLengthError {
+    std::uint32_t expected;
+    std::uint32_t actual;
+};
+
+struct ArrayOverflowError {
+    std::uint32_t max;
+};
+
+struct DivideByZeroError {};
+
+struct DuplicateKeywordError {
+    Symbol keyword;
+};
+
+struct EmptyArrayError {
+    Any obj;
+};
+
 struct KeywordsError {
     Symbol* keywords;
     std::uint32_t len;
 };
 
+struct NoAttrError {
+    Any obj;
+    Symbol name;
+};
+
+struct NotBoolError {
+    Any obj;
+};
+
+struct NotCallableError {
+    Any obj;
+};
+
+struct NotIterableError {
+    Any obj;
+};
+
 struct NumArgsError {
     std::uint32_t min;
     std::uint32_t max;
@@ -36,6 +72,20 @@ struct TypeOverflowError {
     std::uint32_t max;
 }
 
+struct UnpackOverflowError {
+    std::uint32_t max;
+};
+
+struct UnsupportedOperandError {
+    Symbol op;
+    Any lhs;
+    Any rhs;
+};
+
+struct ValueStackOverflowError {
+    std::uint32_t max;
+};
+
 struct VarOverflowError {
     std::uint32_t max;
 };
@@ -0,0 +1,458 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <chrono>
+#include <vector>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/heap.hpp"
+
+namespace dl::gc {
+
+// Marking traces objects in units of at most this many slots, checking the
+// clock after each, so that a large object is spread over several slices.
+constexpr std::uint32_t MARK_STEP = 256;
+
+// Returned by `Tracer::trace_part` once an object has been traced in full.
+constexpr std::uint32_t TRACED = UINT32_MAX;
+
+// Precise tracer shared by minor and major collections. Reference slots are
+// discovered from each type's `Struct::tids` and `Struct::offsets`, with the
+// variable-length builtins (`Seq`, `Vars`, `Def`, `Type` and `Array`) handled
+// specially since their lengths are not part of their structs.
+struct Tracer {
+    State& state;
+    Heap& heap;
+
+    // Whether nursery objects are being promoted (minor) or old objects are
+    // being marked (major).
+    bool minor;
+
+    // Objects whose fields have yet to be traced. For major collections this
+    // is `Heap::gray`, so that marking can be resumed by a later slice.
+    std::vector<ObjHeader*>& gray;
+
+    Tracer(
+        State& state, Heap& heap, bool minor, std::vector<ObjHeader*>& gray
+    ) noexcept: state(state), heap(heap), minor(minor), gray(gray) {}
+
+    // Copy a nursery object into the old generation, leaving a forwarding
+    // pointer behind.
+    ObjHeader* promote(ObjHeader* header) {
+        ObjHeader* copy = heap.allocate_old(header->tid, header->size);
+        std::memcpy(copy->payload(), header->payload(), header->size);
+        header->forward = copy;
+        heap.stats.bytes_promoted += header->size;
+        gray.push_back(copy);
+        return copy;
+    }
+
+    // Visit a slot holding the address of (or into) a payload, updating it if
+    // its object moves.
+    void visit_addr(void*& addr) {
+        if (addr == nullptr)
+            return;
+        ObjHeader* header = heap.find(addr);
+        if (header == nullptr)
+            // Points outside the heap, such as into a scope's variables.
+            return;
+        if (minor) {
+            if (header->old)
+                return;
+            ObjHeader* copy = header->forward;
+            if (copy == nullptr)
+                copy = promote(header);
+            auto offset = static_cast<char*>(addr) - header->payload();
+            addr = copy->payload() + offset;
+            return;
+        }
+        // Nursery objects are not marked: their headers do not survive the
+        // next minor collection. Those still alive when marking finishes are
+        // promoted gray instead.
+        if (!header->old)
+            return;
+        if (!header->marked) {
+            header->marked = true;
+            gray.push_back(header);
+        }
+    }
+
+    void visit_any(Any& obj) {
+        if (is_immediate_tid(obj.tid) || coreutil::is_error(obj))
+            return;
+        visit_addr(obj.data);
+    }
+
+    void trace_vars(Vars& vars) {
+        for (std::uint32_t i = 0; i < vars.len; i++)
+            visit_any(vars.data[vars.idxs[i]]);
+    }
+
+    void trace_seq(Seq& seq) {
+        for (std::uint32_t i = 0; i < seq.len; i++)
+            visit_any(seq.xs[i]);
+    }
+
+    void trace_type(Type& type) {
+        trace_vars(type.dunder_getattr);
+        trace_vars(type.dunder_setattr);
+        trace_vars(type.dunder_callattr);
+        trace_vars(type.dunder_updateattr);
+    }
+
+    // Trace the reference slots of a payload of type tid at addr.
+    void trace(std::uint32_t tid, char* addr) {
+        using enum BuiltinTypeID;
+        if (is_immediate_tid(tid))
+            return;
+        switch(static_cast<BuiltinTypeID>(tid)) {
+        case ANY:
+            visit_any(*reinterpret_cast<Any*>(addr));
+            return;
+        case DEF: {
+            auto& def = *reinterpret_cast<Def*>(addr);
+            for (std::uint32_t i = 0; i < def.len; i++)
+                visit_any(def.code[i]);
+            return;
+        }
+        case SEQ:
+            trace_seq(*reinterpret_cast<Seq*>(addr));
+            return;
+        case ARRAY:
+            // The elements are immediates; only the buffer is referenced.
+            visit_addr(reinterpret_cast<Array*>(addr)->data);
+            return;
+        case VARS:
+            trace_vars(*reinterpret_cast<Vars*>(addr));
+            return;
+        case TYPE:
+        case PTR_TYPE:
+            trace_type(*reinterpret_cast<Type*>(addr));
+            return;
+        case ADDRESS:
+        case FN_PTR:
+        case STRUCT:
+        case TIDS:
+            // No references to heap objects.
+            return;
+        default:
+            break;
+        }
+        if (coreutil::is_ptr_type(state, tid)) {
+            visit_addr(*reinterpret_cast<void**>(addr));
+            return;
+        }
+        Struct& structure = coreutil::get_type(state, tid).dunder_struct;
+        for (std::uint32_t i = 0; i < structure.len; i++)
+            trace(structure.tids[i], addr + structure.offsets[i]);
+    }
+
+    // Trace a unit of the slots of an old object from the index first on,
+    // returning the index to continue from, or `TRACED` if there are none
+    // left. Slots are the elements of a `Def`, `Seq` or `Vars` or the fields of
+    // a struct; anything else is one unit. Lengths are read anew each time,
+    // since the program may have changed them between slices.
+    std::uint32_t trace_part(ObjHeader* header, std::uint32_t first) {
+        using enum BuiltinTypeID;
+        std::uint32_t tid = header->tid;
+        char* addr = header->payload();
+        Struct* structure = nullptr;
+        std::uint32_t len = 0;
+        switch(static_cast<BuiltinTypeID>(tid)) {
+        case DEF:
+            len = reinterpret_cast<Def*>(addr)->len;
+            break;
+        case SEQ:
+            len = reinterpret_cast<Seq*>(addr)->len;
+            break;
+        case VARS:
+            len = reinterpret_cast<Vars*>(addr)->len;
+            break;
+        default:
+            if (
+                tid < std::size(BUILTIN_SIZES) ||
+                coreutil::is_ptr_type(state, tid)
+            ) {
+                trace(tid, addr);
+                return TRACED;
+            }
+            structure = &coreutil::get_type(state, tid).dunder_struct;
+            len = structure->len;
+            break;
+        }
+        if (first >= len)
+            return TRACED;
+        std::uint32_t end = len - first > MARK_STEP ? first + MARK_STEP : len;
+        for (std::uint32_t i = first; i < end; i++) {
+            switch(static_cast<BuiltinTypeID>(tid)) {
+            case DEF:
+                visit_any(reinterpret_cast<Def*>(addr)->code[i]);
+                break;
+            case SEQ:
+                visit_any(reinterpret_cast<Seq*>(addr)->xs[i]);
+                break;
+            case VARS: {
+                auto& vars = *reinterpret_cast<Vars*>(addr);
+                visit_any(vars.data[vars.idxs[i]]);
+                break;
+            }
+            default:
+                trace(structure->tids[i], addr + structure->offsets[i]);
+                break;
+            }
+        }
+        return end < len ? end : TRACED;
+    }
+
+    // Visit everything directly reachable from the interpreter state.
+    void roots() {
+        Stack& stack = state.stack;
+        for (std::uint32_t i = 0; i <= stack.scope_depth; i++)
+            trace_vars(stack.scope[i]);
+        for (std::uint32_t i = 0; i <= stack.call_depth; i++) {
+            trace_seq(stack.args[i].args);
+            trace_vars(stack.args[i].kwargs);
+        }
+        // Covers arguments pushed for a call which has not started yet.
+        for (std::uint32_t i = 0; i < stack.nvalues; i++)
+            visit_any(stack.values[i]);
+        visit_any(state.exc_info.raised);
+        for (auto [xs, len]: heap.roots) {
+            for (std::uint32_t i = 0; i < len; i++)
+                visit_any(xs[i]);
+        }
+
+        // Attribute tables of types live outside the heap, so stores into them
+        // are not seen by the write barrier. There are few types, so scan them
+        // all instead.
+        Seq& types = coreutil::types(state);
+        auto type_tid = static_cast<std::uint32_t>(BuiltinTypeID::TYPE);
+        for (std::uint32_t i = 0; i < types.len; i++)
+            trace(type_tid, static_cast<char*>(types.xs[i].data));
+    }
+
+    void drain() {
+        while (!gray.empty()) {
+            ObjHeader* header = gray.back();
+            gray.pop_back();
+            trace(header->tid, header->payload());
+        }
+    }
+};
+
+std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) noexcept {
+    return std::uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start
+        ).count()
+    );
+}
+
+void record_pause(
+    Heap& heap, std::chrono::steady_clock::time_point start
+) noexcept {
+    std::uint64_t pause = elapsed_ns(start);
+    heap.stats.last_pause_ns = pause;
+    heap.stats.total_pause_ns += pause;
+    if (pause > heap.stats.max_pause_ns)
+        heap.stats.max_pause_ns = pause;
+    std::uint32_t bucket = std::bit_width(pause / 1000);
+    if (bucket >= PAUSE_BUCKETS)
+        bucket = PAUSE_BUCKETS - 1;
+    heap.stats.pause_histogram[bucket]++;
+}
+
+// Upper bound on the given percentile (between 0 and 100) of all pauses so
+// far, accurate to a power of two microseconds.
+std::uint64_t pause_percentile(const GCStats& stats, double percentile) {
+    std::uint64_t total = 0;
+    for (std::uint64_t count: stats.pause_histogram)
+        total += count;
+    auto needed = std::uint64_t(total * percentile / 100);
+    std::uint64_t seen = 0;
+    for (std::uint32_t i = 0; i < PAUSE_BUCKETS; i++) {
+        seen += stats.pause_histogram[i];
+        if (seen >= needed && seen != 0)
+            return (std::uint64_t(1) << i) * 1000;
+    }
+    return 0;
+}
+
+// Promote every live nursery object, then empty the nursery.
+void collect_minor(State& state, Heap& heap) {
+    auto gray = std::vector<ObjHeader*>();
+    auto tracer = Tracer(state, heap, true, gray);
+    tracer.roots();
+    for (ObjHeader* header: heap.remembered) {
+        header->remembered = false;
+        tracer.trace(header->tid, header->payload());
+    }
+    heap.remembered.clear();
+    for (auto& [dest, tid]: heap.external)
+        tracer.trace(tid, static_cast<char*>(dest));
+    heap.external.clear();
+    tracer.drain();
+    heap.reset_nursery();
+    heap.stats.minor_collections++;
+}
+
+// Begin a major collection by shading the roots. The nursery is emptied first
+// so that marking starts from old objects only.
+void start_marking(State& state, Heap& heap) {
+    collect_minor(state, heap);
+    heap.phase = GCPhase::MARKING;
+    Tracer(state, heap, false, heap.gray).roots();
+}
+
+// Trace gray objects, a unit of slots at a time, until there are none left or
+// the budget runs out. Returns whether marking is complete.
+bool mark_slice(State& state, Heap& heap, std::uint64_t budget_ns) {
+    auto start = std::chrono::steady_clock::now();
+    auto tracer = Tracer(state, heap, false, heap.gray);
+    while (heap.partial != nullptr || !heap.gray.empty()) {
+        ObjHeader* header = heap.partial;
+        std::uint32_t first = heap.partial_next;
+        if (header == nullptr) {
+            header = heap.gray.back();
+            heap.gray.pop_back();
+            first = 0;
+        }
+        std::uint32_t next = tracer.trace_part(header, first);
+        heap.partial = next == TRACED ? nullptr : header;
+        heap.partial_next = next;
+        if (elapsed_ns(start) >= budget_ns)
+            return heap.partial == nullptr && heap.gray.empty();
+    }
+    return true;
+}
+
+// Finish marking once the gray set has been emptied. Roots and nursery
+// objects are mutated without barriers, so they are traced once more. This
+// pause is proportional to the roots and the nursery, not the old generation.
+void finish_marking(State& state, Heap& heap) {
+    // Promoting the nursery makes its survivors gray.
+    collect_minor(state, heap);
+    Tracer(state, heap, false, heap.gray).roots();
+    mark_slice(state, heap, UINT64_MAX);
+    heap.phase = GCPhase::SWEEPING;
+    heap.sweep_cursor = 0;
+}
+
+// Free unmarked old objects from the sweep cursor on until the end of the old
+// generation or the budget runs out. Returns whether sweeping is complete.
+// A freed object is replaced by the last one, which is yet to be visited.
+bool sweep_slice(Heap& heap, std::uint64_t budget_ns) {
+    auto start = std::chrono::steady_clock::now();
+    while (heap.sweep_cursor < heap.old.size()) {
+        ObjHeader* header = heap.old[heap.sweep_cursor];
+        if (header->marked) {
+            header->marked = false;
+            heap.sweep_cursor++;
+        } else {
+            heap.free_old(header);
+            heap.old[heap.sweep_cursor] = heap.old.back();
+            heap.old.pop_back();
+        }
+        if (elapsed_ns(start) >= budget_ns)
+            return false;
+    }
+    heap.phase = GCPhase::IDLE;
+    heap.major_threshold = heap.old_bytes * 2;
+    if (heap.major_threshold < MIN_MAJOR_THRESHOLD)
+        heap.major_threshold = MIN_MAJOR_THRESHOLD;
+    heap.stats.major_collections++;
+    return true;
+}
+
+// Run a major collection to completion without yielding to the program.
+void collect_major(State& state, Heap& heap) {
+    if (heap.phase == GCPhase::IDLE)
+        start_marking(state, heap);
+    if (heap.phase == GCPhase::MARKING) {
+        mark_slice(state, heap, UINT64_MAX);
+        finish_marking(state, heap);
+    }
+    sweep_slice(heap, UINT64_MAX);
+}
+
+// Write barrier, to be called after the payload of type tid at dest has been
+// overwritten. Remembers old objects which may now reference the nursery, and
+// while marking, shades whatever was stored so that no black object ends up
+// pointing to a white one.
+void write_barrier(State& state, std::uint32_t tid, void* dest) {
+    if (is_immediate_tid(tid))
+        return;
+    Heap& heap = runtime_heap();
+    heap.record_write(tid, dest);
+    if (heap.phase == GCPhase::MARKING) {
+        auto tracer = Tracer(state, heap, false, heap.gray);
+        tracer.trace(tid, static_cast<char*>(dest));
+    }
+}
+
+// Make the len values from xs roots until `remove_roots(xs)`. Each call is
+// undone by one call to that, so the same values may be added by several
+// owners. Roots added while marking are traced when it finishes.
+void add_roots(Any* xs, std::uint32_t len) {
+    runtime_heap().roots.emplace(xs, len);
+}
+
+void remove_roots(Any* xs) {
+    Heap& heap = runtime_heap();
+    auto it = heap.roots.find(xs);
+    if (it != heap.roots.end())
+        heap.roots.erase(it);
+}
+
+// Must be called before freeing or clearing the storage of slots from begin
+// up to end which lie outside of the heap, so that the next minor collection
+// does not trace them.
+void forget_external(const void* begin, const void* end) {
+    Heap& heap = runtime_heap();
+    if (!heap.external.empty())
+        heap.forget(begin, end);
+}
+
+// Collect if an allocation asked for it, and advance an incremental major
+// collection by one slice. Must only be called where every live object is
+// reachable from state, such as between statements. Inside a call, native
+// frames below it may hold values in C++ locals, such as the operands of
+// `binary_slow` while it calls a dunder method, so nothing is done until
+// control is back at call depth 0.
+void safepoint(State& state) {
+    if (state.stack.call_depth != 0)
+        return;
+    Heap& heap = runtime_heap();
+    if (heap.phase == GCPhase::MARKING) {
+        auto start = std::chrono::steady_clock::now();
+        if (mark_slice(state, heap, heap.config.slice_budget_ns))
+            finish_marking(state, heap);
+        heap.stats.slices++;
+        record_pause(heap, start);
+    } else if (heap.phase == GCPhase::SWEEPING) {
+        auto start = std::chrono::steady_clock::now();
+        sweep_slice(heap, heap.config.slice_budget_ns);
+        heap.stats.slices++;
+        record_pause(heap, start);
+    }
+
+    if (!heap.collect_requested)
+        return;
+    heap.collect_requested = false;
+    auto start = std::chrono::steady_clock::now();
+    if (heap.old_bytes < heap.major_threshold || heap.phase != GCPhase::IDLE)
+        // Already collecting the old generation, which the slices above take
+        // care of.
+        collect_minor(state, heap);
+    else if (heap.config.incremental)
+        start_marking(state, heap);
+    else
+        collect_major(state, heap);
+    record_pause(heap, start);
+}
+
+}
@@ -0,0 +1,415 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <bit>
+#include <unordered_map>
+#include <vector>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/pool.hpp"
+
+namespace dl {
+
+// Bytes of nursery objects are allocated from before a minor collection is
+// requested.
+constexpr std::uint64_t NURSERY_SIZE = 4 * 1024 * 1024;
+
+// Payloads at least this large skip the nursery and are allocated old.
+constexpr std::uint64_t PRETENURE_SIZE = 64 * 1024;
+
+// Smallest old generation size which triggers a major collection.
+constexpr std::uint64_t MIN_MAJOR_THRESHOLD = 16 * 1024 * 1024;
+
+// Old objects are indexed by the pages of this many bytes that their payloads
+// cover.
+constexpr std::uintptr_t OLD_PAGE_SIZE = 4096;
+
+// Number of power-of-two buckets in the pause histogram. Bucket `i` counts
+// pauses shorter than `2^i` microseconds.
+constexpr std::uint32_t PAUSE_BUCKETS = 32;
+
+// What the old generation collector is doing between safepoints.
+enum class GCPhase {
+    // No major collection in progress.
+    IDLE,
+    // Incrementally marking old objects from `Heap::gray`.
+    MARKING,
+    // Incrementally freeing unmarked old objects.
+    SWEEPING
+};
+
+// Collector settings, which may be changed between safepoints.
+struct GCConfig {
+    // Whether major collections are done in bounded slices interleaved with
+    // execution rather than all at once.
+    bool incremental;
+
+    // Time a single marking or sweeping slice may take.
+    std::uint64_t slice_budget_ns;
+};
+
+// Header preceding the payload of every heap object.
+struct ObjHeader {
+    // Size of the payload in bytes, rounded up to `POOL_ALIGN`.
+    std::uint64_t size;
+
+    // For a nursery object which has been promoted, the header of its copy.
+    ObjHeader* forward;
+
+    // TID of the object, used to find its reference fields when tracing.
+    std::uint32_t tid;
+
+    // Set on old objects reached during marking.
+    bool marked;
+
+    // Set on old objects which are in the remembered set.
+    bool remembered;
+
+    // Whether the object lives in the old generation.
+    bool old;
+
+    // Padding to keep payloads aligned.
+    bool unused;
+
+    char* payload() noexcept {
+        return reinterpret_cast<char*>(this + 1);
+    }
+};
+
+static_assert(sizeof(ObjHeader) % POOL_ALIGN == 0);
+
+// Index of the old payloads in one page: one bit per `POOL_ALIGN` bytes, set
+// where a payload starts, and the payload starting in an earlier page that
+// runs into this one, of which there is at most one.
+struct OldPage {
+    std::uint64_t starts[OLD_PAGE_SIZE / POOL_ALIGN / 64];
+    ObjHeader* spill;
+
+    // Payloads starting in or running into the page. It is dropped from the
+    // index once there are none.
+    std::uint32_t count;
+};
+
+// Collector statistics. Pauses are measured in nanoseconds of wall time.
+struct GCStats {
+    std::uint64_t minor_collections;
+    std::uint64_t major_collections;
+
+    // Payload bytes allocated, promoted out of the nursery and reclaimed from
+    // the old generation.
+    std::uint64_t bytes_allocated;
+    std::uint64_t bytes_promoted;
+    std::uint64_t bytes_freed;
+
+    std::uint64_t last_pause_ns;
+    std::uint64_t max_pause_ns;
+    std::uint64_t total_pause_ns;
+
+    // Number of incremental marking and sweeping slices run.
+    std::uint64_t slices;
+
+    // Every pause, including slices, bucketed by duration.
+    std::uint64_t pause_histogram[PAUSE_BUCKETS];
+};
+
+// The runtime heap: a bump-allocated nursery in front of an old generation of
+// pool-allocated objects. Objects are found from interior addresses (as
+// produced by pointer arithmetic) via the nursery start bitmap or the page
+// index of old objects, both in constant time. Collection itself lives in
+// `dl/interpreter2/gc.hpp`, since it needs the type information in `State`.
+struct Heap {
+    // Nursery bounds and bump pointer.
+    char* nursery;
+    char* nursery_top;
+    char* nursery_end;
+
+    // One bit per `POOL_ALIGN` bytes of the nursery, set where a payload
+    // starts.
+    std::uint64_t* starts;
+
+    // Old objects, in no particular order.
+    std::vector<ObjHeader*> old;
+
+    // Pages holding old payloads, by address divided by `OLD_PAGE_SIZE`.
+    std::unordered_map<std::uintptr_t, OldPage> old_pages;
+
+    // Backing storage for old objects, with room for their headers.
+    Pool old_space;
+
+    // Total payload bytes in the old generation.
+    std::uint64_t old_bytes;
+
+    // Old generation size which triggers the next major collection.
+    std::uint64_t major_threshold;
+
+    // Old objects which may reference nursery objects.
+    std::vector<ObjHeader*> remembered;
+
+    // Slots outside of any heap object which a store may have pointed at the
+    // nursery, with the TIDs of their payloads. The next minor collection
+    // traces them as roots, so whoever frees or clears such a slot before then
+    // must `forget` it.
+    std::unordered_map<void*, std::uint32_t> external;
+
+    // Values kept outside of the heap and of `State`, such as the constants of
+    // compiled code, as the first of each range and its length. They are
+    // traced as roots, so they are updated when what they refer to moves. A
+    // range may be registered more than once.
+    std::unordered_multimap<Any*, std::uint32_t> roots;
+
+    // Set when an allocation found the nursery full. Collections only happen
+    // at safepoints, where every live value is reachable from `State`.
+    bool collect_requested;
+
+    GCConfig config;
+    GCPhase phase;
+
+    // Old objects which are marked but whose fields have not been traced yet,
+    // i.e., the gray objects of an incremental major collection. Marked
+    // objects not in here are black, unmarked ones are white.
+    std::vector<ObjHeader*> gray;
+
+    // An object marking has traced only some of the fields of, so that a
+    // large one is spread over several slices, and the index of the next.
+    ObjHeader* partial;
+    std::uint32_t partial_next;
+
+    // While sweeping, the index in `old` of the next object to visit.
+    std::size_t sweep_cursor;
+
+    GCStats stats;
+
+    Heap() noexcept:
+    nursery(static_cast<char*>(std::malloc(NURSERY_SIZE))),
+    nursery_top(nursery),
+    nursery_end(nursery + NURSERY_SIZE),
+    starts(static_cast<std::uint64_t*>(
+        std::calloc(NURSERY_SIZE / POOL_ALIGN / 64, sizeof(std::uint64_t))
+    )),
+    old(),
+    old_pages(),
+    old_space(sizeof(ObjHeader)),
+    old_bytes(0),
+    major_threshold(MIN_MAJOR_THRESHOLD),
+    remembered(),
+    external(),
+    roots(),
+    collect_requested(false),
+    config(GCConfig{true, 500 * 1000}),
+    phase(GCPhase::IDLE),
+    gray(),
+    partial(nullptr),
+    partial_next(0),
+    sweep_cursor(0),
+    stats() {}
+
+    Heap(const Heap& that) = delete;
+
+    ~Heap() noexcept {
+        for (ObjHeader* header: old)
+            old_space.deallocate(header, sizeof(ObjHeader) + header->size);
+        std::free(starts);
+        std::free(nursery);
+    }
+
+    // Add a pool class fitting payloads of a newly registered type.
+    void add_size_class(std::uint64_t size) noexcept {
+        old_space.add_class(size);
+    }
+
+    // Allocate a zeroed payload for an object of type tid. Zeroing keeps the
+    // tracer from reading garbage out of fields not yet initialized. Never
+    // collects: if the nursery is full the object is allocated old and a
+    // collection is requested for the next safepoint.
+    void* allocate(std::uint32_t tid, std::uint64_t size) noexcept {
+        std::uint64_t rounded = Pool::round_up(size);
+        stats.bytes_allocated += rounded;
+        std::uint64_t total = sizeof(ObjHeader) + rounded;
+        if (
+            rounded >= PRETENURE_SIZE ||
+            total > static_cast<std::uint64_t>(nursery_end - nursery_top)
+        ) {
+            if (rounded < PRETENURE_SIZE)
+                collect_requested = true;
+            // Its fields will be initialized without a write barrier, and may
+            // well be set to nursery objects.
+            ObjHeader* header = allocate_old(tid, rounded);
+            header->remembered = true;
+            remembered.push_back(header);
+            return header->payload();
+        }
+        auto header = reinterpret_cast<ObjHeader*>(nursery_top);
+        *header = ObjHeader{rounded, nullptr, tid, false, false, false, false};
+        std::memset(header->payload(), 0, rounded);
+        nursery_top += total;
+        std::uint64_t bit = (header->payload() - nursery) / POOL_ALIGN;
+        starts[bit / 64] |= std::uint64_t(1) << (bit % 64);
+        return header->payload();
+    }
+
+    ObjHeader* allocate_old(std::uint32_t tid, std::uint64_t size) noexcept {
+        auto header = static_cast<ObjHeader*>(
+            old_space.allocate(sizeof(ObjHeader) + size)
+        );
+        *header = ObjHeader{size, nullptr, tid, false, false, true, false};
+        std::memset(header->payload(), 0, size);
+        old.push_back(header);
+        index_old(header);
+        // Objects allocated during a major collection must survive it. While
+        // marking, they are gray so that whatever they are initialized with is
+        // traced. While sweeping, they go after the cursor, so they are marked
+        // for the sweeper to leave them alone and clear the mark as it passes.
+        if (phase == GCPhase::MARKING) {
+            header->marked = true;
+            gray.push_back(header);
+        } else if (phase == GCPhase::SWEEPING)
+            header->marked = true;
+        old_bytes += size;
+        if (old_bytes >= major_threshold)
+            collect_requested = true;
+        return header;
+    }
+
+    // Find the header of the object containing addr, or `nullptr` if addr is
+    // not in the heap.
+    ObjHeader* find(const void* addr) noexcept {
+        if (in_nursery(addr))
+            return find_young(addr);
+        return find_old(addr);
+    }
+
+    ObjHeader* find_old(const void* addr) noexcept {
+        auto key = reinterpret_cast<std::uintptr_t>(addr);
+        auto it = old_pages.find(key / OLD_PAGE_SIZE);
+        if (it == old_pages.end())
+            return nullptr;
+        // The closest payload start in the page at or before addr, or failing
+        // that the payload running into the page. Payloads do not overlap, so
+        // if that one does not contain addr, none does.
+        const OldPage& page = it->second;
+        std::uintptr_t bit = key % OLD_PAGE_SIZE / POOL_ALIGN;
+        std::uintptr_t word = bit / 64;
+        std::uint64_t bits =
+            page.starts[word] & ~std::uint64_t(0) >> (63 - bit % 64);
+        while (bits == 0 && word != 0)
+            bits = page.starts[--word];
+        ObjHeader* header = page.spill;
+        if (bits != 0) {
+            bit = word * 64 + 63 - std::countl_zero(bits);
+            auto start = key - key % OLD_PAGE_SIZE + bit * POOL_ALIGN;
+            header = reinterpret_cast<ObjHeader*>(start) - 1;
+        }
+        if (
+            header == nullptr ||
+            key - reinterpret_cast<std::uintptr_t>(header->payload()) >=
+                header->size
+        )
+            return nullptr;
+        return header;
+    }
+
+    // Add an old object to `old_pages`: a start bit in the page its payload
+    // starts in, and a spill into each page after that it runs into.
+    void index_old(ObjHeader* header) {
+        auto begin = reinterpret_cast<std::uintptr_t>(header->payload());
+        std::uintptr_t last = (begin + header->size - 1) / OLD_PAGE_SIZE;
+        OldPage& first = old_pages[begin / OLD_PAGE_SIZE];
+        std::uintptr_t bit = begin % OLD_PAGE_SIZE / POOL_ALIGN;
+        first.starts[bit / 64] |= std::uint64_t(1) << bit % 64;
+        first.count++;
+        for (std::uintptr_t i = begin / OLD_PAGE_SIZE + 1; i <= last; i++) {
+            OldPage& page = old_pages[i];
+            page.spill = header;
+            page.count++;
+        }
+    }
+
+    // Undo `index_old`.
+    void unindex_old(ObjHeader* header) noexcept {
+        auto begin = reinterpret_cast<std::uintptr_t>(header->payload());
+        std::uintptr_t last = (begin + header->size - 1) / OLD_PAGE_SIZE;
+        auto first = old_pages.find(begin / OLD_PAGE_SIZE);
+        std::uintptr_t bit = begin % OLD_PAGE_SIZE / POOL_ALIGN;
+        first->second.starts[bit / 64] &= ~(std::uint64_t(1) << bit % 64);
+        if (--first->second.count == 0)
+            old_pages.erase(first);
+        for (std::uintptr_t i = begin / OLD_PAGE_SIZE + 1; i <= last; i++) {
+            auto it = old_pages.find(i);
+            it->second.spill = nullptr;
+            if (--it->second.count == 0)
+                old_pages.erase(it);
+        }
+    }
+
+    ObjHeader* find_young(const void* addr) noexcept {
+        // Scan the start bitmap backwards for the closest payload start.
+        std::uint64_t bit =
+            (static_cast<const char*>(addr) - nursery) / POOL_ALIGN;
+        std::uint64_t word = bit / 64;
+        std::uint64_t mask = ~std::uint64_t(0) >> (63 - bit % 64);
+        std::uint64_t bits = starts[word] & mask;
+        while (bits == 0) {
+            if (word == 0)
+                return nullptr;
+            bits = starts[--word];
+        }
+        bit = word * 64 + 63 - std::countl_zero(bits);
+        return reinterpret_cast<ObjHeader*>(nursery + bit * POOL_ALIGN) - 1;
+    }
+
+    // Free an unreachable old object, which the caller takes out of `old`.
+    void free_old(ObjHeader* header) noexcept {
+        unindex_old(header);
+        old_bytes -= header->size;
+        stats.bytes_freed += header->size;
+        old_space.deallocate(header, sizeof(ObjHeader) + header->size);
+    }
+
+    bool in_nursery(const void* addr) const noexcept {
+        auto p = static_cast<const char*>(addr);
+        return p >= nursery && p < nursery_top;
+    }
+
+    // Write barrier for stores of non-immediate payloads of type tid to dest.
+    // Remembers the old object containing dest, or dest itself if it is not in
+    // the heap, since the stored data may hold nursery references.
+    void record_write(std::uint32_t tid, void* dest) {
+        if (nursery_top == nursery || in_nursery(dest))
+            return;
+        ObjHeader* header = find_old(dest);
+        if (header == nullptr) {
+            external[dest] = tid;
+            return;
+        }
+        if (!header->remembered) {
+            header->remembered = true;
+            remembered.push_back(header);
+        }
+    }
+
+    // Drop the external slots from begin up to end, which are being freed or
+    // cleared.
+    void forget(const void* begin, const void* end) {
+        std::erase_if(external, [&](const auto& entry) {
+            return entry.first >= begin && entry.first < end;
+        });
+    }
+
+    // Forget every nursery object after its survivors have been promoted.
+    void reset_nursery() noexcept {
+        std::uint64_t used_bits = (nursery_top - nursery) / POOL_ALIGN;
+        std::memset(starts, 0, (used_bits + 63) / 64 * sizeof(std::uint64_t));
+        nursery_top = nursery;
+    }
+};
+
+// Like the payload pool, each thread has its own heap.
+Heap& runtime_heap() noexcept {
+    thread_local auto heap = Heap();
+    return heap;
+}
+
+}
@@ -33,6 +33,8 @@ int sorted_idx(
 Type builtin_type(BuiltinSymbol name, BuiltinTypeID tid) {
     auto res = Type{}
     res.dunder_bases = TIDs{nullptr, 0};
+    // Filled in by `coreutil::compute_supers` on registration.
+    res.dunder_supers = TIDs{nullptr, 0};
     res.dunder_name = name;
     res.dunder_tid = tid;
     res.dunder_getattr = empty_vars();
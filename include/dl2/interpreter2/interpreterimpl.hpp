@@ -3,12 +3,27 @@
 #include <cstdint>
 #include <cstring>
 
+#include <algorithm>
+
 #include "dl/interpret/builtinsymbol.hpp"
 #include "dl/interpret/builtintypeid.hpp"
 #include "dl/interpret/types.hpp"
+#include "dl/interpretnode/call.hpp"
+#include "dl/interpretnode/def.hpp"
+#include "dl/interpreter2/gc.hpp"
 
 namespace dl {
 
+struct InterpreterImpl;
+
+// Runs `Def`s some other way than statement by statement, such as from
+// register code compiled for the types of their arguments.
+struct DefRunner {
+	// Run def on the arguments bound at the current call depth, setting res,
+	// or return false to leave it to `execute_def`.
+	virtual bool run(InterpreterImpl& interp, const Def& def, Any& res) = 0;
+};
+
 struct InterpreterImpl {
 	static constexpr std::uint32_t MAX_TID =
 		UINT32_MAX - BuiltinTypeID::DUNDER_FLOAT64;
@@ -16,80 +31,124 @@ struct InterpreterImpl {
 	State state;
 	Seq* types;
 	TIDs* ptr_tids;
+
+	// Tried first for every call to a `Def`, if set.
+	DefRunner* def_runner = nullptr;
 };
 
-Any InterpreterImpl::call(Call c) {
-	if (state.stack.call_depth == state.config.max_call_depth)
-		raise(stack_overflow_error);
-	state.stack.call_depth++;
-	std::uint32_t i = 0;
-	for (std::uint32_t j = 0; j < c.nargs; j++) {
-		if (c.pos_unpacked[j]) {
+int InterpreterImpl::bind_args(const Call& c, Args& args) {
+	Stack& stack = state.stack;
+	Any* values = stack.values + c.base;
+	// The flags of later arguments would be lost, so refuse to guess them.
+	if (
+		(c.pos_unpacked != 0 && c.nargs > MAX_UNPACK_FLAGS)
+		|| (c.kw_unpacked != 0 && c.nkwargs > MAX_UNPACK_FLAGS)
+	) {
+		coreutil::raise(state, UnpackOverflowError{MAX_UNPACK_FLAGS});
+		return 1;
+	}
+	if (c.pos_unpacked == 0)
+		args.args = Seq{values, c.nargs};
+	else {
+		// Unpacking changes the number of arguments, so the expanded arguments
+		// are pushed again above the ones given.
+		std::uint32_t start = stack.nvalues;
+		for (std::uint32_t i = 0; i < c.nargs; i++) {
+			if (c.pos_unpacked >> i & 1) {
+				if (pos_unpack(values[i]) != 0)
+					return 1;
+				continue;
+			}
+			Any* slot = push_values(1);
+			if (slot == nullptr)
+				return 1;
+			*slot = values[i];
+		}
+		args.args = Seq{stack.values + start, stack.nvalues - start};
+	}
 
+	Any* kwvalues = values + c.nargs;
+	Symbol* syms = c.syms;
+	// Shifted as it is read: a call which unpacks no keyword arguments may
+	// have more than `MAX_UNPACK_FLAGS` of them.
+	std::uint64_t kw_unpacked = c.kw_unpacked;
+	for (std::uint32_t i = 0; i < c.nkwargs; i++, kw_unpacked >>= 1) {
+		if (kw_unpacked & 1) {
+			if (kw_unpack(kwvalues[i], args.kwargs) != 0)
+				return 1;
+			continue;
 		}
+		if (put_kwarg(*syms++, kwvalues[i], args.kwargs) != 0)
+			return 1;
 	}
-	Type* type = c.callee.qtype.type;
-	if (type == &FUNC_TYPE)
+	return 0;
+}
 
-	else if (type == &CALL_TYPE)
-	else
+Any InterpreterImpl::call(Call c) {
+	// The arguments stay where the caller pushed them: the callee reads them
+	// through `args` and they are popped on return, so nothing is allocated.
+	Stack& stack = state.stack;
+	Any res;
+	if (stack.call_depth == state.config.max_call_depth) {
+		coreutil::raise(
+			state, StackOverflowError{state.config.max_call_depth}
+		);
+		res = coreutil::ERROR_SIGNAL;
+	} else {
+		Args& args = stack.args[stack.call_depth + 1];
+		if (bind_args(c, args) != 0)
+			res = coreutil::ERROR_SIGNAL;
+		else {
+			stack.call_depth++;
+			res = invoke(c.callee);
+			stack.call_depth--;
+		}
+		del_vars(args.kwargs);
+	}
+	// Also pops anything unpacking pushed above the arguments.
+	stack.nvalues = c.base;
+	return res;
 }
 
 Any InterpreterImpl::call0(Any callee) {
-	auto c = Call{};
-	c.callee = callee;
-
-	c.nargs = 0;
-	c.args = nullptr;
-	c.pos_unpacked = nullptr;
-
-	c.nkwargs = 0;
-	c.kws = nullptr;
-	c.kwargs = nullptr;
-	c.kw_unpacked = nullptr;
-	return call(c);
+	return call(Call{
+		Source{}, callee, state.stack.nvalues, 0, 0, 0, nullptr, 0
+	});
 }
 
 Any InterpreterImpl::call1(Any callee, Any x) {
-	auto c = Call{};
-	c.callee = callee;
-	
-	c.nargs = 1;
-	c.args = new Any(x);
-	c.pos_unpacked = new bool(false);
-
-	c.nkwargs = 0;
-	c.kws = nullptr;
-	c.kwargs = nullptr;
-	c.kw_unpacked = nullptr;
-	return call(c);
+	std::uint32_t base = state.stack.nvalues;
+	Any* values = push_values(1);
+	if (values == nullptr)
+		return coreutil::ERROR_SIGNAL;
+	values[0] = x;
+	return call(Call{Source{}, callee, base, 1, 0, 0, nullptr, 0});
 }
 
 Any InterpreterImpl::call2(Any callee, Any x, Any y) {
-	auto c = Call{};
-	c.callee = callee;
-
-	c.nargs = 2;
-	c.args = new Any[]{x, y};
-	c.pos_unpacked = new bool[]{false, false};
-
-	c.nkwargs = 0;
-	c.kws = nullptr;
-	c.kwargs = nullptr;
-	c.kw_unpacked = nullptr;
-	return call(c);
+	std::uint32_t base = state.stack.nvalues;
+	Any* values = push_values(2);
+	if (values == nullptr)
+		return coreutil::ERROR_SIGNAL;
+	values[0] = x;
+	values[1] = y;
+	return call(Call{Source{}, callee, base, 2, 0, 0, nullptr, 0});
 }
 
 void InterpreterImpl::del(Any arg) {
-	
+	// Nothing to free eagerly: other objects may still reference arg, and the
+	// collector reclaims its payload once it is unreachable.
 }
 
 void InterpreterImpl::del_vars(Vars& vars) {
+	// Clearing the slots makes their values unreachable from this scope.
 	for (std::uint32_t i = 0; i < vars.len; i++) {
 		std::uint32_t j = vars.idxs[i];
-		vars.syms[j] = static_cast<Symbol>(BuiltinSymbols::NO_SYMBOL);
-
+		vars.names[j] = static_cast<Symbol>(BuiltinSymbol::NO_SYMBOL);
+		vars.data[j] = coreutil::NONE;
 	}
+	vars.len = 0;
+	gc::forget_external(vars.data, vars.data + vars.cap);
 }
 
 Any InterpreterImpl::deref(Any any) {
@@ -99,7 +158,19 @@ Any InterpreterImpl::deref(Any any) {
 }
 
 void InterpreterImpl::execute(Any arg) {
-	
+	// Collections requested by allocations run between statements, but only
+	// those of the program itself: `safepoint` does nothing inside a call.
+	gc::safepoint(state);
+}
+
+Any InterpreterImpl::execute_def(const Def& def) {
+	// While nothing is raised, `exc_info.raised` is an error signal.
+	for (std::uint32_t i = 0; i < def.len; i++) {
+		execute(def.code[i]);
+		if (!coreutil::is_error(state.exc_info.raised))
+			return coreutil::ERROR_SIGNAL;
+	}
+	return coreutil::NONE;
 }
 
 void InterpreterImpl::exit() {
@@ -131,6 +202,18 @@ Any InterpreterImpl::get_var(Symbol name, const Vars& vars) {
 }
 
 void InterpreterImpl::init() {
+	// Preallocate the value stack and a keyword argument table per call
+	// depth, so calls never allocate.
+	Stack& stack = state.stack;
+	stack.values = new Any[state.config.max_values];
+	stack.nvalues = 0;
+	stack.args = new Args[state.config.max_call_depth + 1];
+	for (std::uint32_t i = 0; i <= state.config.max_call_depth; i++) {
+		stack.args[i] = Args{
+			Seq{nullptr, 0}, coreutil::fixed_vars(2 * state.config.max_kwargs)
+		};
+	}
+
 	// First, make all the core types without full initialization.
 	Type none_type = builtin_type(
 		BuiltinSymbol::NONE_TYPE, BuiltinTypeID::NONE_TYPE
@@ -199,6 +282,19 @@ void InterpreterImpl::init() {
 		}
 	);
 
+	// The elements of an array are in a buffer of their own, whose type is
+	// only known from its TID field; see `dl/interpreter2/array.hpp`.
+	Type array_type = builtin_type(
+		BuiltinSymbol::ARRAY,
+		BuiltinTypeID::ARRAY,
+		std::vector<BuiltinField>{
+			BuiltinField(BuiltinSymbol::DATA, BuiltinTypeID::ADDRESS),
+			BuiltinField(BuiltinSymbol::TID, BuiltinTypeID::UINT32),
+			BuiltinField(BuiltinSymbol::LEN, BuiltinTypeID::UINT32),
+			BuiltinField(BuiltinSymbol::CAP, BuiltinTypeID::UINT32)
+		}
+	);
+
 	Type fixed_vars_type = builtin_type(
 		BuiltinSymbol::FIXED_VARS,
 		BuiltinTypeID::FIXED_VARS,
@@ -241,8 +337,12 @@ void InterpreterImpl::init() {
 			BuiltinField(
 				BuiltinSymbol::DUNDER_BASES, BuiltinTypeID::TYPE_SEQ
 			)
+			BuiltinField(
+				BuiltinSymbol::DUNDER_SUPERS, BuiltinTypeID::TYPE_SEQ
+			),
 			BuiltinField(BuiltinSymbol::DUNDER_NAME, BuiltinTypeID::SYMBOL),
 			BuiltinField(BuiltinSymbol::DUNDER_TID, BuiltinTypeID::UINT32),
+			BuiltinField(BuiltinSymbol::DUNDER_DEPTH, BuiltinTypeID::UINT32),
 			BuiltinField(
 				BuiltinSymbol::DUNDER_GET, BuiltinTypeID::FIXED_VARS
 			),
@@ -259,6 +359,40 @@ void InterpreterImpl::init() {
 	);
 }
 
+Any InterpreterImpl::invoke(Any callee) {
+	// Run callee on the arguments already bound at the current call depth.
+	switch (static_cast<BuiltinTypeID>(callee.tid)) {
+	case BuiltinTypeID::FN_PTR:
+		return coreutil::unwrap<FnPtr>(callee)(state);
+	case BuiltinTypeID::DEF: {
+		const Def& def = coreutil::unwrap<Def>(callee);
+		Any res;
+		if (def_runner != nullptr && def_runner->run(*this, def, res))
+			return res;
+		return execute_def(def);
+	}
+	default:
+		break;
+	}
+
+	// Other objects are called through `__call__`, with the object itself
+	// prepended to the arguments. The caller pops the copy.
+	Any call_method =
+		coreutil::get_method(state, callee, BuiltinSymbol::DUNDER_CALL);
+	if (coreutil::is_error(call_method)) {
+		coreutil::raise(state, NotCallableError{callee});
+		return coreutil::ERROR_SIGNAL;
+	}
+	Args& args = coreutil::args(state);
+	Any* values = push_values(args.args.len + 1);
+	if (values == nullptr)
+		return coreutil::ERROR_SIGNAL;
+	values[0] = callee;
+	std::copy_n(args.args.xs, args.args.len, values + 1);
+	args.args = Seq{values, args.args.len + 1};
+	return invoke(call_method);
+}
+
 bool InterpreterImpl::is_ptr(Any obj) {
 	return is_ptr_type(obj.tid);
 }
@@ -278,6 +412,83 @@ bool issubclass(std::uint32_t child_tid, std::uint32_t parent_tid) {
 	return false;
 }
 
+int InterpreterImpl::iter_begin(Any xs, Any* cursor) {
+	// Set up the `ITER_SLOTS` values at cursor to walk the items of xs with
+	// `iter_next`. Builtin sequences are indexed in place, without calls; for
+	// anything else the methods of its iterator are looked up here, once.
+	if (coreutil::is_seq_tid(xs.tid)) {
+		cursor[0] = xs;
+		cursor[1] = coreutil::wrap(std::int64_t(0));
+		return 0;
+	}
+	Any iter_method =
+		coreutil::get_method(state, xs, BuiltinSymbol::DUNDER_ITER);
+	if (coreutil::is_error(iter_method)) {
+		coreutil::raise(state, NotIterableError{xs});
+		return 1;
+	}
+	Any iter = call1(iter_method, xs);
+	if (coreutil::is_error(iter))
+		return 1;
+
+	cursor[0] = iter;
+	cursor[1] = coreutil::wrap(false);
+	cursor[2] = coreutil::get_method(state, iter, BuiltinSymbol::DUNDER_END);
+	cursor[3] = coreutil::get_method(state, iter, BuiltinSymbol::DUNDER_ITEM);
+	cursor[4] =
+		coreutil::get_method(state, iter, BuiltinSymbol::DUNDER_ADVANCE);
+	if (
+		coreutil::is_error(cursor[2]) || coreutil::is_error(cursor[3]) ||
+		coreutil::is_error(cursor[4])
+	) {
+		coreutil::raise(state, NotIterableError{xs});
+		return 1;
+	}
+	return 0;
+}
+
+Any InterpreterImpl::iter_next(Any* cursor, bool& end) {
+	// The next item of an iteration set up by `iter_begin`, or None with end
+	// set once there are no more. An iterator advances past an item only when
+	// asked for the next one, by which time the caller has stored the item.
+	end = false;
+	if (cursor[1].tid == static_cast<std::uint32_t>(BuiltinTypeID::INT64)) {
+		auto& i = coreutil::unwrap<std::int64_t>(cursor[1]);
+		if (i >= coreutil::seq_len(cursor[0])) {
+			end = true;
+			return coreutil::NONE;
+		}
+		return coreutil::seq_item(cursor[0], static_cast<std::uint32_t>(i++));
+	}
+	if (coreutil::unwrap<bool>(cursor[1])) {
+		if (coreutil::is_error(call1(cursor[4], cursor[0])))
+			return coreutil::ERROR_SIGNAL;
+	}
+	Any is_end = call1(cursor[2], cursor[0]);
+	if (coreutil::is_error(is_end))
+		return is_end;
+	if (coreutil::unwrap<bool>(is_end)) {
+		end = true;
+		return coreutil::NONE;
+	}
+	cursor[1] = coreutil::wrap(true);
+	return call1(cursor[3], cursor[0]);
+}
+
+int InterpreterImpl::kw_unpack(Any kwargs, Vars& dest) {
+	if (kwargs.tid != static_cast<std::uint32_t>(BuiltinTypeID::VARS)) {
+		coreutil::raise(state, ArgTypeError{0, kwargs});
+		return 1;
+	}
+	Vars& src = coreutil::unwrap<Vars>(kwargs);
+	for (std::uint32_t i = 0; i < src.len; i++) {
+		std::uint32_t j = src.idxs[i];
+		if (put_kwarg(src.names[j], src.data[j], dest) != 0)
+			return 1;
+	}
+	return 0;
+}
+
 std::uint32_t InterpreterImpl::nptr(std::uint32_t tid) {
 	// Get the level of indirection of a type, that is, the number of times an
 	// object of that type must be dereferenced to get a non-pointer.
@@ -290,33 +501,35 @@ std::uint32_t InterpreterImpl::nptr(std::uint32_t tid) {
 	return i;
 }
 
-void InterpreterImpl::pos_unpack(Any args) {
-	Type* type = types[args.tid];
-	Any iter_method =
-		get_var(type.dunder_callattr, BuiltinSymbol::DUNDER_ITER);
-	if (iter_method.tid == 0)
-		raise(not_iterable_error(args));
-	Any iter = call1(iter_method, args);
-	if (iter.tid == 0)
-		return;
-	Type* iter_type = types[iter.tid];
-	
-	Any adv_method =
-		get_var(iter_type.dunder_callattr, BuiltinSymbol::DUNDER_ADVANCE);
-	if (adv_method.tid == 0)
-		raise(no_iter_advance_method_error(iter));
-	
-	Any item_method =
-		get_var(iter_type.dunder_callattr, BuiltinSymbol::DUNDER_ITEM);
-	if (item_method.tid == 0)
-		raise(no_iter_item_method_error(iter));
-	
-	Any end_method =
-		get_var(iter_type.dunder_callattr, BuiltinSymbol::DUNDER_END);
-	if (end_method.tid == 0)
-		raise(no_iter_end_method_error(iter));
+int InterpreterImpl::pos_unpack(Any args) {
+	// Push every item of args onto the value stack. Builtin sequences are
+	// copied in one go. Calls made here pop their own arguments before
+	// returning, so the items end up contiguous.
+	if (coreutil::is_seq_tid(args.tid)) {
+		std::uint32_t len = coreutil::seq_len(args);
+		Any* slots = push_values(len);
+		if (slots == nullptr)
+			return 1;
+		for (std::uint32_t i = 0; i < len; i++)
+			slots[i] = coreutil::seq_item(args, i);
+		return 0;
+	}
 
-	Any is_end = call1(end_method, iter);
+	Any cursor[coreutil::ITER_SLOTS];
+	if (iter_begin(args, cursor) != 0)
+		return 1;
+	while (true) {
+		bool end;
+		Any item = iter_next(cursor, end);
+		if (coreutil::is_error(item))
+			return 1;
+		if (end)
+			return 0;
+		Any* slot = push_values(1);
+		if (slot == nullptr)
+			return 1;
+		*slot = item;
+	}
 }
 
 std::uint32_t InterpreterImpl::ptr_tid_for(std::uint32_t tid) {
@@ -342,6 +555,42 @@ Type InterpreterImpl::ptr_type_for(std::uint32_t tid) {
 	*types_len_ptr += 1;
 }
 
+Any* InterpreterImpl::push_values(std::uint32_t n) {
+	// Reserve n slots on top of the value stack, which never grows.
+	Stack& stack = state.stack;
+	if (state.config.max_values - stack.nvalues < n) {
+		coreutil::raise(
+			state, ValueStackOverflowError{state.config.max_values}
+		);
+		return nullptr;
+	}
+	Any* res = stack.values + stack.nvalues;
+	stack.nvalues += n;
+	return res;
+}
+
+int InterpreterImpl::put_kwarg(Symbol name, Any value, Vars& kwargs) {
+	// Unlike `set_var`, binding a name twice is an error rather than an
+	// assignment.
+	if (!coreutil::is_error(coreutil::get_var(name, kwargs))) {
+		coreutil::raise(state, DuplicateKeywordError{name});
+		return 1;
+	}
+	if (kwargs.len == kwargs.cap) {
+		coreutil::raise(state, KeywordsError{&name, 1});
+		return 1;
+	}
+	std::uint32_t idx = name % kwargs.cap;
+	while (
+		kwargs.names[idx] != static_cast<Symbol>(BuiltinSymbol::NO_SYMBOL)
+	)
+		idx = (idx + 1) % kwargs.cap;
+	kwargs.names[idx] = name;
+	kwargs.data[idx] = value;
+	kwargs.idxs[kwargs.len++] = idx;
+	return 0;
+}
+
 void InterpreterImpl::raise(Any exc, Source origin) {
 	state.exc_info = ExcInfo{exc, origin};
 }
@@ -0,0 +1,337 @@
+#pragma once
+
+// Baseline JIT compiling register code to x86-64 machine code, when built with
+// `DL_JIT`. Without it `run_tiered` always interprets.
+
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <vector>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/assembler.hpp"
+#include "dl/interpreter2/binaryop.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/exceptions.hpp"
+#include "dl/interpreter2/interpreterimpl.hpp"
+#include "dl/interpreter2/regcode.hpp"
+#include "dl/interpreter2/regvm.hpp"
+#include "dl/interpretnode/call.hpp"
+
+namespace dl::jit {
+
+// State shared by the native code of a frame and the helpers it calls.
+struct Context {
+    InterpreterImpl& interp;
+    RegCode& code;
+    Any* slots;
+    std::uint32_t frame_top;
+    // What the frame returns, once a helper returns nonzero.
+    Any res;
+};
+
+// Native code runs instructions it has no template for, and the slow paths of
+// the ones it has, by calling a helper with the instruction word. A helper
+// returns zero to continue with the next instruction, or nonzero once the
+// frame is done, with `Context::res` set.
+using Helper = int (*)(Context*, std::uint32_t);
+
+using Entry = void (*)(Context*, Any*);
+
+int finish(Context* ctx, Any res) noexcept {
+    ctx->res = res;
+    return 1;
+}
+
+template<BinaryOp OP>
+int binary(Context* ctx, std::uint32_t inst) {
+    Any x = ctx->slots[reg_b(inst)];
+    Any y = ctx->slots[reg_c(inst)];
+    if (vm::binary_fast<OP>(x, y, ctx->slots[reg_a(inst)]))
+        return 0;
+    Any res = vm::binary_slow(ctx->interp, OP, x, y);
+    if (coreutil::is_error(res))
+        return finish(ctx, res);
+    ctx->slots[reg_a(inst)] = res;
+    return 0;
+}
+
+int call(Context* ctx, std::uint32_t inst) {
+    Stack& stack = ctx->interp.state.stack;
+    Any* callee = ctx->slots + reg_b(inst);
+    auto base = static_cast<std::uint32_t>(callee + 1 - stack.values);
+    Any res = ctx->interp.call(
+        Call{Source{}, *callee, base, reg_c(inst), 0, 0, nullptr, 0}
+    );
+    stack.nvalues = ctx->frame_top;
+    if (coreutil::is_error(res))
+        return finish(ctx, res);
+    ctx->slots[reg_a(inst)] = res;
+    return 0;
+}
+
+int get_attr(Context* ctx, std::uint32_t inst) {
+    const AttrCache& cache = ctx->code.attr_caches[reg_c(inst)];
+    Any obj = ctx->slots[reg_b(inst)];
+    std::uint32_t field_tid;
+    std::uint32_t offset;
+    if (
+        is_immediate_tid(obj.tid) || !coreutil::find_field(
+            ctx->interp.state, obj.tid, cache.name, field_tid, offset
+        )
+    ) {
+        coreutil::raise(ctx->interp.state, NoAttrError{obj, cache.name});
+        return finish(ctx, coreutil::ERROR_SIGNAL);
+    }
+    ctx->slots[reg_a(inst)] = coreutil::load_field(obj, field_tid, offset);
+    return 0;
+}
+
+// Only reached once the inline check of a `BRANCH` failed.
+int not_bool(Context* ctx, std::uint32_t inst) {
+    Any cond = ctx->slots[reg_a(inst)];
+    coreutil::raise(ctx->interp.state, NotBoolError{cond});
+    return finish(ctx, coreutil::ERROR_SIGNAL);
+}
+
+int ret(Context* ctx, std::uint32_t inst) {
+    return finish(ctx, ctx->slots[reg_a(inst)]);
+}
+
+int raise(Context* ctx, std::uint32_t inst) {
+    ctx->interp.state.exc_info.raised = ctx->slots[reg_a(inst)];
+    return finish(ctx, coreutil::ERROR_SIGNAL);
+}
+
+int end(Context* ctx, std::uint32_t) {
+    return finish(ctx, coreutil::NONE);
+}
+
+constexpr Helper BINARY_HELPERS[] = {
+    binary<BinaryOp::ADD>,
+    binary<BinaryOp::SUB>,
+    binary<BinaryOp::MUL>,
+    binary<BinaryOp::DIV>,
+    binary<BinaryOp::MOD>,
+    binary<BinaryOp::EQ>,
+    binary<BinaryOp::NEQ>,
+    binary<BinaryOp::LT>,
+    binary<BinaryOp::LTE>,
+    binary<BinaryOp::GT>,
+    binary<BinaryOp::GTE>
+};
+
+// Stitches the machine code templates of instructions together. Native code
+// keeps the context in rbx and the frame's slots in r12; jumps target the
+// index of an instruction.
+struct RegAssembler: Assembler {
+    static constexpr auto BOOL =
+        static_cast<std::uint32_t>(BuiltinTypeID::BOOL);
+    static constexpr auto INT64 =
+        static_cast<std::uint32_t>(BuiltinTypeID::INT64);
+
+    void call_helper(Helper helper, std::uint32_t inst) {
+        bytes({0x48, 0x89, 0xdf}); // mov rdi, rbx
+        bytes({0xbe});             // mov esi, inst
+        u32(inst);
+        bytes({0x48, 0xb8});       // mov rax, helper
+        u64(reinterpret_cast<std::uint64_t>(helper));
+        bytes({0xff, 0xd0});       // call rax
+        bytes({0x85, 0xc0});       // test eax, eax
+        bytes({0x0f, 0x85});       // jnz exit
+        rel32(EXIT);
+    }
+
+    // Inline `Int64` arithmetic or comparison, falling back to the helper for
+    // other operands and on overflow.
+    void binary_int64(std::uint32_t inst, BinaryOp op) {
+        using enum BinaryOp;
+        std::size_t not_b = guard_tid(reg_b(inst), INT64);
+        std::size_t not_c = guard_tid(reg_c(inst), INT64);
+        load_data(0, reg_b(inst)); // mov rax, [b data]
+        std::size_t overflow = 0;
+        if (op == ADD || op == SUB || op == MUL) {
+            if (op == ADD)
+                bytes({0x49, 0x03}); // add rax, [c data]
+            else if (op == SUB)
+                bytes({0x49, 0x2b}); // sub rax, [c data]
+            else
+                bytes({0x49, 0x0f, 0xaf}); // imul rax, [c data]
+            slot_operand(0, data_at(reg_c(inst)));
+            bytes({0x0f, 0x80});   // jo slow
+            overflow = forward();
+            store_tid(reg_a(inst), INT64);
+        } else {
+            bytes({0x49, 0x3b});   // cmp rax, [c data]
+            slot_operand(0, data_at(reg_c(inst)));
+            auto cc = COMPARE_CCS[static_cast<int>(op) - static_cast<int>(EQ)];
+            bytes({0x0f, cc, 0xc0}); // setcc al
+            bytes({0x0f, 0xb6, 0xc0}); // movzx eax, al
+            store_tid(reg_a(inst), BOOL);
+        }
+        store_data(reg_a(inst), 0); // mov [a data], rax
+        bytes({0xe9});             // jmp next
+        std::size_t done = forward();
+        bind(not_b);
+        bind(not_c);
+        if (overflow != 0)
+            bind(overflow);
+        call_helper(BINARY_HELPERS[static_cast<int>(op)], inst);
+        bind(done);
+    }
+
+    void branch(std::uint32_t inst) {
+        std::size_t not_bool = guard_tid(reg_a(inst), BOOL);
+        bytes({0x41, 0x80});       // cmp byte [a data], 0
+        slot_operand(7, data_at(reg_a(inst)));
+        bytes({0x00});
+        bytes({0x0f, 0x84});       // je target
+        rel32(reg_bx(inst));
+        bytes({0xe9});             // jmp next
+        std::size_t done = forward();
+        bind(not_bool);
+        call_helper(jit::not_bool, inst);
+        bind(done);
+    }
+};
+
+// Compile code, which must have passed `verify`, to native code. Returns an
+// empty `JitCode` if executable memory cannot be had, or if code has a
+// `SWITCH` or walks items with `ITER`, which stay interpreted.
+JitCode compile(const RegCode& code) {
+    using enum RegOpcode;
+    auto as = RegAssembler();
+    std::vector<std::size_t> offsets(code.len);
+    as.prologue();
+    for (std::uint32_t i = 0; i < code.len; i++) {
+        offsets[i] = as.buf.size();
+        std::uint32_t inst = code.insts[i];
+        // Native code guards every operand itself, so it does not need the
+        // quickened forms.
+        RegOpcode op = generic_opcode_of(reg_opcode_of(inst));
+        switch (op) {
+        case MOVE:
+            as.move(reg_a(inst), reg_b(inst));
+            break;
+        case LOADK: {
+            const Any& k = code.consts[reg_bx(inst)];
+            if (is_immediate_tid(k.tid))
+                as.loadk(reg_a(inst), k);
+            else
+                as.loadk_at(reg_a(inst), &k);
+            break;
+        }
+        case ADD:
+        case SUB:
+        case MUL:
+        case EQ:
+        case NEQ:
+        case LT:
+        case LTE:
+        case GT:
+        case GTE:
+            as.binary_int64(inst, static_cast<BinaryOp>(
+                static_cast<std::uint32_t>(op) - static_cast<std::uint32_t>(ADD)
+            ));
+            break;
+        case DIV:
+        case MOD:
+            as.call_helper(BINARY_HELPERS[static_cast<int>(op) - 2], inst);
+            break;
+        case CALL:
+            as.call_helper(call, inst);
+            break;
+        case GET_ATTR:
+            as.call_helper(get_attr, inst);
+            break;
+        case BRANCH:
+            as.branch(inst);
+            break;
+        case GOTO:
+        case LOOP:
+            as.jump(reg_bx(inst));
+            break;
+        case RETURN:
+            as.call_helper(ret, inst);
+            break;
+        case RAISE:
+            as.call_helper(raise, inst);
+            break;
+        case SWITCH:
+        case ITER:
+        case FOR_ITER:
+            return JitCode();
+        case FOR_NEXT: {
+            // As the addition, comparison and branch it stands for.
+            std::uint32_t a = reg_a(inst);
+            std::uint32_t b = reg_b(inst);
+            auto test = reg_c(inst) != 0 ? BinaryOp::GT : BinaryOp::LT;
+            auto test_op = static_cast<RegOpcode>(
+                static_cast<std::uint32_t>(ADD) +
+                static_cast<std::uint32_t>(test)
+            );
+            as.binary_int64(encode_abc(ADD, a, a, b + 1), BinaryOp::ADD);
+            as.binary_int64(encode_abc(test_op, b + 2, a, b), test);
+            as.branch(encode_abx(BRANCH, b + 2, i + 2));
+            break;
+        }
+        default:
+            as.call_helper(end, inst);
+        }
+    }
+    std::size_t exit = as.buf.size();
+    as.epilogue();
+    as.link(offsets, exit);
+    return make_executable(as.buf);
+}
+
+// Run the native code of code in a new frame, like `vm::run`.
+Any run(InterpreterImpl& interp, RegCode& code, const JitCode& jit) {
+    Stack& stack = interp.state.stack;
+    Seq& args = coreutil::args(interp.state).args;
+    std::uint32_t frame_base = stack.nvalues;
+    Any* slots = interp.push_values(code.nslots);
+    if (slots == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    std::fill_n(slots, code.nslots, coreutil::NONE);
+    std::copy_n(args.xs, std::min(args.len, code.nslots), slots);
+    auto ctx = Context{interp, code, slots, stack.nvalues, coreutil::NONE};
+    jit.entry<Entry>()(&ctx, slots);
+    stack.nvalues = frame_base;
+    return ctx.res;
+}
+
+}
+
+namespace dl {
+
+// Register code that moves to native code once it has run often enough.
+struct TieredCode {
+    RegCode code;
+    std::uint32_t runs = 0;
+    jit::JitCode jit;
+};
+
+}
+
+namespace dl::vm {
+
+// Run tiered code, compiling it to native code on the run that reaches
+// `Config::jit_threshold` when built with `DL_JIT`. If compiling fails, code
+// stays interpreted.
+Any run_tiered(InterpreterImpl& interp, TieredCode& tiered) {
+#ifdef DL_JIT_ENABLED
+    if (tiered.jit.mem != nullptr)
+        return jit::run(interp, tiered.code, tiered.jit);
+    if (++tiered.runs == interp.state.config.jit_threshold) {
+        tiered.jit = jit::compile(tiered.code);
+        if (tiered.jit.mem != nullptr)
+            return jit::run(interp, tiered.code, tiered.jit);
+    }
+#endif
+    return run(interp, tiered.code);
+}
+
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+
+#include "dl/interpreter2/builtintypeid.hpp"
+
+namespace dl {
+
+// Payloads are handed out in multiples of this, which is also their alignment.
+constexpr std::uint32_t POOL_ALIGN = 8;
+
+// Payloads larger than this are not pooled and go straight to `std::malloc`.
+constexpr std::uint32_t MAX_POOLED_SIZE = 512;
+
+// Maximum number of size classes, including those added for user types.
+constexpr std::uint32_t MAX_SIZE_CLASSES = 32;
+
+// Number of bytes requested from the system at a time for a single class.
+constexpr std::uint32_t POOL_CHUNK_SIZE = 64 * 1024;
+
+// Allocation counters for a single size class, exposed to tune the classes.
+struct PoolClassStats {
+    // Size in bytes of each block of the class.
+    std::uint32_t size;
+
+    // Total number of blocks handed out from this class.
+    std::uint64_t allocs;
+
+    // Total number of blocks returned to this class.
+    std::uint64_t frees;
+
+    // Number of chunks requested from the system for this class.
+    std::uint64_t chunks;
+};
+
+// Segregated free-list allocator for runtime object payloads. Each size class
+// carves blocks out of chunks and recycles freed blocks through an intrusive
+// free list, so both allocation and deallocation are O(1).
+struct Pool {
+    // Freed blocks store the next free block of their class in place.
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    // Chunks are linked through their first word so they can be released.
+    struct Chunk {
+        Chunk* next;
+    };
+
+    // Block sizes of each class, in increasing order.
+    PoolClassStats classes[MAX_SIZE_CLASSES];
+
+    // Head of the free list of each class.
+    FreeBlock* free[MAX_SIZE_CLASSES];
+
+    // Unused tail of the most recent chunk of each class.
+    char* bump[MAX_SIZE_CLASSES];
+    char* bump_end[MAX_SIZE_CLASSES];
+
+    // Number of classes currently in use.
+    std::uint32_t nclasses;
+
+    // Maps `(size + POOL_ALIGN - 1) / POOL_ALIGN` to the smallest class which
+    // fits it, making class lookup a single load.
+    std::uint8_t class_for[MAX_POOLED_SIZE / POOL_ALIGN + 1];
+
+    // All chunks requested so far.
+    Chunk* chunks;
+
+    // Counters for payloads too large to be pooled.
+    std::uint64_t large_allocs;
+    std::uint64_t large_frees;
+
+    // Bytes the owner of the pool prepends to every payload, such as an object
+    // header. Added to each class so that payloads still fit exactly.
+    std::uint32_t overhead;
+
+    static constexpr std::uint32_t round_up(std::uint64_t size) noexcept {
+        if (size == 0)
+            return POOL_ALIGN;
+        return (size + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+    }
+
+    // Start with one class per distinct builtin composite size, so that every
+    // builtin payload fits a class exactly. Power-of-two classes up to
+    // `MAX_POOLED_SIZE` catch user structs registered once classes run out.
+    Pool(std::uint32_t overhead = 0) noexcept:
+    classes(),
+    free(),
+    bump(),
+    bump_end(),
+    nclasses(0),
+    class_for(),
+    chunks(nullptr),
+    large_allocs(0),
+    large_frees(0),
+    overhead(overhead == 0 ? 0 : round_up(overhead)) {
+        for (std::uint32_t size: BUILTIN_SIZES)
+            add_class(size);
+        for (std::uint32_t sz = POOL_ALIGN; sz <= MAX_POOLED_SIZE; sz *= 2)
+            add_class(sz);
+    }
+
+    Pool(const Pool& that) = delete;
+
+    ~Pool() noexcept {
+        while (chunks != nullptr) {
+            Chunk* next = chunks->next;
+            std::free(chunks);
+            chunks = next;
+        }
+    }
+
+    // Add a class whose blocks fit payloads of exactly `size` bytes (after
+    // rounding), if there is no such class yet and there is room for it.
+    // Called for each `Struct::size` as types are registered. The overhead is
+    // not counted against `MAX_POOLED_SIZE`, so that the largest power of two
+    // class always fits whatever `allocate` pools.
+    void add_class(std::uint64_t size) noexcept {
+        if (size > MAX_POOLED_SIZE || nclasses == MAX_SIZE_CLASSES)
+            return;
+        std::uint32_t rounded = round_up(size) + overhead;
+        std::uint32_t idx = 0;
+        while (idx < nclasses && classes[idx].size < rounded)
+            idx++;
+        if (idx < nclasses && classes[idx].size == rounded)
+            return;
+
+        // Shift larger classes up to keep classes sorted by size. Blocks freed
+        // after this may land in a smaller class than they came from, which
+        // only wastes the difference.
+        for (std::uint32_t i = nclasses; i > idx; i--) {
+            classes[i] = classes[i - 1];
+            free[i] = free[i - 1];
+            bump[i] = bump[i - 1];
+            bump_end[i] = bump_end[i - 1];
+        }
+        classes[idx] = PoolClassStats{rounded, 0, 0, 0};
+        free[idx] = nullptr;
+        bump[idx] = nullptr;
+        bump_end[idx] = nullptr;
+        nclasses++;
+
+        // Rebuild the lookup table from scratch; it is tiny.
+        std::uint32_t cls = 0;
+        for (std::uint32_t i = 0; i <= MAX_POOLED_SIZE / POOL_ALIGN; i++) {
+            while (cls < nclasses && classes[cls].size < i * POOL_ALIGN)
+                cls++;
+            class_for[i] = cls;
+        }
+    }
+
+    // Get memory for a payload of `size` bytes.
+    void* allocate(std::uint64_t size) noexcept {
+        if (size > MAX_POOLED_SIZE) {
+            large_allocs++;
+            return std::malloc(size);
+        }
+        std::uint32_t cls = class_for[(size + POOL_ALIGN - 1) / POOL_ALIGN];
+        classes[cls].allocs++;
+        if (free[cls] != nullptr) {
+            FreeBlock* block = free[cls];
+            free[cls] = block->next;
+            return block;
+        }
+        std::uint32_t block_size = classes[cls].size;
+        if (bump[cls] == nullptr || bump[cls] + block_size > bump_end[cls])
+            refill(cls);
+        void* res = bump[cls];
+        bump[cls] += block_size;
+        return res;
+    }
+
+    // Return a payload of `size` bytes, which must be the size it was
+    // allocated with.
+    void deallocate(void* data, std::uint64_t size) noexcept {
+        if (data == nullptr)
+            return;
+        if (size > MAX_POOLED_SIZE) {
+            large_frees++;
+            std::free(data);
+            return;
+        }
+        std::uint32_t cls = class_for[(size + POOL_ALIGN - 1) / POOL_ALIGN];
+        classes[cls].frees++;
+        auto block = static_cast<FreeBlock*>(data);
+        block->next = free[cls];
+        free[cls] = block;
+    }
+
+    // Request a new chunk for the given class.
+    void refill(std::uint32_t cls) noexcept {
+        auto chunk = static_cast<Chunk*>(std::malloc(POOL_CHUNK_SIZE));
+        assert(chunk != nullptr);
+        chunk->next = chunks;
+        chunks = chunk;
+        classes[cls].chunks++;
+        // The chunk header takes the first aligned slot.
+        bump[cls] = reinterpret_cast<char*>(chunk) + round_up(sizeof(Chunk));
+        bump_end[cls] = reinterpret_cast<char*>(chunk) + POOL_CHUNK_SIZE;
+    }
+};
+
+// Each thread gets its own pool so no locking is needed. Payloads must be freed
+// on the thread that allocated them.
+Pool& payload_pool() noexcept {
+    thread_local auto pool = Pool();
+    return pool;
+}
+
+}
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/trace.hpp"
+
+namespace dl {
+
+// Operations of the register VM in `dl/interpreter2/regvm.hpp`. Operands name
+// frame slots directly, so an operation reads its inputs and writes its result
+// without any operand stack traffic.
+enum class RegOpcode: std::uint8_t {
+    // `a = b`
+    MOVE,
+    // `a = consts[bx]`
+    LOADK,
+    // `a = b op c`, in the order of `BinaryOp`.
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    EQ,
+    NEQ,
+    LT,
+    LTE,
+    GT,
+    GTE,
+    // `a = b(b + 1, ..., b + c)`. The callee and its arguments are adjacent so
+    // that the arguments can be passed in place.
+    CALL,
+    // `a = b.name`, where name is that of attribute cache `c`.
+    GET_ATTR,
+    // Jump to instruction `bx` if `a` is false.
+    BRANCH,
+    // Jump to instruction `bx`.
+    GOTO,
+    // Return `a`.
+    RETURN,
+    // Raise `a`.
+    RAISE,
+    // Jump back to instruction `bx`, the head of the loop with trace `a`.
+    LOOP,
+    // Jump to the target of the case of switch table `bx` that `a` equals.
+    SWITCH,
+    // Step the counter of a range loop, `a = a + (b + 1)`, and compare it to
+    // the limit `b`, writing the result to `b + 2`: `a < b`, or `a > b` if `c`
+    // is 1 and the loop counts down. Go on to the next instruction, the `LOOP`
+    // back, while it is true, and skip it once it is false.
+    FOR_NEXT,
+    // Set up the `ITER_SLOTS` slots from `a` to walk the items of `b`.
+    ITER,
+    // Write the next item of the walk in the slots from `b` to `a` and go on
+    // to the next instruction, the `LOOP` back, or skip it if there are no
+    // more.
+    FOR_ITER,
+
+    // Typed forms, which compilers emit where they proved the types of the
+    // operands. They have no guard and are never rewritten; what their fast
+    // path leaves to the dunder method, such as overflow, still goes to it.
+
+    // Binary operators on two `Int64`s, in the order of `BinaryOp`.
+    ADD_INT64_TYPED,
+    SUB_INT64_TYPED,
+    MUL_INT64_TYPED,
+    DIV_INT64_TYPED,
+    MOD_INT64_TYPED,
+    EQ_INT64_TYPED,
+    NEQ_INT64_TYPED,
+    LT_INT64_TYPED,
+    LTE_INT64_TYPED,
+    GT_INT64_TYPED,
+    GTE_INT64_TYPED,
+    // Binary operators on two `Float64`s, in the order of `BinaryOp`.
+    ADD_FLOAT64_TYPED,
+    SUB_FLOAT64_TYPED,
+    MUL_FLOAT64_TYPED,
+    DIV_FLOAT64_TYPED,
+    MOD_FLOAT64_TYPED,
+    EQ_FLOAT64_TYPED,
+    NEQ_FLOAT64_TYPED,
+    LT_FLOAT64_TYPED,
+    LTE_FLOAT64_TYPED,
+    GT_FLOAT64_TYPED,
+    GTE_FLOAT64_TYPED,
+
+    // Quickened forms, which generic instructions rewrite themselves to once
+    // they have seen the same kind of operands for a while. Each guards that
+    // its operands are still of that kind, and rewrites itself back to the
+    // generic form if not.
+
+    // Binary operators on two `Int64`s, in the order of `BinaryOp`.
+    ADD_INT64,
+    SUB_INT64,
+    MUL_INT64,
+    DIV_INT64,
+    MOD_INT64,
+    EQ_INT64,
+    NEQ_INT64,
+    LT_INT64,
+    LTE_INT64,
+    GT_INT64,
+    GTE_INT64,
+    // Binary operators on two `Float64`s, in the order of `BinaryOp`.
+    ADD_FLOAT64,
+    SUB_FLOAT64,
+    MUL_FLOAT64,
+    DIV_FLOAT64,
+    MOD_FLOAT64,
+    EQ_FLOAT64,
+    NEQ_FLOAT64,
+    LT_FLOAT64,
+    LTE_FLOAT64,
+    GT_FLOAT64,
+    GTE_FLOAT64,
+    // `CALL` of a `FnPtr` with only positional arguments, skipping argument
+    // binding and callee dispatch.
+    CALL_FN_PTR,
+    // `GET_ATTR` on an object of the type recorded in its cache, skipping the
+    // field lookup.
+    GET_ATTR_SHAPE,
+
+    // Return None. Code must end with it, so it cannot run off its end.
+    END
+};
+
+// Executions of a generic instruction before it first tries to quicken.
+constexpr std::uint8_t QUICKEN_DELAY = 8;
+
+// Executions before trying again after a failed attempt or a failed guard, so
+// that instructions with unstable operand types stop paying for it.
+constexpr std::uint8_t QUICKEN_BACKOFF = 250;
+
+// Inline cache of a `GET_ATTR` instruction: the attribute name, and the field
+// it was last found at.
+struct AttrCache {
+    Symbol name;
+    std::uint32_t tid;
+    std::uint32_t field_tid;
+    std::uint32_t offset;
+};
+
+// Cases of a `SWITCH`: `Int64` keys, in source order, each with the
+// instruction to jump to if the operand equals it, and where to jump if it
+// equals none. Only the first of equal keys counts.
+//
+// An `Int64` operand is looked up in the jump table `dense` if the keys are
+// close enough together for one, and by binary search otherwise. Any other
+// operand is compared with `==` to each key in turn, as the chain of
+// comparisons the switch stands for would.
+struct SwitchTable {
+    const std::int64_t* keys;
+    const std::uint32_t* targets;
+    std::uint32_t len;
+    std::uint32_t otherwise;
+
+    // Distinct keys in ascending order, and their targets.
+    const std::int64_t* sorted_keys;
+    const std::uint32_t* sorted_targets;
+    std::uint32_t nsorted;
+
+    // Target of each value from `min` on, or null.
+    const std::uint32_t* dense;
+    std::uint32_t ndense;
+    std::int64_t min;
+
+    std::uint32_t find(std::int64_t x) const noexcept {
+        if (dense != nullptr) {
+            // Values below `min` wrap around to offsets past the end.
+            std::uint64_t i = static_cast<std::uint64_t>(x) -
+                static_cast<std::uint64_t>(min);
+            return i < ndense ? dense[i] : otherwise;
+        }
+        const std::int64_t* end = sorted_keys + nsorted;
+        const std::int64_t* it = std::lower_bound(sorted_keys, end, x);
+        return it != end && *it == x ?
+            sorted_targets[it - sorted_keys] : otherwise;
+    }
+};
+
+// Instructions are single words in one of two layouts, both with the opcode in
+// the low byte:
+//
+//     | c (8) | b (8) | a (8) | op (8) |
+//     |    bx (16)    | a (8) | op (8) |
+//
+// So a frame has at most 256 slots.
+constexpr std::uint32_t REG_OPERAND_BITS = 8;
+constexpr std::uint32_t MAX_REG_SLOTS = 1 << REG_OPERAND_BITS;
+constexpr std::uint32_t MAX_REG_BX = (1 << 16) - 1;
+
+constexpr std::uint32_t encode_abc(
+    RegOpcode op, std::uint32_t a, std::uint32_t b = 0, std::uint32_t c = 0
+) noexcept {
+    return c << 24 | b << 16 | a << 8 | static_cast<std::uint32_t>(op);
+}
+
+constexpr std::uint32_t encode_abx(
+    RegOpcode op, std::uint32_t a, std::uint32_t bx
+) noexcept {
+    return bx << 16 | a << 8 | static_cast<std::uint32_t>(op);
+}
+
+constexpr RegOpcode reg_opcode_of(std::uint32_t inst) noexcept {
+    return static_cast<RegOpcode>(inst & 0xff);
+}
+
+// The generic form of a quickened or typed opcode.
+constexpr RegOpcode generic_opcode_of(RegOpcode op) noexcept {
+    using enum RegOpcode;
+    auto i = static_cast<std::uint32_t>(op);
+    if (op >= ADD_INT64_TYPED && op <= GTE_INT64_TYPED)
+        return static_cast<RegOpcode>(
+            static_cast<std::uint32_t>(ADD) + i -
+            static_cast<std::uint32_t>(ADD_INT64_TYPED)
+        );
+    if (op >= ADD_FLOAT64_TYPED && op <= GTE_FLOAT64_TYPED)
+        return static_cast<RegOpcode>(
+            static_cast<std::uint32_t>(ADD) + i -
+            static_cast<std::uint32_t>(ADD_FLOAT64_TYPED)
+        );
+    if (op >= ADD_INT64 && op <= GTE_INT64)
+        return static_cast<RegOpcode>(
+            static_cast<std::uint32_t>(ADD) + i -
+            static_cast<std::uint32_t>(ADD_INT64)
+        );
+    if (op >= ADD_FLOAT64 && op <= GTE_FLOAT64)
+        return static_cast<RegOpcode>(
+            static_cast<std::uint32_t>(ADD) + i -
+            static_cast<std::uint32_t>(ADD_FLOAT64)
+        );
+    if (op == CALL_FN_PTR)
+        return CALL;
+    if (op == GET_ATTR_SHAPE)
+        return GET_ATTR;
+    return op;
+}
+
+constexpr std::uint32_t reg_a(std::uint32_t inst) noexcept {
+    return inst >> 8 & 0xff;
+}
+
+constexpr std::uint32_t reg_b(std::uint32_t inst) noexcept {
+    return inst >> 16 & 0xff;
+}
+
+constexpr std::uint32_t reg_c(std::uint32_t inst) noexcept {
+    return inst >> 24;
+}
+
+constexpr std::uint32_t reg_bx(std::uint32_t inst) noexcept {
+    return inst >> 16;
+}
+
+struct RegCode {
+    // Mutable, as instructions are quickened in place.
+    std::uint32_t* insts;
+    std::uint32_t len;
+
+    // Executions left before each instruction tries to quicken.
+    std::uint8_t* counters;
+
+    AttrCache* attr_caches;
+    std::uint32_t nattr_caches;
+
+    LoopTrace* traces;
+    std::uint32_t ntraces;
+
+    const Any* consts;
+    std::uint32_t nconsts;
+
+    const SwitchTable* switches;
+    std::uint32_t nswitches;
+
+    // Number of slots of a frame: arguments, then the other local variables,
+    // then temporaries.
+    std::uint32_t nslots;
+};
+
+// Check that the targets of a switch table are in code of length len.
+bool in_range(const SwitchTable& table, std::uint32_t len) {
+    auto in_code = [&](const std::uint32_t* targets, std::uint32_t n) {
+        return std::all_of(targets, targets + n, [&](std::uint32_t target) {
+            return target < len;
+        });
+    };
+    return table.otherwise < len && in_code(table.targets, table.len) &&
+        in_code(table.sorted_targets, table.nsorted) &&
+        (table.dense == nullptr || in_code(table.dense, table.ndense));
+}
+
+// Check that code is safe to run without checks in the VM loop: opcodes, slots,
+// constants and jump targets in range, and the last instruction is `END`.
+// Returns nonzero if code is malformed.
+int verify(const RegCode& code) {
+    using enum RegOpcode;
+    if (
+        code.len == 0 || code.nslots > MAX_REG_SLOTS ||
+        reg_opcode_of(code.insts[code.len - 1]) != END
+    )
+        return 1;
+    for (std::uint32_t i = 0; i < code.len; i++) {
+        std::uint32_t inst = code.insts[i];
+        std::uint32_t a = reg_a(inst);
+        bool ok;
+        switch (reg_opcode_of(inst)) {
+        case MOVE:
+            ok = a < code.nslots && reg_b(inst) < code.nslots;
+            break;
+        case LOADK:
+            ok = a < code.nslots && reg_bx(inst) < code.nconsts;
+            break;
+        case CALL:
+        case CALL_FN_PTR:
+            ok = a < code.nslots && reg_b(inst) + reg_c(inst) < code.nslots;
+            break;
+        case GET_ATTR:
+        case GET_ATTR_SHAPE:
+            ok = a < code.nslots && reg_b(inst) < code.nslots &&
+                reg_c(inst) < code.nattr_caches;
+            break;
+        case BRANCH:
+            ok = a < code.nslots && reg_bx(inst) < code.len;
+            break;
+        case GOTO:
+            ok = reg_bx(inst) < code.len;
+            break;
+        case LOOP:
+            ok = a < code.ntraces && reg_bx(inst) < code.len;
+            break;
+        case SWITCH:
+            ok = a < code.nslots && reg_bx(inst) < code.nswitches &&
+                in_range(code.switches[reg_bx(inst)], code.len);
+            break;
+        case FOR_NEXT:
+            ok = a < code.nslots && reg_b(inst) + 2 < code.nslots &&
+                reg_c(inst) <= 1 && i + 2 < code.len;
+            break;
+        case ITER:
+            ok = a + coreutil::ITER_SLOTS <= code.nslots &&
+                reg_b(inst) < code.nslots;
+            break;
+        case FOR_ITER:
+            ok = a < code.nslots &&
+                reg_b(inst) + coreutil::ITER_SLOTS <= code.nslots &&
+                i + 2 < code.len;
+            break;
+        case RETURN:
+        case RAISE:
+            ok = a < code.nslots;
+            break;
+        case END:
+            ok = true;
+            break;
+        default:
+            // Binary operators, generic, typed or quickened.
+            ok = reg_opcode_of(inst) < END && a < code.nslots &&
+                reg_b(inst) < code.nslots && reg_c(inst) < code.nslots;
+        }
+        if (!ok)
+            return 1;
+    }
+    return 0;
+}
+
+}
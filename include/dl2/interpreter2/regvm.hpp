@@ -0,0 +1,521 @@
+#pragma once
+
+#include <cstdint>
+
+#include <algorithm>
+#include <iterator>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/binaryop.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/dispatch.hpp"
+#include "dl/interpreter2/exceptions.hpp"
+#include "dl/interpreter2/interpreterimpl.hpp"
+#include "dl/interpreter2/regcode.hpp"
+#include "dl/interpreter2/tracer.hpp"
+#include "dl/interpretnode/call.hpp"
+
+#ifdef DL_COMPUTED_GOTO
+#define DL_OP(op) case RegOpcode::op: op_##op
+#define DL_NEXT() \
+    do { \
+        inst = *pc++; \
+        goto *labels[inst & 0xff]; \
+    } while (false)
+#else
+#define DL_OP(op) case RegOpcode::op
+#define DL_NEXT() goto dispatch
+#endif
+
+// Run the current instruction again after rewriting it.
+#define DL_RETRY() \
+    do { \
+        pc--; \
+        DL_NEXT(); \
+    } while (false)
+
+// Count down an execution of the current generic instruction, and check if it
+// is due to try quickening.
+#define DL_WARM() (--code.counters[pc - 1 - code.insts] == 0)
+
+// Binary operators write straight into their destination slot, and only leave
+// the loop for operands without a fast path.
+#define DL_BINARY(op) \
+    do { \
+        Any x = slots[reg_b(inst)]; \
+        Any y = slots[reg_c(inst)]; \
+        if (DL_WARM()) \
+            quicken_binary(code, pc - 1, BinaryOp::op, x, y); \
+        if (!binary_fast<BinaryOp::op>(x, y, slots[reg_a(inst)])) { \
+            res = binary_slow(interp, BinaryOp::op, x, y); \
+            if (coreutil::is_error(res)) \
+                goto done; \
+            slots[reg_a(inst)] = res; \
+        } \
+        DL_NEXT(); \
+    } while (false)
+
+// Quickened binary operators go back to the generic form when their guard
+// fails, which also covers the operations their fast path leaves to the dunder
+// methods, such as division by zero.
+#define DL_BINARY_AS(kind, op) \
+    do { \
+        Any x = slots[reg_b(inst)]; \
+        Any y = slots[reg_c(inst)]; \
+        if (binary_##kind<BinaryOp::op>(x, y, slots[reg_a(inst)])) \
+            DL_NEXT(); \
+        dequicken(code, pc - 1, RegOpcode::op); \
+        DL_RETRY(); \
+    } while (false)
+
+// Typed binary operators run their fast path with no guard, and call the
+// dunder method for what it leaves to it, but stay as they are.
+#define DL_BINARY_TYPED(kind, op) \
+    do { \
+        Any x = slots[reg_b(inst)]; \
+        Any y = slots[reg_c(inst)]; \
+        if (!binary_##kind##_typed<BinaryOp::op>(x, y, slots[reg_a(inst)])) { \
+            res = binary_slow(interp, BinaryOp::op, x, y); \
+            if (coreutil::is_error(res)) \
+                goto done; \
+            slots[reg_a(inst)] = res; \
+        } \
+        DL_NEXT(); \
+    } while (false)
+
+namespace dl::vm {
+
+void rewrite(std::uint32_t* inst, RegOpcode op) noexcept {
+    *inst = (*inst & ~std::uint32_t{0xff}) | static_cast<std::uint32_t>(op);
+}
+
+// Put a quickened instruction back to its generic form.
+void dequicken(RegCode& code, std::uint32_t* inst, RegOpcode op) noexcept {
+    rewrite(inst, op);
+    code.counters[inst - code.insts] = QUICKEN_BACKOFF;
+}
+
+// Quicken a binary operator for its current operands if they have a quickened
+// form. Only the 64-bit types of unsuffixed literals do; narrower types have
+// wrapping rules that are left to their dunder methods.
+void quicken_binary(
+    RegCode& code, std::uint32_t* inst, BinaryOp op, Any x, Any y
+) noexcept {
+    using enum BuiltinTypeID;
+    code.counters[inst - code.insts] = QUICKEN_BACKOFF;
+    if (x.tid != y.tid)
+        return;
+    RegOpcode first;
+    if (x.tid == static_cast<std::uint32_t>(INT64))
+        first = RegOpcode::ADD_INT64;
+    else if (x.tid == static_cast<std::uint32_t>(FLOAT64))
+        first = RegOpcode::ADD_FLOAT64;
+    else
+        return;
+    rewrite(inst, static_cast<RegOpcode>(
+        static_cast<std::uint32_t>(first) + static_cast<std::uint32_t>(op)
+    ));
+}
+
+// Run code, which must have passed `verify`, in a new frame whose first slots
+// are initialized to the positional arguments at the current call depth.
+// Instructions quicken themselves in place as they run.
+Any run(InterpreterImpl& interp, RegCode& code) {
+    Stack& stack = interp.state.stack;
+    Seq& args = coreutil::args(interp.state).args;
+    std::uint32_t frame_base = stack.nvalues;
+    Any* slots = interp.push_values(code.nslots);
+    if (slots == nullptr)
+        return coreutil::ERROR_SIGNAL;
+    // The whole frame is a GC root, so it must not hold stale references.
+    std::fill_n(slots, code.nslots, coreutil::NONE);
+    std::copy_n(args.xs, std::min(args.len, code.nslots), slots);
+    std::uint32_t frame_top = stack.nvalues;
+
+    std::uint32_t* pc = code.insts;
+    std::uint32_t inst;
+    Any res;
+
+#ifdef DL_COMPUTED_GOTO
+    static void* const labels[] = {
+        &&op_MOVE, &&op_LOADK, &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV,
+        &&op_MOD, &&op_EQ, &&op_NEQ, &&op_LT, &&op_LTE, &&op_GT, &&op_GTE,
+        &&op_CALL, &&op_GET_ATTR, &&op_BRANCH, &&op_GOTO, &&op_RETURN,
+        &&op_RAISE, &&op_LOOP, &&op_SWITCH, &&op_FOR_NEXT, &&op_ITER,
+        &&op_FOR_ITER,
+        &&op_ADD_INT64_TYPED, &&op_SUB_INT64_TYPED,
+        &&op_MUL_INT64_TYPED, &&op_DIV_INT64_TYPED, &&op_MOD_INT64_TYPED,
+        &&op_EQ_INT64_TYPED, &&op_NEQ_INT64_TYPED, &&op_LT_INT64_TYPED,
+        &&op_LTE_INT64_TYPED, &&op_GT_INT64_TYPED, &&op_GTE_INT64_TYPED,
+        &&op_ADD_FLOAT64_TYPED, &&op_SUB_FLOAT64_TYPED, &&op_MUL_FLOAT64_TYPED,
+        &&op_DIV_FLOAT64_TYPED, &&op_MOD_FLOAT64_TYPED, &&op_EQ_FLOAT64_TYPED,
+        &&op_NEQ_FLOAT64_TYPED, &&op_LT_FLOAT64_TYPED, &&op_LTE_FLOAT64_TYPED,
+        &&op_GT_FLOAT64_TYPED, &&op_GTE_FLOAT64_TYPED, &&op_ADD_INT64,
+        &&op_SUB_INT64, &&op_MUL_INT64,
+        &&op_DIV_INT64, &&op_MOD_INT64, &&op_EQ_INT64, &&op_NEQ_INT64,
+        &&op_LT_INT64, &&op_LTE_INT64, &&op_GT_INT64, &&op_GTE_INT64,
+        &&op_ADD_FLOAT64, &&op_SUB_FLOAT64, &&op_MUL_FLOAT64,
+        &&op_DIV_FLOAT64, &&op_MOD_FLOAT64, &&op_EQ_FLOAT64,
+        &&op_NEQ_FLOAT64, &&op_LT_FLOAT64, &&op_LTE_FLOAT64, &&op_GT_FLOAT64,
+        &&op_GTE_FLOAT64, &&op_CALL_FN_PTR, &&op_GET_ATTR_SHAPE, &&op_END
+    };
+    static_assert(
+        std::size(labels) == static_cast<std::size_t>(RegOpcode::END) + 1
+    );
+#endif
+
+#ifndef DL_COMPUTED_GOTO
+dispatch:
+#endif
+    inst = *pc++;
+#ifdef DL_COMPUTED_GOTO
+    goto *labels[inst & 0xff];
+#endif
+    switch (reg_opcode_of(inst)) {
+    DL_OP(MOVE):
+        slots[reg_a(inst)] = slots[reg_b(inst)];
+        DL_NEXT();
+    DL_OP(LOADK):
+        slots[reg_a(inst)] = code.consts[reg_bx(inst)];
+        DL_NEXT();
+    DL_OP(ADD):
+        DL_BINARY(ADD);
+    DL_OP(SUB):
+        DL_BINARY(SUB);
+    DL_OP(MUL):
+        DL_BINARY(MUL);
+    DL_OP(DIV):
+        DL_BINARY(DIV);
+    DL_OP(MOD):
+        DL_BINARY(MOD);
+    DL_OP(EQ):
+        DL_BINARY(EQ);
+    DL_OP(NEQ):
+        DL_BINARY(NEQ);
+    DL_OP(LT):
+        DL_BINARY(LT);
+    DL_OP(LTE):
+        DL_BINARY(LTE);
+    DL_OP(GT):
+        DL_BINARY(GT);
+    DL_OP(GTE):
+        DL_BINARY(GTE);
+    DL_OP(CALL): {
+        // The arguments are passed in place, so the call resets the top of
+        // the value stack into this frame; put it back above the frame.
+        Any* callee = slots + reg_b(inst);
+        if (DL_WARM()) {
+            code.counters[pc - 1 - code.insts] = QUICKEN_BACKOFF;
+            auto fn_ptr = static_cast<std::uint32_t>(BuiltinTypeID::FN_PTR);
+            if (callee->tid == fn_ptr)
+                rewrite(pc - 1, RegOpcode::CALL_FN_PTR);
+        }
+        auto base = static_cast<std::uint32_t>(callee + 1 - stack.values);
+        res = interp.call(
+            Call{Source{}, *callee, base, reg_c(inst), 0, 0, nullptr, 0}
+        );
+        stack.nvalues = frame_top;
+        if (coreutil::is_error(res))
+            goto done;
+        slots[reg_a(inst)] = res;
+        DL_NEXT();
+    }
+    DL_OP(GET_ATTR): {
+        AttrCache& cache = code.attr_caches[reg_c(inst)];
+        Any obj = slots[reg_b(inst)];
+        std::uint32_t field_tid;
+        std::uint32_t offset;
+        if (
+            is_immediate_tid(obj.tid) ||
+            !coreutil::find_field(
+                interp.state, obj.tid, cache.name, field_tid, offset
+            )
+        ) {
+            coreutil::raise(interp.state, NoAttrError{obj, cache.name});
+            res = coreutil::ERROR_SIGNAL;
+            goto done;
+        }
+        if (DL_WARM()) {
+            // Remember where the field is in objects of this type.
+            code.counters[pc - 1 - code.insts] = QUICKEN_BACKOFF;
+            cache.tid = obj.tid;
+            cache.field_tid = field_tid;
+            cache.offset = offset;
+            rewrite(pc - 1, RegOpcode::GET_ATTR_SHAPE);
+        }
+        slots[reg_a(inst)] = coreutil::load_field(obj, field_tid, offset);
+        DL_NEXT();
+    }
+    DL_OP(BRANCH): {
+        Any cond = slots[reg_a(inst)];
+        if (cond.tid != static_cast<std::uint32_t>(BuiltinTypeID::BOOL)) {
+            coreutil::raise(interp.state, NotBoolError{cond});
+            res = coreutil::ERROR_SIGNAL;
+            goto done;
+        }
+        if (!coreutil::unwrap<bool>(cond))
+            pc = code.insts + reg_bx(inst);
+        DL_NEXT();
+    }
+    DL_OP(GOTO):
+        pc = code.insts + reg_bx(inst);
+        DL_NEXT();
+    DL_OP(LOOP): {
+        // Hot loops run as native traces when built with `DL_JIT`, unless also
+        // built with `DL_NO_TRACES`.
+#if defined(DL_JIT_ENABLED) && !defined(DL_NO_TRACES)
+        LoopTrace& trace = code.traces[reg_a(inst)];
+        if (
+            trace.ready() ||
+            (trace.aborts < MAX_TRACE_ABORTS && --trace.countdown == 0)
+        ) {
+            pc = code.insts + trace::enter(
+                interp.state, code, reg_a(inst), reg_bx(inst), slots
+            );
+            DL_NEXT();
+        }
+#endif
+        pc = code.insts + reg_bx(inst);
+        DL_NEXT();
+    }
+    DL_OP(SWITCH): {
+        const SwitchTable& table = code.switches[reg_bx(inst)];
+        Any x = slots[reg_a(inst)];
+        if (x.tid == static_cast<std::uint32_t>(BuiltinTypeID::INT64)) {
+            pc = code.insts + table.find(coreutil::unwrap<std::int64_t>(x));
+            DL_NEXT();
+        }
+        // The slot is read again for every key rather than kept in `x`, since
+        // the frame, not a C++ local, is what the collector keeps up to date.
+        std::uint32_t target = table.otherwise;
+        for (std::uint32_t i = 0; i < table.len; i++) {
+            x = slots[reg_a(inst)];
+            Any key = coreutil::wrap(table.keys[i]);
+            Any eq;
+            if (!binary_fast<BinaryOp::EQ>(x, key, eq)) {
+                eq = binary_slow(interp, BinaryOp::EQ, x, key);
+                if (coreutil::is_error(eq)) {
+                    res = eq;
+                    goto done;
+                }
+            }
+            if (eq.tid != static_cast<std::uint32_t>(BuiltinTypeID::BOOL)) {
+                coreutil::raise(interp.state, NotBoolError{eq});
+                res = coreutil::ERROR_SIGNAL;
+                goto done;
+            }
+            if (coreutil::unwrap<bool>(eq)) {
+                target = table.targets[i];
+                break;
+            }
+        }
+        pc = code.insts + target;
+        DL_NEXT();
+    }
+    DL_OP(FOR_NEXT): {
+        // The limit, the step and the result of the comparison are adjacent.
+        // `Int64`s and `Float64`s take the operators' fast paths, in place;
+        // the rest, and overflow, go to the dunder methods.
+        Any& counter = slots[reg_a(inst)];
+        Any* range = slots + reg_b(inst);
+        bool down = reg_c(inst) != 0;
+        if (!binary_fast<BinaryOp::ADD>(counter, range[1], counter)) {
+            res = binary_slow(interp, BinaryOp::ADD, counter, range[1]);
+            if (coreutil::is_error(res))
+                goto done;
+            counter = res;
+        }
+        bool fast = down ?
+            binary_fast<BinaryOp::GT>(counter, range[0], range[2]) :
+            binary_fast<BinaryOp::LT>(counter, range[0], range[2]);
+        if (!fast) {
+            BinaryOp test = down ? BinaryOp::GT : BinaryOp::LT;
+            res = binary_slow(interp, test, counter, range[0]);
+            if (coreutil::is_error(res))
+                goto done;
+            range[2] = res;
+            if (res.tid != static_cast<std::uint32_t>(BuiltinTypeID::BOOL)) {
+                coreutil::raise(interp.state, NotBoolError{res});
+                res = coreutil::ERROR_SIGNAL;
+                goto done;
+            }
+        }
+        if (!coreutil::unwrap<bool>(range[2]))
+            pc++;
+        DL_NEXT();
+    }
+    DL_OP(ITER):
+        if (interp.iter_begin(slots[reg_b(inst)], slots + reg_a(inst)) != 0) {
+            res = coreutil::ERROR_SIGNAL;
+            goto done;
+        }
+        DL_NEXT();
+    DL_OP(FOR_ITER): {
+        // Builtin sequences are indexed here; iterators go to their methods.
+        Any* cursor = slots + reg_b(inst);
+        bool end;
+        if (cursor[1].tid == static_cast<std::uint32_t>(BuiltinTypeID::INT64)) {
+            auto& i = coreutil::unwrap<std::int64_t>(cursor[1]);
+            end = i >= coreutil::seq_len(cursor[0]);
+            if (!end) {
+                slots[reg_a(inst)] = coreutil::seq_item(
+                    cursor[0], static_cast<std::uint32_t>(i++)
+                );
+            }
+        } else {
+            res = interp.iter_next(cursor, end);
+            if (coreutil::is_error(res))
+                goto done;
+            if (!end)
+                slots[reg_a(inst)] = res;
+        }
+        if (end)
+            pc++;
+        DL_NEXT();
+    }
+    DL_OP(RETURN):
+        res = slots[reg_a(inst)];
+        goto done;
+    DL_OP(RAISE):
+        interp.state.exc_info.raised = slots[reg_a(inst)];
+        res = coreutil::ERROR_SIGNAL;
+        goto done;
+    DL_OP(ADD_INT64_TYPED):
+        DL_BINARY_TYPED(int64, ADD);
+    DL_OP(SUB_INT64_TYPED):
+        DL_BINARY_TYPED(int64, SUB);
+    DL_OP(MUL_INT64_TYPED):
+        DL_BINARY_TYPED(int64, MUL);
+    DL_OP(DIV_INT64_TYPED):
+        DL_BINARY_TYPED(int64, DIV);
+    DL_OP(MOD_INT64_TYPED):
+        DL_BINARY_TYPED(int64, MOD);
+    DL_OP(EQ_INT64_TYPED):
+        DL_BINARY_TYPED(int64, EQ);
+    DL_OP(NEQ_INT64_TYPED):
+        DL_BINARY_TYPED(int64, NEQ);
+    DL_OP(LT_INT64_TYPED):
+        DL_BINARY_TYPED(int64, LT);
+    DL_OP(LTE_INT64_TYPED):
+        DL_BINARY_TYPED(int64, LTE);
+    DL_OP(GT_INT64_TYPED):
+        DL_BINARY_TYPED(int64, GT);
+    DL_OP(GTE_INT64_TYPED):
+        DL_BINARY_TYPED(int64, GTE);
+    DL_OP(ADD_FLOAT64_TYPED):
+        DL_BINARY_TYPED(float64, ADD);
+    DL_OP(SUB_FLOAT64_TYPED):
+        DL_BINARY_TYPED(float64, SUB);
+    DL_OP(MUL_FLOAT64_TYPED):
+        DL_BINARY_TYPED(float64, MUL);
+    DL_OP(DIV_FLOAT64_TYPED):
+        DL_BINARY_TYPED(float64, DIV);
+    DL_OP(MOD_FLOAT64_TYPED):
+        DL_BINARY_TYPED(float64, MOD);
+    DL_OP(EQ_FLOAT64_TYPED):
+        DL_BINARY_TYPED(float64, EQ);
+    DL_OP(NEQ_FLOAT64_TYPED):
+        DL_BINARY_TYPED(float64, NEQ);
+    DL_OP(LT_FLOAT64_TYPED):
+        DL_BINARY_TYPED(float64, LT);
+    DL_OP(LTE_FLOAT64_TYPED):
+        DL_BINARY_TYPED(float64, LTE);
+    DL_OP(GT_FLOAT64_TYPED):
+        DL_BINARY_TYPED(float64, GT);
+    DL_OP(GTE_FLOAT64_TYPED):
+        DL_BINARY_TYPED(float64, GTE);
+    DL_OP(ADD_INT64):
+        DL_BINARY_AS(int64, ADD);
+    DL_OP(SUB_INT64):
+        DL_BINARY_AS(int64, SUB);
+    DL_OP(MUL_INT64):
+        DL_BINARY_AS(int64, MUL);
+    DL_OP(DIV_INT64):
+        DL_BINARY_AS(int64, DIV);
+    DL_OP(MOD_INT64):
+        DL_BINARY_AS(int64, MOD);
+    DL_OP(EQ_INT64):
+        DL_BINARY_AS(int64, EQ);
+    DL_OP(NEQ_INT64):
+        DL_BINARY_AS(int64, NEQ);
+    DL_OP(LT_INT64):
+        DL_BINARY_AS(int64, LT);
+    DL_OP(LTE_INT64):
+        DL_BINARY_AS(int64, LTE);
+    DL_OP(GT_INT64):
+        DL_BINARY_AS(int64, GT);
+    DL_OP(GTE_INT64):
+        DL_BINARY_AS(int64, GTE);
+    DL_OP(ADD_FLOAT64):
+        DL_BINARY_AS(float64, ADD);
+    DL_OP(SUB_FLOAT64):
+        DL_BINARY_AS(float64, SUB);
+    DL_OP(MUL_FLOAT64):
+        DL_BINARY_AS(float64, MUL);
+    DL_OP(DIV_FLOAT64):
+        DL_BINARY_AS(float64, DIV);
+    DL_OP(MOD_FLOAT64):
+        DL_BINARY_AS(float64, MOD);
+    DL_OP(EQ_FLOAT64):
+        DL_BINARY_AS(float64, EQ);
+    DL_OP(NEQ_FLOAT64):
+        DL_BINARY_AS(float64, NEQ);
+    DL_OP(LT_FLOAT64):
+        DL_BINARY_AS(float64, LT);
+    DL_OP(LTE_FLOAT64):
+        DL_BINARY_AS(float64, LTE);
+    DL_OP(GT_FLOAT64):
+        DL_BINARY_AS(float64, GT);
+    DL_OP(GTE_FLOAT64):
+        DL_BINARY_AS(float64, GTE);
+    DL_OP(CALL_FN_PTR): {
+        // With only positional arguments, binding them is pointing at them,
+        // and there are no keyword arguments to delete afterwards.
+        Any* callee = slots + reg_b(inst);
+        if (
+            callee->tid != static_cast<std::uint32_t>(BuiltinTypeID::FN_PTR) ||
+            stack.call_depth == interp.state.config.max_call_depth
+        ) {
+            dequicken(code, pc - 1, RegOpcode::CALL);
+            DL_RETRY();
+        }
+        stack.args[stack.call_depth + 1].args = Seq{callee + 1, reg_c(inst)};
+        stack.call_depth++;
+        res = coreutil::unwrap<FnPtr>(*callee)(interp.state);
+        stack.call_depth--;
+        stack.nvalues = frame_top;
+        if (coreutil::is_error(res))
+            goto done;
+        slots[reg_a(inst)] = res;
+        DL_NEXT();
+    }
+    DL_OP(GET_ATTR_SHAPE): {
+        const AttrCache& cache = code.attr_caches[reg_c(inst)];
+        Any obj = slots[reg_b(inst)];
+        if (obj.tid != cache.tid) {
+            dequicken(code, pc - 1, RegOpcode::GET_ATTR);
+            DL_RETRY();
+        }
+        slots[reg_a(inst)] =
+            coreutil::load_field(obj, cache.field_tid, cache.offset);
+        DL_NEXT();
+    }
+    DL_OP(END):
+        res = coreutil::NONE;
+        goto done;
+    }
+
+done:
+    stack.nvalues = frame_base;
+    return res;
+}
+
+}
+
+#undef DL_BINARY
+#undef DL_BINARY_AS
+#undef DL_OP
+#undef DL_NEXT
+#undef DL_RETRY
+#undef DL_WARM
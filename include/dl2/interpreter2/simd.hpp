@@ -0,0 +1,434 @@
+#pragma once
+
+// Kernels are written with the vector extensions of GCC and Clang and compiled
+// once per instruction set with target attributes, then picked at run time.
+// Define `DL_NO_SIMD` to force the scalar loops, e.g. to compare the two.
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(DL_NO_SIMD)
+#define DL_SIMD_ENABLED
+#endif
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+#include "dl/interpreter2/binaryop.hpp"
+
+// Kernels over the elements of typed arrays: elementwise arithmetic and
+// comparisons, reductions, filling and conversion. They take raw buffers, so
+// callers check element types and lengths first.
+//
+// Results have the element type of their operands. Integers wrap modulo 2^bits
+// of their type, whichever of `S8` through `U64` it is, and division truncates
+// towards zero. Floats follow IEEE 754, except that sums and dot products are
+// reassociated across vector lanes, so they may round differently from a loop
+// adding one element at a time.
+namespace dl::simd {
+
+// Instruction sets with kernels, from least to most capable.
+enum class Isa {
+    SCALAR,
+    SSE4,
+    AVX2
+};
+
+// The most capable instruction set this CPU has kernels for.
+Isa detect_isa() noexcept {
+#ifdef DL_SIMD_ENABLED
+    if (__builtin_cpu_supports("avx2"))
+        return Isa::AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return Isa::SSE4;
+#endif
+    return Isa::SCALAR;
+}
+
+// The instruction set kernels run with, detected on first use. It may be
+// lowered, e.g. to benchmark or test the fallbacks, but never raised above
+// `detect_isa()`.
+Isa& isa() noexcept {
+    static Isa active = detect_isa();
+    return active;
+}
+
+// W bytes of elements of type T.
+template<typename T, std::size_t W>
+using Vec [[gnu::vector_size(W)]] = T;
+
+// Vector lanes of integers are unsigned, where overflow wraps.
+template<typename T>
+using Lane = typename std::conditional_t<
+    std::is_integral_v<T>, std::make_unsigned<T>, std::type_identity<T>
+>::type;
+
+// Scalar integers are widened to 64 bits instead, so that narrow ones are not
+// promoted to `int`, where overflow is undefined.
+template<typename T>
+using Wide = std::conditional_t<std::is_integral_v<T>, std::uint64_t, T>;
+
+// Buffers are only aligned to their elements, so vectors are copied in and
+// out. Helpers take vectors by reference: passing them by value outside the
+// kernels would be compiled for the baseline instruction set.
+template<typename V, typename T>
+[[gnu::always_inline]] inline
+void load_vec(V& v, const T* src) noexcept {
+    std::memcpy(&v, src, sizeof(V));
+}
+
+template<typename T, typename V>
+[[gnu::always_inline]] inline
+void store_vec(T* dst, const V& v) noexcept {
+    std::memcpy(dst, &v, sizeof(V));
+}
+
+// Apply an arithmetic operator, `ADD` through `MOD`, to two elements. Returns
+// false for an integer division by zero.
+template<BinaryOp OP, typename T>
+bool arith_elem(T x, T y, T& res) noexcept {
+    using enum BinaryOp;
+    auto a = static_cast<Wide<T>>(x);
+    auto b = static_cast<Wide<T>>(y);
+    if constexpr (OP == ADD)
+        res = static_cast<T>(a + b);
+    else if constexpr (OP == SUB)
+        res = static_cast<T>(a - b);
+    else if constexpr (OP == MUL)
+        res = static_cast<T>(a * b);
+    else if constexpr (std::is_floating_point_v<T>)
+        res = OP == DIV ? x / y : std::fmod(x, y);
+    else {
+        if (y == 0)
+            return false;
+        if constexpr (std::is_signed_v<T>) {
+            // The one quotient that overflows, of the minimum by -1, wraps.
+            if (y == -1) {
+                res = OP == DIV ? static_cast<T>(0 - a) : 0;
+                return true;
+            }
+        }
+        res = static_cast<T>(OP == DIV ? x / y : x % y);
+    }
+    return true;
+}
+
+// Whether an operator has a vector form for elements of type T. Vector
+// integer division does not exist, and `fmod` has no vector form either.
+template<BinaryOp OP, typename T>
+constexpr bool has_vec_arith =
+    OP == BinaryOp::ADD || OP == BinaryOp::SUB || OP == BinaryOp::MUL ||
+    (OP == BinaryOp::DIV && std::is_floating_point_v<T>);
+
+// a = a OP b.
+template<BinaryOp OP, typename V>
+[[gnu::always_inline]] inline
+void arith_vec(V& a, const V& b) noexcept {
+    using enum BinaryOp;
+    if constexpr (OP == ADD)
+        a += b;
+    else if constexpr (OP == SUB)
+        a -= b;
+    else if constexpr (OP == MUL)
+        a *= b;
+    else
+        a /= b;
+}
+
+// A mask of lanes of a OP b, all ones where the comparison holds.
+template<BinaryOp OP, typename V, typename Mask>
+[[gnu::always_inline]] inline
+void compare_vec(const V& a, const V& b, Mask& mask) noexcept {
+    using enum BinaryOp;
+    if constexpr (OP == EQ)
+        mask = a == b;
+    else if constexpr (OP == NEQ)
+        mask = a != b;
+    else if constexpr (OP == LT)
+        mask = a < b;
+    else if constexpr (OP == LTE)
+        mask = a <= b;
+    else if constexpr (OP == GT)
+        mask = a > b;
+    else
+        mask = a >= b;
+}
+
+// Convert an element. Integers wrap, floats saturate when converted to
+// integers, with NaN becoming 0, and anything converted to `Bool` is compared
+// to 0.
+template<typename To, typename From>
+To convert_elem(From x) noexcept {
+    if constexpr (std::is_same_v<To, bool>)
+        return x != 0;
+    else if constexpr (
+        std::is_floating_point_v<From> && std::is_integral_v<To>
+    ) {
+        using Limits = std::numeric_limits<To>;
+        if (x != x)
+            return 0;
+        if (x <= static_cast<From>(Limits::min()))
+            return Limits::min();
+        // The maximum may round up to a power of two, which does not fit.
+        if (x >= static_cast<From>(Limits::max()))
+            return Limits::max();
+        return static_cast<To>(x);
+    } else
+        return static_cast<To>(x);
+}
+
+// Each kernel is a struct whose `run<W>` works on vectors of W bytes, or only
+// on scalars if W is 0, with a scalar loop for the elements left over.
+
+// out[i] = xs[i] OP ys[i] for an arithmetic operator, `ADD` through `MOD`, or
+// xs[i] OP ys[0] for all i if BROADCAST. Returns false for an integer division
+// by zero.
+template<BinaryOp OP, bool BROADCAST, typename T>
+struct Arith {
+    template<std::size_t W>
+    [[gnu::always_inline]] inline
+    static bool run(T* out, const T* xs, const T* ys, std::size_t n) noexcept {
+        std::size_t i = 0;
+        if constexpr (W != 0 && has_vec_arith<OP, T>) {
+            using V = Vec<Lane<T>, W>;
+            constexpr std::size_t N = W / sizeof(T);
+            V a;
+            V b = {};
+            if constexpr (BROADCAST)
+                b += static_cast<Lane<T>>(ys[0]);
+            for (; i + N <= n; i += N) {
+                load_vec(a, xs + i);
+                if constexpr (!BROADCAST)
+                    load_vec(b, ys + i);
+                arith_vec<OP>(a, b);
+                store_vec(out + i, a);
+            }
+        }
+        for (; i < n; i++) {
+            if (!arith_elem<OP>(xs[i], ys[BROADCAST ? 0 : i], out[i]))
+                return false;
+        }
+        return true;
+    }
+};
+
+// out[i] = xs[i] OP ys[i] for a comparison, `EQ` through `GTE`, or
+// xs[i] OP ys[0] for all i if BROADCAST.
+template<BinaryOp OP, bool BROADCAST, typename T>
+struct Compare {
+    template<std::size_t W>
+    [[gnu::always_inline]] inline
+    static void run(
+        bool* out, const T* xs, const T* ys, std::size_t n
+    ) noexcept {
+        std::size_t i = 0;
+        if constexpr (W != 0) {
+            using V = Vec<T, W>;
+            constexpr std::size_t N = W / sizeof(T);
+            V a;
+            V b = {};
+            if constexpr (BROADCAST)
+                b += ys[0];
+            decltype(a == b) mask;
+            for (; i + N <= n; i += N) {
+                load_vec(a, xs + i);
+                if constexpr (!BROADCAST)
+                    load_vec(b, ys + i);
+                compare_vec<OP>(a, b, mask);
+                // Lanes of all ones become the bytes 1 of true.
+                Vec<std::int8_t, N> bytes =
+                    __builtin_convertvector(mask, Vec<std::int8_t, N>) & 1;
+                store_vec(out + i, bytes);
+            }
+        }
+        for (; i < n; i++)
+            out[i] = vm::compare<OP>(xs[i], ys[BROADCAST ? 0 : i]);
+    }
+};
+
+// The sum of xs, or 0 if n is 0.
+template<typename T>
+struct Sum {
+    template<std::size_t W>
+    [[gnu::always_inline]] inline
+    static T run(const T* xs, std::size_t n) noexcept {
+        Wide<T> sum = 0;
+        std::size_t i = 0;
+        if constexpr (W != 0) {
+            using V = Vec<Lane<T>, W>;
+            constexpr std::size_t N = W / sizeof(T);
+            V v;
+            V sums = {};
+            for (; i + N <= n; i += N) {
+                load_vec(v, xs + i);
+                sums += v;
+            }
+            for (std::size_t j = 0; j < N; j++)
+                sum += static_cast<Wide<T>>(static_cast<T>(sums[j]));
+        }
+        for (; i < n; i++)
+            sum += static_cast<Wide<T>>(xs[i]);
+        return static_cast<T>(sum);
+    }
+};
+
+// The sum of xs[i] * ys[i], or 0 if n is 0.
+template<typename T>
+struct Dot {
+    template<std::size_t W>
+    [[gnu::always_inline]] inline
+    static T run(const T* xs, const T* ys, std::size_t n) noexcept {
+        Wide<T> sum = 0;
+        std::size_t i = 0;
+        if constexpr (W != 0) {
+            using V = Vec<Lane<T>, W>;
+            constexpr std::size_t N = W / sizeof(T);
+            V a;
+            V b;
+            V sums = {};
+            for (; i + N <= n; i += N) {
+                load_vec(a, xs + i);
+                load_vec(b, ys + i);
+                sums += a * b;
+            }
+            for (std::size_t j = 0; j < N; j++)
+                sum += static_cast<Wide<T>>(static_cast<T>(sums[j]));
+        }
+        for (; i < n; i++)
+            sum += static_cast<Wide<T>>(xs[i]) * static_cast<Wide<T>>(ys[i]);
+        return static_cast<T>(sum);
+    }
+};
+
+// The greatest of xs if MAX, otherwise the least, where n is not 0. NaNs are
+// skipped, so only an array of nothing but NaNs has a NaN result.
+template<bool MAX, typename T>
+struct Extreme {
+    [[gnu::always_inline]] inline
+    static bool better(T x, T best) noexcept {
+        return MAX ? x > best : x < best;
+    }
+
+    template<std::size_t W>
+    [[gnu::always_inline]] inline
+    static T run(const T* xs, std::size_t n) noexcept {
+        constexpr bool FLOAT = std::is_floating_point_v<T>;
+        using Limits = std::numeric_limits<T>;
+        // Any NaN compares false, so it never becomes the best.
+        T best = FLOAT ?
+            (MAX ? -Limits::infinity() : Limits::infinity()) :
+            (MAX ? Limits::lowest() : Limits::max());
+        bool number = !FLOAT;
+        std::size_t i = 0;
+        if constexpr (W != 0) {
+            using V = Vec<T, W>;
+            constexpr std::size_t N = W / sizeof(T);
+            V v;
+            V bests = V{} + best;
+            auto numbers = bests != bests;
+            for (; i + N <= n; i += N) {
+                load_vec(v, xs + i);
+                bests = (MAX ? v > bests : v < bests) ? v : bests;
+                if constexpr (FLOAT)
+                    numbers |= v == v;
+            }
+            for (std::size_t j = 0; j < N; j++) {
+                if (better(bests[j], best))
+                    best = bests[j];
+                number |= numbers[j] != 0;
+            }
+        }
+        for (; i < n; i++) {
+            if (better(xs[i], best))
+                best = xs[i];
+            number |= xs[i] == xs[i];
+        }
+        if constexpr (FLOAT) {
+            if (!number)
+                return Limits::quiet_NaN();
+        }
+        return best;
+    }
+};
+
+// out[i] = x for all i.
+template<typename T>
+struct Fill {
+    template<std::size_t W>
+    [[gnu::always_inline]] inline
+    static void run(T* out, T x, std::size_t n) noexcept {
+        std::size_t i = 0;
+        if constexpr (W != 0 && !std::is_same_v<T, bool>) {
+            Vec<T, W> v = Vec<T, W>{} + x;
+            for (; i + W / sizeof(T) <= n; i += W / sizeof(T))
+                store_vec(out + i, v);
+        }
+        for (; i < n; i++)
+            out[i] = x;
+    }
+};
+
+// out[i] = xs[i] converted as by `convert_elem`.
+template<typename To, typename From>
+struct Convert {
+    // Vector conversions wrap and round like scalar ones, except from floats
+    // to integers, which would not saturate. Vectors of `bool` do not exist.
+    static constexpr bool VECTOR =
+        !std::is_same_v<To, bool> && !std::is_same_v<From, bool> &&
+        !(std::is_floating_point_v<From> && std::is_integral_v<To>);
+
+    template<std::size_t W>
+    [[gnu::always_inline]] inline
+    static void run(To* out, const From* xs, std::size_t n) noexcept {
+        std::size_t i = 0;
+        if constexpr (W != 0 && VECTOR) {
+            constexpr std::size_t N = W / std::max(sizeof(To), sizeof(From));
+            using FromVec = Vec<From, N * sizeof(From)>;
+            using ToVec = Vec<To, N * sizeof(To)>;
+            FromVec v;
+            for (; i + N <= n; i += N) {
+                load_vec(v, xs + i);
+                ToVec converted = __builtin_convertvector(v, ToVec);
+                store_vec(out + i, converted);
+            }
+        }
+        for (; i < n; i++)
+            out[i] = convert_elem<To>(xs[i]);
+    }
+};
+
+#ifdef DL_SIMD_ENABLED
+// Each kernel compiled for each instruction set. Kernels are always inlined,
+// so that their vectors use the instructions of the caller.
+template<typename K, typename... Args>
+[[gnu::target("avx2")]]
+auto run_avx2(Args... args) noexcept {
+    return K::template run<32>(args...);
+}
+
+template<typename K, typename... Args>
+[[gnu::target("sse4.2")]]
+auto run_sse4(Args... args) noexcept {
+    return K::template run<16>(args...);
+}
+#endif
+
+// Run kernel K with the widest vectors `isa()` has.
+template<typename K, typename... Args>
+auto run(Args... args) noexcept {
+#ifdef DL_SIMD_ENABLED
+    switch (isa()) {
+    case Isa::AVX2:
+        return run_avx2<K>(args...);
+    case Isa::SSE4:
+        return run_sse4<K>(args...);
+    case Isa::SCALAR:
+        break;
+    }
+#endif
+    return K::template run<0>(args...);
+}
+
+}
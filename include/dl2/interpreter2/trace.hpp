@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+
+#include <vector>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/assembler.hpp"
+
+namespace dl {
+
+// Operations of a trace: the instructions of one iteration of a hot loop,
+// specialized to the operand types the recording saw. Instead of branching, a
+// trace checks its assumptions and exits back to the register VM where one
+// fails.
+enum class TraceOp: std::uint8_t {
+    // Exit unless slot `a` holds a value of TID `tid`.
+    GUARD_TID,
+    // Exit unless `Bool` slot `a` is true, or false.
+    GUARD_TRUE,
+    GUARD_FALSE,
+    // `a = b`
+    MOVE,
+    // `a = k`
+    LOADK,
+
+    // `a = b op c` on `Int64`s, in the order of `BinaryOp`. Arithmetic exits
+    // where the VM's fast path would leave the result to the dunder method.
+    ADD_INT64,
+    SUB_INT64,
+    MUL_INT64,
+    DIV_INT64,
+    MOD_INT64,
+    EQ_INT64,
+    NEQ_INT64,
+    LT_INT64,
+    LTE_INT64,
+    GT_INT64,
+    GTE_INT64,
+    // `a = b op k`, the same with a constant right operand.
+    ADD_INT64_K,
+    SUB_INT64_K,
+    MUL_INT64_K,
+    DIV_INT64_K,
+    MOD_INT64_K,
+    EQ_INT64_K,
+    NEQ_INT64_K,
+    LT_INT64_K,
+    LTE_INT64_K,
+    GT_INT64_K,
+    GTE_INT64_K,
+    // `a = b op c` on `Float64`s.
+    ADD_FLOAT64,
+    SUB_FLOAT64,
+    MUL_FLOAT64,
+    DIV_FLOAT64,
+    MOD_FLOAT64,
+    EQ_FLOAT64,
+    NEQ_FLOAT64,
+    LT_FLOAT64,
+    LTE_FLOAT64,
+    GT_FLOAT64,
+    GTE_FLOAT64,
+
+    // `a = b.name`, for a `b` whose TID a guard has checked, as the field of
+    // TID `tid` at `offset`.
+    GET_FIELD,
+    // Run the loop body again.
+    LOOP
+};
+
+// A comparison with no guard fused into it.
+constexpr std::uint8_t NO_EXPECT = 2;
+
+struct TraceInst {
+    TraceOp op;
+    std::uint8_t a;
+    std::uint8_t b;
+    std::uint8_t c;
+
+    // For comparisons, the result the trace continues on, or `NO_EXPECT`:
+    // a guard on the result folded into the comparison.
+    std::uint8_t expect;
+
+    // Whether the result's TID has to be written. It does not once the slot
+    // is known to hold a value of the same type.
+    bool store_tid;
+
+    // Instruction of the register code to resume at if the trace exits here.
+    std::uint32_t exit;
+
+    // TID checked by a guard, or of the field read by `GET_FIELD`.
+    std::uint32_t tid;
+
+    std::uint32_t offset;
+
+    // Constant operand.
+    Any k;
+};
+
+// Iterations of a loop before its body is recorded as a trace.
+constexpr std::uint32_t TRACE_DELAY = 56;
+
+// Iterations before trying again after a failed recording, or after throwing
+// away a trace that kept exiting early.
+constexpr std::uint32_t TRACE_BACKOFF = 1000;
+
+// Failed recordings after which a loop is never traced again.
+constexpr std::uint32_t MAX_TRACE_ABORTS = 4;
+
+// Instructions of the register code one iteration may run to be traced.
+constexpr std::uint32_t MAX_TRACE_LEN = 512;
+
+// Entries into a trace that exited before completing an iteration, after
+// which the trace is thrown away: its path is not the one the loop takes.
+constexpr std::uint32_t MAX_TRACE_MISSES = 64;
+
+// The trace of one loop of register code, and its recording state. Code has
+// one for each `LOOP` instruction, which finds it by index.
+struct LoopTrace {
+    // Loop invariant guards, checked once on entry, then the body, ending in
+    // `LOOP`. Empty while there is no trace.
+    std::vector<TraceInst> insts;
+    std::uint32_t body_start = 0;
+
+    // `insts` compiled to native code, which is what runs.
+    jit::JitCode native;
+
+    std::uint32_t countdown = TRACE_DELAY;
+    std::uint32_t aborts = 0;
+    std::uint32_t misses = 0;
+
+    bool ready() const noexcept {
+        return !insts.empty();
+    }
+};
+
+}
@@ -0,0 +1,706 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/assembler.hpp"
+#include "dl/interpreter2/binaryop.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/regcode.hpp"
+#include "dl/interpreter2/trace.hpp"
+
+namespace dl::trace {
+
+// Type of a slot that nothing is known about.
+constexpr std::uint32_t NO_TID = UINT32_MAX;
+
+constexpr auto BOOL = static_cast<std::uint32_t>(BuiltinTypeID::BOOL);
+constexpr auto INT64 = static_cast<std::uint32_t>(BuiltinTypeID::INT64);
+constexpr auto FLOAT64 = static_cast<std::uint32_t>(BuiltinTypeID::FLOAT64);
+
+using FastFn = bool (*)(Any, Any, Any&);
+
+constexpr FastFn BINARY_FAST[] = {
+    vm::binary_fast<BinaryOp::ADD>,
+    vm::binary_fast<BinaryOp::SUB>,
+    vm::binary_fast<BinaryOp::MUL>,
+    vm::binary_fast<BinaryOp::DIV>,
+    vm::binary_fast<BinaryOp::MOD>,
+    vm::binary_fast<BinaryOp::EQ>,
+    vm::binary_fast<BinaryOp::NEQ>,
+    vm::binary_fast<BinaryOp::LT>,
+    vm::binary_fast<BinaryOp::LTE>,
+    vm::binary_fast<BinaryOp::GT>,
+    vm::binary_fast<BinaryOp::GTE>
+};
+
+TraceInst make(
+    TraceOp op, std::uint32_t exit, std::uint32_t a = 0, std::uint32_t b = 0,
+    std::uint32_t c = 0
+) noexcept {
+    return TraceInst{
+        op, static_cast<std::uint8_t>(a), static_cast<std::uint8_t>(b),
+        static_cast<std::uint8_t>(c), NO_EXPECT, true, exit, 0, 0,
+        coreutil::NONE
+    };
+}
+
+TraceOp offset_op(TraceOp base, BinaryOp op) noexcept {
+    return static_cast<TraceOp>(
+        static_cast<int>(base) + static_cast<int>(op)
+    );
+}
+
+// Operator of a binary trace operation, and the operation for its first form.
+std::pair<BinaryOp, TraceOp> split_binary(TraceOp op) noexcept {
+    using enum TraceOp;
+    TraceOp base = op >= ADD_FLOAT64 ? ADD_FLOAT64 :
+        op >= ADD_INT64_K ? ADD_INT64_K : ADD_INT64;
+    auto bop = static_cast<BinaryOp>(
+        static_cast<int>(op) - static_cast<int>(base)
+    );
+    return {bop, base};
+}
+
+bool is_binary(TraceOp op) noexcept {
+    return op >= TraceOp::ADD_INT64 && op <= TraceOp::GTE_FLOAT64;
+}
+
+bool is_compare(BinaryOp op) noexcept {
+    return op >= BinaryOp::EQ;
+}
+
+// TID of what an operation writes to its slot `a`, or `NO_TID` if it writes
+// nothing or it depends on its operand.
+std::uint32_t result_tid(const TraceInst& inst) noexcept {
+    using enum TraceOp;
+    if (inst.op == LOADK)
+        return inst.k.tid;
+    if (inst.op == GET_FIELD)
+        return inst.tid;
+    if (!is_binary(inst.op))
+        return NO_TID;
+    auto [op, base] = split_binary(inst.op);
+    if (is_compare(op))
+        return BOOL;
+    return base == ADD_FLOAT64 ? FLOAT64 : INT64;
+}
+
+bool writes(const TraceInst& inst) noexcept {
+    return inst.op == TraceOp::MOVE || result_tid(inst) != NO_TID;
+}
+
+void guard(std::vector<TraceInst>& out, std::uint32_t pc, std::uint32_t slot,
+    std::uint32_t tid) {
+    TraceInst inst = make(TraceOp::GUARD_TID, pc, slot);
+    inst.tid = tid;
+    out.push_back(inst);
+}
+
+// Record one iteration of the loop with trace index whose head is instruction
+// head, by running it from there on a copy of slots. Every operand read gets a
+// guard on the type it had. Only instructions without side effects can be
+// recorded, so returns nonzero on others, such as calls, and on operands that
+// the VM's fast paths do not take.
+int record(
+    State& state, const RegCode& code, std::uint32_t index, std::uint32_t head,
+    const Any* slots, std::vector<TraceInst>& out
+) {
+    using enum RegOpcode;
+    Any frame[MAX_REG_SLOTS];
+    std::copy_n(slots, code.nslots, frame);
+    std::uint32_t pc = head;
+    for (std::uint32_t n = 0; n < MAX_TRACE_LEN; n++) {
+        std::uint32_t inst = code.insts[pc];
+        std::uint32_t a = reg_a(inst);
+        std::uint32_t b = reg_b(inst);
+        std::uint32_t c = reg_c(inst);
+        RegOpcode op = generic_opcode_of(reg_opcode_of(inst));
+        switch (op) {
+        case MOVE:
+            out.push_back(make(TraceOp::MOVE, pc, a, b));
+            frame[a] = frame[b];
+            break;
+        case LOADK: {
+            // Traces keep their constants, so an object, which may move,
+            // cannot be one.
+            if (!is_immediate_tid(code.consts[reg_bx(inst)].tid))
+                return 1;
+            TraceInst load = make(TraceOp::LOADK, pc, a);
+            load.k = code.consts[reg_bx(inst)];
+            out.push_back(load);
+            frame[a] = load.k;
+            break;
+        }
+        case GET_ATTR: {
+            Any obj = frame[b];
+            std::uint32_t field_tid;
+            std::uint32_t offset;
+            if (
+                is_immediate_tid(obj.tid) || !coreutil::find_field(
+                    state, obj.tid, code.attr_caches[c].name, field_tid,
+                    offset
+                )
+            )
+                return 1;
+            guard(out, pc, b, obj.tid);
+            TraceInst get = make(TraceOp::GET_FIELD, pc, a, b);
+            get.tid = field_tid;
+            get.offset = offset;
+            out.push_back(get);
+            frame[a] = coreutil::load_field(obj, field_tid, offset);
+            break;
+        }
+        case BRANCH: {
+            // Exits go back to the branch, which reads the condition again.
+            Any cond = frame[a];
+            if (cond.tid != BOOL)
+                return 1;
+            guard(out, pc, a, BOOL);
+            bool taken = coreutil::unwrap<bool>(cond);
+            auto test = taken ? TraceOp::GUARD_TRUE : TraceOp::GUARD_FALSE;
+            out.push_back(make(test, pc, a));
+            if (!taken) {
+                pc = reg_bx(inst);
+                continue;
+            }
+            break;
+        }
+        case GOTO:
+            pc = reg_bx(inst);
+            continue;
+        case LOOP:
+            // Inner loops are traced on their own.
+            if (a != index || reg_bx(inst) != head)
+                return 1;
+            out.push_back(make(TraceOp::LOOP, pc));
+            return 0;
+        case FOR_NEXT: {
+            // The addition and the comparison, with a guard on its result
+            // that exits past the `LOOP` once the loop is done. Every operand
+            // is guarded before the counter changes.
+            Any x = frame[a];
+            Any limit = frame[b];
+            Any step = frame[b + 1];
+            TraceOp base;
+            if (x.tid == INT64 && limit.tid == INT64 && step.tid == INT64)
+                base = TraceOp::ADD_INT64;
+            else if (
+                x.tid == FLOAT64 && limit.tid == FLOAT64 &&
+                step.tid == FLOAT64
+            )
+                base = TraceOp::ADD_FLOAT64;
+            else
+                return 1;
+            auto test = c != 0 ? BinaryOp::GT : BinaryOp::LT;
+            if (!BINARY_FAST[static_cast<int>(BinaryOp::ADD)](
+                x, step, frame[a]
+            ))
+                return 1;
+            BINARY_FAST[static_cast<int>(test)](frame[a], limit, frame[b + 2]);
+            if (!coreutil::unwrap<bool>(frame[b + 2]))
+                return 1;
+            guard(out, pc, a, x.tid);
+            guard(out, pc, b, limit.tid);
+            guard(out, pc, b + 1, step.tid);
+            out.push_back(make(base, pc, a, a, b + 1));
+            out.push_back(make(offset_op(base, test), pc, b + 2, a, b));
+            out.push_back(make(TraceOp::GUARD_TRUE, pc + 2, b + 2));
+            break;
+        }
+        default: {
+            if (op < ADD || op > GTE)
+                return 1;
+            auto bop = static_cast<BinaryOp>(
+                static_cast<int>(op) - static_cast<int>(ADD)
+            );
+            Any x = frame[b];
+            Any y = frame[c];
+            TraceOp base;
+            if (x.tid == INT64 && y.tid == INT64)
+                base = TraceOp::ADD_INT64;
+            else if (x.tid == FLOAT64 && y.tid == FLOAT64)
+                base = TraceOp::ADD_FLOAT64;
+            else
+                return 1;
+            // Results the fast path leaves to the dunder method exit.
+            if (!BINARY_FAST[static_cast<int>(bop)](x, y, frame[a]))
+                return 1;
+            guard(out, pc, b, x.tid);
+            guard(out, pc, c, y.tid);
+            out.push_back(make(offset_op(base, bop), pc, a, b, c));
+        }
+        }
+        pc++;
+    }
+    return 1;
+}
+
+// Rewrite a binary operation on a constant right operand k to its `_K` form,
+// if it has one. A constant left operand is swapped to the right where the
+// operator allows, mirroring comparisons.
+void use_constant(TraceInst& inst, bool lhs_const, bool rhs_const, Any lhs,
+    Any rhs) noexcept {
+    using enum BinaryOp;
+    auto [op, base] = split_binary(inst.op);
+    if (base != TraceOp::ADD_INT64)
+        return;
+    if (rhs_const) {
+        inst.op = offset_op(TraceOp::ADD_INT64_K, op);
+        inst.k = rhs;
+        return;
+    }
+    if (!lhs_const)
+        return;
+    BinaryOp swapped;
+    switch (op) {
+    case ADD:
+    case MUL:
+    case EQ:
+    case NEQ:
+        swapped = op;
+        break;
+    case LT:
+        swapped = GT;
+        break;
+    case LTE:
+        swapped = GTE;
+        break;
+    case GT:
+        swapped = LT;
+        break;
+    case GTE:
+        swapped = LTE;
+        break;
+    default:
+        return;
+    }
+    inst.op = offset_op(TraceOp::ADD_INT64_K, swapped);
+    inst.b = inst.c;
+    inst.k = lhs;
+}
+
+// Turn a recorded iteration of the loop at head into trace.
+//
+// - Guards on slots whose type is already known are dropped.
+// - Guards on slots that are read before they are written, and only ever
+//   written with the type guarded, are loop invariant; they are hoisted out of
+//   the body, to be checked once on entry, exiting to head.
+// - Operations on constants are folded, and constant `Int64` operands become
+//   immediates.
+// - Guards on the result of a comparison are fused into it.
+// - Results leave the TID of their slot alone once it is known to be theirs,
+//   so loop-carried numbers are updated unboxed, as bare data words.
+//
+// Every operation still writes its result to its slot, so that the register
+// VM finds the frame as it expects at any exit.
+void optimize(
+    const std::vector<TraceInst>& rec, std::uint32_t head, LoopTrace& trace
+) {
+    using enum TraceOp;
+    std::uint32_t known[MAX_REG_SLOTS];
+
+    // The types each slot is written with, within an iteration.
+    std::fill_n(known, MAX_REG_SLOTS, NO_TID);
+    std::uint32_t written[MAX_REG_SLOTS];
+    std::fill_n(written, MAX_REG_SLOTS, NO_TID);
+    bool stable[MAX_REG_SLOTS];
+    std::fill_n(stable, MAX_REG_SLOTS, true);
+    std::vector<bool> hoist(rec.size(), false);
+    for (std::size_t i = 0; i < rec.size(); i++) {
+        const TraceInst& inst = rec[i];
+        if (inst.op == GUARD_TID) {
+            if (known[inst.a] == inst.tid)
+                continue;
+            known[inst.a] = inst.tid;
+            hoist[i] = written[inst.a] == NO_TID;
+        } else if (writes(inst)) {
+            std::uint32_t tid =
+                inst.op == MOVE ? known[inst.b] : result_tid(inst);
+            if (tid == NO_TID || (
+                written[inst.a] != NO_TID && written[inst.a] != tid
+            ))
+                stable[inst.a] = false;
+            written[inst.a] = tid;
+            known[inst.a] = tid;
+        }
+    }
+    std::fill_n(known, MAX_REG_SLOTS, NO_TID);
+    trace.insts.clear();
+    for (std::size_t i = 0; i < rec.size(); i++) {
+        const TraceInst& inst = rec[i];
+        bool carried = written[inst.a] == NO_TID || (
+            stable[inst.a] && written[inst.a] == inst.tid
+        );
+        if (hoist[i] && carried && known[inst.a] == NO_TID) {
+            TraceInst check = inst;
+            check.exit = head;
+            trace.insts.push_back(check);
+            known[inst.a] = inst.tid;
+        }
+    }
+    trace.body_start = static_cast<std::uint32_t>(trace.insts.size());
+
+    bool is_const[MAX_REG_SLOTS];
+    std::fill_n(is_const, MAX_REG_SLOTS, false);
+    Any consts[MAX_REG_SLOTS];
+    std::fill_n(consts, MAX_REG_SLOTS, coreutil::NONE);
+    for (TraceInst inst: rec) {
+        switch (inst.op) {
+        case GUARD_TID:
+            if (known[inst.a] == inst.tid)
+                continue;
+            known[inst.a] = inst.tid;
+            break;
+        case GUARD_TRUE:
+        case GUARD_FALSE: {
+            bool expect = inst.op == GUARD_TRUE;
+            if (
+                is_const[inst.a] &&
+                coreutil::unwrap<bool>(consts[inst.a]) == expect
+            )
+                continue;
+            if (trace.insts.size() == trace.body_start)
+                break;
+            TraceInst& last = trace.insts.back();
+            if (
+                is_binary(last.op) && last.a == inst.a &&
+                is_compare(split_binary(last.op).first) &&
+                last.expect == NO_EXPECT
+            ) {
+                last.expect = expect;
+                last.exit = inst.exit;
+                continue;
+            }
+            break;
+        }
+        case MOVE:
+            if (is_const[inst.b]) {
+                inst.op = LOADK;
+                inst.k = consts[inst.b];
+            }
+            known[inst.a] = known[inst.b];
+            is_const[inst.a] = is_const[inst.b];
+            consts[inst.a] = consts[inst.b];
+            break;
+        case LOADK:
+            known[inst.a] = inst.k.tid;
+            is_const[inst.a] = true;
+            consts[inst.a] = inst.k;
+            break;
+        case GET_FIELD:
+            known[inst.a] = inst.tid;
+            is_const[inst.a] = false;
+            break;
+        case LOOP:
+            break;
+        default: {
+            std::uint32_t tid = result_tid(inst);
+            auto op = split_binary(inst.op).first;
+            Any res;
+            if (
+                is_const[inst.b] && is_const[inst.c] &&
+                BINARY_FAST[static_cast<int>(op)](
+                    consts[inst.b], consts[inst.c], res
+                )
+            ) {
+                inst.op = LOADK;
+                inst.k = res;
+                known[inst.a] = tid;
+                is_const[inst.a] = true;
+                consts[inst.a] = res;
+                break;
+            }
+            use_constant(
+                inst, is_const[inst.b], is_const[inst.c], consts[inst.b],
+                consts[inst.c]
+            );
+            inst.store_tid = known[inst.a] != tid;
+            known[inst.a] = tid;
+            is_const[inst.a] = false;
+        }
+        }
+        trace.insts.push_back(inst);
+    }
+}
+
+std::int64_t int64_of(Any slot) noexcept {
+    return coreutil::unwrap<std::int64_t>(slot);
+}
+
+double float64_of(Any slot) noexcept {
+    return coreutil::unwrap<double>(slot);
+}
+
+// Functions called by native traces for operations with no template.
+void get_field(Any* slots, const TraceInst* t) noexcept {
+    slots[t->a] = coreutil::load_field(slots[t->b], t->tid, t->offset);
+}
+
+void mod_float64(Any* slots, const TraceInst* t) noexcept {
+    double res = std::fmod(float64_of(slots[t->b]), float64_of(slots[t->c]));
+    if (t->store_tid)
+        slots[t->a].tid = FLOAT64;
+    std::memcpy(&slots[t->a].data, &res, sizeof(res));
+}
+
+// Native code of a trace, run on the slots of a frame until it exits. Returns
+// the instruction of the register code to resume at; looped is set if a whole
+// iteration ran.
+using NativeTrace = std::uint32_t (*)(bool* looped, Any* slots);
+
+// Compiles each trace operation to a template with the operands in rax and
+// rdx, or xmm0 and xmm1, and the result left in its slot. Exits jump to stubs
+// after the loop that return their instruction of the register code.
+struct TraceAssembler: jit::Assembler {
+    struct SideExit {
+        std::size_t at;
+        std::uint32_t pc;
+    };
+
+    std::vector<SideExit> exits;
+
+    void side_exit(std::size_t at, std::uint32_t pc) {
+        exits.push_back(SideExit{at, pc});
+    }
+
+    // Conditional jump with the second opcode byte jcc to the exit of t.
+    void exit_if(std::uint8_t jcc, const TraceInst& t) {
+        bytes({0x0f, jcc});
+        side_exit(forward(), t.exit);
+    }
+
+    void call(void (*helper)(Any*, const TraceInst*), const TraceInst& t) {
+        bytes({0x4c, 0x89, 0xe7}); // mov rdi, r12
+        bytes({0x48, 0xbe});       // mov rsi, t
+        u64(reinterpret_cast<std::uint64_t>(&t));
+        bytes({0x48, 0xb8});       // mov rax, helper
+        u64(reinterpret_cast<std::uint64_t>(helper));
+        bytes({0xff, 0xd0});       // call rax
+    }
+
+    void guard_bool(const TraceInst& t, bool expect) {
+        bytes({0x41, 0x80});       // cmp byte [a data], 0
+        slot_operand(7, data_at(t.a));
+        bytes({0x00});
+        exit_if(expect ? 0x84 : 0x85, t); // je, or jne, exit
+    }
+
+    // Store the result in rax, and its TID unless the slot already has it.
+    void result(const TraceInst& t, std::uint32_t tid) {
+        store_data(t.a, 0);        // mov [a data], rax
+        if (t.store_tid)
+            store_tid(t.a, tid);
+    }
+
+    // Store the boolean in al, then test it for a fused guard.
+    void compare_result(const TraceInst& t) {
+        bytes({0x0f, 0xb6, 0xc0}); // movzx eax, al
+        result(t, BOOL);
+        if (t.expect == NO_EXPECT)
+            return;
+        bytes({0x85, 0xc0});       // test eax, eax
+        exit_if(t.expect ? 0x84 : 0x85, t); // je, or jne, exit
+    }
+
+    void binary_int64(const TraceInst& t, BinaryOp op, bool k) {
+        using enum BinaryOp;
+        load_data(0, t.b);         // mov rax, [b data]
+        if (k) {
+            bytes({0x48, 0xba});   // mov rdx, k
+            u64(static_cast<std::uint64_t>(int64_of(t.k)));
+        } else {
+            load_data(2, t.c);     // mov rdx, [c data]
+        }
+        switch (op) {
+        case ADD:
+        case SUB:
+        case MUL:
+            if (op == ADD)
+                bytes({0x48, 0x01, 0xd0}); // add rax, rdx
+            else if (op == SUB)
+                bytes({0x48, 0x29, 0xd0}); // sub rax, rdx
+            else
+                bytes({0x48, 0x0f, 0xaf, 0xc2}); // imul rax, rdx
+            exit_if(0x80, t);      // jo exit
+            result(t, INT64);
+            return;
+        case DIV:
+        case MOD:
+            // Only the operands the VM's fast path takes.
+            bytes({0x48, 0x85, 0xc0}); // test rax, rax
+            exit_if(0x88, t);      // js exit
+            bytes({0x48, 0x89, 0xd1}); // mov rcx, rdx
+            bytes({0x48, 0x85, 0xc9}); // test rcx, rcx
+            exit_if(0x8e, t);      // jle exit
+            bytes({0x48, 0x99});   // cqo
+            bytes({0x48, 0xf7, 0xf9}); // idiv rcx
+            if (op == MOD)
+                bytes({0x48, 0x89, 0xd0}); // mov rax, rdx
+            result(t, INT64);
+            return;
+        default:
+            bytes({0x48, 0x39, 0xd0}); // cmp rax, rdx
+            auto cc = jit::COMPARE_CCS[
+                static_cast<int>(op) - static_cast<int>(EQ)
+            ];
+            bytes({0x0f, cc, 0xc0}); // setcc al
+            compare_result(t);
+        }
+    }
+
+    void binary_float64(const TraceInst& t, BinaryOp op) {
+        using enum BinaryOp;
+        if (op == MOD) {
+            call(mod_float64, t);
+            return;
+        }
+        bytes({0xf2, 0x41, 0x0f, 0x10}); // movsd xmm0, [b data]
+        slot_operand(0, data_at(t.b));
+        bytes({0xf2, 0x41, 0x0f, 0x10}); // movsd xmm1, [c data]
+        slot_operand(1, data_at(t.c));
+        if (op <= DIV) {
+            constexpr std::uint8_t OPCODES[] = {
+                0x58, // addsd
+                0x5c, // subsd
+                0x59, // mulsd
+                0x5e  // divsd
+            };
+            bytes({0xf2, 0x0f, OPCODES[static_cast<int>(op)], 0xc1});
+            bytes({0xf2, 0x41, 0x0f, 0x11}); // movsd [a data], xmm0
+            slot_operand(0, data_at(t.a));
+            if (t.store_tid)
+                store_tid(t.a, FLOAT64);
+            return;
+        }
+        // Unordered operands compare false, but for `!=`: the flags of
+        // ucomisd then have ZF, PF and CF all set.
+        switch (op) {
+        case EQ:
+            bytes({0x66, 0x0f, 0x2e, 0xc1}); // ucomisd xmm0, xmm1
+            bytes({0x0f, 0x94, 0xc0}); // sete al
+            bytes({0x0f, 0x9b, 0xc1}); // setnp cl
+            bytes({0x20, 0xc8});   // and al, cl
+            break;
+        case NEQ:
+            bytes({0x66, 0x0f, 0x2e, 0xc1}); // ucomisd xmm0, xmm1
+            bytes({0x0f, 0x95, 0xc0}); // setne al
+            bytes({0x0f, 0x9a, 0xc1}); // setp cl
+            bytes({0x08, 0xc8});   // or al, cl
+            break;
+        case LT:
+        case LTE:
+            bytes({0x66, 0x0f, 0x2e, 0xc8}); // ucomisd xmm1, xmm0
+            // seta, or setae, al
+            bytes({0x0f, static_cast<std::uint8_t>(op == LT ? 0x97 : 0x93)});
+            bytes({0xc0});
+            break;
+        default:
+            bytes({0x66, 0x0f, 0x2e, 0xc1}); // ucomisd xmm0, xmm1
+            bytes({0x0f, static_cast<std::uint8_t>(op == GT ? 0x97 : 0x93)});
+            bytes({0xc0});
+        }
+        compare_result(t);
+    }
+
+    void inst(const TraceInst& t, std::uint32_t body_start) {
+        using enum TraceOp;
+        switch (t.op) {
+        case GUARD_TID:
+            side_exit(guard_tid(t.a, t.tid), t.exit);
+            return;
+        case GUARD_TRUE:
+        case GUARD_FALSE:
+            guard_bool(t, t.op == GUARD_TRUE);
+            return;
+        case MOVE:
+            move(t.a, t.b);
+            return;
+        case LOADK:
+            loadk(t.a, t.k);
+            return;
+        case GET_FIELD:
+            call(get_field, t);
+            return;
+        case LOOP:
+            bytes({0xc6, 0x03, 0x01}); // mov byte [rbx], 1
+            jump(body_start);
+            return;
+        default: {
+            auto [op, base] = split_binary(t.op);
+            if (base == ADD_FLOAT64)
+                binary_float64(t, op);
+            else
+                binary_int64(t, op, base == ADD_INT64_K);
+        }
+        }
+    }
+};
+
+// Compile trace to native code. Returns an empty `JitCode` if executable
+// memory cannot be had, or without `DL_JIT`.
+jit::JitCode compile(const LoopTrace& trace) {
+    auto as = TraceAssembler();
+    std::vector<std::size_t> offsets(trace.insts.size());
+    as.prologue();
+    for (std::size_t i = 0; i < trace.insts.size(); i++) {
+        offsets[i] = as.buf.size();
+        as.inst(trace.insts[i], trace.body_start);
+    }
+    for (const TraceAssembler::SideExit& exit: as.exits) {
+        as.bind(exit.at);
+        as.bytes({0xb8});          // mov eax, pc
+        as.u32(exit.pc);
+        as.jump(jit::Assembler::EXIT);
+    }
+    std::size_t exit = as.buf.size();
+    as.epilogue();
+    as.link(offsets, exit);
+    return jit::make_executable(as.buf);
+}
+
+// Run the `LOOP` instruction of the loop with trace index whose head is
+// instruction head, once the loop is hot: record its trace if it has none yet,
+// then run the trace. Returns the instruction to continue at.
+std::uint32_t enter(
+    State& state, const RegCode& code, std::uint32_t index, std::uint32_t head,
+    Any* slots
+) {
+    LoopTrace& trace = code.traces[index];
+    if (!trace.ready()) {
+        std::vector<TraceInst> rec;
+        if (record(state, code, index, head, slots, rec) != 0) {
+            trace.aborts++;
+            trace.countdown = TRACE_BACKOFF;
+            return head;
+        }
+        optimize(rec, head, trace);
+        trace.native = compile(trace);
+        if (trace.native.mem == nullptr) {
+            trace.insts.clear();
+            trace.aborts = MAX_TRACE_ABORTS;
+            return head;
+        }
+    }
+    bool looped = false;
+    std::uint32_t exit = trace.native.entry<NativeTrace>()(&looped, slots);
+    if (looped)
+        trace.misses = 0;
+    else if (++trace.misses == MAX_TRACE_MISSES) {
+        trace.insts.clear();
+        trace.native = jit::JitCode();
+        trace.misses = 0;
+        trace.aborts++;
+        trace.countdown = TRACE_BACKOFF;
+    }
+    return exit;
+}
+
+}
@@ -1,23 +1,35 @@
 #pragma once
 
+#include <cstdint>
+
 #include "dl/interpretnode/interpretednode.hpp"
 #include "dl/interpret/types.hpp"
 
 namespace dl {
 
+// Unpack flags are bitmasks, so a call which unpacks positional arguments can
+// have at most this many of them, and likewise for keyword arguments.
+constexpr std::uint32_t MAX_UNPACK_FLAGS = 64;
+
+// A call whose arguments the caller has already pushed onto `Stack::values`:
+// the positional arguments, followed by the keyword argument values.
 struct Call {
 	Source origin;
 
 	Any callee;
 
+	// Index into `Stack::values` of the first argument.
+	std::uint32_t base;
+
 	std::uint32_t nargs;
-	Any* args;
-	bool* pos_unpacked;
+	// Bit `i` is set if positional argument `i` is unpacked.
+	std::uint64_t pos_unpacked;
 
 	std::uint32_t nkwargs;
+	// Names of the keyword arguments which are not unpacked, in order.
 	Symbol* syms;
-	Any* kwargs;
-	bool* kw_unpacked;
+	// Bit `i` is set if keyword argument `i` is unpacked.
+	std::uint64_t kw_unpacked;
 };
 
 }
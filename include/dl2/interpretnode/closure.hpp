@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstdint>
+
+#include <vector>
+
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/binaryop.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/exceptions.hpp"
+#include "dl/interpreter2/interpreterimpl.hpp"
+#include "dl/interpretnode/call.hpp"
+
+namespace dl {
+
+struct Closure;
+
+// Where a closure tree runs: the interpreter, and the slots of the variables.
+struct ClosureFrame {
+	InterpreterImpl& interp;
+	Any* slots;
+};
+
+// Runs a closure. Returns the value of an expression, None for a statement,
+// or an error signal if something was raised.
+using ClosureFn = Any (*)(ClosureFrame&, const Closure&);
+
+// A node compiled to the function that runs it, together with everything about
+// it that is known before it runs, so that running it looks nothing up.
+struct Closure {
+	ClosureFn fn = nullptr;
+
+	// Value of a literal.
+	Any value = coreutil::NONE;
+
+	// Slot of a variable, attribute name, or number of call arguments.
+	std::uint32_t index = 0;
+
+	std::vector<Closure> children;
+
+	Any operator()(ClosureFrame& frame) const {
+		return fn(frame, *this);
+	}
+};
+
+}
+
+namespace dl::closure {
+
+Any literal(ClosureFrame&, const Closure& c) {
+	return c.value;
+}
+
+Any get_var(ClosureFrame& frame, const Closure& c) {
+	return frame.slots[c.index];
+}
+
+// Frame slots are roots rather than heap objects, so no write barrier.
+Any set_var(ClosureFrame& frame, const Closure& c) {
+	Any value = c.children[0](frame);
+	if (coreutil::is_error(value))
+		return value;
+	frame.slots[c.index] = value;
+	return coreutil::NONE;
+}
+
+Any block(ClosureFrame& frame, const Closure& c) {
+	for (const Closure& stmt: c.children) {
+		if (coreutil::is_error(stmt(frame)))
+			return coreutil::ERROR_SIGNAL;
+	}
+	return coreutil::NONE;
+}
+
+// Evaluate a condition, raising if it is not a `Bool`. Returns 1 if true, 0 if
+// false and -1 if something was raised.
+int test(ClosureFrame& frame, const Closure& c) {
+	Any cond = c(frame);
+	if (coreutil::is_error(cond))
+		return -1;
+	if (cond.tid != static_cast<std::uint32_t>(BuiltinTypeID::BOOL)) {
+		coreutil::raise(frame.interp.state, NotBoolError{cond});
+		return -1;
+	}
+	return coreutil::unwrap<bool>(cond);
+}
+
+// Children are condition and body pairs, then the body of an `ELSE` if any.
+Any if_chain(ClosureFrame& frame, const Closure& c) {
+	std::size_t i = 0;
+	for (; i + 1 < c.children.size(); i += 2) {
+		int taken = test(frame, c.children[i]);
+		if (taken == -1)
+			return coreutil::ERROR_SIGNAL;
+		if (taken == 1)
+			return c.children[i + 1](frame);
+	}
+	if (i < c.children.size())
+		return c.children[i](frame);
+	return coreutil::NONE;
+}
+
+Any raise(ClosureFrame& frame, const Closure& c) {
+	Any exc = c.children[0](frame);
+	if (coreutil::is_error(exc))
+		return exc;
+	frame.interp.state.exc_info.raised = exc;
+	return coreutil::ERROR_SIGNAL;
+}
+
+template<BinaryOp OP>
+Any binary(ClosureFrame& frame, const Closure& c) {
+	Any x = c.children[0](frame);
+	if (coreutil::is_error(x))
+		return x;
+	Any y = c.children[1](frame);
+	if (coreutil::is_error(y))
+		return y;
+	Any res;
+	if (vm::binary_fast<OP>(x, y, res))
+		return res;
+	return vm::binary_slow(frame.interp, OP, x, y);
+}
+
+// `and` if SHORT is false, `or` if it is true: the right operand only runs if
+// the left one is not SHORT.
+template<bool SHORT>
+Any logical(ClosureFrame& frame, const Closure& c) {
+	for (const Closure& operand: c.children) {
+		int res = test(frame, operand);
+		if (res == -1)
+			return coreutil::ERROR_SIGNAL;
+		if (res == SHORT)
+			return coreutil::wrap(SHORT);
+	}
+	return coreutil::wrap(!SHORT);
+}
+
+Any logical_not(ClosureFrame& frame, const Closure& c) {
+	int res = test(frame, c.children[0]);
+	if (res == -1)
+		return coreutil::ERROR_SIGNAL;
+	return coreutil::wrap(res == 0);
+}
+
+// Children are the callee, then the positional arguments. Each value is pushed
+// as soon as it is computed, so that it is a GC root while the rest are.
+Any call(ClosureFrame& frame, const Closure& c) {
+	InterpreterImpl& interp = frame.interp;
+	std::uint32_t base = interp.state.stack.nvalues;
+	for (const Closure& part: c.children) {
+		Any value = part(frame);
+		Any* slot = nullptr;
+		if (!coreutil::is_error(value))
+			slot = interp.push_values(1);
+		if (slot == nullptr) {
+			interp.state.stack.nvalues = base;
+			return coreutil::ERROR_SIGNAL;
+		}
+		*slot = value;
+	}
+	Any callee = interp.state.stack.values[base];
+	Any res = interp.call(
+		Call{Source{}, callee, base + 1, c.index, 0, 0, nullptr, 0}
+	);
+	// The call pops its arguments, but not the callee.
+	interp.state.stack.nvalues = base;
+	return res;
+}
+
+Any get_attr(ClosureFrame& frame, const Closure& c) {
+	Any obj = c.children[0](frame);
+	if (coreutil::is_error(obj))
+		return obj;
+	std::uint32_t field_tid;
+	std::uint32_t offset;
+	if (
+		is_immediate_tid(obj.tid) || !coreutil::find_field(
+			frame.interp.state, obj.tid, c.index, field_tid, offset
+		)
+	) {
+		coreutil::raise(frame.interp.state, NoAttrError{obj, c.index});
+		return coreutil::ERROR_SIGNAL;
+	}
+	return coreutil::load_field(obj, field_tid, offset);
+}
+
+}
@@ -1,17 +1,268 @@
 #pragma once
 
+#include <cstdint>
+
+#include <algorithm>
+#include <initializer_list>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dl/compile/literal.hpp"
+#include "dl/compile/nodeerr.hpp"
+#include "dl/compile/symboltable.hpp"
 #include "dl/err.hpp"
-#include "dl/interpretnode/nodeopkind.hpp"
-#include "dl/processor/node.hpp"
+#include "dl/interpreter2/binaryop.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/gc.hpp"
+#include "dl/interpreter2/interpreterimpl.hpp"
+#include "dl/interpretnode/closure.hpp"
+#include "dl/parse/opid.hpp"
+#include "dl/process/node.hpp"
+#include "dl/process/opinfo.hpp"
 
 namespace dl {
 
+// Indicates that a statement raised an exception, which is left in
+// `ExcInfo::raised`.
+struct UncaughtExceptionErr final: Err {
+	virtual std::ostream& out_name(std::ostream& os) const override {
+		return os << "UncaughtExceptionErr";
+	}
+};
+
+// Runs processed statements one at a time, by compiling each into a tree of
+// closures and calling its root. Compiling is one pass over the node with no
+// allocation of registers or encoding, which makes this the tier for code that
+// does not run often enough for `RegCompiler` to pay off.
+//
+// Statements have the node shapes `RegCompiler` takes. Their variables live
+// on the value stack, from where its top was when this was made, so nothing
+// else may be left on it between statements.
 struct NodeInterpreterImpl {
+	InterpreterImpl& interp;
+	SymbolTable& symbols;
+	std::unordered_map<std::string, std::uint32_t> vars;
+
+	// Index into `Stack::values` of the slot of the first variable.
+	std::uint32_t base;
+
+	NodeInterpreterImpl(InterpreterImpl& interp, SymbolTable& symbols) noexcept:
+		interp(interp), symbols(symbols), base(interp.state.stack.nvalues) {}
+
 	ErrPtr interpret(Node&& node) {
-		using enum NodeOpKind;
-		switch(node_op_info(node.op).kind) {
-		
+		auto nvars = static_cast<std::uint32_t>(vars.size());
+		Closure root;
+		ErrPtr err = stmt(node, root);
+		// Slots for the variables the statement assigns first.
+		auto nnew = static_cast<std::uint32_t>(vars.size()) - nvars;
+		Any* slots = err ? nullptr : interp.push_values(nnew);
+		if (slots == nullptr) {
+			std::erase_if(vars, [&](const auto& var) {
+				return var.second >= nvars;
+			});
+			return err ? std::move(err) : ErrPtr(new UncaughtExceptionErr());
+		}
+		std::fill_n(slots, nnew, coreutil::NONE);
+
+		auto frame = ClosureFrame{interp, interp.state.stack.values + base};
+		Any res = root(frame);
+		// Between statements every live value is reachable from state.
+		gc::safepoint(interp.state);
+		if (coreutil::is_error(res))
+			return ErrPtr(new UncaughtExceptionErr());
+		return nullptr;
+	}
+
+	// Compile a statement, or a block of them.
+	ErrPtr stmt(const Node& node, Closure& out) {
+		using enum OpID;
+		switch (node.op) {
+		case BLOCK:
+			return block(node.nodes, out);
+		case IF:
+		case ELIF:
+		case ELSE: {
+			// A branch with no preceding siblings.
+			auto nodes = std::vector<const Node*>{&node};
+			return if_chain(nodes, out);
+		}
+		case RAISE:
+			out.fn = closure::raise;
+			return operands(out, {node.node});
+		case SET: {
+			const Node& lhs = node.bin->lhs;
+			if (lhs.op != ALNUM || is_numeric_literal(lhs.str))
+				return ErrPtr(new UnsupportedNodeErr(lhs.op));
+			out.fn = closure::set_var;
+			if (ErrPtr err = operands(out, {&node.bin->rhs}))
+				return err;
+			// A new variable is only visible once assigned.
+			auto var = static_cast<std::uint32_t>(vars.size());
+			out.index = vars.emplace(lhs.str, var).first->second;
+			return nullptr;
+		}
+		default:
+			// Expression statement, whose value is dropped.
+			return expr(node, out);
+		}
+	}
+
+	ErrPtr block(const std::vector<Node>& nodes, Closure& out) {
+		out.fn = closure::block;
+		for (std::size_t i = 0; i < nodes.size(); i++) {
+			Closure& child = out.children.emplace_back();
+			if (nodes[i].op != OpID::IF) {
+				if (ErrPtr err = stmt(nodes[i], child))
+					return err;
+				continue;
+			}
+			// Gather the `ELIF`s and `ELSE` following this `IF`.
+			auto chain = std::vector<const Node*>{&nodes[i]};
+			while (
+				i + 1 < nodes.size() && chain.back()->op != OpID::ELSE && (
+					nodes[i + 1].op == OpID::ELIF ||
+					nodes[i + 1].op == OpID::ELSE
+				)
+			)
+				chain.push_back(&nodes[++i]);
+			if (ErrPtr err = if_chain(chain, child))
+				return err;
+		}
+		return nullptr;
+	}
+
+	// Branches are `IF`/`ELIF` nodes whose operand is a binary node of
+	// condition and body, and an optional `ELSE` whose operand is the body.
+	ErrPtr if_chain(const std::vector<const Node*>& chain, Closure& out) {
+		out.fn = closure::if_chain;
+		for (const Node* branch: chain) {
+			if (branch->op == OpID::ELSE)
+				return stmt(*branch->node, out.children.emplace_back());
+			const Node& pred = *branch->node;
+			if (opinfo(pred.op).kind != OpKind::BINARY)
+				return ErrPtr(new UnsupportedNodeErr(pred.op));
+			if (ErrPtr err = expr(pred.bin->lhs, out.children.emplace_back()))
+				return err;
+			if (ErrPtr err = stmt(pred.bin->rhs, out.children.emplace_back()))
+				return err;
+		}
+		return nullptr;
+	}
+
+	ErrPtr expr(const Node& node, Closure& out) {
+		using enum OpID;
+		switch (node.op) {
+		case ALNUM: {
+			if (is_numeric_literal(node.str)) {
+				out.fn = closure::literal;
+				return parse_literal(node.str, out.value);
+			}
+			auto it = vars.find(node.str);
+			if (it == vars.end())
+				return ErrPtr(new UnknownVarErr(node.str));
+			out.fn = closure::get_var;
+			out.index = it->second;
+			return nullptr;
+		}
+		case TRUE:
+			return literal(coreutil::wrap(true), out);
+		case FALSE:
+			return literal(coreutil::wrap(false), out);
+		case NONE:
+			return literal(coreutil::NONE, out);
+		case GROUP:
+			return expr(*node.node, out);
+		case CALL:
+			return call(node, out);
+		case GET: {
+			const Node& name = node.bin->rhs;
+			if (name.op != ALNUM || is_numeric_literal(name.str))
+				return ErrPtr(new UnsupportedNodeErr(name.op));
+			out.fn = closure::get_attr;
+			out.index = symbols.intern(name.str);
+			return operands(out, {&node.bin->lhs});
+		}
+		case AND:
+			out.fn = closure::logical<false>;
+			return operands(out, {&node.bin->lhs, &node.bin->rhs});
+		case OR:
+			out.fn = closure::logical<true>;
+			return operands(out, {&node.bin->lhs, &node.bin->rhs});
+		case NOT:
+			out.fn = closure::logical_not;
+			return operands(out, {node.node});
+		case ADD:
+			return binary<BinaryOp::ADD>(node, out);
+		case SUB:
+			return binary<BinaryOp::SUB>(node, out);
+		case MUL:
+			return binary<BinaryOp::MUL>(node, out);
+		case DIV:
+			return binary<BinaryOp::DIV>(node, out);
+		case MOD:
+			return binary<BinaryOp::MOD>(node, out);
+		case EQ:
+			return binary<BinaryOp::EQ>(node, out);
+		case NEQ:
+			return binary<BinaryOp::NEQ>(node, out);
+		case LT:
+			return binary<BinaryOp::LT>(node, out);
+		case LTE:
+			return binary<BinaryOp::LTE>(node, out);
+		case GT:
+			return binary<BinaryOp::GT>(node, out);
+		case GTE:
+			return binary<BinaryOp::GTE>(node, out);
+		default:
+			return ErrPtr(new UnsupportedNodeErr(node.op));
+		}
+	}
+
+	ErrPtr literal(Any value, Closure& out) {
+		out.fn = closure::literal;
+		out.value = value;
+		return nullptr;
+	}
+
+	// Compile nodes into the children of out, in order.
+	ErrPtr operands(Closure& out, std::initializer_list<const Node*> nodes) {
+		for (const Node* node: nodes) {
+			if (ErrPtr err = expr(*node, out.children.emplace_back()))
+				return err;
+		}
+		return nullptr;
+	}
+
+	template<BinaryOp OP>
+	ErrPtr binary(const Node& node, Closure& out) {
+		out.fn = closure::binary<OP>;
+		return operands(out, {&node.bin->lhs, &node.bin->rhs});
+	}
+
+	ErrPtr call(const Node& node, Closure& out) {
+		// Flatten the argument list, a (possibly parenthesized) chain of
+		// separators.
+		auto args = std::vector<const Node*>{&node.bin->lhs};
+		const Node* rest = &node.bin->rhs;
+		if (rest->op == OpID::GROUP)
+			rest = rest->node;
+		while (rest->op == OpID::SEP) {
+			args.push_back(&rest->bin->lhs);
+			rest = &rest->bin->rhs;
+		}
+		args.push_back(rest);
+
+		out.fn = closure::call;
+		out.index = static_cast<std::uint32_t>(args.size() - 1);
+		out.children.reserve(args.size());
+		for (const Node* arg: args) {
+			if (ErrPtr err = expr(*arg, out.children.emplace_back()))
+				return err;
 		}
+		return nullptr;
 	}
 };
 
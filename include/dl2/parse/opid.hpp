@@ -80,6 +80,7 @@ enum class OpID {
     TERNARY_ELSE,
     TERNARY_IF,
     THIS,
+    TO,
     TRUE,
     TYPE,
     TYPE_INTERFACE,
@@ -244,6 +245,8 @@ std::ostream& operator<<(std::ostream& os, OpID id) {
         return os << "TERNARY_IF";
     case THIS:
         return os << "THIS";
+    case TO:
+        return os << "TO";
     case TRUE:
         return os << "TRUE";
     case TYPE:
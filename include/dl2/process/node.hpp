@@ -44,6 +44,14 @@ struct Node {
         }
     }
 
+    // The value is moved out first, since it may be part of this node.
+    Node& operator=(Node&& that) noexcept {
+        Node value(std::move(that));
+        this->~Node();
+        new(this) Node(std::move(value));
+        return *this;
+    }
+
     // Nullary constructor
     Node(OpID op, std::uint64_t src_id) noexcept: op(op), src_id(src_id) {}
 
@@ -193,6 +193,8 @@ const OpInfo OP_INFO_[] = {
     OpInfo(OpKind::BINARY, Precedence::TERNARY),
     // THIS
     OpInfo(OpKind::SINGLETON),
+    // TO
+    OpInfo(OpKind::BINARY, Precedence::FOR_PRED),
     // TRUE
     OpInfo(OpKind::SINGLETON),
     // TYPE
@@ -14,6 +14,7 @@
 #include "dl/process/opinfo.hpp"
 #include "dl/process/node.hpp"
 #include "dl/process/processor.hpp"
+#include "dl/process/simplifier.hpp"
 
 namespace dl {
 
@@ -21,8 +22,9 @@ struct ProcessorImpl: Processor {
     std::stack<Op> ops;
     std::stack<Node> nodes;
     std::queue<Node> queue;
+    Simplifier simplifier;
 
-    ProcessorImpl(): ops(), nodes(), queue() {}
+    ProcessorImpl(): ops(), nodes(), queue(), simplifier() {}
 
     void acquire_precedence(OpID op) {
         while (!ops.empty() && has_precedence(ops.top().id, op))
@@ -135,12 +137,14 @@ struct ProcessorImpl: Processor {
         nodes.push(Node(op.obj, std::move(std::move(word)), op.pos));
     }
 
+    // Statements are simplified on the way out, so that every interpreter and
+    // compiler takes them simplified.
     Node next() override {
         if (queue.empty())
             return Node(OpID::WAITING, Pos());
         Node node = queue.front();
         queue.pop();
-        return node;
+        return simplifier.simplify(std::move(node));
     }
 };
 
@@ -0,0 +1,667 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dl/compile/literal.hpp"
+#include "dl/interpret/types.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpretnode/literalsuffix.hpp"
+#include "dl/parse/opid.hpp"
+#include "dl/process/node.hpp"
+#include "dl/process/opinfo.hpp"
+#include "dl/process/opkind.hpp"
+
+namespace dl {
+
+// Suffix each type of literal is written back with, by `LiteralSuffix`.
+constexpr const char* LITERAL_SUFFIXES[] = {
+    "f32", "f64", "s8", "s16", "s32", "s64", "u8", "u16", "u32", "u64", ""
+};
+
+// A numeric literal's value and type. `Int64`s are `LiteralSuffix::NONE`
+// whether they are written with `s64` or not.
+struct Constant {
+    LiteralSuffix type;
+    Any value;
+};
+
+// Apply an arithmetic operator to constants of one type the way their type
+// would at run time. Returns false where the result is left to the type's
+// dunder method, or could not be written as a literal.
+//
+// Unsigned integers wrap. Signed ones, like the VM's fast path for `Int64`s,
+// leave overflow and division of or by a negative number to the dunder method.
+// Floats are folded in their own precision, unless the result is infinite or
+// NaN.
+template<typename T>
+bool fold_arith(OpID op, T a, T b, T& res) noexcept {
+    using enum OpID;
+    if constexpr (std::is_floating_point_v<T>) {
+        switch (op) {
+        case ADD:
+            res = a + b;
+            break;
+        case SUB:
+            res = a - b;
+            break;
+        case MUL:
+            res = a * b;
+            break;
+        case DIV:
+            res = a / b;
+            break;
+        case MOD:
+            res = static_cast<T>(std::fmod(a, b));
+            break;
+        default:
+            return false;
+        }
+        return std::isfinite(res);
+    } else if constexpr (std::is_unsigned_v<T>) {
+        // Widened first, so that narrow operands are not promoted to int.
+        auto x = static_cast<std::uint64_t>(a);
+        auto y = static_cast<std::uint64_t>(b);
+        switch (op) {
+        case ADD:
+            res = static_cast<T>(x + y);
+            return true;
+        case SUB:
+            res = static_cast<T>(x - y);
+            return true;
+        case MUL:
+            res = static_cast<T>(x * y);
+            return true;
+        case DIV:
+        case MOD:
+            if (y == 0)
+                return false;
+            res = static_cast<T>(op == DIV ? x / y : x % y);
+            return true;
+        default:
+            return false;
+        }
+    } else {
+        switch (op) {
+        case ADD:
+            return !__builtin_add_overflow(a, b, &res);
+        case SUB:
+            return !__builtin_sub_overflow(a, b, &res);
+        case MUL:
+            return !__builtin_mul_overflow(a, b, &res);
+        case DIV:
+        case MOD:
+            if (a < 0 || b <= 0)
+                return false;
+            res = static_cast<T>(op == DIV ? a / b : a % b);
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+template<typename T>
+bool fold_compare(OpID op, T a, T b, bool& res) noexcept {
+    using enum OpID;
+    switch (op) {
+    case EQ:
+        res = a == b;
+        return true;
+    case NEQ:
+        res = a != b;
+        return true;
+    case LT:
+        res = a < b;
+        return true;
+    case LTE:
+        res = a <= b;
+        return true;
+    case GT:
+        res = a > b;
+        return true;
+    case GTE:
+        res = a >= b;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The digits of a literal of value x. Only nonnegative values are literals;
+// a negative one would have to be negated, which the compilers do not take.
+template<typename T>
+bool literal_digits(T x, std::string& digits) {
+    if constexpr (std::is_floating_point_v<T>) {
+        if (std::signbit(x))
+            return false;
+        // Enough digits to read back the same double, which a float widens
+        // to exactly.
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.17g", static_cast<double>(x));
+        digits = buf;
+    } else {
+        if (x < 0)
+            return false;
+        digits = std::to_string(x);
+    }
+    return true;
+}
+
+// Simplifies processed statements before they are executed or compiled. It
+// folds constant subexpressions over numeric literals, precomputes `CONCAT`s
+// of string literals, removes identities and prunes branches of `if` chains
+// whose conditions are constant.
+//
+// Statements are taken one at a time, in the order `ProcessorImpl::next()`
+// gives them, so it works while a program is still being read. What it carries
+// from one statement to the next is where the top level `if` chain stands,
+// since its `elif`s and `else` come as statements of their own, and the types
+// of the variables known to hold numeric literals, which identities need.
+struct Simplifier {
+    // What the branches of the current `if` chain so far make of it.
+    enum class Chain {
+        // Not in a chain.
+        NONE,
+        // Some branch may or may not be taken.
+        LIVE,
+        // A branch with a true condition was, so the rest are dead.
+        TAKEN,
+        // Every branch had a false condition and was removed, so the next one
+        // starts the chain.
+        DEAD
+    };
+
+    Chain chain = Chain::NONE;
+
+    // Variables whose value is a numeric literal of a known type, set at the
+    // top level and not assigned since.
+    std::unordered_map<std::string, LiteralSuffix> types;
+
+    // Simplify the next statement. One that simplifies to nothing is an empty
+    // `BLOCK`.
+    Node simplify(Node&& stmt) {
+        using enum OpID;
+        if (stmt.op == WAITING || stmt.op == END || stmt.op == DONE)
+            return std::move(stmt);
+        forget(stmt);
+        if (!statement(stmt, chain))
+            return Node(BLOCK, std::vector<Node>(), stmt.src_id);
+        if (stmt.op == SET && stmt.bin->lhs.op == ALNUM) {
+            Constant k;
+            if (constant(stmt.bin->rhs, k))
+                types[stmt.bin->lhs.str] = k.type;
+        }
+        return std::move(stmt);
+    }
+
+    // Before a statement, forget the types of the variables it assigns. Code
+    // that might assign variables out of sight, like a call, or that has
+    // variables of its own, forgets them all.
+    void forget(const Node& node) {
+        using enum OpID;
+        switch (node.op) {
+        case ADDR:
+        case CALL:
+        case DEF:
+        case INTERFACE:
+        case MATCH:
+        case CASE:
+        case UNPACK_ARGS:
+        case UNPACK_KWARGS:
+        case VARS:
+            types.clear();
+            return;
+        case FOR:
+            if (opinfo(node.node->op).kind == OpKind::BINARY)
+                forget_names(node.node->bin->lhs);
+            break;
+        case SET:
+        case IADD:
+        case IBAND:
+        case IBOR:
+        case IBXOR:
+        case IDIV:
+        case IEXP:
+        case ILSH:
+        case IMOD:
+        case IMUL:
+        case IRSH:
+        case ISUB:
+            if (node.bin->lhs.op == ALNUM)
+                types.erase(node.bin->lhs.str);
+            break;
+        default:
+            break;
+        }
+        switch (opinfo(node.op).kind) {
+        case OpKind::UNARY:
+            forget(*node.node);
+            return;
+        case OpKind::BINARY:
+            forget(node.bin->lhs);
+            forget(node.bin->rhs);
+            return;
+        case OpKind::BLOCK:
+            for (const Node& stmt: node.nodes)
+                forget(stmt);
+            return;
+        default:
+            return;
+        }
+    }
+
+    // Forget every name in a loop's predicate, which binds the loop variable.
+    void forget_names(const Node& node) {
+        switch (opinfo(node.op).kind) {
+        case OpKind::STRING:
+            if (node.op == OpID::ALNUM)
+                types.erase(node.str);
+            return;
+        case OpKind::UNARY:
+            forget_names(*node.node);
+            return;
+        case OpKind::BINARY:
+            forget_names(node.bin->lhs);
+            forget_names(node.bin->rhs);
+            return;
+        default:
+            return;
+        }
+    }
+
+    // Simplify a statement, given where the `if` chain it follows stands.
+    // Returns false if it is dead and should be removed.
+    bool statement(Node& stmt, Chain& chain) {
+        using enum OpID;
+        switch (stmt.op) {
+        case IF:
+            return branch(stmt, chain);
+        case ELIF:
+            switch (chain) {
+            case Chain::TAKEN:
+                return false;
+            case Chain::DEAD:
+                stmt.op = IF;
+                return branch(stmt, chain);
+            case Chain::LIVE:
+                return branch(stmt, chain);
+            default:
+                // Not after an `if`, which is for the compilers to report.
+                expr(stmt, false);
+                return true;
+            }
+        case ELSE: {
+            Chain before = std::exchange(chain, Chain::NONE);
+            if (before == Chain::TAKEN)
+                return false;
+            expr(*stmt.node, false);
+            if (before == Chain::DEAD)
+                stmt = std::move(*stmt.node);
+            return true;
+        }
+        default:
+            chain = Chain::NONE;
+            expr(stmt, false);
+            return true;
+        }
+    }
+
+    // Simplify an `if` or an `elif` that is not dead. One with a true
+    // condition is the last branch taken: an `if` is replaced by its body and
+    // an `elif` becomes an `else`. One with a false condition is removed.
+    bool branch(Node& stmt, Chain& chain) {
+        using enum OpID;
+        Node& pred = *stmt.node;
+        if (opinfo(pred.op).kind != OpKind::BINARY) {
+            chain = Chain::LIVE;
+            expr(pred, false);
+            return true;
+        }
+        expr(pred.bin->lhs, true);
+        OpID cond = pred.bin->lhs.op;
+        if (cond == FALSE) {
+            if (stmt.op == IF)
+                chain = Chain::DEAD;
+            return false;
+        }
+        expr(pred.bin->rhs, false);
+        if (cond != TRUE) {
+            chain = Chain::LIVE;
+            return true;
+        }
+        if (stmt.op == IF)
+            stmt = std::move(pred.bin->rhs);
+        else
+            stmt = Node(ELSE, std::move(pred.bin->rhs), stmt.src_id);
+        chain = Chain::TAKEN;
+        return true;
+    }
+
+    void block(std::vector<Node>& stmts) {
+        auto chain = Chain::NONE;
+        std::vector<Node> kept;
+        for (Node& stmt: stmts) {
+            if (statement(stmt, chain))
+                kept.push_back(std::move(stmt));
+        }
+        stmts = std::move(kept);
+    }
+
+    // Simplify an expression, or whatever else node is. Where test is set, it
+    // is a condition, which must be a `Bool` anyway.
+    void expr(Node& node, bool test) {
+        using enum OpID;
+        switch (node.op) {
+        case FOR: {
+            Node& pred = *node.node;
+            if (opinfo(pred.op).kind != OpKind::BINARY) {
+                expr(pred, false);
+                return;
+            }
+            expr(pred.bin->lhs, !is_loop_binding(pred.bin->lhs));
+            expr(pred.bin->rhs, false);
+            return;
+        }
+        case GROUP:
+            expr(*node.node, test);
+            if (is_constant(*node.node))
+                node = std::move(*node.node);
+            return;
+        // Operands of logical operators are tested like conditions.
+        case NOT:
+            expr(*node.node, true);
+            not_(node, test);
+            return;
+        case AND:
+        case OR:
+            expr(node.bin->lhs, true);
+            expr(node.bin->rhs, true);
+            logical(node, test);
+            return;
+        case CONCAT:
+            expr(node.bin->lhs, false);
+            expr(node.bin->rhs, false);
+            if (node.bin->lhs.op == STRING && node.bin->rhs.op == STRING) {
+                std::string str = std::move(node.bin->lhs.str);
+                str += node.bin->rhs.str;
+                node = Node(STRING, std::move(str), node.src_id);
+            }
+            return;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case MOD:
+        case EQ:
+        case NEQ:
+        case LT:
+        case LTE:
+        case GT:
+        case GTE:
+            expr(node.bin->lhs, false);
+            expr(node.bin->rhs, false);
+            if (!fold(node))
+                identity(node);
+            return;
+        default:
+            break;
+        }
+        switch (opinfo(node.op).kind) {
+        case OpKind::UNARY:
+            expr(*node.node, false);
+            return;
+        case OpKind::BINARY:
+            expr(node.bin->lhs, false);
+            expr(node.bin->rhs, false);
+            return;
+        case OpKind::BLOCK:
+            block(node.nodes);
+            return;
+        default:
+            return;
+        }
+    }
+
+    // Whether a loop's predicate binds a variable, rather than being a
+    // condition.
+    static bool is_loop_binding(const Node& pred) noexcept {
+        using enum OpID;
+        return pred.op == IN || pred.op == FROM || pred.op == TO ||
+            pred.op == BY;
+    }
+
+    // `not` of a constant is one, and `not not x` is x where x is a `Bool`.
+    void not_(Node& node, bool test) {
+        using enum OpID;
+        Node& operand = *node.node;
+        if (operand.op == TRUE || operand.op == FALSE) {
+            node = Node(operand.op == TRUE ? FALSE : TRUE, node.src_id);
+            return;
+        }
+        if (operand.op == NOT && (test || is_bool(*operand.node)))
+            node = std::move(*operand.node);
+    }
+
+    // `and` and `or` with constant left operands. Only the right operand of a
+    // taken branch is the result as is, so it has to be a `Bool`.
+    void logical(Node& node, bool test) {
+        using enum OpID;
+        OpID lhs = node.bin->lhs.op;
+        if (lhs != TRUE && lhs != FALSE)
+            return;
+        // `false and x` and `true or x`
+        if ((lhs == FALSE) == (node.op == AND)) {
+            node = Node(lhs, node.src_id);
+            return;
+        }
+        if (test || is_bool(node.bin->rhs))
+            node = std::move(node.bin->rhs);
+    }
+
+    // Whether an expression is statically a `Bool`.
+    bool is_bool(const Node& node) const {
+        using enum OpID;
+        switch (node.op) {
+        case TRUE:
+        case FALSE:
+        case NOT:
+        case AND:
+        case OR:
+            return true;
+        case GROUP:
+            return is_bool(*node.node);
+        case EQ:
+        case NEQ:
+        case LT:
+        case LTE:
+        case GT:
+        case GTE: {
+            LiteralSuffix x;
+            LiteralSuffix y;
+            return type_of(node.bin->lhs, x) && type_of(node.bin->rhs, y) &&
+                x == y;
+        }
+        default:
+            return false;
+        }
+    }
+
+    static bool is_constant(const Node& node) noexcept {
+        using enum OpID;
+        switch (node.op) {
+        case TRUE:
+        case FALSE:
+        case NONE:
+        case STRING:
+            return true;
+        case ALNUM:
+            return is_numeric_literal(node.str);
+        default:
+            return false;
+        }
+    }
+
+    // The value of a numeric literal. Literals that are invalid are left for
+    // the compilers to report.
+    static bool constant(const Node& node, Constant& k) {
+        if (node.op != OpID::ALNUM || !is_numeric_literal(node.str))
+            return false;
+        if (parse_literal(node.str, k.value))
+            return false;
+        k.type = lit_suffix(node.str);
+        if (k.type == LiteralSuffix::S64)
+            k.type = LiteralSuffix::NONE;
+        return true;
+    }
+
+    // The type of a numeric literal, or of a variable known to hold one.
+    bool type_of(const Node& node, LiteralSuffix& type) const {
+        Constant k;
+        if (constant(node, k)) {
+            type = k.type;
+            return true;
+        }
+        if (node.op != OpID::ALNUM)
+            return false;
+        auto it = types.find(node.str);
+        if (it == types.end())
+            return false;
+        type = it->second;
+        return true;
+    }
+
+    // Fold a binary operator on two numeric literals of the same type.
+    // Returns false if it is left as is.
+    bool fold(Node& node) {
+        Constant x;
+        Constant y;
+        if (
+            !constant(node.bin->lhs, x) || !constant(node.bin->rhs, y) ||
+            x.type != y.type
+        )
+            return false;
+        switch (x.type) {
+        case LiteralSuffix::F32:
+            return fold_as<float>(node, x, y);
+        case LiteralSuffix::F64:
+            return fold_as<double>(node, x, y);
+        case LiteralSuffix::S8:
+            return fold_as<std::int8_t>(node, x, y);
+        case LiteralSuffix::S16:
+            return fold_as<std::int16_t>(node, x, y);
+        case LiteralSuffix::S32:
+            return fold_as<std::int32_t>(node, x, y);
+        case LiteralSuffix::U8:
+            return fold_as<std::uint8_t>(node, x, y);
+        case LiteralSuffix::U16:
+            return fold_as<std::uint16_t>(node, x, y);
+        case LiteralSuffix::U32:
+            return fold_as<std::uint32_t>(node, x, y);
+        case LiteralSuffix::U64:
+            return fold_as<std::uint64_t>(node, x, y);
+        default:
+            return fold_as<std::int64_t>(node, x, y);
+        }
+    }
+
+    template<typename T>
+    bool fold_as(Node& node, Constant& x, Constant& y) {
+        T a = coreutil::unwrap<T>(x.value);
+        T b = coreutil::unwrap<T>(y.value);
+        bool cmp;
+        if (fold_compare(node.op, a, b, cmp)) {
+            node = Node(cmp ? OpID::TRUE : OpID::FALSE, node.src_id);
+            return true;
+        }
+        T res;
+        std::string digits;
+        if (!fold_arith(node.op, a, b, res) || !literal_digits(res, digits))
+            return false;
+        // The left operand's spelling of `Int64`, with `s64` or without.
+        LiteralSuffix suffix = lit_suffix(node.bin->lhs.str);
+        digits += LITERAL_SUFFIXES[static_cast<int>(suffix)];
+        node = Node(OpID::ALNUM, std::move(digits), node.src_id);
+        return true;
+    }
+
+    // Remove an operation on a value of a known numeric type that leaves it
+    // as it is: adding or subtracting zero and multiplying or dividing by
+    // one. Adding zero is not an identity for floats, since -0.0 + 0.0 is
+    // 0.0.
+    void identity(Node& node) {
+        using enum OpID;
+        LiteralSuffix x;
+        LiteralSuffix y;
+        Node& lhs = node.bin->lhs;
+        Node& rhs = node.bin->rhs;
+        if (!type_of(lhs, x) || !type_of(rhs, y) || x != y)
+            return;
+        bool is_float = x == LiteralSuffix::F32 || x == LiteralSuffix::F64;
+        switch (node.op) {
+        case ADD:
+            if (is_float)
+                return;
+            if (is_value(rhs, 0))
+                node = std::move(lhs);
+            else if (is_value(lhs, 0))
+                node = std::move(rhs);
+            return;
+        case SUB:
+            if (is_value(rhs, 0))
+                node = std::move(lhs);
+            return;
+        case MUL:
+            if (is_value(rhs, 1))
+                node = std::move(lhs);
+            else if (is_value(lhs, 1))
+                node = std::move(rhs);
+            return;
+        case DIV:
+            if (is_value(rhs, 1))
+                node = std::move(lhs);
+            return;
+        default:
+            return;
+        }
+    }
+
+    // Whether a node is a numeric literal equal to n.
+    static bool is_value(const Node& node, int n) {
+        Constant k;
+        if (!constant(node, k))
+            return false;
+        switch (k.type) {
+        case LiteralSuffix::F32:
+            return coreutil::unwrap<float>(k.value) == n;
+        case LiteralSuffix::F64:
+            return coreutil::unwrap<double>(k.value) == n;
+        case LiteralSuffix::S8:
+            return coreutil::unwrap<std::int8_t>(k.value) == n;
+        case LiteralSuffix::S16:
+            return coreutil::unwrap<std::int16_t>(k.value) == n;
+        case LiteralSuffix::S32:
+            return coreutil::unwrap<std::int32_t>(k.value) == n;
+        case LiteralSuffix::U8:
+            return coreutil::unwrap<std::uint8_t>(k.value) == n;
+        case LiteralSuffix::U16:
+            return coreutil::unwrap<std::uint16_t>(k.value) == n;
+        case LiteralSuffix::U32:
+            return coreutil::unwrap<std::uint32_t>(k.value) == n;
+        case LiteralSuffix::U64:
+            return coreutil::unwrap<std::uint64_t>(k.value) ==
+                static_cast<std::uint64_t>(n);
+        default:
+            return coreutil::unwrap<std::int64_t>(k.value) == n;
+        }
+    }
+};
+
+}
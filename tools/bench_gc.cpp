@@ -0,0 +1,84 @@
+// Measures collector pauses with a large old generation, while the program
+// keeps storing new objects into slots outside of the heap, as assignments to
+// variables do. Percentiles come from `gc::pause_percentile`, so they are
+// upper bounds accurate to a power of two microseconds.
+//
+//     bench-gc [--live N] [--stores N]
+
+#include <cstdint>
+#include <cstdlib>
+
+#include <chrono>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "dl/interpreter2/array.hpp"
+#include "dl/interpreter2/builtintypeid.hpp"
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/gc.hpp"
+#include "dl/interpreter2/heap.hpp"
+#include "dl/interpreter2/interpreterimpl.hpp"
+
+// Arrays which die young, allocated along with each one stored.
+constexpr std::uint32_t GARBAGE_PER_STORE = 8;
+
+int main(int argc, char** argv) {
+    std::uint32_t live = 1 << 20;
+    std::uint32_t stores = 1 << 22;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        auto n = static_cast<std::uint32_t>(std::atoi(argv[i + 1]));
+        (arg == "--live" ? live : stores) = n;
+    }
+
+    dl::InterpreterImpl interp{};
+    dl::Config& config = interp.state.config;
+    config.jit_threshold = UINT32_MAX;
+    config.max_call_depth = 64;
+    config.max_kwargs = 8;
+    config.max_values = 1 << 16;
+    interp.init();
+    dl::State& state = interp.state;
+    dl::Heap& heap = dl::runtime_heap();
+
+    // The live objects sit in a table outside of the heap, reached from a
+    // single root, like the variables of a module.
+    constexpr auto SEQ = static_cast<std::uint32_t>(dl::BuiltinTypeID::SEQ);
+    constexpr auto ANY = static_cast<std::uint32_t>(dl::BuiltinTypeID::ANY);
+    constexpr auto INT64 = static_cast<std::uint32_t>(dl::BuiltinTypeID::INT64);
+    auto table = std::vector<dl::Any>(live, dl::coreutil::NONE);
+    auto& seq = *new(dl::coreutil::alloc(SEQ, sizeof(dl::Seq))) dl::Seq{
+        table.data(), live
+    };
+    *interp.push_values(1) = dl::Any{SEQ, &seq};
+
+    // Replace slot i of the table by a new array, then let the collector run.
+    auto store = [&](std::uint32_t i) {
+        for (std::uint32_t j = 0; j < GARBAGE_PER_STORE; j++)
+            dl::array::make(state, INT64, 4);
+        table[i] = dl::array::make(state, INT64, 4);
+        dl::gc::write_barrier(state, ANY, &table[i]);
+        dl::gc::safepoint(state);
+    };
+    for (std::uint32_t i = 0; i < live; i++)
+        store(i);
+
+    heap.stats = dl::GCStats{};
+    auto start = std::chrono::steady_clock::now();
+    for (std::uint32_t i = 0; i < stores; i++)
+        store(static_cast<std::uint32_t>(i * 2654435761u % live));
+    std::chrono::duration<double, std::milli> ms =
+        std::chrono::steady_clock::now() - start;
+
+    const dl::GCStats& stats = heap.stats;
+    std::cout << "live " << live << ", stores " << stores << ", old "
+        << (heap.old_bytes >> 20) << " MB, " << ms.count() << " ms\n";
+    std::cout << "minor " << stats.minor_collections << ", major "
+        << stats.major_collections << ", slices " << stats.slices << "\n";
+    std::cout << "pause p50 " << dl::gc::pause_percentile(stats, 50) / 1000
+        << " us, p99 " << dl::gc::pause_percentile(stats, 99) / 1000
+        << " us, max " << stats.max_pause_ns / 1000 << " us\n";
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Benchmarks `coreutil::issubclass`, which looks types up in the supers that
+// `coreutil::compute_supers` stores on registration, against the recursive
+// walk over `dunder_bases` it replaced. Chains are checked by display and
+// types with several bases by binary search. Times are the best of the
+// repetitions, in nanoseconds per check.
+//
+//     bench-issubclass [--checks N] [--reps N]
+
+#include <cstdint>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dl/interpreter2/coreutil.hpp"
+#include "dl/interpreter2/interpreterimpl.hpp"
+
+// Counts the checks that held, so that none are optimized away.
+std::uint64_t hits = 0;
+
+// `issubclass` as it was before `compute_supers`.
+bool walk_issubclass(
+    dl::State& state, std::uint32_t child_tid, std::uint32_t parent_tid
+) {
+    dl::Type& child_type = dl::coreutil::get_type(state, child_tid);
+    for (std::uint32_t i = 0; i < child_type.dunder_bases.len; i++) {
+        std::uint32_t base_tid = child_type.dunder_bases.tids[i];
+        if (
+            base_tid == parent_tid ||
+            walk_issubclass(state, base_tid, parent_tid)
+        )
+            return true;
+    }
+    return false;
+}
+
+// Register a type with no fields and the given bases.
+std::uint32_t make_type(
+    dl::State& state, const std::vector<std::uint32_t>& bases
+) {
+    auto t = dl::Type{};
+    t.dunder_struct = dl::Struct{nullptr, nullptr, nullptr, 0, 0};
+    auto len = static_cast<std::uint32_t>(bases.size());
+    t.dunder_bases = dl::TIDs{new std::uint32_t[len], len};
+    std::copy(bases.begin(), bases.end(), t.dunder_bases.tids);
+    t.dunder_supers = dl::TIDs{nullptr, 0};
+    t.dunder_getattr = dl::coreutil::empty_vars();
+    t.dunder_setattr = dl::coreutil::empty_vars();
+    t.dunder_callattr = dl::coreutil::empty_vars();
+    t.dunder_updateattr = dl::coreutil::empty_vars();
+    return dl::coreutil::register_type(state, dl::coreutil::wrap(t));
+}
+
+// The best time in milliseconds of reps runs of f.
+template<typename F>
+double best_ms(std::uint32_t reps, F&& f) {
+    double best = 1e300;
+    for (std::uint32_t i = 0; i < reps; i++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto end = std::chrono::steady_clock::now();
+        std::chrono::duration<double, std::milli> ms = end - start;
+        best = std::min(best, ms.count());
+    }
+    return best;
+}
+
+struct Bench {
+    dl::State& state;
+    std::uint32_t checks;
+    std::uint32_t reps;
+
+    // Time checks of whether child is a subclass of parent both ways, after
+    // making sure that they agree.
+    void check(
+        const std::string& label, std::uint32_t child, std::uint32_t parent
+    ) {
+        bool walked = walk_issubclass(state, child, parent);
+        if (dl::coreutil::issubclass(state, child, parent) != walked) {
+            std::cerr << label << ": issubclass disagrees with the walk\n";
+            std::exit(1);
+        }
+        report(label, "walk", best_ms(reps, [&] {
+            for (std::uint32_t i = 0; i < checks; i++)
+                hits += walk_issubclass(state, child, parent);
+        }));
+        report(label, "supers", best_ms(reps, [&] {
+            for (std::uint32_t i = 0; i < checks; i++)
+                hits += dl::coreutil::issubclass(state, child, parent);
+        }));
+    }
+
+    void report(const std::string& label, const char* how, double ms) {
+        std::cout << std::left << std::setw(24) << label << std::setw(8)
+            << how << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << ms * 1e6 / checks << " ns\n";
+    }
+};
+
+int main(int argc, char** argv) {
+    std::uint32_t checks = 1 << 16;
+    std::uint32_t reps = 10;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        auto n = static_cast<std::uint32_t>(std::atoi(argv[i + 1]));
+        (arg == "--checks" ? checks : reps) = n;
+    }
+
+    dl::InterpreterImpl interp{};
+    dl::Config& config = interp.state.config;
+    config.jit_threshold = UINT32_MAX;
+    config.max_call_depth = 64;
+    config.max_kwargs = 8;
+    config.max_values = 1 << 16;
+    interp.init();
+    dl::State& state = interp.state;
+    auto bench = Bench{state, checks, reps};
+    std::cout << "checks " << checks << ", best of " << reps << "\n";
+
+    // A single chain from root, checked against root and against a type
+    // outside of it.
+    std::uint32_t root = make_type(state, {});
+    std::uint32_t other = make_type(state, {});
+    std::uint32_t chain = root;
+    for (std::uint32_t depth = 1; depth <= 64; depth++) {
+        chain = make_type(state, {chain});
+        if (depth != 1 && depth != 4 && depth != 16 && depth != 64)
+            continue;
+        std::string label = "chain " + std::to_string(depth);
+        bench.check(label + " hit", chain, root);
+        bench.check(label + " miss", chain, other);
+    }
+
+    // Levels of two types, each with both types of the level above as bases,
+    // under a single base. A miss walks every path up the lattice, of which
+    // there are 2 to the power of the depth.
+    std::uint32_t base = make_type(state, {});
+    std::uint32_t a = make_type(state, {base});
+    std::uint32_t b = make_type(state, {base});
+    for (std::uint32_t depth = 1; depth <= 8; depth++) {
+        std::uint32_t next_a = make_type(state, {a, b});
+        b = make_type(state, {a, b});
+        a = next_a;
+        if (depth != 2 && depth != 4 && depth != 8)
+            continue;
+        std::string label = "diamond " + std::to_string(depth);
+        bench.check(label + " hit", a, base);
+        bench.check(label + " miss", a, other);
+    }
+    std::cout << "hits " << hits << "\n";
+    return 0;
+}
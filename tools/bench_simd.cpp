@@ -0,0 +1,237 @@
+// Benchmarks the typed array kernels of `dl/interpreter2/simd.hpp` against the
+// register code loops they replace, at each instruction set this CPU has
+// kernels for. Times are the best of the repetitions, in milliseconds.
+//
+//     bench-simd [--len N] [--reps N]
+
+#include <cstdint>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dl/compile/regcompiler.hpp"
+#include "dl/compile/symboltable.hpp"
+#include "dl/interpreter2/array.hpp"
+#include "dl/interpreter2/corefns.hpp"
+#include "dl/interpreter2/interpreterimpl.hpp"
+#include "dl/interpreter2/regcode.hpp"
+#include "dl/interpreter2/regvm.hpp"
+#include "dl/interpreter2/simd.hpp"
+#include "dl/process/node.hpp"
+
+// The result of the last loop, passed to its `out` parameter, or of the last
+// kernel, so that neither is optimized away.
+dl::Any last_out;
+
+dl::Any out(dl::State& state) {
+    last_out = dl::coreutil::args(state).args.xs[0];
+    return dl::coreutil::NONE;
+}
+
+dl::Any fn_ptr(dl::FnPtr f) {
+    return dl::Any{
+        static_cast<std::uint32_t>(dl::BuiltinTypeID::FN_PTR),
+        reinterpret_cast<void*>(f)
+    };
+}
+
+dl::Node name(const char* s) {
+    return dl::Node(dl::OpID::ALNUM, std::string(s), 0);
+}
+
+// `f(args...)`, whose arguments are a chain of separators.
+dl::Node call(const char* f, std::vector<dl::Node>&& args) {
+    dl::Node arg = std::move(args.back());
+    for (std::size_t i = args.size() - 1; i-- > 0;)
+        arg = dl::Node(
+            dl::OpID::SEP, std::move(args[i]), std::move(arg), 0
+        );
+    dl::Node group = dl::Node(dl::OpID::GROUP, std::move(arg), 0);
+    return dl::Node(dl::OpID::CALL, name(f), std::move(group), 0);
+}
+
+// `for x in xs: body`, then `out(res)`.
+dl::Node item_loop(dl::Node&& body, const char* res) {
+    std::vector<dl::Node> loop_body;
+    loop_body.push_back(std::move(body));
+    dl::Node loop = dl::Node(
+        dl::OpID::FOR, dl::Node(
+            dl::OpID::LABEL,
+            dl::Node(dl::OpID::IN, name("x"), name("xs"), 0),
+            dl::Node(dl::OpID::BLOCK, std::move(loop_body), 0), 0
+        ), 0
+    );
+    std::vector<dl::Node> stmts;
+    stmts.push_back(std::move(loop));
+    stmts.push_back(call("out", {name(res)}));
+    return dl::Node(dl::OpID::BLOCK, std::move(stmts), 0);
+}
+
+// The best time in milliseconds of reps runs of f.
+template<typename F>
+double best_ms(std::uint32_t reps, F&& f) {
+    double best = 1e300;
+    for (std::uint32_t i = 0; i < reps; i++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto end = std::chrono::steady_clock::now();
+        std::chrono::duration<double, std::milli> ms = end - start;
+        best = std::min(best, ms.count());
+    }
+    return best;
+}
+
+struct Bench {
+    dl::InterpreterImpl& interp;
+    std::uint32_t reps;
+
+    // Time body compiled to register code, run with the parameters
+    // `out, xs, ...` after calling reset, if given.
+    void loop(
+        const char* label, const dl::Node& body,
+        std::vector<std::string> params, std::vector<dl::Any> args,
+        const std::function<void()>& reset = nullptr
+    ) {
+        dl::SymbolTable symbols;
+        dl::RegCompiler compiler(symbols);
+        params.insert(params.begin(), "out");
+        args.insert(args.begin(), fn_ptr(out));
+        if (dl::ErrPtr err = compiler.compile(body, params)) {
+            std::cerr << label << ": " << *err << "\n";
+            return;
+        }
+        dl::RegCode code = compiler.code();
+        if (dl::verify(code) != 0) {
+            std::cerr << label << ": invalid register code\n";
+            return;
+        }
+        auto& frame = interp.state.stack.args[0];
+        frame.args = dl::Seq{
+            args.data(), static_cast<std::uint32_t>(args.size())
+        };
+        report(label, "loop", best_ms(reps, [&] {
+            if (reset)
+                reset();
+            dl::vm::run(interp, code);
+        }));
+    }
+
+    // Time f at each instruction set, from the most capable down.
+    template<typename F>
+    void kernel(const char* label, F&& f) {
+        using enum dl::simd::Isa;
+        const char* names[] = {"scalar", "sse4", "avx2"};
+        dl::simd::Isa detected = dl::simd::detect_isa();
+        for (auto isa: {AVX2, SSE4, SCALAR}) {
+            if (isa > detected)
+                continue;
+            dl::simd::isa() = isa;
+            report(label, names[static_cast<int>(isa)], best_ms(reps, f));
+        }
+        dl::simd::isa() = detected;
+    }
+
+    void report(const char* label, const char* how, double ms) {
+        std::cout << std::left << std::setw(16) << label << std::setw(8)
+            << how << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << ms << " ms\n";
+    }
+};
+
+// An array of n elements of type T, from 0 counting up modulo 1000.
+template<typename T>
+dl::Any iota(dl::State& state, std::uint32_t n) {
+    dl::Any res = dl::array::make(
+        state, static_cast<std::uint32_t>(dl::tid_for<T>), n
+    );
+    auto& arr = dl::coreutil::unwrap<dl::Array>(res);
+    arr.len = n;
+    for (std::uint32_t i = 0; i < n; i++)
+        dl::array::elems<T>(arr)[i] = static_cast<T>(i % 1000);
+    return res;
+}
+
+int main(int argc, char** argv) {
+    std::uint32_t len = 1 << 20;
+    std::uint32_t reps = 10;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        auto n = static_cast<std::uint32_t>(std::atoi(argv[i + 1]));
+        (arg == "--len" ? len : reps) = n;
+    }
+
+    dl::InterpreterImpl interp{};
+    dl::Config& config = interp.state.config;
+    config.jit_threshold = UINT32_MAX;
+    config.max_call_depth = 64;
+    config.max_kwargs = 8;
+    config.max_values = 1 << 16;
+    interp.init();
+    dl::State& state = interp.state;
+    auto bench = Bench{interp, reps};
+
+    dl::Any f64s = iota<double>(state, len);
+    dl::Any i64s = iota<std::int64_t>(state, len);
+    auto& f64_arr = dl::coreutil::unwrap<dl::Array>(f64s);
+    auto& i64_arr = dl::coreutil::unwrap<dl::Array>(i64s);
+    std::cout << "len " << len << ", best of " << reps << "\n";
+
+    // s = s + x over every element.
+    dl::Node sum = item_loop(
+        dl::Node(
+            dl::OpID::SET, name("s"),
+            dl::Node(dl::OpID::ADD, name("s"), name("x"), 0), 0
+        ), "s"
+    );
+    bench.loop(
+        "sum Float64", sum, {"xs", "s"}, {f64s, dl::coreutil::wrap(0.0)}
+    );
+    bench.kernel("sum Float64", [&] {
+        last_out = dl::coreutil::wrap(dl::simd::run<dl::simd::Sum<double>>(
+            dl::array::elems<double>(f64_arr), std::size_t{len}
+        ));
+    });
+    bench.loop(
+        "sum Int64", sum, {"xs", "s"},
+        {i64s, dl::coreutil::wrap(std::int64_t{0})}
+    );
+    bench.kernel("sum Int64", [&] {
+        using Sum = dl::simd::Sum<std::int64_t>;
+        last_out = dl::coreutil::wrap(dl::simd::run<Sum>(
+            dl::array::elems<std::int64_t>(i64_arr), std::size_t{len}
+        ));
+    });
+
+    // A new array of each element times k.
+    dl::Any scaled = dl::array::make(
+        state, static_cast<std::uint32_t>(dl::BuiltinTypeID::FLOAT64), len
+    );
+    auto& scaled_arr = dl::coreutil::unwrap<dl::Array>(scaled);
+    dl::Node scale = item_loop(
+        call("push", {
+            name("ys"), dl::Node(dl::OpID::MUL, name("x"), name("k"), 0)
+        }), "ys"
+    );
+    dl::Any push = fn_ptr(dl::corefn::array_push);
+    bench.loop(
+        "scale Float64", scale, {"xs", "ys", "k", "push"},
+        {f64s, scaled, dl::coreutil::wrap(2.5), push},
+        [&] { scaled_arr.len = 0; }
+    );
+    scaled_arr.len = len;
+    double k = 2.5;
+    bench.kernel("scale Float64", [&] {
+        using Mul = dl::simd::Arith<dl::BinaryOp::MUL, true, double>;
+        dl::simd::run<Mul>(
+            dl::array::elems<double>(scaled_arr),
+            dl::array::elems<double>(f64_arr), &k, std::size_t{len}
+        );
+    });
+    return 0;
+}
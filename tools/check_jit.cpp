@@ -0,0 +1,302 @@
+// Checks that native code from `dl/interpreter2/jit.hpp` does what
+// `vm::run` does. Each case is compiled to register code and run by both on
+// each set of arguments: the values it outputs, its result and what it raised
+// must be the same. The interpreter runs each set enough times to run both
+// the generic and the quickened forms. Cases the JIT leaves interpreted are
+// skipped. Exits with status 1 if any case disagrees.
+//
+//     check-jit
+
+#include <cstdint>
+#include <cstring>
+
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "dl/compile/regcompiler.hpp"
+#include "dl/compile/symboltable.hpp"
+#include "dl/interpreter2/interpreterimpl.hpp"
+#include "dl/interpreter2/jit.hpp"
+#include "dl/interpreter2/regcode.hpp"
+#include "dl/interpreter2/regvm.hpp"
+#include "dl/process/node.hpp"
+
+// Values passed to `out` by the current run.
+std::vector<dl::Any> outs;
+
+dl::Any out(dl::State& state) {
+    outs.push_back(dl::coreutil::args(state).args.xs[0]);
+    return dl::coreutil::NONE;
+}
+
+// Returns its first argument.
+dl::Any first(dl::State& state) {
+    return dl::coreutil::args(state).args.xs[0];
+}
+
+dl::Any fn_ptr(dl::FnPtr f) {
+    return dl::Any{
+        static_cast<std::uint32_t>(dl::BuiltinTypeID::FN_PTR),
+        reinterpret_cast<void*>(f)
+    };
+}
+
+dl::Node name(const char* s) {
+    return dl::Node(dl::OpID::ALNUM, std::string(s), 0);
+}
+
+dl::Node unary(dl::OpID op, dl::Node&& x) {
+    return dl::Node(op, std::move(x), 0);
+}
+
+dl::Node binary(dl::OpID op, dl::Node&& x, dl::Node&& y) {
+    return dl::Node(op, std::move(x), std::move(y), 0);
+}
+
+template<typename... Nodes>
+dl::Node block(Nodes&&... stmts) {
+    std::vector<dl::Node> nodes;
+    (nodes.push_back(std::move(stmts)), ...);
+    return dl::Node(dl::OpID::BLOCK, std::move(nodes), 0);
+}
+
+// `f(x)`.
+dl::Node call(const char* f, dl::Node&& x) {
+    dl::Node group = unary(dl::OpID::GROUP, std::move(x));
+    return binary(dl::OpID::CALL, name(f), std::move(group));
+}
+
+dl::Node set(const char* var, dl::Node&& x) {
+    return binary(dl::OpID::SET, name(var), std::move(x));
+}
+
+// `if`, `elif` or `for` with the given condition.
+dl::Node labeled(dl::OpID op, dl::Node&& cond, dl::Node&& body) {
+    dl::Node label = binary(dl::OpID::LABEL, std::move(cond), std::move(body));
+    return unary(op, std::move(label));
+}
+
+// `out(x op y)`.
+dl::Node out_binary(dl::OpID op, const char* x, const char* y) {
+    return call("out", binary(op, name(x), name(y)));
+}
+
+struct Case {
+    const char* label;
+    dl::Node body;
+    // After `out`, which every case gets first.
+    std::vector<std::string> params;
+    std::vector<std::vector<dl::Any>> arg_sets;
+};
+
+std::vector<Case> cases() {
+    using enum dl::OpID;
+    using dl::coreutil::wrap;
+    using Limits = std::numeric_limits<std::int64_t>;
+    auto i64 = [](std::int64_t x) { return wrap(x); };
+    auto f64 = [](double x) { return wrap(x); };
+    std::vector<Case> res;
+
+    res.push_back(Case{"arithmetic", block(
+        out_binary(ADD, "a", "b"), out_binary(SUB, "a", "b"),
+        out_binary(MUL, "a", "b"), out_binary(EQ, "a", "b"),
+        out_binary(NEQ, "a", "b"), out_binary(LT, "a", "b"),
+        out_binary(LTE, "a", "b"), out_binary(GT, "a", "b"),
+        out_binary(GTE, "a", "b"), out_binary(DIV, "a", "b"),
+        out_binary(MOD, "a", "b")
+    ), {"a", "b"}, {
+        {i64(7), i64(3)}, {i64(-7), i64(3)}, {i64(7), i64(-3)},
+        {i64(Limits::max()), i64(1)}, {i64(Limits::min()), i64(-1)},
+        {i64(Limits::min()), i64(Limits::max())}, {i64(5), i64(0)},
+        {f64(2.5), i64(4)}, {i64(1), f64(0.5)}, {f64(-1.5), f64(0.0)},
+        {wrap(true), i64(1)}, {dl::coreutil::NONE, i64(1)}
+    }});
+
+    // if a < b: out(1) elif a == b: out(2) else: out(3)
+    res.push_back(Case{"if chain", block(
+        labeled(IF, binary(LT, name("a"), name("b")),
+            block(call("out", name("1")))),
+        labeled(ELIF, binary(EQ, name("a"), name("b")),
+            block(call("out", name("2")))),
+        unary(ELSE, block(call("out", name("3"))))
+    ), {"a", "b"}, {
+        {i64(1), i64(2)}, {i64(2), i64(2)}, {i64(3), i64(2)},
+        {f64(1.5), f64(1.5)}, {i64(1), f64(0.5)}, {wrap(false), i64(1)}
+    }});
+
+    // if a: out(1), for conditions that are not all `Bool`s.
+    res.push_back(Case{"condition", block(
+        labeled(IF, name("a"), block(call("out", name("1"))))
+    ), {"a"}, {
+        {wrap(true)}, {wrap(false)}, {i64(1)}, {dl::coreutil::NONE}
+    }});
+
+    // s = 0; i = 0; for i < n: s = s + i * k; i = i + 1; out(s); out(i)
+    res.push_back(Case{"while loop", block(
+        set("s", name("0")), set("i", name("0")),
+        labeled(FOR, binary(LT, name("i"), name("n")), block(
+            set("s", binary(ADD, name("s"),
+                binary(MUL, name("i"), name("k")))),
+            set("i", binary(ADD, name("i"), name("1")))
+        )),
+        call("out", name("s")), call("out", name("i"))
+    ), {"n", "k"}, {
+        {i64(1000), i64(3)}, {i64(0), i64(3)}, {i64(100), f64(2.5)},
+        {i64(10), i64(Limits::max())}, {f64(3.5), i64(1)}
+    }});
+
+    // s = 0; for i from a to b: s = s + i; out(s); out(i)
+    res.push_back(Case{"range loop", block(
+        set("s", name("0")),
+        labeled(FOR,
+            binary(TO, binary(FROM, name("i"), name("a")), name("b")),
+            block(set("s", binary(ADD, name("s"), name("i"))))),
+        call("out", name("s")), call("out", name("i"))
+    ), {"a", "b"}, {
+        {i64(0), i64(100)}, {i64(10), i64(0)}, {i64(-5), i64(5)},
+        {i64(Limits::max() - 2), i64(Limits::max())}
+    }});
+
+    // if a > b: raise a; out(b)
+    res.push_back(Case{"raise", block(
+        labeled(IF, binary(GT, name("a"), name("b")),
+            block(unary(RAISE, name("a")))),
+        call("out", name("b"))
+    ), {"a", "b"}, {
+        {i64(2), i64(1)}, {i64(1), i64(2)}, {f64(2.5), i64(1)}
+    }});
+
+    // out(f(x)); out(x.y)
+    res.push_back(Case{"calls", block(
+        call("out", call("f", name("x"))),
+        call("out", binary(GET, name("x"), name("y")))
+    ), {"f", "x"}, {
+        {fn_ptr(first), i64(1)}, {fn_ptr(first), f64(2.5)}, {i64(1), i64(2)}
+    }});
+    return res;
+}
+
+// What a run did.
+struct Outcome {
+    std::vector<dl::Any> outs;
+    dl::Any res;
+    dl::Any raised;
+};
+
+// Immediates are compared by value, other objects only by type, since each
+// run makes its own.
+bool same(dl::Any x, dl::Any y) {
+    if (x.tid != y.tid)
+        return false;
+    return !dl::is_immediate_tid(x.tid) ||
+        std::memcmp(&x.data, &y.data, sizeof(x.data)) == 0;
+}
+
+bool same(const Outcome& x, const Outcome& y) {
+    if (x.outs.size() != y.outs.size())
+        return false;
+    for (std::size_t i = 0; i < x.outs.size(); i++) {
+        if (!same(x.outs[i], y.outs[i]))
+            return false;
+    }
+    return same(x.res, y.res) && same(x.raised, y.raised);
+}
+
+void print(std::ostream& os, dl::Any x) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &x.data, sizeof(bits));
+    os << x.tid;
+    if (dl::is_immediate_tid(x.tid))
+        os << ':' << std::hex << bits << std::dec;
+}
+
+// `outs [...], res ..., raised ...`, as TIDs and the bits of immediates.
+void print(std::ostream& os, const Outcome& outcome) {
+    os << "outs [";
+    for (std::size_t i = 0; i < outcome.outs.size(); i++) {
+        os << (i == 0 ? "" : " ");
+        print(os, outcome.outs[i]);
+    }
+    os << "], res ";
+    print(os, outcome.res);
+    os << ", raised ";
+    print(os, outcome.raised);
+}
+
+// Run code on args, as native code if jit is given.
+Outcome run(
+    dl::InterpreterImpl& interp, dl::RegCode& code,
+    const dl::jit::JitCode* jit, std::vector<dl::Any>& args
+) {
+    dl::State& state = interp.state;
+    outs.clear();
+    state.exc_info.raised = dl::coreutil::NONE;
+    state.stack.args[0].args = dl::Seq{
+        args.data(), static_cast<std::uint32_t>(args.size())
+    };
+    dl::Any res = jit != nullptr ?
+        dl::jit::run(interp, code, *jit) : dl::vm::run(interp, code);
+    return Outcome{outs, res, state.exc_info.raised};
+}
+
+int main() {
+    dl::InterpreterImpl interp{};
+    dl::Config& config = interp.state.config;
+    config.jit_threshold = UINT32_MAX;
+    config.max_call_depth = 64;
+    config.max_kwargs = 8;
+    config.max_values = 1 << 16;
+    interp.init();
+#ifndef DL_JIT_ENABLED
+    std::cout << "built without DL_JIT, so every case is interpreted\n";
+#endif
+
+    dl::SymbolTable symbols;
+    bool failed = false;
+    for (Case& c: cases()) {
+        dl::RegCompiler compiler(symbols);
+        c.params.insert(c.params.begin(), "out");
+        if (dl::ErrPtr err = compiler.compile(c.body, c.params)) {
+            std::cout << c.label << ": " << *err << "\n";
+            failed = true;
+            continue;
+        }
+        dl::RegCode code = compiler.code();
+        if (dl::verify(code) != 0) {
+            std::cout << c.label << ": invalid register code\n";
+            failed = true;
+            continue;
+        }
+        dl::jit::JitCode jit = dl::jit::compile(code);
+        if (jit.mem == nullptr) {
+            std::cout << c.label << ": interpreted, skipped\n";
+            continue;
+        }
+        std::uint32_t agreed = 0;
+        for (std::size_t set = 0; set < c.arg_sets.size(); set++) {
+            std::vector<dl::Any>& args = c.arg_sets[set];
+            args.insert(args.begin(), fn_ptr(out));
+            Outcome native = run(interp, code, &jit, args);
+            bool agrees = true;
+            for (std::uint32_t i = 0; agrees && i <= dl::QUICKEN_DELAY; i++) {
+                Outcome interpreted = run(interp, code, nullptr, args);
+                if (same(native, interpreted))
+                    continue;
+                agrees = false;
+                std::cout << c.label << ", arguments " << set << ", run "
+                    << i << ":\n    jit ";
+                print(std::cout, native);
+                std::cout << "\n    vm  ";
+                print(std::cout, interpreted);
+                std::cout << "\n";
+            }
+            agreed += agrees;
+            failed |= !agrees;
+        }
+        std::cout << c.label << ": " << agreed << " of " << c.arg_sets.size()
+            << " argument sets agree\n";
+    }
+    return failed;
+}